@@ -0,0 +1,581 @@
+/*
+ * Home Accessory Architect
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <cJSON.h>
+
+#include "header.h"
+#include "config_image.h"
+
+// Input arrays with GPIO. Only first one is used by general config
+static const char* const input_arrays[] = {
+    BUTTONS_ARRAY,
+    BUTTONS_ARRAY_1,
+    FIXED_BUTTONS_ARRAY_0,
+    FIXED_BUTTONS_ARRAY_1,
+    FIXED_BUTTONS_ARRAY_2,
+    FIXED_BUTTONS_ARRAY_3,
+    FIXED_BUTTONS_ARRAY_4,
+    FIXED_BUTTONS_ARRAY_5,
+    FIXED_BUTTONS_ARRAY_6,
+    FIXED_BUTTONS_ARRAY_7,
+    FIXED_BUTTONS_ARRAY_8,
+};
+
+static const char* const action_arrays[] = {
+    BINARY_OUTPUTS_ARRAY,
+    MANAGE_OTHERS_ACC_ARRAY,
+    SYSTEM_ACTIONS_ARRAY,
+    NETWORK_ACTIONS_ARRAY,
+    IR_ACTIONS_ARRAY,
+    UART_ACTIONS_ARRAY,
+};
+
+typedef struct _image_writer {
+    uint8_t* data;          // NULL while image is measured
+    size_t len;
+    const char** keys;
+    uint16_t keys_n;
+} image_writer_t;
+
+typedef struct _image_reader {
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+    char** keys;
+    uint16_t keys_n;
+    int error;
+} image_reader_t;
+
+uint32_t config_image_hash(const uint8_t* data, const size_t len) {
+    uint32_t hash = 2166136261;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619;
+    }
+    
+    return hash;
+}
+
+static bool is_object_array(cJSON* json_array) {
+    if (!cJSON_IsArray(json_array)) {
+        return false;
+    }
+    
+    cJSON* json_item;
+    cJSON_ArrayForEach(json_item, json_array) {
+        if (!cJSON_IsObject(json_item)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+static bool is_valid_inputs(cJSON* json_context, const uint8_t input_arrays_n) {
+    for (uint8_t i = 0; i < input_arrays_n; i++) {
+        cJSON* json_inputs = cJSON_GetObjectItemCaseSensitive(json_context, input_arrays[i]);
+        if (json_inputs) {
+            if (!is_object_array(json_inputs)) {
+                return false;
+            }
+            
+            cJSON* json_input;
+            cJSON_ArrayForEach(json_input, json_inputs) {
+                if (!cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(json_input, PIN_GPIO))) {
+                    return false;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+// Accessories and their extra services
+static bool is_valid_service(cJSON* json_service) {
+    if (!cJSON_IsObject(json_service) || !is_valid_inputs(json_service, sizeof(input_arrays) / sizeof(input_arrays[0]))) {
+        return false;
+    }
+    
+    cJSON* json_pings = cJSON_GetObjectItemCaseSensitive(json_service, PINGS_ARRAY);
+    if (json_pings && !is_object_array(json_pings)) {
+        return false;
+    }
+    
+    for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
+        char action[4];
+        snprintf(action, sizeof(action), "%i", int_action);
+        
+        cJSON* json_action = cJSON_GetObjectItemCaseSensitive(json_service, action);
+        if (json_action) {
+            if (!cJSON_IsObject(json_action)) {
+                return false;
+            }
+            
+            for (uint8_t i = 0; i < sizeof(action_arrays) / sizeof(action_arrays[0]); i++) {
+                cJSON* json_action_array = cJSON_GetObjectItemCaseSensitive(json_action, action_arrays[i]);
+                if (json_action_array && !is_object_array(json_action_array)) {
+                    return false;
+                }
+            }
+        }
+    }
+    
+    return true;
+}
+
+static bool is_valid_tree(cJSON* json, const uint8_t depth) {
+    if (depth > CONFIG_IMAGE_DEPTH_MAX ||
+        (json->string && strlen(json->string) > CONFIG_IMAGE_KEY_LEN_MAX) ||
+        (cJSON_IsNumber(json) && !isfinite(json->valuedouble)) ||
+        (cJSON_IsString(json) && !json->valuestring) ||
+        !(cJSON_IsNull(json) || cJSON_IsBool(json) || cJSON_IsNumber(json) || cJSON_IsString(json) || cJSON_IsArray(json) || cJSON_IsObject(json))) {
+        return false;
+    }
+    
+    cJSON* json_item;
+    cJSON_ArrayForEach(json_item, json) {
+        if (cJSON_IsObject(json) != (json_item->string != NULL) || !is_valid_tree(json_item, depth + 1)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+int config_image_validate(cJSON* json_haa) {
+    if (!cJSON_IsObject(json_haa) || !is_valid_tree(json_haa, 1)) {
+        return CONFIG_IMAGE_ERR_INVALID;
+    }
+    
+    cJSON* json_config = cJSON_GetObjectItemCaseSensitive(json_haa, GENERAL_CONFIG);
+    if (json_config && (!cJSON_IsObject(json_config) || !is_valid_inputs(json_config, 1))) {
+        return CONFIG_IMAGE_ERR_INVALID;
+    }
+    
+    cJSON* json_accessories = cJSON_GetObjectItemCaseSensitive(json_haa, ACCESSORIES_ARRAY);
+    const int total_accessories = cJSON_GetArraySize(json_accessories);
+    if (!cJSON_IsArray(json_accessories) || total_accessories == 0 || total_accessories > UINT8_MAX) {
+        return CONFIG_IMAGE_ERR_INVALID;
+    }
+    
+    cJSON* json_accessory;
+    cJSON_ArrayForEach(json_accessory, json_accessories) {
+        if (!is_valid_service(json_accessory)) {
+            return CONFIG_IMAGE_ERR_INVALID;
+        }
+        
+        cJSON* json_extra_services = cJSON_GetObjectItemCaseSensitive(json_accessory, EXTRA_SERVICES_ARRAY);
+        if (json_extra_services) {
+            if (!cJSON_IsArray(json_extra_services)) {
+                return CONFIG_IMAGE_ERR_INVALID;
+            }
+            
+            cJSON* json_extra_service;
+            cJSON_ArrayForEach(json_extra_service, json_extra_services) {
+                if (!is_valid_service(json_extra_service)) {
+                    return CONFIG_IMAGE_ERR_INVALID;
+                }
+            }
+        }
+    }
+    
+    return CONFIG_IMAGE_OK;
+}
+
+static void put_byte(image_writer_t* writer, const uint8_t byte) {
+    if (writer->data) {
+        writer->data[writer->len] = byte;
+    }
+    
+    writer->len++;
+}
+
+static void put_bytes(image_writer_t* writer, const void* bytes, const size_t len) {
+    if (writer->data) {
+        memcpy(writer->data + writer->len, bytes, len);
+    }
+    
+    writer->len += len;
+}
+
+static void put_uint(image_writer_t* writer, uint32_t value, const uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        put_byte(writer, value & 0xFF);
+        value >>= 8;
+    }
+}
+
+static void put_varint(image_writer_t* writer, uint32_t value) {
+    while (value >= 0x80) {
+        put_byte(writer, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    
+    put_byte(writer, value);
+}
+
+// Keys are collected while image is measured, so all of them are known while it is written
+static int key_index(image_writer_t* writer, const char* key) {
+    for (uint16_t i = 0; i < writer->keys_n; i++) {
+        if (strcmp(writer->keys[i], key) == 0) {
+            return i;
+        }
+    }
+    
+    if (writer->data || writer->keys_n == CONFIG_IMAGE_KEYS_MAX) {
+        return CONFIG_IMAGE_ERR_INVALID;
+    }
+    
+    if (writer->keys_n % 32 == 0) {
+        const char** keys = realloc(writer->keys, (writer->keys_n + 32) * sizeof(char*));
+        if (!keys) {
+            return CONFIG_IMAGE_ERR_NO_MEM;
+        }
+        
+        writer->keys = keys;
+    }
+    
+    writer->keys[writer->keys_n] = key;
+    
+    return writer->keys_n++;
+}
+
+static void put_number(image_writer_t* writer, const double value) {
+    // -0 is kept as float, so it is not changed to 0
+    if (value >= INT32_MIN && value <= INT32_MAX && value == floor(value) && !(value == 0 && signbit(value))) {
+        const int32_t int_value = value;
+        put_byte(writer, CONFIG_IMAGE_INT);
+        put_varint(writer, ((uint32_t) int_value << 1) ^ (uint32_t) (int_value >> 31));
+        
+    } else if (fabs(value) <= FLT_MAX && (double) ((float) value) == value) {
+        const float float_value = value;
+        put_byte(writer, CONFIG_IMAGE_FLOAT);
+        put_bytes(writer, &float_value, sizeof(float_value));
+        
+    } else {
+        put_byte(writer, CONFIG_IMAGE_DOUBLE);
+        put_bytes(writer, &value, sizeof(value));
+    }
+}
+
+static int put_node(image_writer_t* writer, cJSON* json) {
+    if (cJSON_IsNull(json)) {
+        put_byte(writer, CONFIG_IMAGE_NULL);
+        
+    } else if (cJSON_IsFalse(json)) {
+        put_byte(writer, CONFIG_IMAGE_FALSE);
+        
+    } else if (cJSON_IsTrue(json)) {
+        put_byte(writer, CONFIG_IMAGE_TRUE);
+        
+    } else if (cJSON_IsNumber(json)) {
+        put_number(writer, json->valuedouble);
+        
+    } else if (cJSON_IsString(json)) {
+        const size_t len = strlen(json->valuestring);
+        put_byte(writer, CONFIG_IMAGE_STRING);
+        put_varint(writer, len);
+        put_bytes(writer, json->valuestring, len + 1);
+        
+    } else {
+        const bool is_object = cJSON_IsObject(json);
+        put_byte(writer, is_object ? CONFIG_IMAGE_OBJECT : CONFIG_IMAGE_ARRAY);
+        put_varint(writer, cJSON_GetArraySize(json));
+        
+        cJSON* json_item;
+        cJSON_ArrayForEach(json_item, json) {
+            if (is_object) {
+                const int key = key_index(writer, json_item->string);
+                if (key < 0) {
+                    return key;
+                }
+                
+                put_varint(writer, key);
+            }
+            
+            const int ret = put_node(writer, json_item);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    
+    return CONFIG_IMAGE_OK;
+}
+
+static int compile(image_writer_t* writer, cJSON* json_haa, const uint16_t config_number, const uint32_t json_hash) {
+    // First pass measures tree and collects keys
+    int ret = put_node(writer, json_haa);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    size_t size = CONFIG_IMAGE_HEADER_SIZE + writer->len;
+    for (uint16_t i = 0; i < writer->keys_n; i++) {
+        size += strlen(writer->keys[i]) + 2;
+    }
+    
+    writer->data = malloc(size);
+    if (!writer->data) {
+        return CONFIG_IMAGE_ERR_NO_MEM;
+    }
+    
+    writer->len = CONFIG_IMAGE_HEADER_SIZE;
+    
+    for (uint16_t i = 0; i < writer->keys_n; i++) {
+        const size_t len = strlen(writer->keys[i]);
+        put_byte(writer, len);
+        put_bytes(writer, writer->keys[i], len + 1);
+    }
+    
+    ret = put_node(writer, json_haa);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    writer->len = 0;
+    put_bytes(writer, CONFIG_IMAGE_MAGIC, 3);
+    put_byte(writer, CONFIG_IMAGE_VERSION);
+    put_uint(writer, config_number, 2);
+    put_uint(writer, writer->keys_n, 2);
+    put_uint(writer, size, 4);
+    put_uint(writer, json_hash, 4);
+    put_uint(writer, config_image_hash(writer->data + CONFIG_IMAGE_HEADER_SIZE, size - CONFIG_IMAGE_HEADER_SIZE), 4);
+    
+    return size;
+}
+
+int config_image_compile(cJSON* json_haa, const uint16_t config_number, const uint32_t json_hash, uint8_t** image) {
+    *image = NULL;
+    
+    int ret = config_image_validate(json_haa);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    image_writer_t writer = { 0 };
+    ret = compile(&writer, json_haa, config_number, json_hash);
+    
+    free(writer.keys);
+    
+    if (ret < 0) {
+        free(writer.data);
+    } else {
+        *image = writer.data;
+    }
+    
+    return ret;
+}
+
+static uint32_t get_uint(const uint8_t* data, const uint8_t len) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        value |= (uint32_t) data[i] << (i * 8);
+    }
+    
+    return value;
+}
+
+static bool get_varint(image_reader_t* reader, uint32_t* value) {
+    *value = 0;
+    
+    for (uint8_t shift = 0; shift < 32; shift += 7) {
+        if (reader->pos >= reader->size) {
+            return false;
+        }
+        
+        const uint8_t byte = reader->data[reader->pos++];
+        if (shift == 28 && byte > 0x0F) {
+            return false;
+        }
+        
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+static bool get_bytes(image_reader_t* reader, void* bytes, const size_t len) {
+    if (reader->size - reader->pos < len) {
+        return false;
+    }
+    
+    memcpy(bytes, reader->data + reader->pos, len);
+    reader->pos += len;
+    
+    return true;
+}
+
+static cJSON* new_node(image_reader_t* reader, cJSON* json) {
+    if (!json) {
+        reader->error = CONFIG_IMAGE_ERR_NO_MEM;
+    }
+    
+    return json;
+}
+
+static cJSON* load_node(image_reader_t* reader, const uint8_t depth) {
+    if (depth > CONFIG_IMAGE_DEPTH_MAX || reader->pos >= reader->size) {
+        return NULL;
+    }
+    
+    const uint8_t type = reader->data[reader->pos++];
+    uint32_t value;
+    
+    switch (type) {
+        case CONFIG_IMAGE_NULL:
+            return new_node(reader, cJSON_CreateNull());
+        
+        case CONFIG_IMAGE_FALSE:
+            return new_node(reader, cJSON_CreateFalse());
+        
+        case CONFIG_IMAGE_TRUE:
+            return new_node(reader, cJSON_CreateTrue());
+        
+        case CONFIG_IMAGE_INT:
+            if (!get_varint(reader, &value)) {
+                return NULL;
+            }
+            
+            return new_node(reader, cJSON_CreateNumber((int32_t) ((value >> 1) ^ -(value & 1))));
+        
+        case CONFIG_IMAGE_FLOAT: {
+            float float_value;
+            if (!get_bytes(reader, &float_value, sizeof(float_value))) {
+                return NULL;
+            }
+            
+            return new_node(reader, cJSON_CreateNumber(float_value));
+        }
+        
+        case CONFIG_IMAGE_DOUBLE: {
+            double double_value;
+            if (!get_bytes(reader, &double_value, sizeof(double_value))) {
+                return NULL;
+            }
+            
+            return new_node(reader, cJSON_CreateNumber(double_value));
+        }
+        
+        case CONFIG_IMAGE_STRING: {
+            if (!get_varint(reader, &value) || value >= reader->size - reader->pos || reader->data[reader->pos + value] != 0) {
+                return NULL;
+            }
+            
+            char* string = (char*) reader->data + reader->pos;
+            reader->pos += value + 1;
+            
+            return new_node(reader, cJSON_CreateStringReference(string));
+        }
+        
+        case CONFIG_IMAGE_ARRAY:
+        case CONFIG_IMAGE_OBJECT: {
+            if (!get_varint(reader, &value)) {
+                return NULL;
+            }
+            
+            cJSON* json = new_node(reader, type == CONFIG_IMAGE_OBJECT ? cJSON_CreateObject() : cJSON_CreateArray());
+            cJSON* json_last = NULL;
+            
+            for (uint32_t i = 0; json && i < value; i++) {
+                uint32_t key = 0;
+                cJSON* json_item = NULL;
+                
+                if ((type == CONFIG_IMAGE_ARRAY || (get_varint(reader, &key) && key < reader->keys_n)) &&
+                    (json_item = load_node(reader, depth + 1)) != NULL) {
+                    if (type == CONFIG_IMAGE_OBJECT) {
+                        json_item->string = reader->keys[key];
+                        json_item->type |= cJSON_StringIsConst;
+                    }
+                    
+                    // Linked as cJSON_AddItemToArray() does, without walking the list for every item
+                    if (json_last) {
+                        json_last->next = json_item;
+                        json_item->prev = json_last;
+                    } else {
+                        json->child = json_item;
+                    }
+                    
+                    json_last = json_item;
+                    
+                } else {
+                    cJSON_Delete(json);
+                    json = NULL;
+                }
+            }
+            
+            return json;
+        }
+        
+        default:
+            return NULL;
+    }
+}
+
+int config_image_load(uint8_t* image, const size_t size, const uint16_t config_number, const uint32_t json_hash, cJSON** json_haa) {
+    *json_haa = NULL;
+    
+    if (!image || size < CONFIG_IMAGE_HEADER_SIZE || memcmp(image, CONFIG_IMAGE_MAGIC, 3) != 0) {
+        return CONFIG_IMAGE_ERR_CORRUPT;
+    }
+    
+    if (image[3] != CONFIG_IMAGE_VERSION || get_uint(image + 4, 2) != config_number || get_uint(image + 12, 4) != json_hash) {
+        return CONFIG_IMAGE_ERR_STALE;
+    }
+    
+    if (get_uint(image + 8, 4) != size ||
+        get_uint(image + 16, 4) != config_image_hash(image + CONFIG_IMAGE_HEADER_SIZE, size - CONFIG_IMAGE_HEADER_SIZE)) {
+        return CONFIG_IMAGE_ERR_CORRUPT;
+    }
+    
+    image_reader_t reader = {
+        .data = image,
+        .size = size,
+        .pos = CONFIG_IMAGE_HEADER_SIZE,
+        .keys_n = get_uint(image + 6, 2),
+        .error = CONFIG_IMAGE_ERR_CORRUPT,
+    };
+    
+    reader.keys = malloc((reader.keys_n + 1) * sizeof(char*));
+    if (!reader.keys) {
+        return CONFIG_IMAGE_ERR_NO_MEM;
+    }
+    
+    for (uint16_t i = 0; i < reader.keys_n; i++) {
+        if (size - reader.pos < 2 || image[reader.pos] + 2 > size - reader.pos || image[reader.pos + image[reader.pos] + 1] != 0) {
+            free(reader.keys);
+            return CONFIG_IMAGE_ERR_CORRUPT;
+        }
+        
+        reader.keys[i] = (char*) image + reader.pos + 1;
+        reader.pos += image[reader.pos] + 2;
+    }
+    
+    cJSON* json = load_node(&reader, 1);
+    
+    free(reader.keys);
+    
+    if (!json || reader.pos != size) {
+        cJSON_Delete(json);
+        return json ? CONFIG_IMAGE_ERR_CORRUPT : reader.error;
+    }
+    
+    *json_haa = json;
+    
+    return CONFIG_IMAGE_OK;
+}
@@ -0,0 +1,53 @@
+/*
+ * Home Accessory Architect
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HAA_CONFIG_IMAGE_H__
+#define __HAA_CONFIG_IMAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cJSON.h>
+
+// Compiled config image: JSON config validated and lowered to a packed tree, so it is not parsed again
+// until config changes. Same images are made by devices/common/config_compile.py. Little endian
+#define CONFIG_IMAGE_MAGIC                  "HCF"
+#define CONFIG_IMAGE_VERSION                (1)
+#define CONFIG_IMAGE_HEADER_SIZE            (20)    // Magic + version + uint16 config number + uint16 keys + uint32 size + uint32 JSON hash + uint32 body hash
+#define CONFIG_IMAGE_DEPTH_MAX              (12)
+#define CONFIG_IMAGE_KEY_LEN_MAX            (255)
+#define CONFIG_IMAGE_KEYS_MAX               (65535)
+
+// Body: keys table (uint8 length, chars and NUL, by first use), then root node.
+// Node is a type byte and its value. Counts, lengths and key indexes are varints
+#define CONFIG_IMAGE_NULL                   (0)
+#define CONFIG_IMAGE_FALSE                  (1)
+#define CONFIG_IMAGE_TRUE                   (2)
+#define CONFIG_IMAGE_INT                    (3)     // Zigzag varint
+#define CONFIG_IMAGE_FLOAT                  (4)     // float, only if value is exact
+#define CONFIG_IMAGE_DOUBLE                 (5)
+#define CONFIG_IMAGE_STRING                 (6)     // Length, chars and NUL
+#define CONFIG_IMAGE_ARRAY                  (7)     // Count and nodes
+#define CONFIG_IMAGE_OBJECT                 (8)     // Count and pairs of key index and node
+
+#define CONFIG_IMAGE_OK                     (0)
+#define CONFIG_IMAGE_ERR_INVALID            (-1)    // Config can not be compiled
+#define CONFIG_IMAGE_ERR_NO_MEM             (-2)
+#define CONFIG_IMAGE_ERR_STALE              (-3)    // Image made from another config or by another version
+#define CONFIG_IMAGE_ERR_CORRUPT            (-4)
+#define CONFIG_IMAGE_ERR_NO_ROOM            (-5)    // Image not saved, it would leave no room for saved states
+
+uint32_t config_image_hash(const uint8_t* data, const size_t len);     // FNV-1a
+
+int config_image_validate(cJSON* json_haa);
+
+// Return image size, or error. Image must be freed
+int config_image_compile(cJSON* json_haa, const uint16_t config_number, const uint32_t json_hash, uint8_t** image);
+
+// Keys and strings of loaded tree point to image, so image must be freed only after tree is deleted
+int config_image_load(uint8_t* image, const size_t size, const uint16_t config_number, const uint32_t json_hash, cJSON** json_haa);
+
+#endif  // __HAA_CONFIG_IMAGE_H__
@@ -29,17 +29,13 @@
 #define NTP_TASK_SIZE                       (512)
 #define PING_TASK_SIZE                      GLOBAL_TASK_SIZE
 #define AUTODIMMER_TASK_SIZE                GLOBAL_TASK_SIZE
-#define IR_TX_TASK_SIZE                     (456)
-#define UART_ACTION_TASK_SIZE               (384)
-#define NETWORK_ACTION_TASK_SIZE            (512)
+#define ACTION_WORKER_TASK_SIZE             (512)
 #define DELAYED_SENSOR_START_TASK_SIZE      GLOBAL_TASK_SIZE
-#define TEMPERATURE_TASK_SIZE               GLOBAL_TASK_SIZE
+#define SENSOR_SCHEDULER_TASK_SIZE          GLOBAL_TASK_SIZE
 #define PROCESS_TH_TASK_SIZE                GLOBAL_TASK_SIZE
 #define PROCESS_HUMIDIF_TASK_SIZE           GLOBAL_TASK_SIZE
 #define SET_ZONES_TASK_SIZE                 GLOBAL_TASK_SIZE
 #define LIGHTBULB_TASK_SIZE                 GLOBAL_TASK_SIZE
-#define POWER_MONITOR_TASK_SIZE             GLOBAL_TASK_SIZE
-#define LIGHT_SENSOR_TASK_SIZE              GLOBAL_TASK_SIZE
 #define WIFI_PING_GW_TASK_SIZE              (384)
 #define WIFI_RECONNECTION_TASK_SIZE         GLOBAL_TASK_SIZE
 #define IR_CAPTURE_TASK_SIZE                (768)
@@ -50,22 +46,70 @@
 #define NTP_TASK_PRIORITY                   (tskIDLE_PRIORITY + 1)
 #define PING_TASK_PRIORITY                  (tskIDLE_PRIORITY + 2)
 #define AUTODIMMER_TASK_PRIORITY            (tskIDLE_PRIORITY + 1)
-#define IR_TX_TASK_PRIORITY                 (tskIDLE_PRIORITY + 1)
-#define UART_ACTION_TASK_PRIORITY           (tskIDLE_PRIORITY + 1)
-#define NETWORK_ACTION_TASK_PRIORITY        (tskIDLE_PRIORITY + 1)
+#define ACTION_WORKER_TASK_PRIORITY         (tskIDLE_PRIORITY + 1)
 #define DELAYED_SENSOR_START_TASK_PRIORITY  (tskIDLE_PRIORITY + 1)
-#define TEMPERATURE_TASK_PRIORITY           (tskIDLE_PRIORITY + 1)
+#define SENSOR_SCHEDULER_TASK_PRIORITY      (tskIDLE_PRIORITY + 1)
 #define PROCESS_TH_TASK_PRIORITY            (tskIDLE_PRIORITY + 1)
 #define PROCESS_HUMIDIF_TASK_PRIORITY       (tskIDLE_PRIORITY + 1)
 #define SET_ZONES_TASK_PRIORITY             (tskIDLE_PRIORITY + 1)
 #define LIGHTBULB_TASK_PRIORITY             (tskIDLE_PRIORITY + 1)
-#define POWER_MONITOR_TASK_PRIORITY         (tskIDLE_PRIORITY + 1)
-#define LIGHT_SENSOR_TASK_PRIORITY          (tskIDLE_PRIORITY + 1)
 #define WIFI_PING_GW_TASK_PRIORITY          (tskIDLE_PRIORITY + 1)
 #define WIFI_RECONNECTION_TASK_PRIORITY     (tskIDLE_PRIORITY + 3)
 #define IR_CAPTURE_TASK_PRIORITY            (tskIDLE_PRIORITY + 8)
 #define REBOOT_TASK_PRIORITY                (tskIDLE_PRIORITY + 3)
 
+// Action workers
+#define ACTION_WORKER_MAX_TASKS             (3)
+#define ACTION_QUEUE_SIZE                   (16)        // For each action task type
+#define ACTION_LISTS_WAIT_MS                (10)
+
+#define ACTION_TASK_TYPE_UART               (0)
+#define ACTION_TASK_TYPE_NETWORK            (1)
+#define ACTION_TASK_TYPE_IR_TX              (2)
+#define ACTION_TASK_TYPES                   (3)
+
+// Sensor scheduler
+#define SENSOR_SCHEDULER_STAGGER_MS         (500)
+#define SENSOR_TH_START_DELAY_MS            (3000)
+#define SENSOR_TH_START_STAGGER_MS          (4000)
+#define SENSOR_IAIRZONING_START_STAGGER_MS  (9500)
+#define SENSOR_FILTER_WINDOW_MAX            (7)
+#define SENSOR_FILTER_WINDOW                "sf"
+#define SENSOR_FILTER_EMA                   "se"
+#define NOTIFY_DEADBAND                     "nd"
+#define NOTIFY_MIN_INTERVAL                 "ni"
+#define NOTIFY_MAX_STALE                    "nx"
+
+#define ACTION_TASK_UART_MAX_RUNNING        (1)
+#define ACTION_TASK_NETWORK_MAX_RUNNING     (1)
+#define ACTION_TASK_IR_TX_MAX_RUNNING       (1)
+
+// Network actions client
+#define NETWORK_POOL_SIZE                   (2)
+#define NETWORK_POOL_IDLE_MS                (15000)
+#define NETWORK_DNS_CACHE_SIZE              (4)
+#define NETWORK_DNS_CACHE_TTL_MS            (300000)
+#define NETWORK_RESPONSE_LINE_SIZE          (64)        // Longer status and header lines are truncated
+#define NETWORK_RESPONSE_PRINT_MAX          (2048)
+#define NETWORK_RESPONSE_MAX                (16384)     // Longer HTTP bodies close pooled connection
+
+// IR TX
+#define IR_CODE_CACHE_SIZE                  (3072)      // Bytes of decoded IR codes kept
+
+// Compiled actions
+#define ACTION_LISTS                        (7)
+#define ACTION_LIST(ch_group, action_entry, list)   ((action_entry) ? (action_entry)->list : (ch_group)->list)
+
+// MCP23017
+#define MCP_REG_OLATA                       (0x14)
+#define MCP_REG_OLATB                       (0x15)
+#define MCP_PORT_A                          (0b01)
+#define MCP_PORT_B                          (0b10)
+#define MCP_REG_GPINTENA                    (0x04)
+#define MCP_REG_IOCON                       (0x0A)
+#define MCP_IOCON_MIRROR                    (0b01000000)
+#define MCP_IOCON_ODR                       (0b00000100)
+
 // Button Events
 #define SINGLEPRESS_EVENT                   (0)
 #define DOUBLEPRESS_EVENT                   (1)
@@ -251,6 +295,14 @@
 #define SENSOR_HUMIDITY_FLOAT               ch_group->ch[1]->value.float_value
 #define TH_SENSOR_ERROR_COUNT               ch_group->num[4]
 #define TH_SENSOR_MAX_ALLOWED_ERRORS        (3)
+#define DS18B20_RESOLUTION                  "dr"
+#define DS18B20_RESOLUTION_DEFAULT          (12)
+#define DS18B20_RESOLUTION_MIN              (9)
+#define DS18B20_BUS_MAX_DEVICES             (16)
+#define DS18B20_CONVERSION_TIME_MS          (760)   // At 12 bits. Halved for every bit less
+#define DS18B20_CMD_WRITE_SCRATCHPAD        (0x4E)
+#define DS18B20_ALARM_HIGH_DEFAULT          (0x4B)
+#define DS18B20_ALARM_LOW_DEFAULT           (0x46)
 
 #define HUMIDIF_TYPE                        "w"
 #define HM_TYPE                             ch_group->num[5]
@@ -300,6 +352,7 @@
 #define LIGHTBULB_TYPE_SM16716              (7)
 #define LIGHTBULB_TYPE_NRZ                  (8)
 #define LIGHTBULB_NRZ_TIMES_ARRAY_SET       "nrz"
+#define LIGHTBULB_NRZ_CRITICAL_FALLBACK_SET "nrzf"
 #define LIGHTBULB_CHANNELS_SET              "n"
 #define LIGHTBULB_CHANNELS                  lightbulb_group->channels
 #define LIGHTBULB_INITITAL_STATE_ARRAY_SET  "it"
@@ -310,6 +363,8 @@
 #define LIGHTBULB_MAX_POWER                 ch_group->num[0]
 #define LIGHTBULB_CURVE_FACTOR_SET          "cf"
 #define LIGHTBULB_CURVE_FACTOR              ch_group->num[1]
+#define LIGHTBULB_BRIGHTNESS_CURVE_SET      "bc"
+#define LIGHTBULB_BRIGHTNESS_CURVE          lightbulb_group->brightness_curve
 #define PWM_DITHER_SET                      "di"
 #define LIGHTBULB_COLOR_MAP_SET             "cm"
 #define LIGHTBULB_RANGE_START               lightbulb_group->range_start
@@ -320,6 +375,22 @@
 #define LIGHTBULB_COORDINATE_ARRAY_SET      "ca"
 #define LIGHTBULB_WHITE_POINT_SET           "wp"
 #define RGBW_PERIOD                         (20)
+#define LIGHTBULB_COLOR_TABLE_HUE_STEP      (6)
+#define LIGHTBULB_COLOR_TABLE_HUES          (360 / LIGHTBULB_COLOR_TABLE_HUE_STEP)
+#define LIGHTBULB_COLOR_TABLE_SAT_STEP      (5)
+#define LIGHTBULB_COLOR_TABLE_SATS          ((100 / LIGHTBULB_COLOR_TABLE_SAT_STEP) + 1)
+#define LIGHTBULB_COLOR_TABLE_CELLS         (LIGHTBULB_COLOR_TABLE_HUES * (LIGHTBULB_COLOR_TABLE_SATS - 1))
+#define LIGHTBULB_COLOR_TABLE_CELLS_BYTES   ((LIGHTBULB_COLOR_TABLE_CELLS + 7) >> 3)
+#define LIGHTBULB_COLOR_TABLE_MAX_ERROR     (PWM_SCALE / 100)
+#define LIGHTBULB_COLOR_TABLE_HUE_CHECKS    (3)     // Points checked in each cell, by hue and by saturation
+#define LIGHTBULB_COLOR_TABLE_SAT_CHECKS    (5)
+#define LIGHTBULB_GAMMA_TABLE_SIZE          (64)
+#define LIGHTBULB_BRIGHTNESS_TABLE_SIZE     (100)   // One entry for each brightness percent
+#define LIGHTBULB_COLOR_REGION_WHITE        (0)     // Inside white triangle
+#define LIGHTBULB_COLOR_REGION_GAMUT        (1)     // Outside white triangle, with gamut transform
+#define LIGHTBULB_COLOR_REGION_ANY          (2)
+#define LIGHTBULB_COLOR_REGIONS             (2)
+#define LIGHTBULB_COLOR_FORMS               (4)     // Barycentric coordinates of white triangle, and their denominator
 #define RGBW_STEP_SET                       "st"
 #define RGBW_STEP_DEFAULT                   (2048)
 #define PWM_SCALE                           (UINT16_MAX)
@@ -529,6 +600,8 @@
 #define NETWORK_ACTION_CONTENT              "c"
 #define NETWORK_ACTION_WAIT_RESPONSE_SET    "w"
 #define NETWORK_ACTION_WILDCARD_VALUE       "#HAA@"
+#define NETWORK_ACTION_WILDCARD_VALUE_SIZE  (15)
+#define NETWORK_ACTION_HTTP_HEAD_SIZE       (101 + sizeof(FIRMWARE_VERSION))
 #define SYSTEM_ACTION_REBOOT                (0)
 #define SYSTEM_ACTION_SETUP_MODE            (1)
 #define SYSTEM_ACTION_OTA_UPDATE            (2)
@@ -541,6 +614,7 @@
 #define I2C_CONFIG_ARRAY                    "ic"
 
 #define MCP23017_ARRAY                      "mc"
+#define MCP23017_INT_GPIO_POS               (4)
 
 #define ACCESSORY_TYPE                      "t"
 #define ACC_TYPE_ROOT_DEVICE                (0)
@@ -607,6 +681,7 @@
 #define STATUS_LED_DURATION_OFF             (120)
 
 #define SAVE_STATES_DELAY_MS                (5000)
+#define SAVE_STATES_FREE_SYSPARAM           (4096)  // Free sysparam space kept for saved states when config image is saved
 #define RANDOM_DELAY_MS                     (7000)
 
 #define ACCESSORIES_WITHOUT_BRIDGE          (4)     // Max number of accessories before using a bridge
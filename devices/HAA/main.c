@@ -8,13 +8,18 @@
 #if defined(ESP_OPEN_RTOS)
 
 #include <unistd.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
 #include <esp/uart.h>
 #include <FreeRTOS.h>
 #include <task.h>
+#include <queue.h>
+#include <semphr.h>
 #include <espressif/esp_common.h>
 #include <rboot-api.h>
 #include <sysparam.h>
+#include <spiflash.h>
 #include <math.h>
 #include <esplibs/libmain.h>
 
@@ -42,12 +47,14 @@
 #include <raven_ntp.h>
 #include <adv_pwm.h>
 #include <adv_nrzled.h>
+#include <adv_ir_tx.h>
 #include <ping.h>
 #include <adv_logger_ntp.h>
 #include <adv_i2c.h>
 #include <timers_helper.h>
 
 #include <dht.h>
+#include <onewire/onewire.h>
 #include <ds18b20/ds18b20.h>
 
 #include <cJSON.h>
@@ -58,6 +65,7 @@
 #include "extra_characteristics.h"
 #include "header.h"
 #include "types.h"
+#include "config_image.h"
 
 main_config_t main_config = {
     .wifi_status = WIFI_STATUS_DISCONNECTED,
@@ -92,7 +100,9 @@ main_config_t main_config = {
     .setup_mode_toggle_timer = NULL,
     
     .ch_groups = NULL,
+    .ch_groups_by_acc = NULL,
     .lightbulb_groups = NULL,
+    .color_tables = NULL,
     .ping_inputs = NULL,
     .last_states = NULL,
     
@@ -169,11 +179,11 @@ void IRAM extended_gpio_write(const uint16_t extended_gpio, bool value) {
         if (mcp23017) {
             uint8_t gpio = extended_gpio % 100;
             uint8_t mcp_outs = mcp23017->a_outs;
-            uint8_t mcp_reg = 0x14;
+            uint8_t mcp_reg = MCP_REG_OLATA;
             if (gpio > 7) {
                 gpio -= 8;
                 mcp_outs = mcp23017->b_outs;
-                mcp_reg = 0x15;
+                mcp_reg = MCP_REG_OLATB;
             }
             
             const uint8_t bit = 1 << gpio;
@@ -184,15 +194,78 @@ void IRAM extended_gpio_write(const uint16_t extended_gpio, bool value) {
                 mcp_outs ^= bit;
             }
             
-            if (mcp_reg == 0x14) {
+            if (mcp_reg == MCP_REG_OLATA) {
                 mcp23017->a_outs = mcp_outs;
             } else {
                 mcp23017->b_outs = mcp_outs;
             }
             
-            i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &mcp_outs, 1);
+            if (main_config.mcp_batch > 0 && main_config.mcp_batch_task == xTaskGetCurrentTaskHandle()) {
+                mcp23017->dirty |= (mcp_reg == MCP_REG_OLATA) ? MCP_PORT_A : MCP_PORT_B;
+            } else {
+                i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &mcp_outs, 1);
+            }
+        }
+    }
+}
+
+// Writes pending MCP23017 outputs. Ports changed together are sent in a single sequential OLATA + OLATB write.
+void mcp_flush() {
+    mcp23017_t* mcp23017 = main_config.mcp23017s;
+    while (mcp23017) {
+        taskENTER_CRITICAL();
+        const uint8_t dirty = mcp23017->dirty;
+        mcp23017->dirty = 0;
+        uint8_t mcp_outs[2] = { mcp23017->a_outs, mcp23017->b_outs };
+        taskEXIT_CRITICAL();
+        
+        if (dirty == (MCP_PORT_A | MCP_PORT_B)) {
+            uint8_t mcp_reg = MCP_REG_OLATA;
+            i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, mcp_outs, 2);
+        } else if (dirty == MCP_PORT_A) {
+            uint8_t mcp_reg = MCP_REG_OLATA;
+            i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &mcp_outs[0], 1);
+        } else if (dirty == MCP_PORT_B) {
+            uint8_t mcp_reg = MCP_REG_OLATB;
+            i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &mcp_outs[1], 1);
+        }
+        
+        mcp23017 = mcp23017->next;
+    }
+}
+
+// Output changes of a task between mcp_batch_begin() and its outermost mcp_batch_end() are combined.
+// Batch belongs to the task that started it, so outputs of other tasks, like status LED, are written directly.
+void mcp_batch_begin() {
+    const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    
+    taskENTER_CRITICAL();
+    if (main_config.mcp_batch == 0) {
+        main_config.mcp_batch_task = task;
+    }
+    
+    if (main_config.mcp_batch_task == task) {
+        main_config.mcp_batch++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+void mcp_batch_end() {
+    bool flush = false;
+    
+    taskENTER_CRITICAL();
+    if (main_config.mcp_batch > 0 && main_config.mcp_batch_task == xTaskGetCurrentTaskHandle()) {
+        main_config.mcp_batch--;
+        if (main_config.mcp_batch == 0) {
+            main_config.mcp_batch_task = NULL;
+            flush = true;
         }
     }
+    taskEXIT_CRITICAL();
+    
+    if (flush) {
+        mcp_flush();
+    }
 }
 
 void led_code_run(TimerHandle_t xTimer) {
@@ -244,6 +317,7 @@ void led_create(const uint8_t gpio, const bool inverted) {
 
 void hkc_autooff_setter_task(TimerHandle_t xTimer);
 void do_actions(ch_group_t* ch_group, uint8_t int_action);
+action_entry_t* action_entry_find(ch_group_t* ch_group, const uint8_t action);
 void do_wildcard_actions(ch_group_t* ch_group, uint8_t index, const float action_value);
 
 #ifdef HAA_DEBUG
@@ -263,6 +337,31 @@ void free_heap_watchdog() {
         free(space);
         INFO("* Max chunk = %i", size + 4);
         INFO("* CPU Speed = %i", sdk_system_get_cpu_freq());
+        INFO("* Actions: workers %i, queue peak %i, dropped %i, latency %i/%i ms", main_config.action_workers, main_config.action_queue_peak, main_config.action_drops, main_config.action_latency_last, main_config.action_latency_max);
+        
+        if (main_config.addressleds) {
+            const nrzled_stats_t* nrzled_stats = nrzled_get_stats();
+            INFO("* NRZ LEDs: frames %i, retries %i, fallbacks %i, failures %i", nrzled_stats->frames, nrzled_stats->retries, nrzled_stats->fallbacks, nrzled_stats->failures);
+        }
+        
+        sensor_job_t* sensor_job = main_config.sensor_jobs;
+        while (sensor_job) {
+            INFO("* Sensor <%i>: samples %i, errors %i, latency %i/%i ms", sensor_job->ch_group->accessory, sensor_job->samples, sensor_job->errors, sensor_job->latency_last, sensor_job->latency_max);
+            sensor_job = sensor_job->next;
+        }
+        
+        notify_policy_t* notify_policy = main_config.notify_policies;
+        while (notify_policy) {
+            INFO("* Notify <%i>: sent %i, suppressed %i", notify_policy->ch_group->accessory, notify_policy->sent, notify_policy->suppressed);
+            notify_policy = notify_policy->next;
+        }
+        
+#ifdef ADV_PWM_BENCHMARK
+        if (adv_pwm_is_running()) {
+            INFO("* PWM ISR max %i cycles", adv_pwm_get_isr_cycles_max());
+        }
+#endif
+        
         stats_display();
     }
 }
@@ -294,13 +393,6 @@ uint16_t process_hexstr(const char* string, uint8_t** output_hex_string) {
     return len;
 }
 
-action_task_t* new_action_task() {
-    action_task_t* action_task = malloc(sizeof(action_task_t));
-    memset(action_task, 0, sizeof(*action_task));
-    
-    return action_task;
-}
-
 ch_group_t* new_ch_group(const uint8_t chs, const uint8_t nums, const uint8_t last_wildcard_actions) {
     ch_group_t* ch_group = malloc(sizeof(ch_group_t));
     memset(ch_group, 0, sizeof(*ch_group));
@@ -333,6 +425,10 @@ ch_group_t* new_ch_group(const uint8_t chs, const uint8_t nums, const uint8_t la
 }
 
 ch_group_t* ch_group_find(homekit_characteristic_t* ch) {
+    if (main_config.ch_groups_by_acc) {
+        return ch->context;
+    }
+    
     ch_group_t* ch_group = main_config.ch_groups;
     while (ch_group) {
         for (uint8_t i = 0; i < ch_group->chs; i++) {
@@ -348,6 +444,14 @@ ch_group_t* ch_group_find(homekit_characteristic_t* ch) {
 }
 
 ch_group_t* ch_group_find_by_acc(uint16_t accessory) {
+    if (main_config.ch_groups_by_acc) {
+        if (accessory < main_config.ch_groups_by_acc_size) {
+            return main_config.ch_groups_by_acc[accessory];
+        }
+        
+        return NULL;
+    }
+    
     ch_group_t* ch_group = main_config.ch_groups;
     while (ch_group &&
            ch_group->accessory != accessory) {
@@ -358,6 +462,15 @@ ch_group_t* ch_group_find_by_acc(uint16_t accessory) {
 }
 
 lightbulb_group_t* lightbulb_group_find(homekit_characteristic_t* ch) {
+    if (main_config.ch_groups_by_acc) {
+        ch_group_t* ch_group = ch->context;
+        if (ch_group && ch_group->lightbulb_group && ch_group->lightbulb_group->ch0 == ch) {
+            return ch_group->lightbulb_group;
+        }
+        
+        return NULL;
+    }
+    
     lightbulb_group_t* lightbulb_group = main_config.lightbulb_groups;
     while (lightbulb_group &&
            lightbulb_group->ch0 != ch) {
@@ -367,6 +480,59 @@ lightbulb_group_t* lightbulb_group_find(homekit_characteristic_t* ch) {
     return lightbulb_group;
 }
 
+// Replaces linear lookups once configuration is done. First match in list order wins, as in linear lookups.
+void ch_group_index_build() {
+    uint16_t size = 0;
+    ch_group_t* ch_group = main_config.ch_groups;
+    while (ch_group) {
+        if (ch_group->accessory >= size) {
+            size = ch_group->accessory + 1;
+        }
+        
+        ch_group = ch_group->next;
+    }
+    
+    if (size == 0) {
+        return;
+    }
+    
+    ch_group_t** ch_groups_by_acc = malloc(size * sizeof(ch_group_t*));
+    if (!ch_groups_by_acc) {
+        ERROR("Creating ch_group index");
+        return;
+    }
+    
+    memset(ch_groups_by_acc, 0, size * sizeof(ch_group_t*));
+    
+    ch_group = main_config.ch_groups;
+    while (ch_group) {
+        if (!ch_groups_by_acc[ch_group->accessory]) {
+            ch_groups_by_acc[ch_group->accessory] = ch_group;
+        }
+        
+        for (uint8_t i = 0; i < ch_group->chs; i++) {
+            if (ch_group->ch[i] && !ch_group->ch[i]->context) {
+                ch_group->ch[i]->context = ch_group;
+            }
+        }
+        
+        ch_group = ch_group->next;
+    }
+    
+    lightbulb_group_t* lightbulb_group = main_config.lightbulb_groups;
+    while (lightbulb_group) {
+        ch_group = lightbulb_group->ch0->context;
+        if (ch_group && !ch_group->lightbulb_group) {
+            ch_group->lightbulb_group = lightbulb_group;
+        }
+        
+        lightbulb_group = lightbulb_group->next;
+    }
+    
+    main_config.ch_groups_by_acc_size = size;
+    main_config.ch_groups_by_acc = ch_groups_by_acc;
+}
+
 addressled_t* addressled_find(const uint8_t gpio) {
     addressled_t* addressled = main_config.addressleds;
     while (addressled &&
@@ -391,6 +557,7 @@ addressled_t* new_addressled(const uint8_t gpio, const uint16_t max_range) {
         addressled->gpio = gpio;
         gpio_enable(gpio, GPIO_OUTPUT);
         addressled->max_range = max_range;
+        addressled->critical_fallback = true;
         
         addressled->map[0] = 1;
         addressled->map[1] = 0;
@@ -534,20 +701,28 @@ void reboot_haa() {
     }
 }
 
+// Network tasks wait here for their turn instead of polling network_is_busy
+void network_lock() {
+    xSemaphoreTake(main_config.network_mutex, portMAX_DELAY);
+    main_config.network_is_busy = true;
+}
+
+void network_unlock() {
+    main_config.network_is_busy = false;
+    xSemaphoreGive(main_config.network_mutex);
+}
+
 void ntp_task() {
     int result = -10;
     uint8_t tries = 0;
     for (;;) {
         tries++;
         
-        if (main_config.network_is_busy) {
-            vTaskDelay(MS_TO_TICKS(234));
-        }
-        main_config.network_is_busy = true;
+        network_lock();
         
         result = raven_ntp_update(main_config.ntp_host);
         
-        main_config.network_is_busy = false;
+        network_unlock();
         
         INFO("NTP upd (%i)", result);
         
@@ -590,7 +765,7 @@ void ntp_timer_worker(TimerHandle_t xTimer) {
 }
 
 void wifi_ping_gw_task() {
-    main_config.network_is_busy = true;
+    network_lock();
     
     struct ip_info info;
     if (sdk_wifi_get_ip_info(STATION_IF, &info)) {
@@ -607,7 +782,7 @@ void wifi_ping_gw_task() {
         }
     }
     
-    main_config.network_is_busy = false;
+    network_unlock();
     vTaskDelete(NULL);
 }
 
@@ -750,7 +925,7 @@ ping_input_t* ping_input_find_by_host(char* host) {
 }
 
 void ping_task() {
-    main_config.network_is_busy = true;
+    network_lock();
 
     void ping_input_run_callback_fn(ping_input_callback_fn_t* callbacks) {
         ping_input_callback_fn_t* ping_input_callback_fn = callbacks;
@@ -788,7 +963,7 @@ void ping_task() {
         ping_input = ping_input->next;
     }
     
-    main_config.network_is_busy = false;
+    network_unlock();
     vTaskDelete(NULL);
 }
 
@@ -880,6 +1055,100 @@ void homekit_characteristic_notify_safe(homekit_characteristic_t *ch) {
     }
 }
 
+// --- NOTIFY POLICIES
+// Policies of first chs_n characteristics of ch_group, by characteristic number. Only numeric characteristics get one
+notify_policy_t* notify_policies_create(ch_group_t* ch_group, const uint8_t chs_n) {
+    const uint8_t notify_policies_n = MIN(chs_n, ch_group->chs);
+    notify_policy_t* notify_policies = calloc(notify_policies_n, sizeof(notify_policy_t));
+    if (!notify_policies) {
+        return NULL;
+    }
+    
+    for (uint8_t i = 0; i < notify_policies_n; i++) {
+        homekit_characteristic_t* ch = ch_group->ch[i];
+        if (!ch || ch->value.format == HOMETKIT_FORMAT_BOOL || ch->value.format > HOMETKIT_FORMAT_FLOAT) {
+            continue;
+        }
+        
+        notify_policy_t* notify_policy = &notify_policies[i];
+        notify_policy->ch = ch;
+        notify_policy->ch_group = ch_group;
+        
+        notify_policy->next = main_config.notify_policies;
+        main_config.notify_policies = notify_policy;
+    }
+    
+    ch_group->notify_policies = notify_policies;
+    ch_group->notify_policies_n = notify_policies_n;
+    
+    return notify_policies;
+}
+
+notify_policy_t* notify_policy_find(ch_group_t* ch_group, const uint8_t ch_n) {
+    if (ch_n < ch_group->notify_policies_n && ch_group->notify_policies[ch_n].ch) {
+        return &ch_group->notify_policies[ch_n];
+    }
+    
+    return NULL;
+}
+
+// Returns true if value was notified
+bool notify_policy_run(notify_policy_t* notify_policy, const bool force) {
+    const homekit_value_t* ch_value = &notify_policy->ch->value;
+    const float value = ch_value->format == HOMETKIT_FORMAT_FLOAT ? ch_value->float_value : ch_value->int_value;
+    
+    if (!force && notify_policy->has_notified) {
+        if (value == notify_policy->last_value) {
+            return false;
+        }
+        
+        const uint32_t elapsed = xTaskGetTickCount() - notify_policy->last_time;
+        
+        if (elapsed < notify_policy->min_interval) {
+            return false;
+        }
+        
+        if (fabsf(value - notify_policy->last_value) < notify_policy->deadband &&
+            (notify_policy->max_stale == 0 || elapsed < notify_policy->max_stale)) {
+            return false;
+        }
+    }
+    
+    notify_policy->has_notified = true;
+    notify_policy->last_value = value;
+    notify_policy->last_time = xTaskGetTickCount();
+    notify_policy->sent++;
+    
+    homekit_characteristic_notify_safe(notify_policy->ch);
+    
+    return true;
+}
+
+// Sensor values are notified through their policy if they have one. Forced ones, like sensor errors, are always sent
+void homekit_characteristic_notify_policy(ch_group_t* ch_group, const uint8_t ch_n, const bool force) {
+    notify_policy_t* notify_policy = notify_policy_find(ch_group, ch_n);
+    if (notify_policy) {
+        if (!notify_policy_run(notify_policy, force)) {
+            notify_policy->suppressed++;
+        }
+    } else {
+        homekit_characteristic_notify_safe(ch_group->ch[ch_n]);
+    }
+}
+
+// Sends suppressed values once their interval or staleness time is reached, even if sensor value does not change again
+void notify_policies_flush() {
+    notify_policy_t* notify_policy = main_config.notify_policies;
+    while (notify_policy) {
+        if (notify_policy->has_notified) {
+            notify_policy_run(notify_policy, false);
+        }
+        
+        notify_policy = notify_policy->next;
+    }
+}
+
+// --- SYSTEM SETTERS
 void hkc_custom_ota_setter(homekit_characteristic_t* ch, const homekit_value_t value) {
     if (!strcmp(value.string_value, CUSTOM_TRIGGER_COMMAND)) {
         INFO("<0> OTA update");
@@ -1137,8 +1406,140 @@ void binary_sensor(const uint16_t gpio, void* args, uint8_t type) {
     homekit_characteristic_notify_safe(ch_group->ch[0]);
 }
 
-void power_monitor_task(void* args) {
-    ch_group_t* ch_group = args;
+// --- SENSOR SCHEDULER
+// Median of last samples, and then exponential moving average
+float sensor_filter(sensor_job_t* sensor_job, const uint8_t n, const float value) {
+    if (!sensor_job || !sensor_job->filters || n >= sensor_job->filters_n) {
+        return value;
+    }
+    
+    sensor_filter_t* filter = &sensor_job->filters[n];
+    float filtered_value = value;
+    
+    if (sensor_job->filter_window > 1) {
+        filter->samples[filter->pos] = value;
+        filter->pos = (filter->pos + 1) % sensor_job->filter_window;
+        if (filter->samples_n < sensor_job->filter_window) {
+            filter->samples_n++;
+        }
+        
+        float sorted[SENSOR_FILTER_WINDOW_MAX];
+        for (uint8_t i = 0; i < filter->samples_n; i++) {
+            uint8_t j = i;
+            while (j > 0 && sorted[j - 1] > filter->samples[i]) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = filter->samples[i];
+        }
+        
+        filtered_value = sorted[filter->samples_n >> 1];
+    }
+    
+    if (sensor_job->filter_ema > 0) {
+        if (filter->has_ema) {
+            filter->ema += sensor_job->filter_ema * (filtered_value - filter->ema);
+        } else {
+            filter->ema = filtered_value;
+            filter->has_ema = true;
+        }
+        
+        filtered_value = filter->ema;
+    }
+    
+    return filtered_value;
+}
+
+// Single task running all sensor jobs in time order. A late job is not run again to catch up, so delays do not make bursts
+void sensor_scheduler_task(void* args) {
+    for (;;) {
+        sensor_job_t* sensor_job = NULL;
+        sensor_job_t* next_job = main_config.sensor_jobs;
+        while (next_job) {
+            if (next_job->is_enabled && (!sensor_job || (int32_t) (next_job->next_time - sensor_job->next_time) < 0)) {
+                sensor_job = next_job;
+            }
+            next_job = next_job->next;
+        }
+        
+        if (!sensor_job) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        
+        const int32_t wait = sensor_job->next_time - xTaskGetTickCount();
+        if (wait > 0) {
+            // Woken up earlier if a job is started meanwhile
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+        
+        if (!homekit_is_pairing()) {
+            if (!sensor_job->read(sensor_job)) {
+                sensor_job->errors++;
+            }
+            
+            sensor_job->samples++;
+            
+            notify_policies_flush();
+            
+            sensor_job->latency_last = (xTaskGetTickCount() - sensor_job->next_time) * portTICK_PERIOD_MS;
+            if (sensor_job->latency_last > sensor_job->latency_max) {
+                sensor_job->latency_max = sensor_job->latency_last;
+            }
+        } else {
+            ERROR("<%i> Sensor: HK pairing", sensor_job->ch_group->accessory);
+        }
+        
+        const uint32_t now = xTaskGetTickCount();
+        sensor_job->next_time += sensor_job->period;
+        if ((int32_t) (sensor_job->next_time - now) <= 0) {
+            sensor_job->next_time = now + sensor_job->period;
+        }
+    }
+}
+
+// Jobs are staggered, except sensors sharing a bus with same period, which are read one after another
+void sensor_job_start(sensor_job_t* sensor_job, const uint32_t delay_ms) {
+    if (!main_config.sensor_scheduler_task &&
+        xTaskCreate(sensor_scheduler_task, "sensors", SENSOR_SCHEDULER_TASK_SIZE, NULL, SENSOR_SCHEDULER_TASK_PRIORITY, &main_config.sensor_scheduler_task) != pdPASS) {
+        ERROR("<%i> Creating sensor scheduler", sensor_job->ch_group->accessory);
+        return;
+    }
+    
+    const uint32_t stagger = MS_TO_TICKS(SENSOR_SCHEDULER_STAGGER_MS);
+    uint32_t next_time = xTaskGetTickCount() + MS_TO_TICKS(delay_ms);
+    
+    sensor_job_t* other_job = main_config.sensor_jobs;
+    while (other_job) {
+        if (other_job->is_enabled && other_job != sensor_job) {
+            if (sensor_job->bus_gpio >= 0 &&
+                other_job->bus_gpio == sensor_job->bus_gpio &&
+                other_job->period == sensor_job->period) {
+                next_time = other_job->next_time;
+                break;
+            }
+            
+            const int32_t distance = other_job->next_time - next_time;
+            if (distance > -((int32_t) stagger) && distance < (int32_t) stagger) {
+                next_time = other_job->next_time + stagger;
+                other_job = main_config.sensor_jobs;    // Checked again with new time
+                continue;
+            }
+        }
+        
+        other_job = other_job->next;
+    }
+    
+    sensor_job->next_time = next_time;
+    sensor_job->is_enabled = true;
+    
+    xTaskNotifyGive(main_config.sensor_scheduler_task);
+}
+
+// --- POWER MONITOR
+bool power_monitor_read(sensor_job_t* sensor_job) {
+    ch_group_t* ch_group = sensor_job->ch_group;
     
     float voltage = 0;
     float current = 0;
@@ -1246,6 +1647,11 @@ void power_monitor_task(void* args) {
         const float consumption = ch_group->ch[3]->value.float_value + ((power * PM_POLL_PERIOD) / 3600000.f);
         INFO("<%i> PM: KWh = %1.7g", ch_group->accessory, consumption);
         
+        // Consumption is taken from raw power, and only reported values are filtered
+        voltage = sensor_filter(sensor_job, 0, voltage);
+        current = sensor_filter(sensor_job, 1, current);
+        power = sensor_filter(sensor_job, 2, power);
+        
         do_wildcard_actions(ch_group, 0, voltage);
         
         if (voltage != ch_group->ch[0]->value.float_value) {
@@ -1253,7 +1659,7 @@ void power_monitor_task(void* args) {
             ch_group->ch[0]->value.float_value = voltage;
             
             if (old_voltage != (int) (voltage * 10)) {
-                homekit_characteristic_notify_safe(ch_group->ch[0]);
+                homekit_characteristic_notify_policy(ch_group, 0, false);
             }
         }
         
@@ -1264,7 +1670,7 @@ void power_monitor_task(void* args) {
             ch_group->ch[1]->value.float_value = current;
             
             if (old_current != (int) (current * 1000)) {
-                homekit_characteristic_notify_safe(ch_group->ch[1]);
+                homekit_characteristic_notify_policy(ch_group, 1, false);
             }
         }
         
@@ -1275,7 +1681,7 @@ void power_monitor_task(void* args) {
             ch_group->ch[2]->value.float_value = power;
             
             if (old_power != (int) (power * 10)) {
-                homekit_characteristic_notify_safe(ch_group->ch[2]);
+                homekit_characteristic_notify_policy(ch_group, 2, false);
             }
         }
         
@@ -1286,7 +1692,7 @@ void power_monitor_task(void* args) {
             ch_group->ch[3]->value.float_value = consumption;
             
             if (old_consumption != (int) (consumption * 1000)) {
-                homekit_characteristic_notify_safe(ch_group->ch[3]);
+                homekit_characteristic_notify_policy(ch_group, 3, false);
             }
         }
         
@@ -1296,20 +1702,10 @@ void power_monitor_task(void* args) {
         }
     } else {
         ERROR("<%i> PM Read", ch_group->accessory);
+        return false;
     }
     
-    vTaskDelete(NULL);
-}
-
-void power_monitor_timer_worker(TimerHandle_t xTimer) {
-    if (!homekit_is_pairing()) {
-        if (xTaskCreate(power_monitor_task, "pm", POWER_MONITOR_TASK_SIZE, (void*) pvTimerGetTimerID(xTimer), POWER_MONITOR_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("Creating power_monitor");
-            homekit_remove_oldest_client();
-        }
-    } else {
-        ERROR("pm_task: HK pairing");
-    }
+    return true;
 }
 
 // --- WATER VALVE
@@ -2287,46 +2683,211 @@ void humidif_input_temp(const uint16_t gpio, void* args, const uint8_t type) {
     }
 }
 
-// --- TEMPERATURE
-void temperature_task(void* args) {
-    float taylor_log(float x) {
-        // https://stackoverflow.com/questions/46879166/finding-the-natural-logarithm-of-a-number-using-taylor-series-in-c
-        if (x <= 0.0) {
-            return x;
+// --- DS18B20
+ds18b20_bus_t* ds18b20_bus_find(const uint8_t gpio) {
+    ds18b20_bus_t* ds18b20_bus = main_config.ds18b20_buses;
+    while (ds18b20_bus && ds18b20_bus->gpio != gpio) {
+        ds18b20_bus = ds18b20_bus->next;
+    }
+    
+    return ds18b20_bus;
+}
+
+// Accessories with sensors on same GPIO share bus. It uses highest resolution asked,
+// and a read cycle is served to all of them during half of shortest poll period
+void ds18b20_bus_new(const uint8_t gpio, const uint8_t resolution, const float poll_period) {
+    const uint32_t max_age = MS_TO_TICKS(poll_period * 500);
+    
+    ds18b20_bus_t* ds18b20_bus = ds18b20_bus_find(gpio);
+    if (!ds18b20_bus) {
+        ds18b20_bus = malloc(sizeof(ds18b20_bus_t));
+        memset(ds18b20_bus, 0, sizeof(*ds18b20_bus));
+        
+        ds18b20_bus->gpio = gpio;
+        ds18b20_bus->resolution = resolution;
+        ds18b20_bus->max_age = max_age;
+        ds18b20_bus->is_scan_needed = true;
+        ds18b20_bus->mutex = xSemaphoreCreateMutex();
+        
+        ds18b20_bus->next = main_config.ds18b20_buses;
+        main_config.ds18b20_buses = ds18b20_bus;
+        
+    } else {
+        if (resolution > ds18b20_bus->resolution) {
+            ds18b20_bus->resolution = resolution;
         }
         
-        float z = (x + 1) / (x - 1);
-        const float step = ((x - 1) * (x - 1)) / ((x + 1) * (x + 1));
-        float totalValue = 0;
-        float powe = 1;
-        for (uint8_t i = 0; i < 10; i++) {
-            z *= step;
-            const float y = (1 / powe) * z;
-            totalValue = totalValue + y;
-            powe = powe + 2;
+        if (max_age < ds18b20_bus->max_age) {
+            ds18b20_bus->max_age = max_age;
+        }
+    }
+}
+
+// ROM codes are kept until a sensor fails. Resolution is written to scratchpad of all sensors at once
+bool ds18b20_bus_scan(ds18b20_bus_t* ds18b20_bus) {
+    const uint8_t gpio = ds18b20_bus->gpio;
+    
+    ds18b20_addr_t addrs[DS18B20_BUS_MAX_DEVICES];
+    int devices_n = ds18b20_scan_devices(gpio, addrs, DS18B20_BUS_MAX_DEVICES);
+    if (devices_n <= 0) {
+        ds18b20_bus->devices_n = 0;
+        return false;
+    }
+    
+    if (devices_n > DS18B20_BUS_MAX_DEVICES) {
+        devices_n = DS18B20_BUS_MAX_DEVICES;
+    }
+    
+    if (devices_n != ds18b20_bus->devices_n) {
+        // On failure, bus is left without sensors and it is scanned again on next read
+        ds18b20_addr_t* new_addrs = realloc(ds18b20_bus->addrs, devices_n * sizeof(ds18b20_addr_t));
+        if (!new_addrs) {
+            ds18b20_bus->devices_n = 0;
+            return false;
         }
+        ds18b20_bus->addrs = new_addrs;
         
-        totalValue *= 2;
+        float* new_temps = realloc(ds18b20_bus->temps, devices_n * sizeof(float));
+        if (!new_temps) {
+            ds18b20_bus->devices_n = 0;
+            return false;
+        }
+        ds18b20_bus->temps = new_temps;
         
-        return totalValue;
+        ds18b20_bus->devices_n = devices_n;
     }
     
-    ch_group_t* ch_group = args;
+    memcpy(ds18b20_bus->addrs, addrs, devices_n * sizeof(ds18b20_addr_t));
     
-    float humidity_value, temperature_value;
-    bool get_temp = false;
-    uint8_t iairzoning = 0;
+    INFO("DS18B20 GPIO %i: %i sensors", gpio, devices_n);
     
-    if (ch_group->acc_type == ACC_TYPE_IAIRZONING) {
-        INFO("<%i> iAirZoning sensors", ch_group->accessory);
-        iairzoning = ch_group->accessory;
-        ch_group = main_config.ch_groups;
+    const uint8_t config[3] = {
+        DS18B20_ALARM_HIGH_DEFAULT,
+        DS18B20_ALARM_LOW_DEFAULT,
+        ((ds18b20_bus->resolution - DS18B20_RESOLUTION_MIN) << 5) | 0x1F
+    };
+    
+    if (!onewire_reset(gpio) || !onewire_skip_rom(gpio) ||
+        !onewire_write(gpio, DS18B20_CMD_WRITE_SCRATCHPAD) || !onewire_write_bytes(gpio, config, 3)) {
+        return false;
     }
     
-    while (ch_group) {
-        get_temp = false;
+    ds18b20_bus->is_scan_needed = false;
+    
+    return true;
+}
+
+// Single conversion of all sensors with Skip ROM, and then their scratchpads are read
+void ds18b20_bus_read(ds18b20_bus_t* ds18b20_bus) {
+    const uint8_t gpio = ds18b20_bus->gpio;
+    
+    ds18b20_bus->has_data = false;
+    
+    if (ds18b20_bus->is_scan_needed && !ds18b20_bus_scan(ds18b20_bus)) {
+        return;
+    }
+    
+    const uint8_t unused_bits = DS18B20_RESOLUTION_DEFAULT - ds18b20_bus->resolution;
+    
+    const bool is_converted = ds18b20_measure(gpio, DS18B20_ANY, false);
+    if (is_converted) {
+        vTaskDelay(MS_TO_TICKS(DS18B20_CONVERSION_TIME_MS >> unused_bits));
+        onewire_depower(gpio);
+    }
+    
+    for (uint8_t i = 0; i < ds18b20_bus->devices_n; i++) {
+        uint8_t scratchpad[8];
         
-        if (iairzoning == 0 || (ch_group->acc_type == ACC_TYPE_THERMOSTAT && iairzoning == (uint8_t) TH_IAIRZONING_CONTROLLER)) {
+        // A sensor with other resolution has been powered off, so its scratchpad has no conversion
+        if (is_converted &&
+            ds18b20_read_scratchpad(gpio, ds18b20_bus->addrs[i], scratchpad) &&
+            (scratchpad[4] >> 5) == ds18b20_bus->resolution - DS18B20_RESOLUTION_MIN) {
+            const int16_t raw_temp = ((scratchpad[1] << 8) | scratchpad[0]) & ~((1 << unused_bits) - 1);
+            ds18b20_bus->temps[i] = raw_temp / 16.f;
+            
+        } else {
+            ds18b20_bus->temps[i] = NAN;
+            ds18b20_bus->is_scan_needed = true;
+        }
+    }
+    
+    ds18b20_bus->last_read = xTaskGetTickCount();
+    ds18b20_bus->has_data = true;
+}
+
+// Index starts at 1, in order of ROM search
+bool ds18b20_bus_get_temperature(const uint8_t gpio, const uint8_t index, float* temperature) {
+    ds18b20_bus_t* ds18b20_bus = ds18b20_bus_find(gpio);
+    if (!ds18b20_bus || index == 0) {
+        return false;
+    }
+    
+    xSemaphoreTake(ds18b20_bus->mutex, portMAX_DELAY);
+    
+    if (index > ds18b20_bus->devices_n) {
+        ds18b20_bus->is_scan_needed = true;
+    }
+    
+    if (!ds18b20_bus->has_data || ds18b20_bus->is_scan_needed ||
+        (xTaskGetTickCount() - ds18b20_bus->last_read) >= ds18b20_bus->max_age) {
+        ds18b20_bus_read(ds18b20_bus);
+    }
+    
+    bool result = false;
+    if (ds18b20_bus->has_data && index <= ds18b20_bus->devices_n && !isnan(ds18b20_bus->temps[index - 1])) {
+        *temperature = ds18b20_bus->temps[index - 1];
+        result = true;
+    }
+    
+    xSemaphoreGive(ds18b20_bus->mutex);
+    
+    return result;
+}
+
+// --- TEMPERATURE
+bool temperature_sensor_read(sensor_job_t* sensor_job) {
+    float taylor_log(float x) {
+        // https://stackoverflow.com/questions/46879166/finding-the-natural-logarithm-of-a-number-using-taylor-series-in-c
+        if (x <= 0.0) {
+            return x;
+        }
+        
+        float z = (x + 1) / (x - 1);
+        const float step = ((x - 1) * (x - 1)) / ((x + 1) * (x + 1));
+        float totalValue = 0;
+        float powe = 1;
+        for (uint8_t i = 0; i < 10; i++) {
+            z *= step;
+            const float y = (1 / powe) * z;
+            totalValue = totalValue + y;
+            powe = powe + 2;
+        }
+        
+        totalValue *= 2;
+        
+        return totalValue;
+    }
+    
+    ch_group_t* ch_group = sensor_job->ch_group;
+    
+    float humidity_value, temperature_value;
+    bool get_temp = false;
+    bool is_ok = true;
+    uint8_t iairzoning = 0;
+    
+    if (ch_group->acc_type == ACC_TYPE_IAIRZONING) {
+        INFO("<%i> iAirZoning sensors", ch_group->accessory);
+        iairzoning = ch_group->accessory;
+        ch_group = main_config.ch_groups;
+        
+        // Zones have no filters
+        sensor_job = NULL;
+    }
+    
+    while (ch_group) {
+        get_temp = false;
+        
+        if (iairzoning == 0 || (ch_group->acc_type == ACC_TYPE_THERMOSTAT && iairzoning == (uint8_t) TH_IAIRZONING_CONTROLLER)) {
             INFO("<%i> Read TH sensor", ch_group->accessory);
             
             if (TH_SENSOR_TYPE != 3 && TH_SENSOR_TYPE < 5) {
@@ -2341,14 +2902,7 @@ void temperature_task(void* args) {
                 get_temp = dht_read_float_data(current_sensor_type, TH_SENSOR_GPIO, &humidity_value, &temperature_value);
                 
             } else if (TH_SENSOR_TYPE == 3) {
-                ds18b20_addr_t ds18b20_addr[(uint8_t) TH_SENSOR_INDEX];
-                
-                if (ds18b20_scan_devices(TH_SENSOR_GPIO, ds18b20_addr, (uint8_t) TH_SENSOR_INDEX) >= (uint8_t) TH_SENSOR_INDEX) {
-                    float temps[1];
-                    ds18b20_addr_t ds18b20_addr_single[1];
-                    ds18b20_addr_single[0] = ds18b20_addr[((uint8_t) TH_SENSOR_INDEX) - 1];
-                    ds18b20_measure_and_read_multi(TH_SENSOR_GPIO, ds18b20_addr_single, 1, temps);
-                    temperature_value = temps[0];
+                if (ds18b20_bus_get_temperature(TH_SENSOR_GPIO, TH_SENSOR_INDEX, &temperature_value)) {
                     humidity_value = 0.0;
                     get_temp = true;
                 }
@@ -2394,7 +2948,7 @@ void temperature_task(void* args) {
                 TH_SENSOR_ERROR_COUNT = 0;
                 
                 if (ch_group->chs > 0 && ch_group->ch[0]) {
-                    temperature_value += TH_SENSOR_TEMP_OFFSET;
+                    temperature_value = sensor_filter(sensor_job, 0, temperature_value + TH_SENSOR_TEMP_OFFSET);
                     if (temperature_value < -100) {
                         temperature_value = -100;
                     } else if (temperature_value > 200) {
@@ -2408,7 +2962,7 @@ void temperature_task(void* args) {
                     
                     if (temperature_value != ch_group->ch[0]->value.float_value) {
                         ch_group->ch[0]->value.float_value = temperature_value;
-                        homekit_characteristic_notify_safe(ch_group->ch[0]);
+                        homekit_characteristic_notify_policy(ch_group, 0, false);
                         
                         if (ch_group->chs > 4) {
                             update_th(ch_group->ch[0], ch_group->ch[0]->value);
@@ -2419,7 +2973,7 @@ void temperature_task(void* args) {
                 }
                 
                 if (ch_group->chs > 1 && ch_group->ch[1]) {
-                    humidity_value += TH_SENSOR_HUM_OFFSET;
+                    humidity_value = sensor_filter(sensor_job, 1, humidity_value + TH_SENSOR_HUM_OFFSET);
                     if (humidity_value < 0) {
                         humidity_value = 0;
                     } else if (humidity_value > 100) {
@@ -2430,7 +2984,7 @@ void temperature_task(void* args) {
                     
                     if ((uint8_t) humidity_value != (uint8_t) ch_group->ch[1]->value.float_value) {
                         ch_group->ch[1]->value.float_value = (uint8_t) humidity_value;
-                        homekit_characteristic_notify_safe(ch_group->ch[1]);
+                        homekit_characteristic_notify_policy(ch_group, 1, false);
                         
                         if (ch_group->chs > 4) {
                             update_humidif(ch_group->ch[1], ch_group->ch[1]->value);
@@ -2444,6 +2998,7 @@ void temperature_task(void* args) {
                 led_blink(5);
                 ERROR("<%i> Sensor", ch_group->accessory);
                 
+                is_ok = false;
                 TH_SENSOR_ERROR_COUNT++;
 
                 if ((uint8_t) TH_SENSOR_ERROR_COUNT > TH_SENSOR_MAX_ALLOWED_ERRORS) {
@@ -2451,11 +3006,11 @@ void temperature_task(void* args) {
                     
                     if (ch_group->chs > 0 && ch_group->ch[0]) {
                         ch_group->ch[0]->value.float_value = 0;
-                        homekit_characteristic_notify_safe(ch_group->ch[0]);
+                        homekit_characteristic_notify_policy(ch_group, 0, true);
                     }
                     if (ch_group->chs > 1 && ch_group->ch[1]) {
                         ch_group->ch[1]->value.float_value = 0;
-                        homekit_characteristic_notify_safe(ch_group->ch[1]);
+                        homekit_characteristic_notify_policy(ch_group, 1, true);
                     }
 
                     do_actions(ch_group, THERMOSTAT_ACTION_SENSOR_ERROR);
@@ -2476,22 +3031,32 @@ void temperature_task(void* args) {
         }
     }
     
-    vTaskDelete(NULL);
+    return is_ok;
 }
 
-void temperature_timer_worker(TimerHandle_t xTimer) {
-    if (!homekit_is_pairing()) {
-        if (xTaskCreate(temperature_task, "temp", TEMPERATURE_TASK_SIZE, (void*) pvTimerGetTimerID(xTimer), TEMPERATURE_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("Creating temperature");
-            homekit_remove_oldest_client();
-        }
-    } else {
-        ERROR("temperature_task: HK pairing");
-    }
+// --- LIGHTBULBS
+// Triangle that cuts out the planckian locus. Colors inside it are mixed with white channels, and colors outside it are gamut stretched
+static float lightbulb_white_triangle[3][2] = { { 0.549644, 0.411449 }, { 0.241671, 0.232935 }, { 0.389596, 0.46404 } };
+
+// Chromaticity x and y numerators, and their denominator, as coefficients of each gamma corrected wheel channel.
+// sRGB primaries, with lightbulb white point
+static void lightbulb_xy_matrix(lightbulb_group_t* lightbulb_group, float xy[3][3]) {
+    xy[0][0] = -0.06858669123260035 + 0.47130967708792587 * WP[0] + 0.17294626097117374 * WP[1];
+    xy[0][1] = -0.07488078606033685 + 0.6384263445494799 * WP[0] - 0.021643836986853505 * WP[1];
+    xy[0][2] = 0.14346747729293707 - 0.10973602163740542 * WP[0] - 0.15130242398432014 * WP[1];
+    
+    xy[1][0] = -0.029315872239491187 + 0.18228806745026777 * WP[0] + 0.12851324243365222 * WP[1];
+    xy[1][1] = -0.014752306913086446 - 0.14252506353137964 * WP[0] + 0.8954546388234319 * WP[1];
+    xy[1][2] = 0.044068179152577595 - 0.039763003918887874 * WP[0] - 0.023967881257084177 * WP[1];
+    
+    xy[2][0] = -0.07763613020327381 + 0.6290345979071447 * WP[0] + 0.28254416233165086 * WP[1];
+    xy[2][1] = -0.007345554338030566 + 0.38489743505804436 * WP[0] + 0.8484121370129867 * WP[1];
+    xy[2][2] = 1.0849816845413038 - 1.013932032965188 * WP[0] - 1.1309562993446372 * WP[1];
 }
 
-// --- LIGHTBULBS
-void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
+// Color of given hue and saturation at full brightness, as PWM_SCALE fractions. Used to build color tables, and for their cells that can not be interpolated
+// Region forces white triangle test result, so each color table region is interpolated up to its boundary
+void hsi2rgbw_float(uint16_t h, float s, ch_group_t* ch_group, const uint16_t* gamma_table, const uint8_t region, uint16_t* color) {
     // **************************************************
     // * All credits and thanks to Kevin John Cutler    *
     // * https://github.com/kevinjohncutler/colormixing *
@@ -2661,10 +3226,6 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
     }
     
     // *** HSI TO RGBW FUNCTION ***
-#ifdef LIGHT_DEBUG
-    uint32_t run_time = sdk_system_get_time();
-#endif
-    
     lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
 
     h %= 360; // shorthand modulo arithmetic, h = h%360, so that h is rescaled to the range [0,360) (angle around hue circle)
@@ -2727,15 +3288,19 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
     // (2) convert to XYZ then to xy(ignore Y). Also now apply gamma correction.
     float gc[3];
     for (uint8_t i = 0; i < 3; i++) {
-        gc[i] = (wheel_rgb[i] > 0.04045f) ? fast_precise_pow((wheel_rgb[i] + 0.055f) / (1.0f + 0.055f), 2.4f) : (wheel_rgb[i] / 12.92f);
+        const float gamma_index = wheel_rgb[i] * LIGHTBULB_GAMMA_TABLE_SIZE;
+        const uint8_t gamma_n = MIN((uint8_t) gamma_index, LIGHTBULB_GAMMA_TABLE_SIZE - 1);
+        gc[i] = (gamma_table[gamma_n] + (gamma_table[gamma_n + 1] - gamma_table[gamma_n]) * (gamma_index - gamma_n)) / PWM_SCALE;
     }
     
     // Get the xy coordinates using sRGB Primaries. This appears to be the space that HomeKit gives HSV commands in, however, we need to do some gamut streching.
     // This matrix should later be computed fromms scratch using the functions above
-    const float denom = gc[2] * (1.0849816845413038 - 1.013932032965188 * WP[0] - 1.1309562993446372 * WP[1]) + gc[0] * (-0.07763613020327381 + 0.6290345979071447 * WP[0] + 0.28254416233165086 * WP[1]) + gc[1] * (-0.007345554338030566 + 0.38489743505804436 * WP[0] + 0.8484121370129867 * WP[1]);
+    float xy[3][3];
+    lightbulb_xy_matrix(lightbulb_group, xy);
+    const float denom = gc[0] * xy[2][0] + gc[1] * xy[2][1] + gc[2] * xy[2][2];
     float p[2] = {
-        (gc[2] * (0.14346747729293707 - 0.10973602163740542 * WP[0] - 0.15130242398432014 * WP[1]) + gc[1] * (-0.07488078606033685 + 0.6384263445494799 * WP[0] - 0.021643836986853505 * WP[1]) + gc[0] * (-0.06858669123260035 + 0.47130967708792587 * WP[0] + 0.17294626097117374 * WP[1])) / denom,
-        (gc[2] * (0.044068179152577595 - 0.039763003918887874 * WP[0] - 0.023967881257084177 * WP[1]) + gc[0] * (-0.029315872239491187 + 0.18228806745026777 * WP[0] + 0.12851324243365222 * WP[1]) + gc[1] * (-0.014752306913086446 - 0.14252506353137964 * WP[0] + 0.8954546388234319 * WP[1])) / denom
+        (gc[0] * xy[0][0] + gc[1] * xy[0][1] + gc[2] * xy[0][2]) / denom,
+        (gc[0] * xy[1][0] + gc[1] * xy[1][1] + gc[2] * xy[1][2]) / denom
     };
     L_DEBUG("Chromaticity: [%g, %g]", p[0], p[1]);
     
@@ -2746,13 +3311,11 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
 //    float sb[2] = {0.155906423926,0.066072970629};
 //    float slope = (p[1]-sb[1]) / (p[0]-sb[0]);
     float L[3];
-    float planckR[2] = { 0.549644, 0.411449 };
-    float planckG[2] = { 0.241671, 0.232935 };
-    float planckB[2] = { 0.389596, 0.46404 };
-    bary(L, p, planckR, planckG, planckB);
+    bary(L, p, lightbulb_white_triangle[0], lightbulb_white_triangle[1], lightbulb_white_triangle[2]);
     
     L_DEBUG("Bary test: [%g, %g, %g]", L[0], L[1], L[2]);
-    if ((L[0] < 0) || (L[1] < 0) || (L[2] < 0)) { // Outside the white triangle
+    if (region == LIGHTBULB_COLOR_REGION_GAMUT ||
+        (region == LIGHTBULB_COLOR_REGION_ANY && ((L[0] < 0) || (L[1] < 0) || (L[2] < 0)))) { // Outside the white triangle
         
         // Instead of the algo above to simply use different primaries (which stretches intermediate CMY way off), I came up with a new one. It checks for being in one of six triangles, and applies a unique transform for each to fill the gamut without disrupting CMY. By fixing one intermediate point, I suspect that the colors will be much more 'as expected'.
 //        float cyan[2]    = {0.249488, 0.367277};
@@ -2869,7 +3432,7 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
             L_DEBUG("mat2 = { {%g, %g}, {%g, %g} }", mat2[0][0], mat2[0][1], mat2[1][0], mat2[1][1]);
             
         }
-        INFO("New chromaticity: [%g, %g]", p[0], p[1]);
+        L_DEBUG("New chromaticity: [%g, %g]", p[0], p[1]);
     }
   
     float targetRGB[3];
@@ -2972,7 +3535,7 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
     // (5) Brightness defined by the normalized value argument. We also divide by the scale found earlier to amp the brightness to maximum when the value is 1 (v/100). We also introduce the PWM_SCALE as the final 'units'.
     // Max power cutoff: want to limit the total scaled flux. Should do sum of flux times coeff, but what should the cutoff be? Based on everything being on, i.e. sum of fluxes.
 
-    float brightness = (v / 100.f) * PWM_SCALE;
+    float brightness = PWM_SCALE;
 
     if (LIGHTBULB_MAX_POWER != 1) {
         const float flux_ratio = array_dot(lightbulb_group->flux, coeffs) / array_sum(lightbulb_group->flux); // Actual brightness compared to theoretrical max brightness
@@ -2980,14 +3543,400 @@ void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
     }
 
     // (6) Assign the target colors to lightbulb group struct, now in fraction of PWM_SCALE. This min function is just a final check, it should not ever go over PWM_SCALE.
-    for (uint8_t n = 0; n < 5; n++) {
-        lightbulb_group->target[n]  = MIN(floorf(coeffs[n] * brightness), PWM_SCALE);
+    for (uint8_t n = 0; n < LIGHTBULB_CHANNELS; n++) {
+        color[n] = MIN(floorf(coeffs[n] * brightness), PWM_SCALE);
+    }
+}
+
+static uint16_t lightbulb_gamma_table[LIGHTBULB_GAMMA_TABLE_SIZE + 1];
+static bool lightbulb_gamma_table_ready = false;
+
+static uint16_t lightbulb_brightness_table[LIGHTBULB_BRIGHTNESS_TABLE_SIZE + 1];
+static bool lightbulb_brightness_table_ready = false;
+
+// Output of brightness percent, as PWM_SCALE fraction. With brightness curve, brightness is taken as CIE 1976 lightness,
+// so each step looks alike to eye
+static uint16_t lightbulb_brightness(lightbulb_group_t* lightbulb_group, uint8_t v) {
+    v = MIN(v, LIGHTBULB_BRIGHTNESS_TABLE_SIZE);
+    
+    if (!LIGHTBULB_BRIGHTNESS_CURVE) {
+        return PWM_SCALE * v / LIGHTBULB_BRIGHTNESS_TABLE_SIZE;
+    }
+    
+    if (!lightbulb_brightness_table_ready) {
+        lightbulb_brightness_table_ready = true;
+        
+        for (uint8_t i = 0; i <= LIGHTBULB_BRIGHTNESS_TABLE_SIZE; i++) {
+            const float lightness = ((float) i) * 100 / LIGHTBULB_BRIGHTNESS_TABLE_SIZE;
+            const float cube_root = (lightness + 16) / 116;
+            const float luminance = (lightness > 8) ? (cube_root * cube_root * cube_root) : (lightness / 903.3f);
+            lightbulb_brightness_table[i] = MAX(lroundf(PWM_SCALE * luminance), (i > 0) ? 1 : 0);
+        }
+    }
+    
+    return lightbulb_brightness_table[v];
+}
+
+// Barycentric coordinates of a color in a triangle are ratios of linear forms of its gamma corrected channels, so their signs
+// are tested with those forms. Tolerance of bary() is added with denominator form
+static void lightbulb_bary_forms(float xy[3][3], float* t0, float* t1, float* t2, float forms[3][3]) {
+    const float denom = (t1[1] - t2[1]) * (t0[0] - t2[0]) + (t2[0] - t1[0]) * (t0[1] - t2[1]);
+    
+    for (uint8_t i = 0; i < 3; i++) {
+        const float x = xy[0][i] - (t2[0] * xy[2][i]);
+        const float y = xy[1][i] - (t2[1] * xy[2][i]);
+        forms[0][i] = (t1[1] - t2[1]) * x + (t2[0] - t1[0]) * y;
+        forms[1][i] = (t2[1] - t0[1]) * x + (t0[0] - t2[0]) * y;
+        forms[2][i] = (denom * xy[2][i]) - forms[0][i] - forms[1][i];
+        
+        for (uint8_t k = 0; k < 3; k++) {
+            forms[k][i] = ((denom < 0) ? -forms[k][i] : forms[k][i]) + (1E-4 * fabsf(denom) * xy[2][i]);
+        }
+    }
+}
+
+// Forms of white triangle, and their denominator, scaled to integers
+static void lightbulb_color_forms(lightbulb_group_t* lightbulb_group, int32_t color_forms[LIGHTBULB_COLOR_FORMS][3]) {
+    float xy[3][3];
+    lightbulb_xy_matrix(lightbulb_group, xy);
+    
+    float forms[LIGHTBULB_COLOR_FORMS][3];
+    lightbulb_bary_forms(xy, lightbulb_white_triangle[0], lightbulb_white_triangle[1], lightbulb_white_triangle[2], forms);
+    memcpy(forms[3], xy[2], sizeof(forms[3]));
+    
+    for (uint8_t k = 0; k < LIGHTBULB_COLOR_FORMS; k++) {
+        float form_max = 0;
+        for (uint8_t i = 0; i < 3; i++) {
+            form_max = MAX(form_max, fabsf(forms[k][i]));
+        }
+        
+        if (form_max == 0) {
+            form_max = 1;
+        }
+        
+        for (uint8_t i = 0; i < 3; i++) {
+            color_forms[k][i] = lroundf(forms[k][i] * (1 << 20) / form_max);
+        }
+    }
+}
+
+// All barycentric coordinates of gamma corrected color have sign of denominator
+static bool lightbulb_color_forms_inside(const int32_t forms[3][3], const int64_t* gc, const bool is_positive) {
+    for (uint8_t k = 0; k < 3; k++) {
+        const int64_t form = (forms[k][0] * gc[0]) + (forms[k][1] * gc[1]) + (forms[k][2] * gc[2]);
+        if (is_positive ? (form < 0) : (form > 0)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Region tests of hsi2rgbw_float() without float maths, with wheel color in 20 bits fixed point and its gamma correction
+// with 8 more bits than gamma table
+static uint8_t lightbulb_color_region(const int32_t forms[LIGHTBULB_COLOR_FORMS][3], const uint16_t h, const uint32_t s_fixed) {
+    const uint32_t rgb_max = 1 << 20;
+    const uint32_t rgb_min = ((25600 - s_fixed) << 12) / 100;
+    const uint32_t rgb_adj = ((rgb_max - rgb_min) * (h % 60)) / 60;
+    
+    uint32_t wheel_rgb[3];
+    switch (h / 60) {
+        case 0:     // Red to yellow
+            wheel_rgb[0] = rgb_max;
+            wheel_rgb[1] = rgb_min + rgb_adj;
+            wheel_rgb[2] = rgb_min;
+            break;
+        
+        case 1:     // Yellow to green
+            wheel_rgb[0] = rgb_max - rgb_adj;
+            wheel_rgb[1] = rgb_max;
+            wheel_rgb[2] = rgb_min;
+            break;
+        
+        case 2:     // Green to cyan
+            wheel_rgb[0] = rgb_min;
+            wheel_rgb[1] = rgb_max;
+            wheel_rgb[2] = rgb_min + rgb_adj;
+            break;
+        
+        case 3:     // Cyan to blue
+            wheel_rgb[0] = rgb_min;
+            wheel_rgb[1] = rgb_max - rgb_adj;
+            wheel_rgb[2] = rgb_max;
+            break;
+        
+        case 4:     // Blue to magenta
+            wheel_rgb[0] = rgb_min + rgb_adj;
+            wheel_rgb[1] = rgb_min;
+            wheel_rgb[2] = rgb_max;
+            break;
+        
+        default:    // Magenta to red
+            wheel_rgb[0] = rgb_max;
+            wheel_rgb[1] = rgb_min;
+            wheel_rgb[2] = rgb_max - rgb_adj;
+            break;
+    }
+    
+    int64_t gc[3];
+    for (uint8_t i = 0; i < 3; i++) {
+        const uint32_t gamma_index = wheel_rgb[i] * LIGHTBULB_GAMMA_TABLE_SIZE;
+        uint8_t gamma_n = gamma_index >> 20;
+        uint32_t gamma_weight = gamma_index & 0xFFFFF;
+        if (gamma_n >= LIGHTBULB_GAMMA_TABLE_SIZE) {
+            gamma_n = LIGHTBULB_GAMMA_TABLE_SIZE - 1;
+            gamma_weight = 1 << 20;
+        }
+        
+        gc[i] = (lightbulb_gamma_table[gamma_n] << 8) + ((((uint64_t) (lightbulb_gamma_table[gamma_n + 1] - lightbulb_gamma_table[gamma_n])) * gamma_weight) >> 12);
+    }
+    
+    const bool is_positive = ((forms[3][0] * gc[0]) + (forms[3][1] * gc[1]) + (forms[3][2] * gc[2])) > 0;
+    
+    return lightbulb_color_forms_inside(forms, gc, is_positive) ? LIGHTBULB_COLOR_REGION_WHITE : LIGHTBULB_COLOR_REGION_GAMUT;
+}
+
+// Bilinear interpolation of color table cell in given region, with 8 bits fixed point weights
+static void lightbulb_color_table_interpolate(lightbulb_group_t* lightbulb_group, const uint8_t region, const uint16_t h_cell, const uint8_t s_cell, const uint32_t h_weight, const uint32_t s_weight, uint16_t* color) {
+    const color_table_t* color_table = lightbulb_group->color_table;
+    const uint16_t h_next = (h_cell + 1) % LIGHTBULB_COLOR_TABLE_HUES;
+    const uint16_t* c00 = color_table->colors + color_table->column[region][h_cell] + ((s_cell - color_table->rows_start[region][h_cell]) * LIGHTBULB_CHANNELS);
+    const uint16_t* c10 = color_table->colors + color_table->column[region][h_next] + ((s_cell - color_table->rows_start[region][h_next]) * LIGHTBULB_CHANNELS);
+    
+    for (uint8_t n = 0; n < LIGHTBULB_CHANNELS; n++) {
+        const uint32_t c0 = (c00[n] * (256 - s_weight)) + (c00[n + LIGHTBULB_CHANNELS] * s_weight);
+        const uint32_t c1 = (c10[n] * (256 - s_weight)) + (c10[n + LIGHTBULB_CHANNELS] * s_weight);
+        color[n] = ((((uint64_t) c0) * (256 - h_weight)) + (((uint64_t) c1) * h_weight)) >> 16;
+    }
+}
+
+// Cell is interpolated in a region when both of its hue columns have its rows, and it is not marked to use hsi2rgbw_float()
+static bool lightbulb_color_table_has_cell(const color_table_t* color_table, const uint8_t region, const uint16_t h_cell, const uint8_t s_cell) {
+    const uint16_t cell = (h_cell * (LIGHTBULB_COLOR_TABLE_SATS - 1)) + s_cell;
+    const uint16_t h_next = (h_cell + 1) % LIGHTBULB_COLOR_TABLE_HUES;
+    
+    return !(color_table->float_cells[region][cell >> 3] & (1 << (cell & 0x07))) &&
+           s_cell >= color_table->rows_start[region][h_cell] && s_cell + 1 < color_table->rows_end[region][h_cell] &&
+           s_cell >= color_table->rows_start[region][h_next] && s_cell + 1 < color_table->rows_end[region][h_next];
+}
+
+// Regions found at every integer hue and saturation of a cell
+static uint8_t lightbulb_color_cell_regions(const int32_t forms[LIGHTBULB_COLOR_FORMS][3], const uint16_t h_cell, const uint8_t s_cell) {
+    const uint8_t s_end = (s_cell == LIGHTBULB_COLOR_TABLE_SATS - 2) ? LIGHTBULB_COLOR_TABLE_SAT_STEP + 1 : LIGHTBULB_COLOR_TABLE_SAT_STEP;
+    uint8_t regions = 0;
+    
+    for (uint8_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUE_STEP; h++) {
+        for (uint8_t s = 0; s < s_end; s++) {
+            regions |= 1 << lightbulb_color_region(forms, (h_cell * LIGHTBULB_COLOR_TABLE_HUE_STEP) + h, ((s_cell * LIGHTBULB_COLOR_TABLE_SAT_STEP) + s) << 8);
+        }
+    }
+    
+    return regions;
+}
+
+// Everything used by hsi2rgbw_float(), so lightbulbs with same settings can share their color table
+static bool lightbulb_color_settings_equal(ch_group_t* ch_group_a, ch_group_t* ch_group_b) {
+    lightbulb_group_t* a = lightbulb_group_find(ch_group_a->ch[0]);
+    lightbulb_group_t* b = lightbulb_group_find(ch_group_b->ch[0]);
+    
+    return a->channels == b->channels &&
+           ch_group_a->num[0] == ch_group_b->num[0] &&      // LIGHTBULB_MAX_POWER
+           ch_group_a->num[1] == ch_group_b->num[1] &&      // LIGHTBULB_CURVE_FACTOR
+           !memcmp(a->flux, b->flux, sizeof(a->flux)) &&
+           !memcmp(a->r, b->r, sizeof(a->r)) &&
+           !memcmp(a->g, b->g, sizeof(a->g)) &&
+           !memcmp(a->b, b->b, sizeof(a->b)) &&
+           !memcmp(a->cw, b->cw, sizeof(a->cw)) &&
+           !memcmp(a->ww, b->ww, sizeof(a->ww)) &&
+           !memcmp(a->rgb, b->rgb, sizeof(a->rgb)) &&
+           !memcmp(a->cmy, b->cmy, sizeof(a->cmy)) &&
+           !memcmp(a->wp, b->wp, sizeof(a->wp));
+}
+
+// Table of colors at full brightness for every hue and saturation step of lightbulb profile, so color changes do not need float maths.
+// Colors jump at white triangle boundary, so each side of it has its own rows, calculated up to the boundary as if there were no jump.
+// Cells that still can not be interpolated, mostly crossed by a gamut or a clipped channel boundary, are marked to use hsi2rgbw_float().
+// It is built once, when lightbulb is configured, and lightbulbs with same settings use same table
+bool lightbulb_color_table_build(ch_group_t* ch_group) {
+    lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
+    
+    if (!lightbulb_gamma_table_ready) {
+        lightbulb_gamma_table_ready = true;
+        for (uint8_t i = 0; i <= LIGHTBULB_GAMMA_TABLE_SIZE; i++) {
+            const float value = ((float) i) / LIGHTBULB_GAMMA_TABLE_SIZE;
+            lightbulb_gamma_table[i] = lroundf(PWM_SCALE * ((value > 0.04045f) ? fast_precise_pow((value + 0.055f) / (1.0f + 0.055f), 2.4f) : (value / 12.92f)));
+        }
+    }
+    
+    color_table_t* color_table = main_config.color_tables;
+    while (color_table) {
+        if (lightbulb_color_settings_equal(color_table->ch_group, ch_group)) {
+            lightbulb_group->color_table = color_table;
+            return true;
+        }
+        
+        color_table = color_table->next;
     }
 
 #ifdef LIGHT_DEBUG
-    INFO("hsi2rgbw runtime: %0.3f ms", ((float) (sdk_system_get_time() - run_time)) * 1e-3);
+    uint32_t run_time = sdk_system_get_time();
+#endif
+
+    int32_t forms[LIGHTBULB_COLOR_FORMS][3];
+    lightbulb_color_forms(lightbulb_group, forms);
+    
+    // Hue columns of each region have rows of every cell beside them with colors in that region
+    uint8_t rows_start[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_HUES];
+    uint8_t rows_end[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_HUES];
+    memset(rows_start, LIGHTBULB_COLOR_TABLE_SATS, sizeof(rows_start));
+    memset(rows_end, 0, sizeof(rows_end));
+    
+    for (uint16_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUES; h++) {
+        for (uint8_t s = 0; s < LIGHTBULB_COLOR_TABLE_SATS - 1; s++) {
+            const uint8_t regions = lightbulb_color_cell_regions(forms, h, s);
+            for (uint8_t region = 0; region < LIGHTBULB_COLOR_REGIONS; region++) {
+                if (regions & (1 << region)) {
+                    for (uint16_t column = h; column <= h + 1; column++) {
+                        const uint16_t c = column % LIGHTBULB_COLOR_TABLE_HUES;
+                        rows_start[region][c] = MIN(rows_start[region][c], s);
+                        rows_end[region][c] = MAX(rows_end[region][c], s + 2);
+                    }
+                }
+            }
+        }
+    }
+    
+    size_t colors_size = 0;
+    for (uint8_t region = 0; region < LIGHTBULB_COLOR_REGIONS; region++) {
+        for (uint16_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUES; h++) {
+            if (rows_end[region][h] > rows_start[region][h]) {
+                colors_size += (rows_end[region][h] - rows_start[region][h]) * LIGHTBULB_CHANNELS * sizeof(uint16_t);
+            }
+        }
+    }
+    
+    color_table = malloc(sizeof(color_table_t) + colors_size);
+    if (!color_table) {
+        return false;
+    }
+    
+    color_table->ch_group = ch_group;
+    color_table->colors = (uint16_t*) (color_table + 1);
+    memcpy(color_table->rows_start, rows_start, sizeof(rows_start));
+    memcpy(color_table->rows_end, rows_end, sizeof(rows_end));
+    memset(color_table->float_cells, 0, sizeof(color_table->float_cells));
+    memcpy(color_table->forms, forms, sizeof(forms));
+    
+    lightbulb_group->color_table = color_table;
+    
+    uint16_t* color = color_table->colors;
+    for (uint8_t region = 0; region < LIGHTBULB_COLOR_REGIONS; region++) {
+        for (uint16_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUES; h++) {
+            color_table->column[region][h] = color - color_table->colors;
+            for (uint8_t s = rows_start[region][h]; s < rows_end[region][h]; s++) {
+                hsi2rgbw_float(h * LIGHTBULB_COLOR_TABLE_HUE_STEP, s * LIGHTBULB_COLOR_TABLE_SAT_STEP, ch_group, lightbulb_gamma_table, region, color);
+                color += LIGHTBULB_CHANNELS;
+            }
+        }
+    }
+    
+    // Cells are checked on a grid from their low hue and low saturation corner. Their high hue side is checked by next cell,
+    // and last saturation row is also checked at its high side. Each point is checked in its region, as hsi2rgbw() does,
+    // and a region found in cell but not in its grid is not checked, so it uses hsi2rgbw_float()
+    uint16_t float_cells = 0;
+    for (uint16_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUES; h++) {
+        for (uint8_t s = 0; s < LIGHTBULB_COLOR_TABLE_SATS - 1; s++) {
+            const uint8_t s_checks = (s == LIGHTBULB_COLOR_TABLE_SATS - 2) ? LIGHTBULB_COLOR_TABLE_SAT_CHECKS + 1 : LIGHTBULB_COLOR_TABLE_SAT_CHECKS;
+            uint8_t checked_regions = 0;
+            uint8_t float_regions = 0;
+            
+            for (uint8_t i = 0; i < LIGHTBULB_COLOR_TABLE_HUE_CHECKS; i++) {
+                const uint16_t h_offset = (LIGHTBULB_COLOR_TABLE_HUE_STEP * i) / LIGHTBULB_COLOR_TABLE_HUE_CHECKS;
+                const uint16_t h_point = (h * LIGHTBULB_COLOR_TABLE_HUE_STEP) + h_offset;
+                
+                for (uint8_t j = 0; j < s_checks; j++) {
+                    const uint32_t s_offset = (LIGHTBULB_COLOR_TABLE_SAT_STEP * 256 * j) / LIGHTBULB_COLOR_TABLE_SAT_CHECKS;
+                    const uint32_t s_fixed = ((s * LIGHTBULB_COLOR_TABLE_SAT_STEP) << 8) + s_offset;
+                    const uint32_t s_weight = s_offset / LIGHTBULB_COLOR_TABLE_SAT_STEP;
+                    const uint8_t region = lightbulb_color_region(forms, h_point, s_fixed);
+                    
+                    checked_regions |= 1 << region;
+                    
+                    // Cell corner is a table color
+                    if ((i == 0 && j == 0) || (float_regions & (1 << region))) {
+                        continue;
+                    }
+                    
+                    if (!lightbulb_color_table_has_cell(color_table, region, h, s)) {
+                        float_regions |= 1 << region;
+                        continue;
+                    }
+                    
+                    uint16_t color_float[5], color_interpolated[5];
+                    hsi2rgbw_float(h_point, s_fixed / 256.f, ch_group, lightbulb_gamma_table, LIGHTBULB_COLOR_REGION_ANY, color_float);
+                    lightbulb_color_table_interpolate(lightbulb_group, region, h, s, (h_offset << 8) / LIGHTBULB_COLOR_TABLE_HUE_STEP, s_weight, color_interpolated);
+                    
+                    for (uint8_t n = 0; n < LIGHTBULB_CHANNELS; n++) {
+                        if (abs(color_float[n] - color_interpolated[n]) > LIGHTBULB_COLOR_TABLE_MAX_ERROR) {
+                            float_regions |= 1 << region;
+                            break;
+                        }
+                    }
+                }
+            }
+            
+            float_regions |= lightbulb_color_cell_regions(forms, h, s) & ~checked_regions;
+            
+            const uint16_t cell = (h * (LIGHTBULB_COLOR_TABLE_SATS - 1)) + s;
+            for (uint8_t region = 0; region < LIGHTBULB_COLOR_REGIONS; region++) {
+                if (float_regions & (1 << region)) {
+                    color_table->float_cells[region][cell >> 3] |= 1 << (cell & 0x07);
+                    float_cells++;
+                }
+            }
+        }
+    }
+    
+    color_table->next = main_config.color_tables;
+    main_config.color_tables = color_table;
+    
+#ifdef LIGHT_DEBUG
+    INFO("Color table runtime: %0.3f ms, %i bytes, float cells %i", ((float) (sdk_system_get_time() - run_time)) * 1e-3, (int) (sizeof(color_table_t) + colors_size), float_cells);
 #endif
+    
+    return true;
+}
+
+// Without color table, because there was no memory to build it, colors are calculated by hsi2rgbw_float()
+void hsi2rgbw(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
+    lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
+    
+    h %= 360;
+    s = MIN(MAX(s, 0), 100);
+    const uint32_t s_fixed = s * 256;
+    
+    const uint16_t h_cell = h / LIGHTBULB_COLOR_TABLE_HUE_STEP;
+    const uint32_t h_weight = ((h % LIGHTBULB_COLOR_TABLE_HUE_STEP) << 8) / LIGHTBULB_COLOR_TABLE_HUE_STEP;
+    
+    const uint8_t s_cell = MIN(s_fixed / (LIGHTBULB_COLOR_TABLE_SAT_STEP << 8), LIGHTBULB_COLOR_TABLE_SATS - 2);
+    const uint32_t s_weight = (s_fixed - (s_cell * (LIGHTBULB_COLOR_TABLE_SAT_STEP << 8))) / LIGHTBULB_COLOR_TABLE_SAT_STEP;
+    
+    const color_table_t* color_table = lightbulb_group->color_table;
+    const uint8_t region = color_table ? lightbulb_color_region(color_table->forms, h, s_fixed) : LIGHTBULB_COLOR_REGION_ANY;
+    
+    uint16_t color[5] = { 0, 0, 0, 0, 0 };
+    if (color_table && lightbulb_color_table_has_cell(color_table, region, h_cell, s_cell)) {
+        lightbulb_color_table_interpolate(lightbulb_group, region, h_cell, s_cell, h_weight, s_weight, color);
+    } else {
+        hsi2rgbw_float(h, s, ch_group, lightbulb_gamma_table, LIGHTBULB_COLOR_REGION_ANY, color);
+    }
+    
+    const uint32_t brightness = lightbulb_brightness(lightbulb_group, v);
+    for (uint8_t n = 0; n < 5; n++) {
+        lightbulb_group->target[n] = ((uint32_t) color[n]) * brightness / PWM_SCALE;
+    }
 }
+// --- LIGHTBULB SET
 /*
 void hsi2white(uint16_t h, float s, uint8_t v, ch_group_t* ch_group) {
     lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
@@ -3041,41 +3990,53 @@ void IRAM rgbw_set_timer_worker() {
             lightbulb_group = lightbulb_group->next;
         }
         
+        // PWM schedule is built once for all channels changed in this step
+        adv_pwm_commit();
+        
+        // Strips keep their frame, so only changed ranges are written, and only up to last changed range is sent
         addressled_t* addressled = main_config.addressleds;
         while (addressled) {
-            uint8_t* colors = malloc(addressled->max_range);
-            memset(colors, 0, addressled->max_range);
-            if (colors) {
-                bool has_changed = false;
-                
-                lightbulb_group = main_config.lightbulb_groups;
-                while (lightbulb_group) {
-                    if (LIGHTBULB_TYPE == LIGHTBULB_TYPE_NRZ && lightbulb_group->gpio[0] == addressled->gpio) {
-                        if (lightbulb_group->has_changed) {
-                            has_changed = true;
-                        }
-                        
-                        for (uint16_t p = LIGHTBULB_RANGE_START; p < LIGHTBULB_RANGE_END; p = p + LIGHTBULB_CHANNELS) {
-                            for (uint8_t i = 0; i < LIGHTBULB_CHANNELS; i++) {
-                                uint8_t color = lightbulb_group->current[addressled->map[i]] >> 8;
-                                memcpy(colors + p + i, &color, 1);
-                            }
-                        }
+            if (!addressled->colors) {
+                addressled->colors = calloc(1, addressled->max_range);
+                if (!addressled->colors) {
+                    homekit_remove_oldest_client();
+                    break;
+                }
+            }
+            
+            uint16_t dirty_end = addressled->pending_end;
+            
+            lightbulb_group = main_config.lightbulb_groups;
+            while (lightbulb_group) {
+                if (LIGHTBULB_TYPE == LIGHTBULB_TYPE_NRZ && lightbulb_group->has_changed && lightbulb_group->gpio[0] == addressled->gpio && LIGHTBULB_RANGE_END > LIGHTBULB_RANGE_START) {
+                    uint8_t* range = addressled->colors + LIGHTBULB_RANGE_START;
+                    for (uint8_t i = 0; i < LIGHTBULB_CHANNELS; i++) {
+                        range[i] = lightbulb_group->current[addressled->map[i]] >> 8;
                     }
                     
-                    lightbulb_group = lightbulb_group->next;
+                    // First LED is copied doubling block size each time
+                    const uint16_t range_size = LIGHTBULB_RANGE_END - LIGHTBULB_RANGE_START;
+                    uint16_t done = LIGHTBULB_CHANNELS;
+                    while (done < range_size) {
+                        const uint16_t block = MIN(done, range_size - done);
+                        memcpy(range + done, range, block);
+                        done += block;
+                    }
+                    
+                    if (LIGHTBULB_RANGE_END > dirty_end) {
+                        dirty_end = LIGHTBULB_RANGE_END;
+                    }
                 }
                 
-                if (has_changed) {
-                    taskENTER_CRITICAL();
-                    nrzled_set(addressled->gpio, addressled->time_0, addressled->time_1, addressled->period, colors, addressled->max_range);
-                    taskEXIT_CRITICAL();
+                lightbulb_group = lightbulb_group->next;
+            }
+            
+            if (dirty_end > 0) {
+                addressled->pending_end = 0;
+                if (!nrzled_set_blocks(addressled->gpio, addressled->time_0, addressled->time_1, addressled->period, addressled->colors, dirty_end, addressled->critical_fallback, &addressled->failed_frames)) {
+                    addressled->pending_end = dirty_end;
+                    all_channels_ready = false;
                 }
-                
-                free(colors);
-            } else {
-                homekit_remove_oldest_client();
-                break;
             }
             
             addressled = addressled->next;
@@ -3137,21 +4098,22 @@ void lightbulb_task(void* args) {
                 target_color = PWM_SCALE * (((0.09 + sqrt(0.18 + (0.1352 * (ch_group->ch[2]->value.int_value - COLOR_TEMP_MIN - 1)))) / 0.0676) - 1) / 100;
             }
             
+            const uint32_t brightness = lightbulb_brightness(lightbulb_group, ch_group->ch[1]->value.int_value);
+            
             if (LIGHTBULB_TYPE == LIGHTBULB_TYPE_PWM_CWWW) {
-                const uint32_t w = PWM_SCALE * ch_group->ch[1]->value.int_value / 100;
-                lightbulb_group->target[0] = MIN(LIGHTBULB_MAX_POWER * w, PWM_SCALE);
+                lightbulb_group->target[0] = MIN(LIGHTBULB_MAX_POWER * brightness, PWM_SCALE);
                 lightbulb_group->target[1] = target_color;
                 
             } else {
-                const uint32_t cw = lightbulb_group->flux[0] * target_color * ch_group->ch[1]->value.int_value / 100;
-                const uint32_t ww = lightbulb_group->flux[1] * (PWM_SCALE - target_color) * ch_group->ch[1]->value.int_value / 100;
+                const uint32_t cw = lightbulb_group->flux[0] * target_color * brightness / PWM_SCALE;
+                const uint32_t ww = lightbulb_group->flux[1] * (PWM_SCALE - target_color) * brightness / PWM_SCALE;
                 lightbulb_group->target[0] = MIN(LIGHTBULB_MAX_POWER * cw, PWM_SCALE);
                 lightbulb_group->target[1] = MIN(LIGHTBULB_MAX_POWER * ww, PWM_SCALE);
             }
             
         } else {
             // Channels 1
-            const uint32_t w = PWM_SCALE * ch_group->ch[1]->value.int_value / 100;
+            const uint32_t w = lightbulb_brightness(lightbulb_group, ch_group->ch[1]->value.int_value);
             lightbulb_group->target[0] = MIN(LIGHTBULB_MAX_POWER * w, PWM_SCALE);
         }
     } else {
@@ -3884,8 +4846,8 @@ void hkc_fan_status_setter(homekit_characteristic_t* ch0, const homekit_value_t
 }
 
 // --- LIGHT SENSOR
-void light_sensor_task(void* args) {
-    ch_group_t* ch_group = (ch_group_t*) args;
+bool light_sensor_read(sensor_job_t* sensor_job) {
+    ch_group_t* ch_group = sensor_job->ch_group;
     
     float luxes = 0.0001f;
     
@@ -3905,14 +4867,17 @@ void light_sensor_task(void* args) {
         
     } else if (light_sersor_type == 2) {  // BH1750
         uint8_t value[2] = { 0, 0 };
-        i2c_slave_read(LIGHT_SENSOR_I2C_BUS, LIGHT_SENSOR_I2C_ADDR, NULL, 0, value, 2);
+        if (i2c_slave_read(LIGHT_SENSOR_I2C_BUS, LIGHT_SENSOR_I2C_ADDR, NULL, 0, value, 2) != 0) {
+            ERROR("<%i> Light sensor", ch_group->accessory);
+            return false;
+        }
         
         uint16_t final_value = value[0] << 8 | value[1];
         
         luxes = final_value / 1.2f;
     }
     
-    luxes = (luxes * LIGHT_SENSOR_FACTOR) + LIGHT_SENSOR_OFFSET;
+    luxes = sensor_filter(sensor_job, 0, (luxes * LIGHT_SENSOR_FACTOR) + LIGHT_SENSOR_OFFSET);
     INFO("<%i> Luxes %g", ch_group->accessory, luxes);
     
     if (luxes < 0.0001f) {
@@ -3924,21 +4889,10 @@ void light_sensor_task(void* args) {
     if ((uint32_t) ch_group->ch[0]->value.float_value != (uint32_t) luxes) {
         do_wildcard_actions(ch_group, 0, luxes);
         ch_group->ch[0]->value.float_value = luxes;
-        homekit_characteristic_notify_safe(ch_group->ch[0]);
+        homekit_characteristic_notify_policy(ch_group, 0, false);
     }
     
-    vTaskDelete(NULL);
-}
-
-void light_sensor_timer_worker(TimerHandle_t xTimer) {
-    if (!homekit_is_pairing()) {
-        if (xTaskCreate(light_sensor_task, "lux", LIGHT_SENSOR_TASK_SIZE, (void*) pvTimerGetTimerID(xTimer), LIGHT_SENSOR_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("Creating light_sensor");
-            homekit_remove_oldest_client();
-        }
-    } else {
-        ERROR("light_sensor_task: HK pairing");
-    }
+    return true;
 }
 
 // --- SECURITY SYSTEM
@@ -4342,804 +5296,1431 @@ void hkc_autooff_setter_task(TimerHandle_t xTimer) {
     }
 }
 
-// --- Network Action task
-void net_action_task(void* pvParameters) {
-    action_task_t* action_task = pvParameters;
-    action_network_t* action_network = action_task->ch_group->action_network;
-    
-    uint8_t errors = 0;
+// --- Network Action client
+int net_resolve(char* host, const uint16_t port_n, struct sockaddr_in* addr) {
+    const uint32_t now = xTaskGetTickCount();
+    net_dns_cache_t* slot = NULL;
     
-    while (action_network) {
-        if (action_network->action == action_task->action && !action_network->is_running) {
-            action_network->is_running = true;
-            
-            while (main_config.network_is_busy) {
-                vTaskDelay(MS_TO_TICKS(50));
+    for (uint8_t i = 0; i < NETWORK_DNS_CACHE_SIZE; i++) {
+        net_dns_cache_t* dns = &main_config.net_dns_cache[i];
+        
+        if (dns->host && strcmp(dns->host, host) == 0) {
+            if ((now - dns->time) < MS_TO_TICKS(NETWORK_DNS_CACHE_TTL_MS)) {
+                memcpy(addr, &dns->addr, sizeof(*addr));
+                addr->sin_port = htons(port_n);
+                return 0;
             }
             
-            main_config.network_is_busy = true;
-
-            INFO("<%i> Network Action %s:%i", action_task->ch_group->accessory, action_network->host, action_network->port_n);
-            
-            struct addrinfo* res;
-            
-            char port[6];
-            memset(port, 0, 6);
-            itoa(action_network->port_n, port, 10);
+            slot = dns;
+            break;
+        }
+        
+        if (!slot || (slot->host && (!dns->host || (now - dns->time) > (now - slot->time)))) {
+            slot = dns;
+        }
+    }
+    
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    
+    struct addrinfo* res;
+    
+    int getaddr_result = getaddrinfo(host, NULL, &hints, &res);
+    if (getaddr_result == 0) {
+        if (res->ai_family == AF_INET && res->ai_addrlen >= sizeof(*addr)) {
+            memcpy(&slot->addr, res->ai_addr, sizeof(*addr));
+            slot->host = host;
+            slot->time = now;
             
-            if (action_network->method_n < 10) {
-                const struct addrinfo hints = {
-                    .ai_family = AF_UNSPEC,
-                    .ai_socktype = SOCK_STREAM,
-                };
-                
-                int getaddr_result = getaddrinfo(action_network->host, port, &hints, &res);
-                if (getaddr_result == 0) {
-                    int s = socket(res->ai_family, res->ai_socktype, 0);
-                    if (s >= 0) {
-                        const struct timeval sndtimeout = { 3, 0 };
-                        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sndtimeout, sizeof(sndtimeout));
-                        const struct timeval rcvtimeout = { 1, 0 };
-                        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout));
+            memcpy(addr, &slot->addr, sizeof(*addr));
+            addr->sin_port = htons(port_n);
+        } else {
+            getaddr_result = -1;
+        }
+        
+        freeaddrinfo(res);
+    }
+    
+    return getaddr_result;
+}
 
-                        int connect_result = connect(s, res->ai_addr, res->ai_addrlen);
-                        if (connect_result == 0) {
-                            uint16_t content_len_n = 0;
-                            str_ch_value_t* str_ch_value_first = NULL;
-                            
-                            char* method = strdup("GET");
-                            char* method_req = NULL;
-                            if (action_network->method_n == 1 ||
-                                action_network->method_n == 2 ||
-                                action_network->method_n == 3) {
-                                content_len_n = strlen(action_network->content);
-                                
-                                char* content_search = action_network->content;
-                                str_ch_value_t* str_ch_value_last = NULL;
-                                
-                                do {
-                                    content_search = strstr(content_search, NETWORK_ACTION_WILDCARD_VALUE);
-                                    if (content_search) {
-                                        char buffer[15];
-                                        buffer[2] = 0;
-                                        
-                                        buffer[0] = content_search[5];
-                                        buffer[1] = content_search[6];
-                                        
-                                        uint8_t acc_number = (uint8_t) strtol(buffer, NULL, 10);
-                                        
-                                        ch_group_t* ch_group_found = action_task->ch_group;
-                                        
-                                        if (acc_number > 0) {
-                                            ch_group_found = ch_group_find_by_acc(acc_number);
-                                        }
-                                        
-                                        buffer[0] = content_search[7];
-                                        buffer[1] = content_search[8];
-
-                                        homekit_value_t* value;
-                                        
-                                        switch ((uint8_t) strtol(buffer, NULL, 10)) {
-                                            case 1:
-                                                value = &ch_group_found->ch[1]->value;
-                                                break;
-                                                
-                                            case 2:
-                                                value = &ch_group_found->ch[2]->value;
-                                                break;
-                                                
-                                            case 3:
-                                                value = &ch_group_found->ch[3]->value;
-                                                break;
-                                                
-                                            case 4:
-                                                value = &ch_group_found->ch[4]->value;
-                                                break;
-                                                
-                                            case 5:
-                                                value = &ch_group_found->ch[5]->value;
-                                                break;
-                                                
-                                            case 6:
-                                                value = &ch_group_found->ch[6]->value;
-                                                break;
-                                                
-                                            default:    // case 0:
-                                                value = &ch_group_found->ch[0]->value;
-                                                break;
-                                        }
-                                        
-                                        switch (value->format) {
-                                            case HOMETKIT_FORMAT_BOOL:
-                                                snprintf(buffer, 15, "%s", value->bool_value ? "true" : "false");
-                                                break;
-                                                
-                                            case HOMETKIT_FORMAT_UINT8:
-                                            case HOMETKIT_FORMAT_UINT16:
-                                            case HOMETKIT_FORMAT_UINT32:
-                                            case HOMETKIT_FORMAT_UINT64:
-                                            case HOMETKIT_FORMAT_INT:
-                                                snprintf(buffer, 15, "%i", value->int_value);
-                                                break;
-
-                                            case HOMETKIT_FORMAT_FLOAT:
-                                                snprintf(buffer, 15, "%1.7g", value->float_value);
-                                                break;
-                                                
-                                            default:
-                                                buffer[0] = 0;
-                                                break;
-                                        }
-                                        
-                                        content_len_n += strlen(buffer) - 9;
-                                        
-                                        str_ch_value_t* str_ch_value = malloc(sizeof(str_ch_value_t));
-                                        memset(str_ch_value, 0, sizeof(*str_ch_value));
-                                        
-                                        str_ch_value->string = strdup(buffer);
-                                        str_ch_value->next = NULL;
-                                        INFO("Wildcard val %s", str_ch_value->string);
-                                        
-                                        if (str_ch_value_first == NULL) {
-                                            str_ch_value_first = str_ch_value;
-                                            str_ch_value_last = str_ch_value;
-                                        } else {
-                                            str_ch_value_last->next = str_ch_value;
-                                            str_ch_value_last = str_ch_value;
-                                        }
-
-                                        content_search += 9;
-                                    }
-                                    
-                                } while (content_search);
+void net_dns_forget(char* host) {
+    for (uint8_t i = 0; i < NETWORK_DNS_CACHE_SIZE; i++) {
+        if (main_config.net_dns_cache[i].host && strcmp(main_config.net_dns_cache[i].host, host) == 0) {
+            main_config.net_dns_cache[i].host = NULL;
+        }
+    }
+}
 
-                                char content_len[4];
-                                itoa(content_len_n, content_len, 10);
-                                method_req = malloc(23);
-                                snprintf(method_req, 23, "Content-length: %s\r\n", content_len);
-                                
-                                free(method);
-                                if (action_network->method_n == 1) {
-                                    method = strdup("PUT");
-                                } else {
-                                    method = strdup("POST");
-                                }
-                            }
-                            
-                            char* req = NULL;
-                            
-                            if (action_network->method_n == 3) {    // TCP RAW
-                                req = action_network->content;
-                                
-                            } else if (action_network->method_n != 4) {     // HTTP
-                                action_network->len = 69 + strlen(method) + ((method_req != NULL) ? strlen(method_req) : 0) + strlen(FIRMWARE_VERSION) + strlen(action_network->host) +  strlen(action_network->url) + strlen(action_network->header) + content_len_n;
-                                
-                                req = malloc(action_network->len);
-                                if (!req) {
-                                    lwip_close(s);
-                                    action_network->is_running = false;
-                                    main_config.network_is_busy = false;
-                                    
-                                    if (method_req) {
-                                        free(method_req);
-                                    }
-                                    
-                                    free(method);
-                                    freeaddrinfo(res);
-                                    
-                                    homekit_remove_oldest_client();
-                                    errors++;
-                                    
-                                    if (errors < 5) {
-                                        vTaskDelay(MS_TO_TICKS(200));
-                                        continue;
-                                    } else {
-                                        break;
-                                    }
-                                }
-                                
-                                snprintf(req, action_network->len, "%s /%s HTTP/1.1\r\nHost: %s\r\nUser-Agent: HAA/"FIRMWARE_VERSION" esp8266\r\nConnection: close\r\n%s%s\r\n",
-                                         method,
-                                         action_network->url,
-                                         action_network->host,
-                                         action_network->header,
-                                         (method_req != NULL) ? method_req : "");
-                                free(method);
-                                
-                                if (str_ch_value_first) {
-                                    str_ch_value_t* str_ch_value = str_ch_value_first;
-                                    char* content_search = action_network->content;
-                                    char* last_pos = action_network->content;
-                                    
-                                    do {
-                                        content_search = strstr(last_pos, NETWORK_ACTION_WILDCARD_VALUE);
-                                        
-                                        if (content_search - last_pos > 0) {
-                                            strncat(req, last_pos, content_search - last_pos);
-                                        }
-                                        
-                                        strcat(req, str_ch_value->string);
-                                        
-                                        free(str_ch_value->string);
-
-                                        str_ch_value_t* str_ch_value_old = str_ch_value;
-                                        str_ch_value = str_ch_value->next;
-                                        
-                                        free(str_ch_value_old);
-
-                                        last_pos = content_search + 9;
-                                        
-                                    } while (str_ch_value);
-                                    
-                                    strcat(req, last_pos);
-                                    
-                                } else {
-                                    strcat(req, action_network->content);
-                                }
-                                
-                            }
-                            
-                            int result = -1;
-                            if (action_network->method_n == 4) {
-                                result = write(s, action_network->raw, action_network->len);
-                            } else {
-                                result = write(s, req, action_network->len);
-                            }
+int net_tcp_open(char* host, const uint16_t port_n) {
+    struct sockaddr_in addr;
+    
+    int result = net_resolve(host, port_n, &addr);
+    if (result != 0) {
+        ERROR("DNS %s (%i)", host, result);
+        return -1;
+    }
+    
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) {
+        ERROR("Socket (%i)", s);
+        return -1;
+    }
+    
+    const struct timeval sndtimeout = { 3, 0 };
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sndtimeout, sizeof(sndtimeout));
+    const struct timeval rcvtimeout = { 1, 0 };
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &rcvtimeout, sizeof(rcvtimeout));
+    
+    result = connect(s, (struct sockaddr*) &addr, sizeof(addr));
+    if (result != 0) {
+        ERROR("Connection %s:%i (%i)", host, port_n, result);
+        lwip_close(s);
+        net_dns_forget(host);
+        return -1;
+    }
+    
+    return s;
+}
 
-                            if (result >= 0) {
-                                if (action_network->method_n == 4) {
-                                    INFO("<%i> Payload RAW", action_task->ch_group->accessory);
-                                } else {
-                                    INFO("<%i> Payload:\n%s", action_task->ch_group->accessory, req);
-                                }
-                                
-                                if (action_network->wait_response) {
-                                    INFO("<%i> TCP Response:", action_task->ch_group->accessory);
-                                    int read_byte;
-                                    uint16_t total_recv = 0;
-                                    do {
-                                        uint8_t recv_buffer[64];
-                                        memset(recv_buffer, 0, 64);
-                                        read_byte = lwip_read(s, recv_buffer, 64);
-                                        printf("%s", recv_buffer);
-                                        recv_buffer[0] = 0;
-                                        total_recv += 64;
-                                    } while (read_byte > 0 && total_recv < 2048);
-                                    
-                                    INFO("Error: %i", read_byte);
-                                }
-                                
-                            } else {
-                                ERROR("<%i> TCP (%i)", action_task->ch_group->accessory, result);
-                            }
-                            
-                            if (method_req) {
-                                free(method_req);
-                            }
-                            
-                            if (req && action_network->method_n != 3) {
-                                free(req);
-                            }
+void net_pool_close(net_pool_conn_t* conn) {
+    lwip_close(conn->socket);
+    conn->host = NULL;
+}
 
-                        } else {
-                            ERROR("<%i> Connection (%i)", action_task->ch_group->accessory, connect_result);
-                        }
-                    } else {
-                        ERROR("<%i> Socket (%i)", action_task->ch_group->accessory, s);
-                    }
-                    
-                    lwip_close(s);
-                } else {
-                    ERROR("<%i> DNS (%i)", action_task->ch_group->accessory, getaddr_result);
-                }
+// Responses are read to their end after every request, so pending data is not expected and it is dropped.
+// False if server closed connection
+bool net_pool_is_alive(const int s) {
+    uint8_t recv_buffer[64];
+    int read_byte;
+    
+    while ((read_byte = lwip_recv(s, recv_buffer, 64, MSG_DONTWAIT)) > 0);
+    
+    return read_byte < 0 && (errno == EWOULDBLOCK || errno == EAGAIN);
+}
 
-            } else {
-                const struct addrinfo hints = {
-                    .ai_family = AF_UNSPEC,
-                    .ai_socktype = SOCK_DGRAM,
-                };
-                
-                int getaddr_result = getaddrinfo(action_network->host, port, &hints, &res);
-                if (getaddr_result == 0) {
-                    int s = socket(res->ai_family, res->ai_socktype, 0);
-                    if (s >= 0) {
-                        const struct timeval sndtimeout = { 3, 0 };
-                        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sndtimeout, sizeof(sndtimeout));
-                        
-                        uint8_t* wol = NULL;
-                        if (action_network->method_n == 12) {
-                            wol = malloc(102);
-                            for (uint8_t i = 0; i < 6; i++) {
-                                wol[i] = 255;
-                            }
-                            
-                            for (uint8_t i = 6; i < 102; i += 6) {
-                                for (uint8_t j = 0; j < 6; j++) {
-                                    wol[i + j] = action_network->raw[j];
-                                }
-                            }
-                        }
-                        
-                        int result = -1;
-                        if (action_network->method_n == 13) {
-                            result = lwip_sendto(s, action_network->content, action_network->len, 0, res->ai_addr, res->ai_addrlen);
-                        } else {
-                            uint8_t wol_attemps = 1;
-                            if (wol) {
-                                wol_attemps = 5;
-                            }
-                            
-                            for (uint8_t udp_sent = 0; udp_sent < wol_attemps; udp_sent++) {
-                                result = lwip_sendto(s, wol ? wol : action_network->raw, wol ? 102 : action_network->len, 0, res->ai_addr, res->ai_addrlen);
-                                if (wol) {
-                                    vTaskDelay(MS_TO_TICKS(10));
-                                }
-                            }
-                        }
-                        
-                        if (result > 0) {
-                            if (action_network->method_n == 13) {
-                                INFO("<%i> Payload:\n%s", action_task->ch_group->accessory, action_network->content);
-                            } else {
-                                INFO("<%i> Payload RAW", action_task->ch_group->accessory);
-                            }
-                            
-                        } else {
-                            ERROR("<%i> UDP", action_task->ch_group->accessory);
-                        }
-                        
-                        if (wol) {
-                            free(wol);
-                        }
-                    } else {
-                        ERROR("<%i> Socket (%i)", action_task->ch_group->accessory, s);
-                    }
-                
-                    lwip_close(s);
-                
-                } else {
-                    ERROR("<%i> DNS (%i)", action_task->ch_group->accessory, getaddr_result);
-                }
+void net_pool_timer_worker(TimerHandle_t xTimer) {
+    if (xSemaphoreTake(main_config.network_mutex, 0) == pdTRUE) {
+        const uint32_t now = xTaskGetTickCount();
+        
+        for (uint8_t i = 0; i < NETWORK_POOL_SIZE; i++) {
+            net_pool_conn_t* conn = &main_config.net_pool[i];
+            if (conn->host && (now - conn->time) >= MS_TO_TICKS(NETWORK_POOL_IDLE_MS)) {
+                INFO("Network pool close %s:%i (%i)", conn->host, conn->port_n, conn->requests);
+                net_pool_close(conn);
+            }
+        }
+        
+        xSemaphoreGive(main_config.network_mutex);
+    }
+}
+
+net_pool_conn_t* net_pool_open(char* host, const uint16_t port_n) {
+    const uint32_t now = xTaskGetTickCount();
+    net_pool_conn_t* slot = NULL;
+    
+    for (uint8_t i = 0; i < NETWORK_POOL_SIZE; i++) {
+        net_pool_conn_t* conn = &main_config.net_pool[i];
+        
+        if (conn->host && conn->port_n == port_n && strcmp(conn->host, host) == 0) {
+            if ((now - conn->time) < MS_TO_TICKS(NETWORK_POOL_IDLE_MS) && net_pool_is_alive(conn->socket)) {
+                return conn;
             }
             
-            freeaddrinfo(res);
-            
-            action_network->is_running = false;
-            main_config.network_is_busy = false;
-            
-            INFO("<%i> Network Action %s:%i done", action_task->ch_group->accessory, action_network->host, action_network->port_n);
+            net_pool_close(conn);
+            slot = conn;
+            break;
+        }
+        
+        if (!slot || (slot->host && (!conn->host || (now - conn->time) > (now - slot->time)))) {
+            slot = conn;
+        }
+    }
+    
+    if (slot->host) {
+        net_pool_close(slot);
+    }
+    
+    const int s = net_tcp_open(host, port_n);
+    if (s < 0) {
+        return NULL;
+    }
+    
+    slot->host = host;
+    slot->port_n = port_n;
+    slot->requests = 0;
+    slot->socket = s;
+    slot->time = now;
+    
+    if (!main_config.net_pool_timer) {
+        main_config.net_pool_timer = esp_timer_create(NETWORK_POOL_IDLE_MS, true, NULL, net_pool_timer_worker);
+        esp_timer_start(main_config.net_pool_timer);
+    }
+    
+    return slot;
+}
+
+// Returns next byte of response, or -1 if connection was closed or timed out
+int net_reader_byte(net_reader_t* reader) {
+    if (reader->pos == reader->len) {
+        const int read_byte = lwip_read(reader->socket, reader->buffer, sizeof(reader->buffer));
+        if (read_byte <= 0) {
+            return -1;
+        }
+        
+        reader->len = read_byte;
+        reader->pos = 0;
+    }
+    
+    return reader->buffer[reader->pos++];
+}
+
+// Reads a line without its CRLF. Returns false if connection ended before line end
+bool net_reader_line(net_reader_t* reader, char* line) {
+    uint8_t len = 0;
+    int c;
+    while ((c = net_reader_byte(reader)) >= 0) {
+        if (c == '\n') {
+            if (len > 0 && line[len - 1] == '\r') {
+                len--;
+            }
             
-            vTaskDelay(MS_TO_TICKS(20));
+            line[len] = 0;
+            return true;
         }
         
-        action_network = action_network->next;
+        if (len < NETWORK_RESPONSE_LINE_SIZE - 1) {
+            line[len] = c;
+            len++;
+        }
     }
+    
+    return false;
+}
 
-    free(pvParameters);
-    vTaskDelete(NULL);
+// Reads body data, printing it until print limit is reached
+bool net_reader_body(net_reader_t* reader, uint32_t len) {
+    while (len > 0) {
+        const int c = net_reader_byte(reader);
+        if (c < 0) {
+            return false;
+        }
+        
+        if (reader->printed < NETWORK_RESPONSE_PRINT_MAX) {
+            putchar(c);
+            reader->printed++;
+        }
+        
+        len--;
+    }
+    
+    return true;
 }
 
-// --- IR Send task
-void ir_tx_task(void* pvParameters) {
-    action_task_t* action_task = pvParameters;
-    action_ir_tx_t* action_ir_tx = action_task->ch_group->action_ir_tx;
+// Reads a whole HTTP response, so a pooled connection is left ready for next request without waiting for timeouts.
+// Returns false if connection cannot be reused: it was closed, or response has no known length or is too long
+bool net_http_response_read(const int s, const bool is_printed) {
+    // Body is printed only until print limit
+    net_reader_t reader = { .socket = s, .printed = is_printed ? 0 : NETWORK_RESPONSE_PRINT_MAX };
+    char line[NETWORK_RESPONSE_LINE_SIZE];
     
-    uint8_t errors = 0;
+    int status;
+    int32_t content_length;
+    bool is_chunked;
+    bool keep_alive;
     
-    while (action_ir_tx) {
-        if (action_ir_tx->action == action_task->action) {
-            uint16_t* ir_code = NULL;
-            uint16_t ir_code_len = 0;
+    // Interim 1xx responses are followed by final one
+    do {
+        if (!net_reader_line(&reader, line) || strncmp(line, "HTTP/1.", 7) != 0) {
+            return false;
+        }
+        
+        if (is_printed) {
+            printf("%s\n", line);
+        }
+        
+        const char* status_code = strchr(line, ' ');
+        status = status_code ? atoi(status_code + 1) : 0;
+        content_length = -1;
+        is_chunked = false;
+        keep_alive = line[7] == '1';    // HTTP/1.0 closes by default
+        
+        for (;;) {
+            if (!net_reader_line(&reader, line)) {
+                return false;
+            }
             
-            uint8_t freq = main_config.ir_tx_freq;
-            if (action_ir_tx->freq > 0) {
-                freq = action_ir_tx->freq;
+            if (!line[0]) {
+                break;
             }
             
-            // Decoding protocol based IR code
-            if (action_ir_tx->prot_code) {
-                char* prot = NULL;
-                
-                if (action_ir_tx->prot) {
-                    prot = action_ir_tx->prot;
-                } else if (action_task->ch_group->ir_protocol) {
-                    prot = action_task->ch_group->ir_protocol;
-                } else {
-                    prot = ch_group_find_by_acc(ACC_TYPE_ROOT_DEVICE)->ir_protocol;
-                }
+            if (is_printed) {
+                printf("%s\n", line);
+            }
+            
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                content_length = atoi(line + 15);
+            } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                is_chunked = strstr(line + 18, "chunked") != NULL;
+            } else if (strncasecmp(line, "Connection:", 11) == 0) {
+                keep_alive = strstr(line + 11, "close") == NULL && strstr(line + 11, "Close") == NULL;
+            }
+        }
+    } while (status >= 100 && status < 200);
+    
+    if (status == 204 || status == 304) {
+        // No body
+        
+    } else if (is_chunked) {
+        uint32_t total_len = 0;
+        for (;;) {
+            if (!net_reader_line(&reader, line)) {
+                return false;
+            }
+            
+            const uint32_t chunk_len = strtoul(line, NULL, 16);
+            if (chunk_len == 0) {
+                break;
+            }
+            
+            total_len += chunk_len;
+            if (total_len > NETWORK_RESPONSE_MAX ||
+                !net_reader_body(&reader, chunk_len) ||
+                !net_reader_line(&reader, line)) {
+                return false;
+            }
+        }
+        
+        // Trailer, until empty line
+        do {
+            if (!net_reader_line(&reader, line)) {
+                return false;
+            }
+        } while (line[0]);
+        
+    } else if (content_length >= 0) {
+        if (content_length > NETWORK_RESPONSE_MAX || !net_reader_body(&reader, content_length)) {
+            return false;
+        }
+        
+    } else {
+        // Body ends when server closes connection
+        net_reader_body(&reader, NETWORK_RESPONSE_MAX);
+        return false;
+    }
+    
+    // Any data after response does not belong to a request, so connection is not reused
+    return keep_alive && reader.pos == reader.len;
+}
+
+// --- Network templates
+void net_template_free(net_template_t* template) {
+    free(template->text);
+    free(template->wildcards);
+    template->text = NULL;
+    template->wildcards = NULL;
+}
+
+// Splits template in literal text and wildcards, so payloads are rendered without searching and allocations.
+// Returns false if there is no memory or template has more than UINT8_MAX wildcards
+bool net_template_compile(net_template_t* template, const char* string) {
+    const uint16_t string_len = strlen(string);
+    const uint8_t wildcard_len = strlen(NETWORK_ACTION_WILDCARD_VALUE) + 4;
+    
+    template->text = NULL;
+    template->len = 0;
+    template->wildcards_n = 0;
+    template->wildcards = NULL;
+    
+    uint16_t wildcards_n = 0;
+    const char* content_search = string;
+    while ((content_search = strstr(content_search, NETWORK_ACTION_WILDCARD_VALUE)) &&
+           (content_search - string) + wildcard_len <= string_len) {
+        wildcards_n++;
+        content_search += wildcard_len;
+    }
+    
+    if (wildcards_n > UINT8_MAX) {
+        return false;
+    }
+    
+    template->text = malloc(string_len - (wildcards_n * wildcard_len) + 1);
+    if (!template->text) {
+        return false;
+    }
+    
+    if (wildcards_n > 0) {
+        template->wildcards = malloc(wildcards_n * sizeof(net_wildcard_t));
+        if (!template->wildcards) {
+            net_template_free(template);
+            return false;
+        }
+    }
+    
+    template->wildcards_n = wildcards_n;
+    
+    const char* last_pos = string;
+    for (uint8_t i = 0; i < wildcards_n; i++) {
+        content_search = strstr(last_pos, NETWORK_ACTION_WILDCARD_VALUE);
+        
+        memcpy(template->text + template->len, last_pos, content_search - last_pos);
+        template->len += content_search - last_pos;
+        
+        char buffer[3];
+        buffer[2] = 0;
+        
+        buffer[0] = content_search[5];
+        buffer[1] = content_search[6];
+        template->wildcards[i].acc = (uint8_t) strtol(buffer, NULL, 10);
+        
+        buffer[0] = content_search[7];
+        buffer[1] = content_search[8];
+        template->wildcards[i].ch_n = (uint8_t) strtol(buffer, NULL, 10);
+        
+        template->wildcards[i].pos = template->len;
+        
+        last_pos = content_search + wildcard_len;
+    }
+    
+    strcpy(template->text + template->len, last_pos);
+    template->len += strlen(last_pos);
+    
+    return true;
+}
+
+uint16_t net_template_size(net_template_t* template) {
+    return template->len + (template->wildcards_n * (NETWORK_ACTION_WILDCARD_VALUE_SIZE - 1));
+}
+
+// Buffer must have net_template_size() + 1 bytes. Returns written length
+uint16_t net_template_render(net_template_t* template, ch_group_t* ch_group, char* buffer) {
+    uint16_t len = 0;
+    uint16_t text_pos = 0;
+    
+    for (uint8_t i = 0; i < template->wildcards_n; i++) {
+        net_wildcard_t* wildcard = &template->wildcards[i];
+        
+        memcpy(buffer + len, template->text + text_pos, wildcard->pos - text_pos);
+        len += wildcard->pos - text_pos;
+        text_pos = wildcard->pos;
+        
+        ch_group_t* ch_group_found = ch_group;
+        if (wildcard->acc > 0) {
+            ch_group_found = ch_group_find_by_acc(wildcard->acc);
+        }
+        
+        if (!ch_group_found) {
+            continue;
+        }
+        
+        homekit_value_t* value = &ch_group_found->ch[wildcard->ch_n < ch_group_found->chs ? wildcard->ch_n : 0]->value;
+        
+        int value_len = 0;
+        switch (value->format) {
+            case HOMETKIT_FORMAT_BOOL:
+                value_len = snprintf(buffer + len, NETWORK_ACTION_WILDCARD_VALUE_SIZE, "%s", value->bool_value ? "true" : "false");
+                break;
+                
+            case HOMETKIT_FORMAT_UINT8:
+            case HOMETKIT_FORMAT_UINT16:
+            case HOMETKIT_FORMAT_UINT32:
+            case HOMETKIT_FORMAT_UINT64:
+            case HOMETKIT_FORMAT_INT:
+                value_len = snprintf(buffer + len, NETWORK_ACTION_WILDCARD_VALUE_SIZE, "%i", value->int_value);
+                break;
+
+            case HOMETKIT_FORMAT_FLOAT:
+                value_len = snprintf(buffer + len, NETWORK_ACTION_WILDCARD_VALUE_SIZE, "%1.7g", value->float_value);
+                break;
                 
-                // Decoding protocol based IR code length
-                const uint8_t ir_action_protocol_len = strlen(prot);
-                const uint16_t json_ir_code_len = strlen(action_ir_tx->prot_code);
-                ir_code_len = 3;
+            default:
+                break;
+        }
+        
+        if (value_len > NETWORK_ACTION_WILDCARD_VALUE_SIZE - 1) {
+            value_len = NETWORK_ACTION_WILDCARD_VALUE_SIZE - 1;
+        }
+        
+        len += value_len;
+    }
+    
+    memcpy(buffer + len, template->text + text_pos, template->len - text_pos);
+    len += template->len - text_pos;
+    buffer[len] = 0;
+    
+    return len;
+}
+
+// Largest HTTP head without content
+uint16_t net_head_size(action_network_t* action_network) {
+    return NETWORK_ACTION_HTTP_HEAD_SIZE + strlen(action_network->host) + net_template_size(&action_network->url) + net_template_size(&action_network->header);
+}
+
+// --- Network Action task
+void net_action_task(action_task_t* action_task) {
+    action_network_t* action_network = ACTION_LIST(action_task->ch_group, action_entry_find(action_task->ch_group, action_task->action), action_network);
+    
+    uint8_t errors = 0;
+    
+    while (action_network) {
+        if (action_network->action == action_task->action && !action_network->is_running) {
+            action_network->is_running = true;
+            
+            network_lock();
+
+            INFO("<%i> Network Action %s:%i", action_task->ch_group->accessory, action_network->host, action_network->port_n);
+            
+            if (action_network->method_n < 10) {
+                // HTTP requests use pooled keep-alive connections, raw TCP payloads use their own connection
+                net_pool_conn_t* conn = NULL;
+                int s;
                 
-                printf("<%i> IR Protocol bits: ", action_task->ch_group->accessory);
+                if (action_network->method_n < 3) {
+                    conn = net_pool_open(action_network->host, action_network->port_n);
+                    s = conn ? conn->socket : -1;
+                } else {
+                    s = net_tcp_open(action_network->host, action_network->port_n);
+                }
                 
-                switch (ir_action_protocol_len) {
-                    case IR_ACTION_PROTOCOL_LEN_4BITS:
-                        INFO("4");
-                        for (uint16_t i = 0; i < json_ir_code_len; i++) {
-                            char* found = strchr(baseUC_dic, action_ir_tx->prot_code[i]);
-                            if (found) {
-                                if (found - baseUC_dic < 13) {
-                                    ir_code_len += (1 + found - baseUC_dic) << 1;
-                                } else {
-                                    ir_code_len += (1 - 13 + found - baseUC_dic) << 1;
-                                }
-                            } else {
-                                found = strchr(baseLC_dic, action_ir_tx->prot_code[i]);
-                                if (found - baseLC_dic < 13) {
-                                    ir_code_len += (1 + found - baseLC_dic) << 1;
-                                } else {
-                                    ir_code_len += (1 - 13 + found - baseLC_dic) << 1;
-                                }
-                            }
+                if (s >= 0) {
+                    if (!main_config.net_buffer && action_network->method_n != 4) {
+                        main_config.net_buffer = malloc(main_config.net_buffer_size);
+                    }
+                    
+                    char* req = main_config.net_buffer;
+                    uint16_t req_len = 0;
+                    
+                    if (!req && action_network->method_n != 4) {
+                        if (conn) {
+                            net_pool_close(conn);
+                        } else {
+                            lwip_close(s);
                         }
-                        break;
                         
-                    case IR_ACTION_PROTOCOL_LEN_6BITS:
-                        INFO("6");
-                        for (uint16_t i = 0; i < json_ir_code_len; i++) {
-                            char* found = strchr(baseUC_dic, action_ir_tx->prot_code[i]);
-                            if (found) {
-                                if (found - baseUC_dic < 9) {
-                                    ir_code_len += (1 + found - baseUC_dic) << 1;
-                                } else if (found - baseUC_dic < 18) {
-                                    ir_code_len += (1 - 9 + found - baseUC_dic) << 1;
-                                } else {
-                                    ir_code_len += (1 - 18 + found - baseUC_dic) << 1;
-                                }
-                            } else {
-                                found = strchr(baseLC_dic, action_ir_tx->prot_code[i]);
-                                if (found - baseLC_dic < 9) {
-                                    ir_code_len += (1 + found - baseLC_dic) << 1;
-                                } else if (found - baseLC_dic < 18) {
-                                    ir_code_len += (1 - 9 + found - baseLC_dic) << 1;
-                                } else {
-                                    ir_code_len += (1 - 18 + found - baseLC_dic) << 1;
-                                }
-                            }
+                        action_network->is_running = false;
+                        network_unlock();
+                        
+                        homekit_remove_oldest_client();
+                        errors++;
+                        
+                        if (errors < 5) {
+                            vTaskDelay(MS_TO_TICKS(200));
+                            continue;
+                        } else {
+                            break;
                         }
-                        break;
+                    }
+                    
+                    if (action_network->method_n == 3) {    // TCP RAW
+                        req_len = net_template_render(&action_network->content, action_task->ch_group, req);
                         
-                    default:    // case IR_ACTION_PROTOCOL_LEN_2BITS:
-                        INFO("2");
-                        for (uint16_t i = 0; i < json_ir_code_len; i++) {
-                            char* found = strchr(baseUC_dic, action_ir_tx->prot_code[i]);
-                            if (found) {
-                                ir_code_len += (1 + found - baseUC_dic) << 1;
-                            } else {
-                                found = strchr(baseLC_dic, action_ir_tx->prot_code[i]);
-                                ir_code_len += (1 + found - baseLC_dic) << 1;
-                            }
+                    } else if (action_network->method_n != 4) {     // HTTP
+                        // Content is rendered after room for head, and moved next to head when its length is known
+                        char* content = req + net_head_size(action_network);
+                        const uint16_t content_len = net_template_render(&action_network->content, action_task->ch_group, content);
+                        
+                        char* method = "GET";
+                        if (action_network->method_n == 1) {
+                            method = "PUT";
+                        } else if (action_network->method_n == 2) {
+                            method = "POST";
                         }
-                        break;
-                }
-                
-                ir_code = malloc(sizeof(uint16_t) * ir_code_len);
-                if (!ir_code) {
-                    homekit_remove_oldest_client();
-                    errors++;
+                        
+                        req_len = sprintf(req, "%s /", method);
+                        req_len += net_template_render(&action_network->url, action_task->ch_group, req + req_len);
+                        req_len += sprintf(req + req_len, " HTTP/1.1\r\nHost: %s\r\nUser-Agent: HAA/"FIRMWARE_VERSION" esp8266\r\nConnection: keep-alive\r\n", action_network->host);
+                        req_len += net_template_render(&action_network->header, action_task->ch_group, req + req_len);
+                        
+                        if (action_network->method_n != 0) {
+                            req_len += sprintf(req + req_len, "Content-length: %i\r\n", content_len);
+                        }
+                        
+                        req_len += sprintf(req + req_len, "\r\n");
+                        
+                        memmove(req + req_len, content, content_len);
+                        req_len += content_len;
+                        req[req_len] = 0;
+                    }
                     
-                    if (errors < 5) {
-                        vTaskDelay(MS_TO_TICKS(200));
-                        continue;
+                    int result = -1;
+                    if (action_network->method_n == 4) {
+                        result = write(s, action_network->raw, action_network->len);
                     } else {
-                        break;
+                        result = write(s, req, req_len);
+                        
+                        if (result < 0 && conn && conn->requests > 0) {
+                            // Pooled connection was dropped by server or network
+                            INFO("<%i> Reconnecting", action_task->ch_group->accessory);
+                            net_pool_close(conn);
+                            conn = net_pool_open(action_network->host, action_network->port_n);
+                            if (conn) {
+                                s = conn->socket;
+                                result = write(s, req, req_len);
+                            } else {
+                                s = -1;
+                            }
+                        }
                     }
-                }
-                
-                INFO("<%i> IR Code Len: %i\nIR Protocol: %s", action_task->ch_group->accessory, ir_code_len, prot);
-                
-                uint16_t bit0_mark = 0, bit0_space = 0, bit1_mark = 0, bit1_space = 0;
-                uint16_t bit2_mark = 0, bit2_space = 0, bit3_mark = 0, bit3_space = 0;
-                uint16_t bit4_mark = 0, bit4_space = 0, bit5_mark = 0, bit5_space = 0;
-                uint16_t packet;
-                uint8_t index;
-                
-                for (uint8_t i = 0; i < (ir_action_protocol_len >> 1); i++) {
-                    index = i << 1;     // i * 2
-                    char* found = strchr(baseRaw_dic, prot[index]);
-                    packet = (found - baseRaw_dic) * IR_CODE_LEN * IR_CODE_SCALE;
                     
-                    found = strchr(baseRaw_dic, prot[index + 1]);
-                    packet += (found - baseRaw_dic) * IR_CODE_SCALE;
-
-                    printf("%s%5d ", i & 1 ? "-" : "+", packet);
+                    bool keep_alive = (result >= 0);
                     
-                    switch (i) {
-                        case IR_CODE_HEADER_MARK_POS:
-                            ir_code[0] = packet;
-                            break;
-                            
-                        case IR_CODE_HEADER_SPACE_POS:
-                            ir_code[1] = packet;
-                            break;
-                            
-                        case IR_CODE_BIT0_MARK_POS:
-                            bit0_mark = packet;
-                            break;
-                            
-                        case IR_CODE_BIT0_SPACE_POS:
-                            bit0_space = packet;
-                            break;
-                            
-                        case IR_CODE_BIT1_MARK_POS:
-                            bit1_mark = packet;
-                            break;
+                    if (result >= 0) {
+                        if (action_network->method_n == 4) {
+                            INFO("<%i> Payload RAW", action_task->ch_group->accessory);
+                        } else {
+                            INFO("<%i> Payload:\n%s", action_task->ch_group->accessory, req);
+                        }
+                        
+                        if (conn) {
+                            // HTTP responses are always read until their end, so next request of pooled connection
+                            // does not read this one, and connection does not wait for timeout. Printed only if waited
+                            if (action_network->wait_response) {
+                                INFO("<%i> TCP Response:", action_task->ch_group->accessory);
+                            }
                             
-                        case IR_CODE_BIT1_SPACE_POS:
-                            bit1_space = packet;
-                            break;
+                            keep_alive = net_http_response_read(s, action_network->wait_response);
                             
-                        case IR_CODE_BIT2_MARK_POS:
-                            if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_2BITS) {
-                                ir_code[ir_code_len - 1] = packet;
-                            } else {
-                                bit2_mark = packet;
+                            if (action_network->wait_response) {
+                                printf("\n");
                             }
-                            break;
-                                
-                        case IR_CODE_BIT2_SPACE_POS:
-                            bit2_space = packet;
-                            break;
-                                
-                        case IR_CODE_BIT3_MARK_POS:
-                            bit3_mark = packet;
-                            break;
-                                
-                        case IR_CODE_BIT3_SPACE_POS:
-                            bit3_space = packet;
-                            break;
                             
-                        case IR_CODE_BIT4_MARK_POS:
-                            if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_4BITS) {
-                                ir_code[ir_code_len - 1] = packet;
-                            } else {
-                                bit4_mark = packet;
-                            }
-                            break;
-                                    
-                        case IR_CODE_BIT4_SPACE_POS:
-                            bit4_space = packet;
-                            break;
-                                
-                        case IR_CODE_BIT5_MARK_POS:
-                            bit5_mark = packet;
-                            break;
-                                
-                        case IR_CODE_BIT5_SPACE_POS:
-                            bit5_space = packet;
-                            break;
+                        } else if (action_network->wait_response) {
+                            INFO("<%i> TCP Response:", action_task->ch_group->accessory);
                             
-                        case IR_CODE_FOOTER_MARK_POS_6BITS:
-                            ir_code[ir_code_len - 1] = packet;
-                            break;
+                            int read_byte;
+                            uint16_t total_recv = 0;
+                            do {
+                                uint8_t recv_buffer[64];
+                                read_byte = lwip_read(s, recv_buffer, 63);
+                                if (read_byte > 0) {
+                                    recv_buffer[read_byte] = 0;
+                                    printf("%s", recv_buffer);
+                                    total_recv += read_byte;
+                                }
+                            } while (read_byte > 0 && total_recv < NETWORK_RESPONSE_PRINT_MAX);
                             
-                        default:
-                            // Do nothing
-                            break;
+                            INFO("Error: %i", read_byte);
+                        }
+                        
+                    } else {
+                        ERROR("<%i> TCP (%i)", action_task->ch_group->accessory, result);
                     }
-                }
-                
-                // Decoding BIT code part
-                uint16_t ir_code_index = 2;
-                
-                void fill_code(const uint16_t count, const uint16_t bit_mark, const uint16_t bit_space) {
-                    for (uint16_t j = 0; j < count; j++) {
-                        ir_code[ir_code_index] = bit_mark;
-                        ir_code_index++;
-                        ir_code[ir_code_index] = bit_space;
-                        ir_code_index++;
+                    
+                    if (conn) {
+                        if (keep_alive) {
+                            conn->requests++;
+                            conn->time = xTaskGetTickCount();
+                        } else {
+                            net_pool_close(conn);
+                        }
+                    } else if (s >= 0) {
+                        lwip_close(s);
                     }
+                    
+                } else {
+                    ERROR("<%i> Connection", action_task->ch_group->accessory);
                 }
                 
-                for (uint16_t i = 0; i < json_ir_code_len; i++) {
-                    char* found = strchr(baseUC_dic, action_ir_tx->prot_code[i]);
-                    if (found) {
-                        switch (ir_action_protocol_len) {
-                            case IR_ACTION_PROTOCOL_LEN_4BITS:
-                                if (found - baseUC_dic < 13) {
-                                    fill_code(1 + found - baseUC_dic, bit1_mark, bit1_space);
-                                } else {
-                                    fill_code(found - baseUC_dic - 12, bit3_mark, bit3_space);
-                                }
-                                break;
-                                
-                            case IR_ACTION_PROTOCOL_LEN_6BITS:
-                                if (found - baseUC_dic < 9) {
-                                    fill_code(1 + found - baseUC_dic, bit1_mark, bit1_space);
-                                } else if (found - baseUC_dic < 18) {
-                                    fill_code(found - baseUC_dic - 8, bit3_mark, bit3_space);
-                                } else {
-                                    fill_code(found - baseUC_dic - 17, bit5_mark, bit5_space);
+            } else {
+                struct sockaddr_in addr;
+                
+                int getaddr_result = net_resolve(action_network->host, action_network->port_n, &addr);
+                if (getaddr_result == 0) {
+                    int s = socket(AF_INET, SOCK_DGRAM, 0);
+                    if (s >= 0) {
+                        const struct timeval sndtimeout = { 3, 0 };
+                        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &sndtimeout, sizeof(sndtimeout));
+                        
+                        uint8_t* wol = NULL;
+                        if (action_network->method_n == 12) {
+                            wol = malloc(102);
+                            for (uint8_t i = 0; i < 6; i++) {
+                                wol[i] = 255;
+                            }
+                            
+                            for (uint8_t i = 6; i < 102; i += 6) {
+                                for (uint8_t j = 0; j < 6; j++) {
+                                    wol[i + j] = action_network->raw[j];
                                 }
-                                break;
-                                
-                            default:    // case IR_ACTION_PROTOCOL_LEN_2BITS:
-                                fill_code(1 + found - baseUC_dic, bit1_mark, bit1_space);
-                                break;
+                            }
                         }
                         
-                    } else {
-                        found = strchr(baseLC_dic, action_ir_tx->prot_code[i]);
-                        switch (ir_action_protocol_len) {
-                            case IR_ACTION_PROTOCOL_LEN_4BITS:
-                                if (found - baseLC_dic < 13) {
-                                    fill_code(1 + found - baseLC_dic, bit0_mark, bit0_space);
-                                } else {
-                                    fill_code(found - baseLC_dic - 12, bit2_mark, bit2_space);
-                                }
-                                break;
-                                
-                            case IR_ACTION_PROTOCOL_LEN_6BITS:
-                                if (found - baseLC_dic < 9) {
-                                    fill_code(1 + found - baseLC_dic, bit0_mark, bit0_space);
-                                } else if (found - baseLC_dic < 18) {
-                                    fill_code(found - baseLC_dic - 8, bit2_mark, bit2_space);
-                                } else {
-                                    fill_code(found - baseLC_dic - 17, bit4_mark, bit4_space);
+                        int result = -1;
+                        if (action_network->method_n == 13) {
+                            result = lwip_sendto(s, action_network->content.text, action_network->len, 0, (struct sockaddr*) &addr, sizeof(addr));
+                        } else {
+                            uint8_t wol_attemps = 1;
+                            if (wol) {
+                                wol_attemps = 5;
+                            }
+                            
+                            for (uint8_t udp_sent = 0; udp_sent < wol_attemps; udp_sent++) {
+                                result = lwip_sendto(s, wol ? wol : action_network->raw, wol ? 102 : action_network->len, 0, (struct sockaddr*) &addr, sizeof(addr));
+                                if (wol) {
+                                    vTaskDelay(MS_TO_TICKS(10));
                                 }
-                                break;
-                                
-                            default:    // case IR_ACTION_PROTOCOL_LEN_2BITS:
-                                fill_code(1 + found - baseLC_dic, bit0_mark, bit0_space);
-                                break;
+                            }
                         }
+                        
+                        if (result > 0) {
+                            if (action_network->method_n == 13) {
+                                INFO("<%i> Payload:\n%s", action_task->ch_group->accessory, action_network->content.text);
+                            } else {
+                                INFO("<%i> Payload RAW", action_task->ch_group->accessory);
+                            }
+                            
+                        } else {
+                            ERROR("<%i> UDP", action_task->ch_group->accessory);
+                        }
+                        
+                        if (wol) {
+                            free(wol);
+                        }
+                    } else {
+                        ERROR("<%i> Socket (%i)", action_task->ch_group->accessory, s);
                     }
+                
+                    lwip_close(s);
+                
+                } else {
+                    ERROR("<%i> DNS (%i)", action_task->ch_group->accessory, getaddr_result);
+                }
+            }
+            
+            action_network->is_running = false;
+            network_unlock();
+            
+            INFO("<%i> Network Action %s:%i done", action_task->ch_group->accessory, action_network->host, action_network->port_n);
+            
+            vTaskDelay(MS_TO_TICKS(20));
+        }
+        
+        action_network = action_network->next;
+    }
+}
+
+// --- IR codes
+// Direct lookup of baseRaw_dic positions, instead of searching dictionary for every char
+static uint8_t ir_raw_dic_index[128];
+static bool ir_raw_dic_ready = false;
+
+static inline uint16_t ir_raw_packet(const char* code) {
+    return ((ir_raw_dic_index[code[0] & 0x7F] * IR_CODE_LEN) + ir_raw_dic_index[code[1] & 0x7F]) * IR_CODE_SCALE;
+}
+
+// Position in baseUC_dic or baseLC_dic, or -1 if not valid
+static inline int8_t ir_bit_dic_index(const char c, bool* is_uc) {
+    *is_uc = (c >= 'A' && c <= 'Z');
+    if (*is_uc) {
+        return c - 'A';
+    }
+    
+    if (c >= 'a' && c <= 'z') {
+        return c - 'a';
+    }
+    
+    return -1;
+}
+
+uint16_t* ir_code_decode(action_ir_tx_t* action_ir_tx, ch_group_t* ch_group, uint16_t* ir_code_len) {
+    if (!ir_raw_dic_ready) {
+        for (uint8_t i = 0; i < IR_CODE_LEN; i++) {
+            ir_raw_dic_index[(uint8_t) baseRaw_dic[i]] = i;
+        }
+        ir_raw_dic_ready = true;
+    }
+    
+    uint16_t* ir_code = NULL;
+    
+    // Decoding protocol based IR code
+    if (action_ir_tx->prot_code) {
+        char* prot = NULL;
+        
+        if (action_ir_tx->prot) {
+            prot = action_ir_tx->prot;
+        } else if (ch_group->ir_protocol) {
+            prot = ch_group->ir_protocol;
+        } else {
+            prot = ch_group_find_by_acc(ACC_TYPE_ROOT_DEVICE)->ir_protocol;
+        }
+        
+        const uint8_t ir_action_protocol_len = strlen(prot);
+        const uint16_t json_ir_code_len = strlen(action_ir_tx->prot_code);
+        
+        // Each char of code is a run of 1 to group_size equal bits, and bits are grouped in pairs (0,1), (2,3) and (4,5)
+        uint8_t groups = 1;
+        if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_4BITS) {
+            groups = 2;
+        } else if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_6BITS) {
+            groups = 3;
+        }
+        const uint8_t group_size = (strlen(baseUC_dic) + groups - 1) / groups;     // 26, 13 or 9
+        const uint8_t footer_pos = IR_CODE_BIT0_MARK_POS + (groups << 2);
+        
+        INFO("<%i> IR Protocol bits: %i", ch_group->accessory, groups << 1);
+        
+        // Decoding protocol based IR code length
+        *ir_code_len = 3;
+        for (uint16_t i = 0; i < json_ir_code_len; i++) {
+            bool is_uc;
+            const int8_t index = ir_bit_dic_index(action_ir_tx->prot_code[i], &is_uc);
+            if (index >= 0) {
+                *ir_code_len += ((index % group_size) + 1) << 1;
+            }
+        }
+        
+        ir_code = malloc(sizeof(uint16_t) * (*ir_code_len));
+        if (!ir_code) {
+            return NULL;
+        }
+        
+        memset(ir_code, 0, sizeof(uint16_t) * (*ir_code_len));
+        
+        INFO("<%i> IR Code Len: %i\nIR Protocol: %s", ch_group->accessory, *ir_code_len, prot);
+        
+        uint16_t bit_mark[6] = { 0 };
+        uint16_t bit_space[6] = { 0 };
+        
+        for (uint8_t i = 0; i < (ir_action_protocol_len >> 1); i++) {
+            const uint16_t packet = ir_raw_packet(prot + (i << 1));
+            
+            printf("%s%5d ", i & 1 ? "-" : "+", packet);
+            
+            if (i == IR_CODE_HEADER_MARK_POS) {
+                ir_code[0] = packet;
+            } else if (i == IR_CODE_HEADER_SPACE_POS) {
+                ir_code[1] = packet;
+            } else if (i < footer_pos) {
+                if (i & 1) {
+                    bit_space[(i - IR_CODE_BIT0_MARK_POS) >> 1] = packet;
+                } else {
+                    bit_mark[(i - IR_CODE_BIT0_MARK_POS) >> 1] = packet;
+                }
+            } else if (i == footer_pos) {
+                ir_code[*ir_code_len - 1] = packet;
+            }
+        }
+        
+        // Decoding BIT code part
+        uint16_t ir_code_index = 2;
+        
+        for (uint16_t i = 0; i < json_ir_code_len; i++) {
+            bool is_uc;
+            const int8_t index = ir_bit_dic_index(action_ir_tx->prot_code[i], &is_uc);
+            if (index >= 0) {
+                const uint8_t bit = ((index / group_size) << 1) + is_uc;
+                for (uint8_t j = (index % group_size) + 1; j > 0; j--) {
+                    ir_code[ir_code_index++] = bit_mark[bit];
+                    ir_code[ir_code_index++] = bit_space[bit];
                 }
+            }
+        }
+        
+        INFO("\n<%i> IR code: %s", ch_group->accessory, action_ir_tx->prot_code);
+        
+    } else {    // IR_ACTION_RAW_CODE
+        *ir_code_len = strlen(action_ir_tx->raw_code) >> 1;
+        
+        ir_code = malloc(sizeof(uint16_t) * (*ir_code_len));
+        if (!ir_code) {
+            return NULL;
+        }
+        
+        INFO("<%i> IR packet (%i)", ch_group->accessory, *ir_code_len);
+        
+        for (uint16_t i = 0; i < *ir_code_len; i++) {
+            ir_code[i] = ir_raw_packet(action_ir_tx->raw_code + (i << 1));
+        }
+    }
+    
+    for (uint16_t i = 0; i < *ir_code_len; i++) {
+        printf("%s%5d ", i & 1 ? "-" : "+", ir_code[i]);
+        if (i % 16 == 15) {
+            printf("\n");
+        }
+    }
+    printf("\n");
+    
+    return ir_code;
+}
+
+// Decoded IR codes are kept in a most recently used first list, up to IR_CODE_CACHE_SIZE bytes.
+// Codes bigger than whole cache are not kept, and ir_code_release() frees them once sent
+void ir_code_cache_remove(action_ir_tx_t* action_ir_tx) {
+    action_ir_tx_t** cached = &main_config.ir_code_cache;
+    while (*cached) {
+        if (*cached == action_ir_tx) {
+            *cached = action_ir_tx->cache_next;
+            break;
+        }
+        cached = &(*cached)->cache_next;
+    }
+    
+    action_ir_tx->cache_next = NULL;
+}
+
+void ir_code_cache_evict() {
+    action_ir_tx_t* last = main_config.ir_code_cache;
+    while (last->cache_next) {
+        last = last->cache_next;
+    }
+    
+    ir_code_cache_remove(last);
+    
+    main_config.ir_code_cache_size -= last->ir_code_len * sizeof(uint16_t);
+    free(last->ir_code);
+    last->ir_code = NULL;
+}
+
+uint16_t* ir_code_get(action_ir_tx_t* action_ir_tx, ch_group_t* ch_group) {
+    if (action_ir_tx->ir_code) {
+        ir_code_cache_remove(action_ir_tx);
+        
+    } else {
+        uint16_t ir_code_len = 0;
+        uint16_t* ir_code = ir_code_decode(action_ir_tx, ch_group, &ir_code_len);
+        
+        if (!ir_code) {
+            if (!main_config.ir_code_cache) {
+                return NULL;
+            }
+            
+            while (main_config.ir_code_cache) {
+                ir_code_cache_evict();
+            }
+            
+            ir_code = ir_code_decode(action_ir_tx, ch_group, &ir_code_len);
+            if (!ir_code) {
+                return NULL;
+            }
+        }
+        
+        action_ir_tx->ir_code = ir_code;
+        action_ir_tx->ir_code_len = ir_code_len;
+        
+        if (ir_code_len * sizeof(uint16_t) > IR_CODE_CACHE_SIZE) {
+            return ir_code;
+        }
+        
+        while (main_config.ir_code_cache &&
+               (main_config.ir_code_cache_size + (ir_code_len * sizeof(uint16_t))) > IR_CODE_CACHE_SIZE) {
+            ir_code_cache_evict();
+        }
+        
+        main_config.ir_code_cache_size += ir_code_len * sizeof(uint16_t);
+    }
+    
+    action_ir_tx->cache_next = main_config.ir_code_cache;
+    main_config.ir_code_cache = action_ir_tx;
+    
+    return action_ir_tx->ir_code;
+}
+
+void ir_code_release(action_ir_tx_t* action_ir_tx) {
+    if (action_ir_tx->ir_code_len * sizeof(uint16_t) > IR_CODE_CACHE_SIZE) {
+        free(action_ir_tx->ir_code);
+        action_ir_tx->ir_code = NULL;
+    }
+}
+
+// --- IR Send task
+void ir_tx_task(action_task_t* action_task) {
+    action_ir_tx_t* action_ir_tx = ACTION_LIST(action_task->ch_group, action_entry_find(action_task->ch_group, action_task->action), action_ir_tx);
+    
+    uint8_t errors = 0;
+    
+    while (action_ir_tx) {
+        if (action_ir_tx->action == action_task->action) {
+            uint8_t freq = main_config.ir_tx_freq;
+            if (action_ir_tx->freq > 0) {
+                freq = action_ir_tx->freq;
+            }
+            
+            uint16_t* ir_code = ir_code_get(action_ir_tx, action_task->ch_group);
+            if (!ir_code) {
+                homekit_remove_oldest_client();
+                errors++;
                 
-                INFO("\n<%i> IR code: %s", action_task->ch_group->accessory, action_ir_tx->prot_code);
-                for (uint16_t i = 0; i < ir_code_len; i++) {
-                    printf("%s%5d ", i & 1 ? "-" : "+", ir_code[i]);
-                    if (i % 16 == 15) {
-                        printf("\n");
+                if (errors < 5) {
+                    vTaskDelay(MS_TO_TICKS(200));
+                    continue;
+                } else {
+                    break;
+                }
+            }
+            
+            const uint16_t ir_code_len = action_ir_tx->ir_code_len;
+            
+            // IR TRANSMITTER
+            uint32_t start;
+            const bool ir_true = true ^ main_config.ir_tx_inv;
+            const bool ir_false = false ^ main_config.ir_tx_inv;
+
+            for (uint8_t r = 0; r < action_ir_tx->repeats; r++) {
+                // FRC1 interrupts send code when timer is not used by PWM, so other interrupts are not stopped
+                if (!adv_ir_tx_send(main_config.ir_tx_gpio, main_config.ir_tx_inv, freq, ir_code, ir_code_len)) {
+                    taskENTER_CRITICAL();
+                    
+                    for (uint16_t i = 0; i < ir_code_len; i++) {
+                        if (ir_code[i] > 0) {
+                            if (i & 1) {    // Space
+                                gpio_write(main_config.ir_tx_gpio, ir_false);
+                                sdk_os_delay_us(ir_code[i]);
+                            } else {        // Mark
+                                start = sdk_system_get_time();
+                                while ((sdk_system_get_time() - start) < ir_code[i]) {
+                                    gpio_write(main_config.ir_tx_gpio, ir_true);
+                                    sdk_os_delay_us(freq);
+                                    gpio_write(main_config.ir_tx_gpio, ir_false);
+                                    sdk_os_delay_us(freq);
+                                }
+                            }
+                        }
                     }
+                    
+                    gpio_write(main_config.ir_tx_gpio, ir_false);
 
+                    taskEXIT_CRITICAL();
                 }
-                printf("\n");
                 
-            } else {    // IR_ACTION_RAW_CODE
-                const uint16_t json_ir_code_len = strlen(action_ir_tx->raw_code);
-                ir_code_len = json_ir_code_len >> 1;
+                INFO("<%i> IR %i sent", action_task->ch_group->accessory, r);
                 
-                ir_code = malloc(sizeof(uint16_t) * ir_code_len);
+                vTaskDelay(action_ir_tx->pause);
+            }
+            
+            ir_code_release(action_ir_tx);
+        }
+        
+        action_ir_tx = action_ir_tx->next;
+    }
+}
+
+// --- UART action task
+void uart_action_task(action_task_t* action_task) {
+    vTaskDelay(MS_TO_TICKS(10));
+    
+    action_uart_t* action_uart = ACTION_LIST(action_task->ch_group, action_entry_find(action_task->ch_group, action_task->action), action_uart);
+
+    while (action_uart) {
+        if (action_uart->action == action_task->action) {
+            INFO("<%i> UART Action", action_task->ch_group->accessory);
+            
+            taskENTER_CRITICAL();
+            
+            for (uint8_t i = 0; i < action_uart->len; i++) {
+                uart_putc(action_uart->uart, action_uart->command[i]);
+            }
+
+            uart_flush_txfifo(action_uart->uart);
+            
+            taskEXIT_CRITICAL();
+        }
+        
+        if (action_uart->pause > 0) {
+            vTaskDelay(action_uart->pause);
+        }
+        
+        action_uart = action_uart->next;
+    }
+}
+
+// --- Action workers
+static const uint8_t action_task_max_running[ACTION_TASK_TYPES] = {
+    ACTION_TASK_UART_MAX_RUNNING,
+    ACTION_TASK_NETWORK_MAX_RUNNING,
+    ACTION_TASK_IR_TX_MAX_RUNNING
+};
+
+// Each type has its own queue, so jobs of a type are started in order. A worker only takes a job from a type
+// below its running limit, and it sleeps otherwise, so jobs of saturated types never hold a worker
+void action_worker_task(void* args) {
+    action_task_t action_task;
+    
+    for (;;) {
+        int8_t type = -1;
+        
+        taskENTER_CRITICAL();
+        for (uint8_t i = 0; i < ACTION_TASK_TYPES; i++) {
+            if (main_config.action_queues[i] &&
+                main_config.action_running[i] < action_task_max_running[i] &&
+                uxQueueMessagesWaiting(main_config.action_queues[i]) > 0) {
+                main_config.action_running[i]++;
+                main_config.action_workers_busy++;
+                type = i;
+                break;
+            }
+        }
+        taskEXIT_CRITICAL();
+        
+        if (type < 0) {
+            xSemaphoreTake(main_config.action_wakeup, portMAX_DELAY);
+            continue;
+        }
+        
+        if (xQueueReceive(main_config.action_queues[type], &action_task, 0) != pdTRUE) {
+            // Taken by other worker of same type
+            taskENTER_CRITICAL();
+            main_config.action_running[type]--;
+            main_config.action_workers_busy--;
+            taskEXIT_CRITICAL();
+            continue;
+        }
+        
+        main_config.action_latency_last = (sdk_system_get_time() - action_task.time) / 1000;
+        if (main_config.action_latency_last > main_config.action_latency_max) {
+            main_config.action_latency_max = main_config.action_latency_last;
+        }
+        
+        action_lists_read_begin();
+        
+        switch (action_task.type) {
+            case ACTION_TASK_TYPE_NETWORK:
+                net_action_task(&action_task);
+                break;
+                
+            case ACTION_TASK_TYPE_IR_TX:
+                ir_tx_task(&action_task);
+                break;
                 
-                INFO("<%i> IR packet (%i)", action_task->ch_group->accessory, ir_code_len);
+            default:    // case ACTION_TASK_TYPE_UART:
+                uart_action_task(&action_task);
+                break;
+        }
+        
+        action_lists_read_end();
+        
+        taskENTER_CRITICAL();
+        main_config.action_running[type]--;
+        main_config.action_workers_busy--;
+        taskEXIT_CRITICAL();
+        
+        // Next job of this type can run now
+        xSemaphoreGive(main_config.action_wakeup);
+    }
+}
 
-                uint16_t index, packet;
-                for (uint16_t i = 0; i < ir_code_len; i++) {
-                    index = i << 1;
-                    char* found = strchr(baseRaw_dic, action_ir_tx->raw_code[index]);
-                    packet = (found - baseRaw_dic) * IR_CODE_LEN * IR_CODE_SCALE;
-                    
-                    found = strchr(baseRaw_dic, action_ir_tx->raw_code[index + 1]);
-                    packet += (found - baseRaw_dic) * IR_CODE_SCALE;
+void action_task_enqueue(ch_group_t* ch_group, const uint8_t action, const uint8_t type) {
+    if (!main_config.action_wakeup) {
+        main_config.action_wakeup = xSemaphoreCreateCounting(ACTION_QUEUE_SIZE * ACTION_TASK_TYPES, 0);
+        if (!main_config.action_wakeup) {
+            ERROR("<%i> Creating action queue", ch_group->accessory);
+            return;
+        }
+    }
+    
+    if (!main_config.action_queues[type]) {
+        main_config.action_queues[type] = xQueueCreate(ACTION_QUEUE_SIZE, sizeof(action_task_t));
+        if (!main_config.action_queues[type]) {
+            ERROR("<%i> Creating action queue", ch_group->accessory);
+            return;
+        }
+    }
+    
+    // Workers are started on demand and kept alive, up to ACTION_WORKER_MAX_TASKS.
+    // Queued jobs count too, because workers may not have taken them yet
+    uint8_t action_pending = main_config.action_workers_busy;
+    for (uint8_t i = 0; i < ACTION_TASK_TYPES; i++) {
+        if (main_config.action_queues[i]) {
+            action_pending += uxQueueMessagesWaiting(main_config.action_queues[i]);
+        }
+    }
+    
+    if (action_pending >= main_config.action_workers &&
+        main_config.action_workers < ACTION_WORKER_MAX_TASKS) {
+        if (xTaskCreate(action_worker_task, "action", ACTION_WORKER_TASK_SIZE, NULL, ACTION_WORKER_TASK_PRIORITY, NULL) == pdPASS) {
+            main_config.action_workers++;
+        } else {
+            ERROR("<%i> Creating action worker", ch_group->accessory);
+        }
+    }
+    
+    const action_task_t action_task = {
+        .action = action,
+        .type = type,
+        .time = sdk_system_get_time(),
+        .ch_group = ch_group,
+    };
+    
+    // Called from button and timer callbacks, so it never waits for room in queue
+    if (xQueueSend(main_config.action_queues[type], &action_task, 0) != pdPASS) {
+        main_config.action_drops++;
+        ERROR("<%i> Action queue full, dropped %i", ch_group->accessory, main_config.action_drops);
+        return;
+    }
+    
+    // Give only fails when semaphore is full, and then workers already have enough wakeups pending
+    xSemaphoreGive(main_config.action_wakeup);
+    
+    const uint8_t queue_depth = uxQueueMessagesWaiting(main_config.action_queues[type]);
+    if (queue_depth > main_config.action_queue_peak) {
+        main_config.action_queue_peak = queue_depth;
+    }
+}
 
-                    ir_code[i] = packet;
+// --- ACTIONS
+void autoswitch_timer(TimerHandle_t xTimer) {
+    // Timer ID holds gpio and value, so it does not depend on action list lifetime
+    const uint32_t autoswitch = (uint32_t) pvTimerGetTimerID(xTimer);
+    const uint16_t gpio = autoswitch >> 1;
+    const bool value = autoswitch & 1;
 
-                    printf("%s%5d ", i & 1 ? "-" : "+", packet);
-                    if (i % 16 == 15) {
-                        printf("\n");
-                    }
+    extended_gpio_write(gpio, !value);
+    INFO("AutoSw digO GPIO %i -> %i", gpio, !value);
+    
+    esp_timer_delete(xTimer);
+}
+
+// --- Compiled actions
+// Every action struct starts with its uint8_t action number
+static const struct {
+    size_t size;
+    size_t next_offset;
+    size_t entry_offset;
+} action_lists[ACTION_LISTS] = {
+    { sizeof(action_copy_t), offsetof(action_copy_t, next), offsetof(action_entry_t, action_copy) },
+    { sizeof(action_binary_output_t), offsetof(action_binary_output_t, next), offsetof(action_entry_t, action_binary_output) },
+    { sizeof(action_acc_manager_t), offsetof(action_acc_manager_t, next), offsetof(action_entry_t, action_acc_manager) },
+    { sizeof(action_system_t), offsetof(action_system_t, next), offsetof(action_entry_t, action_system) },
+    { sizeof(action_network_t), offsetof(action_network_t, next), offsetof(action_entry_t, action_network) },
+    { sizeof(action_ir_tx_t), offsetof(action_ir_tx_t, next), offsetof(action_entry_t, action_ir_tx) },
+    { sizeof(action_uart_t), offsetof(action_uart_t, next), offsetof(action_entry_t, action_uart) },
+};
+
+static inline void** action_next(void* action, const size_t next_offset) {
+    return (void**) ((uint8_t*) action + next_offset);
+}
+
+action_entry_t* action_entry_find(ch_group_t* ch_group, const uint8_t action) {
+    int16_t low = 0;
+    int16_t high = ch_group->action_entries - 1;
+    
+    while (low <= high) {
+        const int16_t middle = (low + high) >> 1;
+        const uint8_t middle_action = ch_group->action_entry[middle].action;
+        
+        if (middle_action == action) {
+            return &ch_group->action_entry[middle];
+        } else if (middle_action < action) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    
+    return NULL;
+}
+
+// Copies all nodes of an action list into a single array, grouped by action number and keeping their order.
+// Each group is linked as its own NULL terminated list, and its head is stored in the matching entry.
+static bool action_list_pack(void* action_list, const uint8_t list, action_entry_t* action_entry, const uint16_t action_entries, uint8_t** packed_list) {
+    const size_t size = action_lists[list].size;
+    const size_t next_offset = action_lists[list].next_offset;
+    
+    *packed_list = NULL;
+    
+    uint16_t count = 0;
+    for (uint8_t* action = action_list; action; action = *action_next(action, next_offset)) {
+        count++;
+    }
+    
+    if (count == 0) {
+        return true;
+    }
+    
+    uint8_t* packed = malloc(count * size);
+    if (!packed) {
+        return false;
+    }
+    
+    *packed_list = packed;
+    
+    for (uint16_t i = 0; i < action_entries; i++) {
+        uint8_t* last = NULL;
+        for (uint8_t* action = action_list; action; action = *action_next(action, next_offset)) {
+            if (*action == action_entry[i].action) {
+                memcpy(packed, action, size);
+                *action_next(packed, next_offset) = NULL;
+                
+                if (last) {
+                    *action_next(last, next_offset) = packed;
+                } else {
+                    *((void**) ((uint8_t*) &action_entry[i] + action_lists[list].entry_offset)) = packed;
                 }
                 
-                printf("\n");
+                last = packed;
+                packed += size;
             }
-            
-            // IR TRANSMITTER
-            uint32_t start;
-            const bool ir_true = true ^ main_config.ir_tx_inv;
-            const bool ir_false = false ^ main_config.ir_tx_inv;
+        }
+    }
+    
+    return true;
+}
 
-            for (uint8_t r = 0; r < action_ir_tx->repeats; r++) {
-                
-                taskENTER_CRITICAL();
-                
-                for (uint16_t i = 0; i < ir_code_len; i++) {
-                    if (ir_code[i] > 0) {
-                        if (i & 1) {    // Space
-                            gpio_write(main_config.ir_tx_gpio, ir_false);
-                            sdk_os_delay_us(ir_code[i]);
-                        } else {        // Mark
-                            start = sdk_system_get_time();
-                            while ((sdk_system_get_time() - start) < ir_code[i]) {
-                                gpio_write(main_config.ir_tx_gpio, ir_true);
-                                sdk_os_delay_us(freq);
-                                gpio_write(main_config.ir_tx_gpio, ir_false);
-                                sdk_os_delay_us(freq);
-                            }
-                        }
-                    }
+bool compile_actions(ch_group_t* ch_group) {
+    void** ch_group_lists[ACTION_LISTS] = {
+        (void**) &ch_group->action_copy,
+        (void**) &ch_group->action_binary_output,
+        (void**) &ch_group->action_acc_manager,
+        (void**) &ch_group->action_system,
+        (void**) &ch_group->action_network,
+        (void**) &ch_group->action_ir_tx,
+        (void**) &ch_group->action_uart,
+    };
+    
+    uint32_t actions_map[8];
+    memset(actions_map, 0, sizeof(actions_map));
+    
+    for (uint8_t list = 0; list < ACTION_LISTS; list++) {
+        for (uint8_t* action = *ch_group_lists[list]; action; action = *action_next(action, action_lists[list].next_offset)) {
+            actions_map[*action >> 5] |= 1UL << (*action & 0x1F);
+        }
+    }
+    
+    uint16_t action_entries = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+        action_entries += __builtin_popcount(actions_map[i]);
+    }
+    
+    action_entry_t* action_entry = NULL;
+    uint8_t* packed_lists[ACTION_LISTS];
+    memset(packed_lists, 0, sizeof(packed_lists));
+    
+    if (action_entries > 0) {
+        action_entry = malloc(action_entries * sizeof(action_entry_t));
+        if (!action_entry) {
+            return false;
+        }
+        
+        memset(action_entry, 0, action_entries * sizeof(action_entry_t));
+        
+        uint8_t entry = 0;
+        for (uint16_t action = 0; action < 256; action++) {
+            if (actions_map[action >> 5] & (1UL << (action & 0x1F))) {
+                action_entry[entry].action = action;
+                entry++;
+            }
+        }
+        
+        for (uint8_t list = 0; list < ACTION_LISTS; list++) {
+            if (!action_list_pack(*ch_group_lists[list], list, action_entry, action_entries, &packed_lists[list])) {
+                for (uint8_t i = 0; i < list; i++) {
+                    free(packed_lists[i]);
                 }
                 
-                gpio_write(main_config.ir_tx_gpio, ir_false);
-
-                taskEXIT_CRITICAL();
-                
-                INFO("<%i> IR %i sent", action_task->ch_group->accessory, r);
-                
-                vTaskDelay(action_ir_tx->pause);
-            }
-            
-            if (ir_code) {
-                free(ir_code);
+                free(action_entry);
+                return false;
             }
         }
+    }
+    
+    // No task is reading action lists, see compile_all_actions()
+    ch_group->action_entry = action_entry;
+    ch_group->action_entries = action_entries;
+    ch_group->action_compiled = true;
+    
+    for (uint8_t list = 0; list < ACTION_LISTS; list++) {
+        void* action = *ch_group_lists[list];
+        *ch_group_lists[list] = NULL;
         
-        action_ir_tx = action_ir_tx->next;
+        while (action) {
+            void* next = *action_next(action, action_lists[list].next_offset);
+            free(action);
+            action = next;
+        }
     }
     
-    free(pvParameters);
-    vTaskDelete(NULL);
+    return true;
 }
 
-// --- UART action task
-void uart_action_task(void* pvParameters) {
-    vTaskDelay(MS_TO_TICKS(10));
-    
-    action_task_t* action_task = pvParameters;
-    action_uart_t* action_uart = action_task->ch_group->action_uart;
+// do_actions() and action workers read action lists between action_lists_read_begin() and action_lists_read_end().
+// Compiling only starts when there are no readers, and new readers wait until it finishes, so no node is freed while in use
+void action_lists_read_begin() {
+    for (;;) {
+        taskENTER_CRITICAL();
+        if (!main_config.action_lists_compiling) {
+            main_config.action_lists_readers++;
+            taskEXIT_CRITICAL();
+            return;
+        }
+        taskEXIT_CRITICAL();
+        
+        vTaskDelay(MS_TO_TICKS(ACTION_LISTS_WAIT_MS));
+    }
+}
 
-    while (action_uart) {
-        if (action_uart->action == action_task->action) {
-            INFO("<%i> UART Action", action_task->ch_group->accessory);
-            
-            taskENTER_CRITICAL();
-            
-            for (uint8_t i = 0; i < action_uart->len; i++) {
-                uart_putc(action_uart->uart, action_uart->command[i]);
-            }
+void action_lists_read_end() {
+    taskENTER_CRITICAL();
+    main_config.action_lists_readers--;
+    taskEXIT_CRITICAL();
+}
 
-            uart_flush_txfifo(action_uart->uart);
-            
+void compile_all_actions() {
+    // Queued jobs only hold ch_group and action number, so they run with compiled lists
+    for (;;) {
+        taskENTER_CRITICAL();
+        if (main_config.action_lists_readers == 0) {
+            main_config.action_lists_compiling = true;
             taskEXIT_CRITICAL();
+            break;
         }
+        taskEXIT_CRITICAL();
         
-        if (action_uart->pause > 0) {
-            vTaskDelay(action_uart->pause);
+        vTaskDelay(MS_TO_TICKS(ACTION_LISTS_WAIT_MS));
+    }
+    
+    // Cached IR codes are linked to action nodes, which are moved when compiled
+    while (main_config.ir_code_cache) {
+        ir_code_cache_evict();
+    }
+    
+    ch_group_t* ch_group = main_config.ch_groups;
+    while (ch_group) {
+        if (!compile_actions(ch_group)) {
+            ERROR("<%i> Compiling actions", ch_group->accessory);
         }
         
-        action_uart = action_uart->next;
+        ch_group = ch_group->next;
     }
     
-    free(pvParameters);
-    vTaskDelete(NULL);
-}
-
-// --- ACTIONS
-void autoswitch_timer(TimerHandle_t xTimer) {
-    action_binary_output_t* action_binary_output = (action_binary_output_t*) pvTimerGetTimerID(xTimer);
-
-    extended_gpio_write(action_binary_output->gpio, !action_binary_output->value);
-    INFO("AutoSw digO GPIO %i -> %i", action_binary_output->gpio, !action_binary_output->value);
-    
-    esp_timer_delete(xTimer);
+    taskENTER_CRITICAL();
+    main_config.action_lists_compiling = false;
+    taskEXIT_CRITICAL();
 }
 
-void do_actions(ch_group_t* ch_group, uint8_t action) {
+void do_actions_run(ch_group_t* ch_group, uint8_t action) {
     INFO("<%i> Exec Action %i", ch_group->accessory, action);
     
+    action_entry_t* action_entry = action_entry_find(ch_group, action);
+    
     // Copy actions
-    action_copy_t* action_copy = ch_group->action_copy;
+    action_copy_t* action_copy = ACTION_LIST(ch_group, action_entry, action_copy);
     while(action_copy) {
         if (action_copy->action == action) {
             action = action_copy->new_action;
             action_copy = NULL;
+            action_entry = action_entry_find(ch_group, action);
         } else {
             action_copy = action_copy->next;
         }
     }
     
+    if (ch_group->action_compiled && !action_entry) {
+        return;
+    }
+    
+    mcp_batch_begin();
+    
     // Binary outputs
-    action_binary_output_t* action_binary_output = ch_group->action_binary_output;
+    action_binary_output_t* action_binary_output = ACTION_LIST(ch_group, action_entry, action_binary_output);
     while(action_binary_output) {
         if (action_binary_output->action == action) {
             extended_gpio_write(action_binary_output->gpio, action_binary_output->value);
             INFO("<%i> Binary Output: gpio %i, val %i, inch %g", ch_group->accessory, action_binary_output->gpio, action_binary_output->value, action_binary_output->inching);
             
             if (action_binary_output->inching > 0) {
-                esp_timer_start(esp_timer_create(action_binary_output->inching * 1000, false, (void*) action_binary_output, autoswitch_timer));
+                esp_timer_start(esp_timer_create(action_binary_output->inching * 1000, false, (void*) (uint32_t) ((action_binary_output->gpio << 1) | action_binary_output->value), autoswitch_timer));
             }
         }
 
@@ -5147,7 +6728,7 @@ void do_actions(ch_group_t* ch_group, uint8_t action) {
     }
     
     // Service Manager
-    action_acc_manager_t* action_acc_manager = ch_group->action_acc_manager;
+    action_acc_manager_t* action_acc_manager = ACTION_LIST(ch_group, action_entry, action_acc_manager);
     while(action_acc_manager) {
         if (action_acc_manager->action == action) {
             ch_group_t* ch_group = ch_group_find_by_acc(action_acc_manager->accessory);
@@ -5451,8 +7032,10 @@ void do_actions(ch_group_t* ch_group, uint8_t action) {
         action_acc_manager = action_acc_manager->next;
     }
     
+    mcp_batch_end();
+    
     // System actions
-    action_system_t* action_system = ch_group->action_system;
+    action_system_t* action_system = ACTION_LIST(ch_group, action_entry, action_system);
     while(action_system) {
         if (action_system->action == action) {
             INFO("<%i> System Action %i", ch_group->accessory, action_system->value);
@@ -5484,45 +7067,27 @@ void do_actions(ch_group_t* ch_group, uint8_t action) {
     }
     
     // UART actions
-    if (ch_group->action_uart) {
-        action_task_t* action_task = new_action_task();
-        action_task->action = action;
-        action_task->ch_group = ch_group;
-        
-        if (xTaskCreate(uart_action_task, "uart", UART_ACTION_TASK_SIZE, action_task, UART_ACTION_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("<%i> Creating uart", ch_group->accessory);
-            free(action_task);
-            homekit_remove_oldest_client();
-        }
+    if (ACTION_LIST(ch_group, action_entry, action_uart)) {
+        action_task_enqueue(ch_group, action, ACTION_TASK_TYPE_UART);
     }
     
     // Network actions
-    if (ch_group->action_network && main_config.wifi_status == WIFI_STATUS_CONNECTED) {
-        action_task_t* action_task = new_action_task();
-        action_task->action = action;
-        action_task->ch_group = ch_group;
-        
-        if (xTaskCreate(net_action_task, "net", NETWORK_ACTION_TASK_SIZE, action_task, NETWORK_ACTION_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("<%i> Creating net", ch_group->accessory);
-            free(action_task);
-            homekit_remove_oldest_client();
-        }
+    if (ACTION_LIST(ch_group, action_entry, action_network) && main_config.wifi_status == WIFI_STATUS_CONNECTED) {
+        action_task_enqueue(ch_group, action, ACTION_TASK_TYPE_NETWORK);
     }
     
     // IR TX actions
-    if (ch_group->action_ir_tx) {
-        action_task_t* action_task = new_action_task();
-        action_task->action = action;
-        action_task->ch_group = ch_group;
-        
-        if (xTaskCreate(ir_tx_task, "ir", IR_TX_TASK_SIZE, action_task, IR_TX_TASK_PRIORITY, NULL) != pdPASS) {
-            ERROR("<%i> Creating ir", ch_group->accessory);
-            free(action_task);
-            homekit_remove_oldest_client();
-        }
+    if (ACTION_LIST(ch_group, action_entry, action_ir_tx)) {
+        action_task_enqueue(ch_group, action, ACTION_TASK_TYPE_IR_TX);
     }
 }
 
+void do_actions(ch_group_t* ch_group, uint8_t action) {
+    action_lists_read_begin();
+    do_actions_run(ch_group, action);
+    action_lists_read_end();
+}
+
 void do_wildcard_actions(ch_group_t* ch_group, uint8_t index, const float action_value) {
     INFO("<%i> Wildcard %i %1.7g", ch_group->accessory, index, action_value);
     float last_value, last_diff = 1000000;
@@ -5603,20 +7168,24 @@ void identify(homekit_characteristic_t* ch, const homekit_value_t value) {
 // ---------
 
 void delayed_sensor_task() {
-    vTaskDelay(MS_TO_TICKS(3000));
+    // TH sensors first, and then iAirZoning ones, in accessories order
+    uint32_t delay_ms = SENSOR_TH_START_DELAY_MS;
     
     ch_group_t* ch_group = main_config.ch_groups;
     while (ch_group) {
-        if (ch_group->timer &&
-            ch_group->acc_type >= ACC_TYPE_THERMOSTAT &&
+        if (ch_group->acc_type >= ACC_TYPE_THERMOSTAT &&
             ch_group->acc_type <= ACC_TYPE_HUMIDIFIER_WITH_TEMP) {
             
-            INFO("<%i> Starting TH sensor", ch_group->accessory);
-            
-            temperature_timer_worker(ch_group->timer);
-            esp_timer_start(ch_group->timer);
+            sensor_job_t* sensor_job = main_config.sensor_jobs;
+            while (sensor_job && sensor_job->ch_group != ch_group) {
+                sensor_job = sensor_job->next;
+            }
             
-            vTaskDelay(MS_TO_TICKS(4000));
+            if (sensor_job) {
+                INFO("<%i> Starting TH sensor", ch_group->accessory);
+                sensor_job_start(sensor_job, delay_ms);
+                delay_ms += SENSOR_TH_START_STAGGER_MS;
+            }
         }
         
         ch_group = ch_group->next;
@@ -5624,15 +7193,17 @@ void delayed_sensor_task() {
     
     ch_group = main_config.ch_groups;
     while (ch_group) {
-        if (ch_group->acc_type == ACC_TYPE_IAIRZONING &&
-            ch_group->timer) {
-            
-            INFO("<%i> Starting iAirZoning", ch_group->accessory);
-            
-            temperature_timer_worker(ch_group->timer);
-            esp_timer_start(ch_group->timer);
+        if (ch_group->acc_type == ACC_TYPE_IAIRZONING) {
+            sensor_job_t* sensor_job = main_config.sensor_jobs;
+            while (sensor_job && sensor_job->ch_group != ch_group) {
+                sensor_job = sensor_job->next;
+            }
             
-            vTaskDelay(MS_TO_TICKS(9500));
+            if (sensor_job) {
+                INFO("<%i> Starting iAirZoning", ch_group->accessory);
+                sensor_job_start(sensor_job, delay_ms);
+                delay_ms += SENSOR_IAIRZONING_START_STAGGER_MS;
+            }
         }
         
         ch_group = ch_group->next;
@@ -5718,11 +7289,96 @@ void reset_uart() {
     uart_set_baud(0, 115200);
 }
 
-void normal_mode_init() {
-    char* txt_config = NULL;
-    sysparam_get_string(HAA_JSON_SYSPARAM, &txt_config);
+// Sysparam entry is a 4 bytes header and its data, aligned to 4 bytes. Key and value are entries
+#define SYSPARAM_ENTRY_SIZE(len)            (4 + (((len) + 3) & ~3))
 
-    cJSON* json_haa = cJSON_Parse(txt_config);
+size_t sysparam_free_size() {
+    uint32_t base_addr, num_sectors;
+    if (sysparam_get_info(&base_addr, &num_sectors) != SYSPARAM_OK) {
+        return 0;
+    }
+    
+    // One sector is kept to compact others
+    size_t free_size = (num_sectors - 1) * SPI_FLASH_SECTOR_SIZE;
+    
+    sysparam_iter_t sysparam_iter;
+    if (sysparam_iter_start(&sysparam_iter) != SYSPARAM_OK) {
+        return 0;
+    }
+    
+    while (sysparam_iter_next(&sysparam_iter) == SYSPARAM_OK) {
+        const size_t entry_size = SYSPARAM_ENTRY_SIZE(sysparam_iter.key_len) + SYSPARAM_ENTRY_SIZE(sysparam_iter.value_len);
+        free_size = (entry_size < free_size) ? free_size - entry_size : 0;
+    }
+    
+    sysparam_iter_end(&sysparam_iter);
+    
+    return free_size;
+}
+
+void normal_mode_init() {
+    // HomeKit last config number
+    int last_config_number = 1;
+    sysparam_get_int32(LAST_CONFIG_NUMBER_SYSPARAM, &last_config_number);
+    
+    // Compiled config image is loaded instead of parsing JSON. It is checked with config number and JSON hash saved with config,
+    // so JSON is only read when image is missing or stale, and it is made again only when config changes
+    int32_t saved_json_hash = 0;
+    const bool has_json_hash = (sysparam_get_int32(HAA_JSON_HASH_SYSPARAM, &saved_json_hash) == SYSPARAM_OK);
+    uint32_t json_hash = saved_json_hash;
+    uint8_t* config_image = NULL;
+    size_t config_image_size = 0;
+    bool is_binary = false;
+    cJSON* json_haa = NULL;
+    
+    sysparam_get_data(HAA_CONFIG_IMAGE_SYSPARAM, &config_image, &config_image_size, &is_binary);
+    int config_image_status = CONFIG_IMAGE_ERR_STALE;
+    if (has_json_hash) {
+        config_image_status = config_image_load(config_image, config_image_size, last_config_number, json_hash, &json_haa);
+    }
+    
+    if (config_image_status != CONFIG_IMAGE_OK) {
+        char* txt_config = NULL;
+        sysparam_get_string(HAA_JSON_SYSPARAM, &txt_config);
+        json_hash = txt_config ? config_image_hash((uint8_t*) txt_config, strlen(txt_config)) : 0;
+        
+        // Config saved without its hash can still have a valid image
+        if (!has_json_hash || json_hash != (uint32_t) saved_json_hash) {
+            sysparam_set_int32(HAA_JSON_HASH_SYSPARAM, json_hash);
+            config_image_status = config_image_load(config_image, config_image_size, last_config_number, json_hash, &json_haa);
+        }
+        
+        if (config_image_status != CONFIG_IMAGE_OK) {
+            free(config_image);
+            config_image = NULL;
+            
+            json_haa = cJSON_Parse(txt_config);
+        }
+        
+        free(txt_config);
+    }
+    
+    if (!config_image) {
+        uint8_t* new_config_image = NULL;
+        config_image_status = config_image_compile(json_haa, last_config_number, json_hash, &new_config_image);
+        
+        // Stale image is removed first, so its space counts as free. It is a second copy of config,
+        // so new one is saved only if saved states still have room
+        if (config_image_size > 0) {
+            sysparam_set_data(HAA_CONFIG_IMAGE_SYSPARAM, NULL, 0, false);
+        }
+        
+        if (config_image_status > 0) {
+            const size_t image_entry_size = SYSPARAM_ENTRY_SIZE(strlen(HAA_CONFIG_IMAGE_SYSPARAM)) + SYSPARAM_ENTRY_SIZE(config_image_status);
+            if (sysparam_free_size() < image_entry_size + SAVE_STATES_FREE_SYSPARAM) {
+                config_image_status = CONFIG_IMAGE_ERR_NO_ROOM;
+            } else if (sysparam_set_data(HAA_CONFIG_IMAGE_SYSPARAM, new_config_image, config_image_status, true) != SYSPARAM_OK) {
+                config_image_status = CONFIG_IMAGE_ERR_NO_MEM;
+            }
+            
+            free(new_config_image);
+        }
+    }
 
     cJSON* json_config = cJSON_GetObjectItemCaseSensitive(json_haa, GENERAL_CONFIG);
     cJSON* json_accessories = cJSON_GetObjectItemCaseSensitive(json_haa, ACCESSORIES_ARRAY);
@@ -5732,7 +7388,12 @@ void normal_mode_init() {
     if (total_accessories == 0) {
         reset_uart();
         printf_header();
+        
+        char* txt_config = NULL;
+        sysparam_get_string(HAA_JSON_SYSPARAM, &txt_config);
         INFO("JSON:\n%s\n", txt_config ? txt_config : "NONE");
+        free(txt_config);
+        
         ERROR("Invalid JSON\n");
         sysparam_set_int32(TOTAL_SERV_SYSPARAM, 0);
         sysparam_set_int8(HAA_SETUP_MODE_SYSPARAM, 2);
@@ -5951,7 +7612,7 @@ void normal_mode_init() {
     
     // REGISTER ACTIONS
     // Copy actions
-    inline void new_action_copy(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_copy(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_copy_t* last_action = ch_group->action_copy;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -5976,7 +7637,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -5986,7 +7649,7 @@ void normal_mode_init() {
     }
     
     // Binary outputs
-    inline void new_action_binary_output(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_binary_output(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_binary_output_t* last_action = ch_group->action_binary_output;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6039,7 +7702,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6049,7 +7714,7 @@ void normal_mode_init() {
     }
     
     // Accessory Manager
-    inline void new_action_acc_manager(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_acc_manager(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_acc_manager_t* last_action = ch_group->action_acc_manager;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6100,7 +7765,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6110,7 +7777,7 @@ void normal_mode_init() {
     }
     
     // System Actions
-    inline void new_action_system(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_system(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_system_t* last_action = ch_group->action_system;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6140,7 +7807,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6150,7 +7819,7 @@ void normal_mode_init() {
     }
     
     // Network Actions
-    inline void new_action_network(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_network(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_network_t* last_action = ch_group->action_network;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6169,12 +7838,6 @@ void normal_mode_init() {
                         
                         action_network->host = strdup(cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_HOST)->valuestring);
                         
-                        if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_URL) != NULL) {
-                            action_network->url = strdup(cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_URL)->valuestring);
-                        } else {
-                            action_network->url = strdup("");
-                        }
-                        
                         action_network->port_n = 80;
                         if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_PORT) != NULL) {
                             action_network->port_n = (uint16_t) cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_PORT)->valuedouble;
@@ -6188,29 +7851,54 @@ void normal_mode_init() {
                             action_network->method_n = (uint8_t) cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_METHOD)->valuedouble;
                         }
                         
-                        if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_HEADER) != NULL) {
-                            action_network->header = strdup(cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_HEADER)->valuestring);
-                        } else {
-                            action_network->header = strdup("Content-type: text/html\r\n");
-                        }
-                        
+                        char* content = "";
                         if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_CONTENT) != NULL) {
-                            action_network->content = strdup(cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_CONTENT)->valuestring);
-                        } else {
-                            action_network->content = strdup("");
+                            content = cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_CONTENT)->valuestring;
                         }
                         
                         INFO("New Network Action %i: %s:%i", new_int_action, action_network->host, action_network->port_n);
                         
-                        if (action_network->method_n ==  3 ||
-                            action_network->method_n == 13) {
-                            action_network->len = strlen(action_network->content);
-                        } else if (action_network->method_n ==  4 ||
-                                   action_network->method_n == 12 ||
-                                   action_network->method_n == 14) {
+                        if (action_network->method_n ==  4 ||
+                            action_network->method_n == 12 ||
+                            action_network->method_n == 14) {
+                            action_network->len = process_hexstr(content, &action_network->raw);
                             
-                            free(action_network->content);
-                            action_network->len = process_hexstr(cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_CONTENT)->valuestring, &action_network->raw);
+                        } else if (action_network->method_n == 13) {
+                            action_network->content.text = strdup(content);
+                            action_network->len = strlen(content);
+                            
+                        } else {
+                            char* url = "";
+                            if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_URL) != NULL) {
+                                url = cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_URL)->valuestring;
+                            }
+                            
+                            char* header = "Content-type: text/html\r\n";
+                            if (cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_HEADER) != NULL) {
+                                header = cJSON_GetObjectItemCaseSensitive(json_action_network, NETWORK_ACTION_HEADER)->valuestring;
+                            }
+                            
+                            if (!net_template_compile(&action_network->url, url) ||
+                                !net_template_compile(&action_network->header, header) ||
+                                !net_template_compile(&action_network->content, content)) {
+                                ERROR("Network Action %i templates", new_int_action);
+                                
+                                net_template_free(&action_network->url);
+                                net_template_free(&action_network->header);
+                                net_template_free(&action_network->content);
+                                free(action_network->host);
+                                free(action_network);
+                                continue;
+                            }
+                            
+                            uint16_t req_size = net_template_size(&action_network->content) + 1;
+                            if (action_network->method_n != 3) {
+                                req_size += net_head_size(action_network);
+                            }
+                            
+                            if (req_size > main_config.net_buffer_size) {
+                                main_config.net_buffer_size = req_size;
+                            }
                         }
                         
                         action_network->next = last_action;
@@ -6222,7 +7910,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6232,7 +7922,7 @@ void normal_mode_init() {
     }
     
     // IR TX Actions
-    inline void new_action_ir_tx(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_ir_tx(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_ir_tx_t* last_action = ch_group->action_ir_tx;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6287,7 +7977,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6297,7 +7989,7 @@ void normal_mode_init() {
     }
     
     // UART Actions
-    inline void new_action_uart(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action) {
+    inline void new_action_uart(ch_group_t* ch_group, cJSON* json_context, uint8_t fixed_action, const uint64_t actions_map) {
         action_uart_t* last_action = ch_group->action_uart;
         
         void register_action(cJSON* json_accessory, uint8_t new_int_action) {
@@ -6339,7 +8031,9 @@ void normal_mode_init() {
         
         if (fixed_action < MAX_ACTIONS) {
             for (uint8_t int_action = 0; int_action < MAX_ACTIONS; int_action++) {
-                register_action(json_context, int_action);
+                if (actions_map & (1ULL << int_action)) {
+                    register_action(json_context, int_action);
+                }
             }
         } else {
             register_action(json_context, fixed_action);
@@ -6349,13 +8043,34 @@ void normal_mode_init() {
     }
     
     void register_actions(ch_group_t* ch_group, cJSON* json_accessory, uint8_t fixed_action) {
-        new_action_copy(ch_group, json_accessory, fixed_action);
-        new_action_binary_output(ch_group, json_accessory, fixed_action);
-        new_action_acc_manager(ch_group, json_accessory, fixed_action);
-        new_action_system(ch_group, json_accessory, fixed_action);
-        new_action_network(ch_group, json_accessory, fixed_action);
-        new_action_ir_tx(ch_group, json_accessory, fixed_action);
-        new_action_uart(ch_group, json_accessory, fixed_action);
+        // Action keys are found with a single pass over the object, instead of looking up every possible action
+        uint64_t actions_map = 0;
+        if (fixed_action < MAX_ACTIONS) {
+            cJSON* json_item;
+            cJSON_ArrayForEach(json_item, json_accessory) {
+                if (!json_item->string) {
+                    continue;
+                }
+                
+                char* key_end = NULL;
+                const long int_action = strtol(json_item->string, &key_end, 10);
+                if (key_end != json_item->string && *key_end == 0 && int_action >= 0 && int_action < MAX_ACTIONS) {
+                    char action[3];
+                    itoa(int_action, action, 10);
+                    if (strcmp(action, json_item->string) == 0) {
+                        actions_map |= 1ULL << int_action;
+                    }
+                }
+            }
+        }
+        
+        new_action_copy(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_binary_output(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_acc_manager(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_system(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_network(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_ir_tx(ch_group, json_accessory, fixed_action, actions_map);
+        new_action_uart(ch_group, json_accessory, fixed_action, actions_map);
     }
     
     void register_wildcard_actions(ch_group_t* ch_group, cJSON* json_accessory) {
@@ -6457,6 +8172,16 @@ void normal_mode_init() {
         return 1;
     }
     
+    uint8_t ds18b20_resolution(cJSON* json_accessory) {
+        if (cJSON_GetObjectItemCaseSensitive(json_accessory, DS18B20_RESOLUTION) != NULL) {
+            const uint8_t resolution = (uint8_t) cJSON_GetObjectItemCaseSensitive(json_accessory, DS18B20_RESOLUTION)->valuedouble;
+            if (resolution >= DS18B20_RESOLUTION_MIN && resolution <= DS18B20_RESOLUTION_DEFAULT) {
+                return resolution;
+            }
+        }
+        return DS18B20_RESOLUTION_DEFAULT;
+    }
+    
     float sensor_poll_period(cJSON* json_accessory, float poll_period) {
         if (cJSON_GetObjectItemCaseSensitive(json_accessory, TEMPERATURE_SENSOR_POLL_PERIOD) != NULL) {
             poll_period = (float) cJSON_GetObjectItemCaseSensitive(json_accessory, TEMPERATURE_SENSOR_POLL_PERIOD)->valuedouble;
@@ -6486,15 +8211,107 @@ void normal_mode_init() {
         TH_SENSOR_TEMP_OFFSET = th_sensor_temp_offset(json_accessory);
         TH_SENSOR_HUM_OFFSET = th_sensor_hum_offset(json_accessory);
         TH_SENSOR_ERROR_COUNT = 0;
+        
+        const float poll_period = sensor_poll_period(json_accessory, TH_SENSOR_POLL_PERIOD_DEFAULT);
+        
         if ((uint8_t) TH_SENSOR_TYPE == 3) {
             TH_SENSOR_INDEX = th_sensor_index(json_accessory);
+            ds18b20_bus_new(TH_SENSOR_GPIO, ds18b20_resolution(json_accessory), poll_period);
+        }
+        
+        return poll_period;
+    }
+    
+    // Deadband can be an array with one value for each sensor characteristic
+    void notify_policies_new(ch_group_t* ch_group, const uint8_t chs_n, cJSON* json_accessory) {
+        cJSON* json_deadband = cJSON_GetObjectItemCaseSensitive(json_accessory, NOTIFY_DEADBAND);
+        cJSON* json_min_interval = cJSON_GetObjectItemCaseSensitive(json_accessory, NOTIFY_MIN_INTERVAL);
+        cJSON* json_max_stale = cJSON_GetObjectItemCaseSensitive(json_accessory, NOTIFY_MAX_STALE);
+        
+        if (!json_deadband && !json_min_interval && !json_max_stale) {
+            return;
+        }
+        
+        notify_policy_t* notify_policies = notify_policies_create(ch_group, chs_n);
+        if (!notify_policies) {
+            ERROR("<%i> Notify policies", ch_group->accessory);
+            return;
+        }
+        
+        for (uint8_t i = 0; i < ch_group->notify_policies_n; i++) {
+            notify_policy_t* notify_policy = &notify_policies[i];
+            if (!notify_policy->ch) {
+                continue;
+            }
+            
+            if (cJSON_IsArray(json_deadband)) {
+                if (i < cJSON_GetArraySize(json_deadband)) {
+                    notify_policy->deadband = (float) cJSON_GetArrayItem(json_deadband, i)->valuedouble;
+                }
+            } else if (json_deadband) {
+                notify_policy->deadband = (float) json_deadband->valuedouble;
+            }
+            
+            if (json_min_interval) {
+                notify_policy->min_interval = MS_TO_TICKS(json_min_interval->valuedouble * 1000);
+            }
+            
+            if (json_max_stale) {
+                notify_policy->max_stale = MS_TO_TICKS(json_max_stale->valuedouble * 1000);
+            }
+        }
+    }
+    
+    sensor_job_t* sensor_job_new(ch_group_t* ch_group, bool (*read)(sensor_job_t*), const float poll_period, const uint8_t filters_n, cJSON* json_accessory) {
+        sensor_job_t* sensor_job = malloc(sizeof(sensor_job_t));
+        memset(sensor_job, 0, sizeof(*sensor_job));
+        
+        sensor_job->ch_group = ch_group;
+        sensor_job->read = read;
+        sensor_job->bus_gpio = -1;
+        sensor_job->filters_n = filters_n;
+        
+        sensor_job->period = MS_TO_TICKS(poll_period * 1000);
+        if (sensor_job->period == 0) {
+            sensor_job->period = 1;
+        }
+        
+        if (cJSON_GetObjectItemCaseSensitive(json_accessory, SENSOR_FILTER_WINDOW) != NULL) {
+            uint8_t filter_window = (uint8_t) cJSON_GetObjectItemCaseSensitive(json_accessory, SENSOR_FILTER_WINDOW)->valuedouble;
+            if (filter_window > SENSOR_FILTER_WINDOW_MAX) {
+                filter_window = SENSOR_FILTER_WINDOW_MAX;
+            }
+            sensor_job->filter_window = filter_window;
+        }
+        
+        if (cJSON_GetObjectItemCaseSensitive(json_accessory, SENSOR_FILTER_EMA) != NULL) {
+            const float filter_ema = (float) cJSON_GetObjectItemCaseSensitive(json_accessory, SENSOR_FILTER_EMA)->valuedouble;
+            if (filter_ema > 0 && filter_ema < 1) {
+                sensor_job->filter_ema = filter_ema;
+            }
+        }
+        
+        if (sensor_job->filter_window > 1 || sensor_job->filter_ema > 0) {
+            sensor_job->filters = calloc(filters_n, sizeof(sensor_filter_t));
         }
         
-        return sensor_poll_period(json_accessory, TH_SENSOR_POLL_PERIOD_DEFAULT);
+        sensor_job->next = main_config.sensor_jobs;
+        main_config.sensor_jobs = sensor_job;
+        
+        return sensor_job;
     }
     
-    void th_sensor_starter(ch_group_t* ch_group, float poll_period) {
-        ch_group->timer = esp_timer_create(poll_period * 1000, true, (void*) ch_group, temperature_timer_worker);
+    // Started by delayed_sensor_task()
+    void th_sensor_starter(ch_group_t* ch_group, float poll_period, cJSON* json_accessory) {
+        sensor_job_t* sensor_job = sensor_job_new(ch_group, temperature_sensor_read, poll_period, 2, json_accessory);
+        
+        if (ch_group->acc_type != ACC_TYPE_IAIRZONING) {
+            notify_policies_new(ch_group, 2, json_accessory);
+            
+            if ((uint8_t) TH_SENSOR_TYPE == 3) {
+                sensor_job->bus_gpio = TH_SENSOR_GPIO;
+            }
+        }
     }
     
     uint8_t virtual_stop(cJSON* json_accessory) {
@@ -6625,9 +8442,15 @@ void normal_mode_init() {
     free(log_output_target);
 
     printf_header();
-    INFO("NORMAL MODE\n\nJSON:\n %s\n", txt_config);
+    INFO("NORMAL MODE\n");
     
-    free(txt_config);
+    if (config_image) {
+        INFO("Config image loaded\n");
+    } else if (config_image_status > 0) {
+        INFO("Config image saved, %i Bytes\n", config_image_status);
+    } else {
+        ERROR("Config image %i\n", config_image_status);
+    }
 
     // Custom Hostname
     char* custom_hostname = name.value.string_value;
@@ -6717,6 +8540,7 @@ void normal_mode_init() {
                 i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &byte_zeros, 1);
             }
             
+            bool has_inputs = false;
             for (uint8_t channel = 0; channel < 2; channel++) {
                 uint16_t mcp_mode = 258;    // Default set to INPUT and not pullup
                 if (channel == 0) {
@@ -6736,6 +8560,13 @@ void normal_mode_init() {
                 
                 uint8_t reg = channel;
                 if (mcp_mode > 255) {   // Mode INPUT
+                    has_inputs = true;
+                    
+                    // Interrupt on change of all inputs, used only if INT pin is wired
+                    reg += MCP_REG_GPINTENA;
+                    i2c_slave_write(mcp23017->bus, mcp23017->addr, &reg, 1, &byte_ones, 1);
+                    reg = channel;
+                    
                     switch (mcp_mode) {
                         case 256:
                             // Pull-up HIGH
@@ -6787,6 +8618,24 @@ void normal_mode_init() {
                     }
                 }
             }
+            
+            // INT pin wired to a GPIO, so inputs are read only when they change
+            if (has_inputs && cJSON_GetArrayItem(json_mcp23017, MCP23017_INT_GPIO_POS) != NULL) {
+                const uint8_t int_gpio = (uint8_t) cJSON_GetArrayItem(json_mcp23017, MCP23017_INT_GPIO_POS)->valuedouble;
+                
+                if (int_gpio < 16 && !get_used_gpio(int_gpio)) {  // GPIO16 has no interrupts
+                    set_used_gpio(int_gpio);
+                    
+                    // INTA and INTB mirrored, as open-drain
+                    mcp_reg = MCP_REG_IOCON;
+                    const uint8_t iocon = MCP_IOCON_MIRROR | MCP_IOCON_ODR;
+                    i2c_slave_write(mcp23017->bus, mcp23017->addr, &mcp_reg, 1, &iocon, 1);
+                    
+                    INFO("MCP23017 %i INT: %i", mcp23017->index, int_gpio);
+                    
+                    adv_button_set_mcp_interrupt(mcp23017->index, mcp23017->bus, mcp23017->addr, int_gpio);
+                }
+            }
         }
     }
     
@@ -7012,8 +8861,8 @@ void normal_mode_init() {
     uint16_t hk_total_ac = 1;
     bool bridge_needed = false;
 
-    for (uint16_t i = 0; i < total_accessories; i++) {
-        cJSON* json_accessory = cJSON_GetArrayItem(json_accessories, i);
+    cJSON* json_accessory;
+    cJSON_ArrayForEach(json_accessory, json_accessories) {
         if (acc_homekit_enabled(json_accessory) && get_acc_type(json_accessory) != ACC_TYPE_IAIRZONING) {
             hk_total_ac += 1;
         }
@@ -7031,10 +8880,6 @@ void normal_mode_init() {
     uint16_t service_numerator = 0;
     uint16_t acc_count = 0;
     
-    // HomeKit last config number
-    int last_config_number = 1;
-    sysparam_get_int32(LAST_CONFIG_NUMBER_SYSPARAM, &last_config_number);
-    
     //uint16_t service_iid = 100;
     
     void new_accessory(const uint16_t accessory, uint16_t services, const bool homekit_enabled, cJSON* json_context) {
@@ -7895,7 +9740,7 @@ void normal_mode_init() {
         }
         
         if ((TH_SENSOR_GPIO != -1 || TH_SENSOR_TYPE > 4) && TH_IAIRZONING_CONTROLLER == 0) {
-            th_sensor_starter(ch_group, poll_period);
+            th_sensor_starter(ch_group, poll_period, json_context);
         }
         
         diginput_register(cJSON_GetObjectItemCaseSensitive(json_context, BUTTONS_ARRAY), th_input, ch_group, 9);
@@ -7954,7 +9799,7 @@ void normal_mode_init() {
         
         ch_group->timer2 = esp_timer_create(th_update_delay(json_context) * 1000, false, (void*) ch_group, set_zones_timer_worker);
         
-        th_sensor_starter(ch_group, sensor_poll_period(json_context, TH_SENSOR_POLL_PERIOD_DEFAULT));
+        th_sensor_starter(ch_group, sensor_poll_period(json_context, TH_SENSOR_POLL_PERIOD_DEFAULT), json_context);
     }
     
     // *** NEW TEMPERATURE SENSOR
@@ -8002,7 +9847,7 @@ void normal_mode_init() {
         }
         
         if (TH_SENSOR_GPIO != -1 || TH_SENSOR_TYPE > 4) {
-            th_sensor_starter(ch_group, poll_period);
+            th_sensor_starter(ch_group, poll_period, json_context);
         }
     }
     
@@ -8048,7 +9893,7 @@ void normal_mode_init() {
         
         if (TH_SENSOR_GPIO != -1) {
             set_used_gpio((uint8_t) TH_SENSOR_GPIO);
-            th_sensor_starter(ch_group, poll_period);
+            th_sensor_starter(ch_group, poll_period, json_context);
         }
     }
     
@@ -8114,7 +9959,7 @@ void normal_mode_init() {
         
         if (TH_SENSOR_GPIO != -1) {
             set_used_gpio((uint8_t) TH_SENSOR_GPIO);
-            th_sensor_starter(ch_group, poll_period);
+            th_sensor_starter(ch_group, poll_period, json_context);
         }
     }
     
@@ -8276,7 +10121,7 @@ void normal_mode_init() {
         }
         
         if (TH_SENSOR_GPIO != -1 || TH_SENSOR_TYPE > 4) {
-            th_sensor_starter(ch_group, poll_period);
+            th_sensor_starter(ch_group, poll_period, json_context);
         }
         
         diginput_register(cJSON_GetObjectItemCaseSensitive(json_context, BUTTONS_ARRAY), humidif_input, ch_group, 9);
@@ -8454,6 +10299,10 @@ void normal_mode_init() {
                 addressled->period = cJSON_GetArrayItem(nrz_times, 2)->valuedouble;
             }
             
+            if (cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_NRZ_CRITICAL_FALLBACK_SET) != NULL) {
+                addressled->critical_fallback = (bool) cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_NRZ_CRITICAL_FALLBACK_SET)->valuedouble;
+            }
+            
             cJSON* color_map = cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_COLOR_MAP_SET);
             if (color_map) {
                 const uint8_t size = cJSON_GetArraySize(color_map);
@@ -8484,6 +10333,10 @@ void normal_mode_init() {
                 LIGHTBULB_CURVE_FACTOR = (float) cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_CURVE_FACTOR_SET)->valuedouble;
             }
             
+            if (cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_BRIGHTNESS_CURVE_SET) != NULL) {
+                LIGHTBULB_BRIGHTNESS_CURVE = (bool) cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_BRIGHTNESS_CURVE_SET)->valuedouble;
+            }
+            
             if (cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_FLUX_ARRAY_SET) != NULL) {
                 cJSON* flux_array = cJSON_GetObjectItemCaseSensitive(json_context, LIGHTBULB_FLUX_ARRAY_SET);
                 for (uint8_t i = 0; i < LIGHTBULB_CHANNELS; i++) {
@@ -8546,6 +10399,10 @@ void normal_mode_init() {
             }
             
             INFO("White point [%g, %g]", lightbulb_group->wp[0], lightbulb_group->wp[1]);
+            
+            if (LIGHTBULB_CHANNELS >= 3 && !lightbulb_color_table_build(ch_group)) {
+                ERROR("Color table");
+            }
         }
         
         if (cJSON_GetObjectItemCaseSensitive(json_context, RGBW_STEP_SET) != NULL) {
@@ -9008,7 +10865,8 @@ void normal_mode_init() {
         }
         
         const float poll_period = sensor_poll_period(json_context, LIGHT_SENSOR_POLL_PERIOD_DEFAULT);
-        esp_timer_start(esp_timer_create(poll_period * 1000, true, (void*) ch_group, light_sensor_timer_worker));
+        sensor_job_start(sensor_job_new(ch_group, light_sensor_read, poll_period, 1, json_context), poll_period * 1000);
+        notify_policies_new(ch_group, 1, json_context);
     }
     
     // *** NEW SECURITY SYSTEM
@@ -9520,11 +11378,16 @@ void normal_mode_init() {
                 PM_SENSOR_HLW_GPIO = data[1];
             }
             
-            adv_hlw_unit_create(data[0], data[1], data[2], (uint8_t) PM_SENSOR_TYPE);
+            if (adv_hlw_unit_create(data[0], data[1], data[2], (uint8_t) PM_SENSOR_TYPE) < 0) {
+                ERROR("<%i> Creating HLW", ch_group->accessory);
+            }
         }
 
         PM_POLL_PERIOD = sensor_poll_period(json_context, PM_POLL_PERIOD_DEFAULT);
-        esp_timer_start(esp_timer_create(PM_POLL_PERIOD * 1000, true, (void*) ch_group, power_monitor_timer_worker));
+        sensor_job_start(sensor_job_new(ch_group, power_monitor_read, PM_POLL_PERIOD, 3, json_context), PM_POLL_PERIOD * 1000);
+        
+        // Consumption is not filtered, but it has a notification policy
+        notify_policies_new(ch_group, 4, json_context);
     }
     
     // *** HISTORICAL
@@ -9712,10 +11575,10 @@ void normal_mode_init() {
         FREEHEAP();
     }
     
+    json_accessory = json_accessories->child;
     for (uint16_t i = 0; i < total_accessories; i++) {
         INFO("\n** ACCESSORY %i", i + 1);
         
-        cJSON* json_accessory = cJSON_GetArrayItem(json_accessories, i);
         uint8_t acc_type = get_acc_type(json_accessory);
         
         uint8_t service = 0;
@@ -9727,9 +11590,8 @@ void normal_mode_init() {
                 service += get_service_recount(acc_type, json_accessory);
 
                 cJSON* json_extra_services = cJSON_GetObjectItemCaseSensitive(json_accessory, EXTRA_SERVICES_ARRAY);
-                for (uint16_t m = 0; m < cJSON_GetArraySize(json_extra_services); m++) {
-                    cJSON* json_extra_service = cJSON_GetArrayItem(json_extra_services, m);
-                    
+                cJSON* json_extra_service;
+                cJSON_ArrayForEach(json_extra_service, json_extra_services) {
                     acc_type = get_acc_type(json_extra_service);
                     new_service(acc_count, service, 0, json_extra_service, acc_type);
                     service += get_service_recount(acc_type, json_extra_service);
@@ -9755,6 +11617,11 @@ void normal_mode_init() {
             vTaskDelay(cJSON_GetObjectItemCaseSensitive(json_accessory, ACC_CREATION_DELAY)->valuedouble * MS_TO_TICKS(1000));
         }
         
+        // Accessory JSON is not needed anymore
+        cJSON* json_next_accessory = json_accessory->next;
+        cJSON_Delete(cJSON_DetachItemViaPointer(json_accessories, json_accessory));
+        json_accessory = json_next_accessory;
+        
         taskYIELD();
     }
     
@@ -9852,6 +11719,10 @@ void normal_mode_init() {
     
     cJSON_Delete(json_haa);
     cJSON_Delete(init_last_state_json);
+    free(config_image);
+    
+    compile_all_actions();
+    ch_group_index_build();
     
     if (xTaskCreate(delayed_sensor_task, "delayed", DELAYED_SENSOR_START_TASK_SIZE, NULL, DELAYED_SENSOR_START_TASK_PRIORITY, NULL) != pdPASS) {
         ERROR("Creating delayed_sensor");
@@ -10015,6 +11886,8 @@ void user_init(void) {
             
             name.value = HOMEKIT_STRING(main_config.name_value);
             
+            main_config.network_mutex = xSemaphoreCreateMutex();
+            
             xTaskCreate(normal_mode_init, "init", INITIAL_SETUP_TASK_SIZE, NULL, INITIAL_SETUP_TASK_PRIORITY, NULL);
             
         } else {
@@ -40,6 +40,7 @@
 #include <timers_helper.h>
 
 #include "header.h"
+#include "config_image.h"
 
 #define SETUP_ANNOUNCER_DESTINATION     "255.255.255.255"
 #define SETUP_ANNOUNCER_PORT            "4567"
@@ -632,12 +633,22 @@ static void wifi_config_server_on_settings_update_task(void* args) {
             sysparam_set_data(saved_state_id, NULL, 0, false);
         }
         
-        if (conf_param && conf_param->value) {
-            sysparam_set_string(HAA_JSON_SYSPARAM, conf_param->value);
-        } else {
-            sysparam_set_string(HAA_JSON_SYSPARAM, "");
+        // Compiled config image is made again from new config. It is removed first, so its space is free for new config
+        sysparam_status_t status = sysparam_set_data(HAA_CONFIG_IMAGE_SYSPARAM, NULL, 0, false);
+        if (status != SYSPARAM_OK) {
+            ERROR("Removing config image (%i)", status);
         }
         
+        const char* txt_config = (conf_param && conf_param->value) ? conf_param->value : "";
+        status = sysparam_set_string(HAA_JSON_SYSPARAM, txt_config);
+        
+        if (status != SYSPARAM_OK) {
+            ERROR("Saving config (%i)", status);
+        }
+        
+        // Image is checked with this hash, so JSON is not read again to make sure image matches it
+        sysparam_set_int32(HAA_JSON_HASH_SYSPARAM, config_image_hash((uint8_t*) txt_config, strlen(txt_config)));
+        
         if (autoota_param) {
             sysparam_set_bool(AUTO_OTA_SYSPARAM, true);
         } else {
@@ -58,6 +58,19 @@ typedef struct _action_system {
     struct _action_system* next;
 } action_system_t;
 
+typedef struct _net_wildcard {
+    uint16_t pos;       // Position in template text
+    uint8_t acc;        // 0 for own accessory
+    uint8_t ch_n;
+} net_wildcard_t;
+
+typedef struct _net_template {
+    char* text;         // Without wildcards
+    uint16_t len;
+    uint8_t wildcards_n;
+    net_wildcard_t* wildcards;
+} net_template_t;
+
 typedef struct _action_network {
     uint8_t action;
     
@@ -72,9 +85,9 @@ typedef struct _action_network {
     
     union {
         struct {
-            char* url;
-            char* header;
-            char* content;
+            net_template_t url;
+            net_template_t header;
+            net_template_t content;
         };
         uint8_t* raw;
     };
@@ -82,6 +95,28 @@ typedef struct _action_network {
     struct _action_network* next;
 } action_network_t;
 
+typedef struct _net_dns_cache {
+    char* host;     // NULL if empty
+    uint32_t time;
+    struct sockaddr_in addr;
+} net_dns_cache_t;
+
+typedef struct _net_pool_conn {
+    char* host;     // NULL if empty
+    uint16_t port_n;
+    uint16_t requests;
+    int socket;
+    uint32_t time;
+} net_pool_conn_t;
+
+typedef struct _net_reader {
+    int socket;
+    uint8_t pos;
+    uint8_t len;
+    uint16_t printed;
+    uint8_t buffer[64];
+} net_reader_t;
+
 typedef struct _action_ir_tx {
     uint8_t action;
     uint8_t freq;
@@ -97,6 +132,10 @@ typedef struct _action_ir_tx {
         };
     };
     
+    uint16_t ir_code_len;
+    uint16_t* ir_code;      // Decoded code, NULL if not cached
+    struct _action_ir_tx* cache_next;
+    
     struct _action_ir_tx* next;
 } action_ir_tx_t;
 
@@ -121,14 +160,29 @@ typedef struct _wildcard_action {
     struct _wildcard_action* next;
 } wildcard_action_t;
 
+typedef struct _action_entry {
+    uint8_t action;
+    
+    action_copy_t* action_copy;
+    action_binary_output_t* action_binary_output;
+    action_acc_manager_t* action_acc_manager;
+    action_system_t* action_system;
+    action_network_t* action_network;
+    action_ir_tx_t* action_ir_tx;
+    action_uart_t* action_uart;
+} action_entry_t;
+
 typedef struct _ch_group {
     uint16_t accessory: 10;
     bool main_enabled: 1;
     bool child_enabled: 1;
     bool homekit_enabled: 1;
+    bool action_compiled: 1;
     
     uint8_t chs;
     uint8_t acc_type: 7;
+    uint16_t action_entries;
+    uint8_t notify_policies_n;
     
     homekit_characteristic_t** ch;
     
@@ -151,6 +205,10 @@ typedef struct _ch_group {
     action_ir_tx_t* action_ir_tx;
     action_uart_t* action_uart;
     
+    action_entry_t* action_entry;       // Sorted by action, filled by compile_actions()
+    struct _lightbulb_group* lightbulb_group;
+    struct _notify_policy* notify_policies;     // By characteristic number, filled by notify_policies_create()
+    
     wildcard_action_t* wildcard_action;
     
     struct _ch_group* next;
@@ -158,9 +216,26 @@ typedef struct _ch_group {
 
 typedef struct _action_task {
     uint8_t action;
+    uint8_t type;
+    uint32_t time;
     ch_group_t* ch_group;
 } action_task_t;
 
+// Colors at full brightness, shared by lightbulbs with same channels and color settings
+typedef struct _color_table {
+    ch_group_t* ch_group;       // Lightbulb whose settings built the table
+    uint16_t* colors;           // Rows of every hue column, for each color region
+    
+    uint16_t column[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_HUES];         // First color of hue column
+    uint8_t rows_start[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_HUES];
+    uint8_t rows_end[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_HUES];
+    uint8_t float_cells[LIGHTBULB_COLOR_REGIONS][LIGHTBULB_COLOR_TABLE_CELLS_BYTES];  // Cells that must use hsi2rgbw_float()
+    
+    int32_t forms[LIGHTBULB_COLOR_FORMS][3];    // Region tests of gamma corrected wheel color
+    
+    struct _color_table* next;
+} color_table_t;
+
 typedef struct _lightbulb_group {
     uint16_t autodimmer: 10;
     uint8_t channels:3;
@@ -170,6 +245,7 @@ typedef struct _lightbulb_group {
     uint8_t autodimmer_task_step;
     uint8_t type: 6;
     bool has_changed: 1;
+    bool brightness_curve: 1;
     //bool temp_changed: 1;
     
     uint16_t pwm_dither;
@@ -199,6 +275,8 @@ typedef struct _lightbulb_group {
     float cmy[3][2];
     
     float wp[2];
+    
+    color_table_t* color_table;     // NULL if it could not be built
 
     homekit_characteristic_t* ch0;
     
@@ -216,6 +294,12 @@ typedef struct _addressled {
     uint16_t time_0;
     uint16_t time_1;
     uint16_t period;
+    uint16_t pending_end;   // Not completed frame is sent again on next tick
+    
+    bool critical_fallback;
+    uint8_t failed_frames;
+    
+    uint8_t* colors;    // Frame buffer
     
     struct _addressled* next;
 } addressled_t;
@@ -244,12 +328,6 @@ typedef struct _ping_input {
     struct _ping_input* next;
 } ping_input_t;
 
-typedef struct _str_ch_value {
-    char* string;
-
-    struct _str_ch_value* next;
-} str_ch_value_t;
-
 typedef struct _mcp23017 {
     uint8_t index;
     uint8_t bus;
@@ -257,10 +335,77 @@ typedef struct _mcp23017 {
     uint8_t a_outs;
     
     uint8_t b_outs;
+    uint8_t dirty: 2;       // Ports with outputs changed during a batch: MCP_PORT_A, MCP_PORT_B
     
     struct _mcp23017* next;
 } mcp23017_t;
 
+typedef struct _sensor_filter {
+    float samples[SENSOR_FILTER_WINDOW_MAX];
+    float ema;
+    uint8_t samples_n;
+    uint8_t pos: 7;
+    bool has_ema: 1;
+} sensor_filter_t;
+
+typedef struct _sensor_job {
+    ch_group_t* ch_group;
+    bool (*read)(struct _sensor_job* sensor_job);  // Returns false if sensor could not be read
+    
+    int8_t bus_gpio;            // Sensors sharing a bus are read together. -1 if none
+    bool is_enabled: 1;
+    uint8_t filter_window: 3;   // Median of last samples. 0 or 1 to disable
+    uint8_t filters_n: 3;
+    float filter_ema;           // Weight of new sample. 0 to disable
+    sensor_filter_t* filters;   // One per value given by sensor
+    
+    uint32_t period;            // Ticks
+    uint32_t next_time;
+    
+    uint16_t samples;
+    uint16_t errors;
+    uint32_t latency_last;      // ms, from scheduled time until sample is processed
+    uint32_t latency_max;
+    
+    struct _sensor_job* next;
+} sensor_job_t;
+
+typedef struct _notify_policy {
+    homekit_characteristic_t* ch;
+    ch_group_t* ch_group;
+    
+    bool has_notified: 1;
+    float deadband;             // Minimum change from last notified value
+    float last_value;           // Last notified value
+    
+    uint32_t min_interval;      // Ticks
+    uint32_t max_stale;         // Ticks a smaller change can wait. 0 to wait until deadband is reached
+    uint32_t last_time;
+    
+    uint16_t sent;
+    uint16_t suppressed;
+    
+    struct _notify_policy* next;
+} notify_policy_t;
+
+typedef struct _ds18b20_bus {
+    uint8_t gpio;
+    uint8_t devices_n;
+    uint8_t resolution;         // Bits, from 9 to 12
+    bool is_scan_needed: 1;
+    bool has_data: 1;
+    
+    uint32_t max_age;           // Ticks a read cycle is valid for all accessories on bus
+    uint32_t last_read;
+    
+    ds18b20_addr_t* addrs;      // ROM codes found by last scan
+    float* temps;               // NAN if sensor could not be read
+    
+    SemaphoreHandle_t mutex;
+    
+    struct _ds18b20_bus* next;
+} ds18b20_bus_t;
+
 typedef struct _led {
     uint16_t gpio;
     uint8_t count;
@@ -319,11 +464,16 @@ typedef struct _main_config {
     TimerHandle_t set_lightbulb_timer;
     
     ch_group_t* ch_groups;
+    ch_group_t** ch_groups_by_acc;      // Indexed by accessory number, filled by ch_group_index_build()
+    uint16_t ch_groups_by_acc_size;
     ping_input_t* ping_inputs;
     lightbulb_group_t* lightbulb_groups;
+    color_table_t* color_tables;
     last_state_t* last_states;
     
     mcp23017_t* mcp23017s;
+    uint8_t mcp_batch;                  // Nested batches of mcp_batch_task
+    TaskHandle_t mcp_batch_task;
     
     char* ntp_host;
     timetable_action_t* timetable_actions;
@@ -331,6 +481,34 @@ typedef struct _main_config {
     led_t* status_led;
     
     addressled_t* addressleds;
+    
+    ds18b20_bus_t* ds18b20_buses;
+    
+    sensor_job_t* sensor_jobs;
+    TaskHandle_t sensor_scheduler_task;
+    notify_policy_t* notify_policies;
+    
+    QueueHandle_t action_queues[ACTION_TASK_TYPES];
+    SemaphoreHandle_t action_wakeup;    // Given when a job may have become runnable
+    uint8_t action_workers;
+    uint8_t action_workers_busy;
+    uint8_t action_running[ACTION_TASK_TYPES];
+    uint8_t action_queue_peak;
+    uint8_t action_lists_readers;       // Tasks walking action lists, see action_lists_read_begin()
+    bool action_lists_compiling;        // Not a bitfield, it is only changed inside critical sections
+    uint16_t action_drops;
+    uint32_t action_latency_max;
+    uint32_t action_latency_last;
+    
+    SemaphoreHandle_t network_mutex;
+    TimerHandle_t net_pool_timer;
+    net_pool_conn_t net_pool[NETWORK_POOL_SIZE];
+    net_dns_cache_t net_dns_cache[NETWORK_DNS_CACHE_SIZE];
+    action_ir_tx_t* ir_code_cache;
+    uint16_t ir_code_cache_size;
+    
+    char* net_buffer;
+    uint16_t net_buffer_size;       // Largest rendered request of all network actions
 } main_config_t;
 
 #endif // __HAA_TYPES_H__
@@ -570,10 +570,23 @@ static void wifi_config_server_on_settings_update_task(void* args) {
         
         sysparam_set_int8(HAA_SETUP_MODE_SYSPARAM, 0);
         
+        // Compiled config image is made again from new config. It is removed first, so its space is free for new config
+        sysparam_status_t status = sysparam_set_data(HAA_CONFIG_IMAGE_SYSPARAM, NULL, 0, false);
+        if (status != SYSPARAM_OK) {
+            ERROR("Removing config image (%i)", status);
+        }
+        
+        // Installer has no config hash, so it is removed and HAA reads JSON to make it
+        sysparam_set_data(HAA_JSON_HASH_SYSPARAM, NULL, 0, false);
+        
         if (conf_param && conf_param->value) {
-            sysparam_set_string(HAA_JSON_SYSPARAM, conf_param->value);
+            status = sysparam_set_string(HAA_JSON_SYSPARAM, conf_param->value);
         } else {
-            sysparam_set_string(HAA_JSON_SYSPARAM, "");
+            status = sysparam_set_string(HAA_JSON_SYSPARAM, "");
+        }
+        
+        if (status != SYSPARAM_OK) {
+            ERROR("Saving config (%i)", status);
         }
         
         if (autoota_param) {
@@ -50,6 +50,12 @@ static WOLFSSL_CTX* ctx;
 static char last_host[HOST_LEN];
 static char last_location[RECV_BUF_LEN];
 
+// SHA-384 of last downloaded file, computed while it is written to flash
+static Sha384 file_sha;
+static byte file_hash[HASHSIZE];
+static int file_hash_sector = 0;
+static int file_hash_size = 0;
+
 #ifdef DEBUG_WOLFSSL    
 void MyLoggingCallback(const int logLevel, const char* const logMessage) {
     /*custom logging function*/
@@ -57,6 +63,7 @@ void MyLoggingCallback(const int logLevel, const char* const logMessage) {
 }
 #endif
 
+// --- HTTP
 static char *strstr_lc(char *full_string, const char *search) {
     const size_t search_len = strlen(search);
     for (size_t i = 0; i <= strlen(full_string) - search_len; i++) {
@@ -225,6 +232,21 @@ static int ota_connect(char* host, uint16_t port, int *socket, WOLFSSL** ssl, co
     return 0;
 }
 
+static void ota_disconnect(const int retc, const int socket, WOLFSSL* ssl, const bool is_ssl) {
+    switch (retc) {
+        case  0:
+        case -1:
+            if (is_ssl) {
+                wolfSSL_free(ssl);
+            }
+        case -2:
+            lwip_close(socket);
+        case -3:
+        default:
+        ;
+    }
+}
+
 static int ota_get_final_location(char* repo, char* file, uint16_t port, const bool is_ssl) {
     int retc;
     int ret = 0;
@@ -302,7 +324,7 @@ static int ota_get_final_location(char* repo, char* file, uint16_t port, const b
                     if (ret > 0) {
                         all_ok = true;
                         buffer_len += strlen(recv_buf);
-                        buffer = realloc(buffer, buffer_len);
+                        buffer = realloc(buffer, buffer_len + 1);   // And final NUL
                         strcat(buffer, recv_buf);
                     }
                     
@@ -366,19 +388,7 @@ static int ota_get_final_location(char* repo, char* file, uint16_t port, const b
             }
         }
 
-        switch (retc) {
-            case  0:
-            case -1:
-                if (is_ssl) {
-                    wolfSSL_free(ssl);
-                }
-            case -2:
-                lwip_close(socket);
-            case -3:
-            default:
-            ;
-        }
-    
+        ota_disconnect(retc, socket, ssl, is_ssl);
     }
     
     if (buffer) {
@@ -420,6 +430,300 @@ static void sign_check_client(const int set) {
 }
 #endif  // HAABOOT
 
+// --- UNPACK
+// Packed image unpacking. Output is built one flash sector at a time in RAM
+static struct {
+    byte* sector_buffer;
+    int sector;
+    int size;
+    int base_size;          // 0 if image is not a delta
+    int pos;
+    uint16_t literal_left;
+    uint8_t op;
+    uint8_t args_len;
+    uint8_t args_need;
+    byte args[PACKHEADERSIZE];
+} unpack;
+
+static int unpack_flush() {
+    const int sector_start = (unpack.pos - 1) & ~(SPI_FLASH_SECTOR_SIZE - 1);
+    const int len = unpack.pos - sector_start;
+    
+    wc_Sha384Update(&file_sha, unpack.sector_buffer, len);
+    
+    printf("Sector 0x%05X ", unpack.sector + sector_start);
+    if (!spiflash_erase_sector(unpack.sector + sector_start)) {
+        return -6;
+    }
+    
+    if (sector_start == 0) {    // Do not write the first byte yet but store it for later
+        file_first_byte[0] = unpack.sector_buffer[0];
+        if (!spiflash_write(unpack.sector + 1, unpack.sector_buffer + 1, len - 1)) {
+            return -7;
+        }
+    } else if (!spiflash_write(unpack.sector + sector_start, unpack.sector_buffer, len)) {
+        return -7;
+    }
+    
+    return 0;
+}
+
+static int unpack_out(const byte* data, int len) {
+    while (len > 0) {
+        if (unpack.pos >= unpack.size) {
+            return -11;
+        }
+        
+        unpack.sector_buffer[unpack.pos & (SPI_FLASH_SECTOR_SIZE - 1)] = *data;
+        unpack.pos++;
+        data++;
+        len--;
+        
+        if ((unpack.pos & (SPI_FLASH_SECTOR_SIZE - 1)) == 0) {
+            const int ret = unpack_flush();
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+static int unpack_match(const int distance, int len) {
+    if (distance == 0 || distance > unpack.pos) {
+        return -11;
+    }
+    
+    int src = unpack.pos - distance;
+    byte buffer[PACKBUFFERSIZE];
+    
+    while (len > 0) {
+        const int sector_start = unpack.pos & ~(SPI_FLASH_SECTOR_SIZE - 1);
+        int n = 1;
+        
+        if (src >= sector_start) {
+            // Byte by byte, because source and output can overlap
+            buffer[0] = unpack.sector_buffer[src - sector_start];
+        } else {
+            n = sector_start - src;
+            if (n > len) {
+                n = len;
+            }
+            if (n > PACKBUFFERSIZE) {
+                n = PACKBUFFERSIZE;
+            }
+            
+            if (!spiflash_read(unpack.sector + src, buffer, n)) {
+                return -12;
+            }
+            
+            if (src == 0) {
+                buffer[0] = file_first_byte[0];
+            }
+        }
+        
+        const int ret = unpack_out(buffer, n);
+        if (ret < 0) {
+            return ret;
+        }
+        
+        src += n;
+        len -= n;
+    }
+    
+    return 0;
+}
+
+// Old image is overwritten while unpacking, so sources must not be before the sector being built
+static int unpack_copy(int src, int len) {
+    byte buffer[PACKBUFFERSIZE];
+    
+    while (len > 0) {
+        const int sector_start = unpack.pos & ~(SPI_FLASH_SECTOR_SIZE - 1);
+        if (src < sector_start || src + len > unpack.base_size) {
+            return -11;
+        }
+        
+        int n = len;
+        if (n > PACKBUFFERSIZE) {
+            n = PACKBUFFERSIZE;
+        }
+        
+        if (!spiflash_read(unpack.sector + src, buffer, n)) {
+            return -12;
+        }
+        
+        const int ret = unpack_out(buffer, n);
+        if (ret < 0) {
+            return ret;
+        }
+        
+        src += n;
+        len -= n;
+    }
+    
+    return 0;
+}
+
+// Delta images are only valid for the image they were made from, so installed image is checked before any sector is overwritten
+static int unpack_check_base(const byte* base_hash) {
+    if (unpack.base_size > MAXFILESIZE) {
+        return -13;
+    }
+    
+    Sha384 sha;
+    byte hash[HASHSIZE];
+    
+    wc_InitSha384(&sha);
+    
+    for (int pos = 0; pos < unpack.base_size; pos += SPI_FLASH_SECTOR_SIZE) {
+        int n = unpack.base_size - pos;
+        if (n > SPI_FLASH_SECTOR_SIZE) {
+            n = SPI_FLASH_SECTOR_SIZE;
+        }
+        
+        if (!spiflash_read(unpack.sector + pos, unpack.sector_buffer, n)) {
+            return -12;
+        }
+        
+        wc_Sha384Update(&sha, unpack.sector_buffer, n);
+    }
+    
+    wc_Sha384Final(&sha, hash);
+    
+    if (memcmp(hash, base_hash, HASHSIZE) != 0) {
+        ERROR("Installed image is not delta base");
+        return -13;
+    }
+    
+    return 0;
+}
+
+static int unpack_data(const byte* data, int len) {
+    while (len > 0) {
+        if (unpack.literal_left > 0) {
+            int n = unpack.literal_left;
+            if (n > len) {
+                n = len;
+            }
+            
+            const int ret = unpack_out(data, n);
+            if (ret < 0) {
+                return ret;
+            }
+            
+            unpack.literal_left -= n;
+            data += n;
+            len -= n;
+            continue;
+        }
+        
+        if (unpack.args_len < unpack.args_need) {
+            unpack.args[unpack.args_len++] = *data;
+            data++;
+            len--;
+            
+            if (unpack.args_len < unpack.args_need) {
+                continue;
+            }
+            
+            int ret = 0;
+            const byte* args = unpack.args;
+            
+            if (unpack.op == 0) {       // Header
+                if (memcmp(args, PACKMAGIC, 4) != 0) {
+                    return -11;
+                }
+                
+                unpack.size = args[4] | (args[5] << 8) | (args[6] << 16) | (args[7] << 24);
+                if (unpack.size <= 0 || unpack.size > MAXFILESIZE) {
+                    ERROR("FILE TOO BIG %i / %i", unpack.size, MAXFILESIZE);
+                    return -10;
+                }
+                
+                unpack.base_size = args[8] | (args[9] << 8) | (args[10] << 16) | (args[11] << 24);
+                if (unpack.base_size != 0) {
+                    ret = unpack_check_base(args + 12);
+                    if (ret < 0) {
+                        return ret;
+                    }
+                }
+                
+                INFO("Unpacking %i Bytes", unpack.size);
+                
+            } else if ((unpack.op & PACKOP_COPY) == PACKOP_COPY) {
+                ret = unpack_copy(args[1] | (args[2] << 8) | (args[3] << 16), (((unpack.op & 0x3F) << 8) | args[0]) + 1);
+                
+            } else {    // PACKOP_MATCH
+                ret = unpack_match(args[0] | (args[1] << 8), (unpack.op & 0x3F) + 3);
+            }
+            
+            if (ret < 0) {
+                return ret;
+            }
+            
+            unpack.args_len = 0;
+            unpack.args_need = 0;
+            continue;
+        }
+        
+        unpack.op = *data;
+        data++;
+        len--;
+        
+        if ((unpack.op & PACKOP_COPY) == PACKOP_COPY) {
+            unpack.args_need = 4;
+        } else if ((unpack.op & PACKOP_MATCH) == PACKOP_MATCH) {
+            unpack.args_need = 2;
+        } else {    // PACKOP_LITERAL
+            unpack.literal_left = unpack.op + 1;
+        }
+        
+        unpack.args_len = 0;
+    }
+    
+    return 0;
+}
+
+static int unpack_start(const int sector) {
+    if (!unpack.sector_buffer) {
+        unpack.sector_buffer = malloc(SPI_FLASH_SECTOR_SIZE);
+        if (!unpack.sector_buffer) {
+            return -9;
+        }
+    }
+    
+    unpack.sector = sector;
+    unpack.size = 0;
+    unpack.base_size = 0;
+    unpack.pos = 0;
+    unpack.literal_left = 0;
+    unpack.op = 0;
+    unpack.args_len = 0;
+    unpack.args_need = PACKHEADERSIZE;
+    
+    return 0;
+}
+
+static int unpack_finish() {
+    int ret = -11;
+    
+    if (unpack.size > 0 && unpack.pos == unpack.size &&
+        unpack.literal_left == 0 && unpack.args_len == unpack.args_need) {
+        ret = 0;
+        if (unpack.pos & (SPI_FLASH_SECTOR_SIZE - 1)) {
+            ret = unpack_flush();
+        }
+    }
+    
+    free(unpack.sector_buffer);
+    unpack.sector_buffer = NULL;
+    
+    return ret;
+}
+
+// --- DOWNLOAD
 static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int bufsz, uint16_t port, const bool is_ssl) { //number of bytes
     INFO("\nDOWNLOADING FILE\n");
     
@@ -435,11 +739,33 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
     int collected = 0;
     int writespace = 0;
     int left, header;
+    uint8_t resumes = 0;
+    bool packed = false;
 
     if (sector == 0 && buffer == NULL) {
         return -5;      // Needs to be either a sector or a signature/version file
     }
     
+    // Drops connection and asks again from the first byte not written yet
+    bool resume() {
+        if (resumes >= MAX_RESUMES) {
+            return false;
+        }
+        
+        resumes++;
+        INFO("Resuming at %d (%i)", collected, resumes);
+        
+        ota_disconnect(retc, socket, ssl, is_ssl);
+        retc = ota_connect(last_host, port, &socket, &ssl, is_ssl);
+        
+        return retc == 0;
+    }
+    
+    if (sector) {
+        file_hash_sector = 0;
+        wc_InitSha384(&file_sha);
+    }
+    
     if (ota_get_final_location(repo, file, port, is_ssl) <= 0) {
         ERROR("SERVER");
         return -1;
@@ -459,8 +785,15 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
 
         char *location;
         
-        while (collected < length) {
-            sprintf(recv_buf, "%s%d-%d%s", getlinestart, collected, collected + 4095, CRLFCRLF);
+        // Download can not go on
+        int download_error(const int error) {
+            free(getlinestart);
+            ota_disconnect(retc, socket, ssl, is_ssl);
+            return error;
+        }
+        
+        while (collected < length && retc == 0) {
+            sprintf(recv_buf, "%s%d-%d%s", getlinestart, collected, collected + OTA_RANGE_SIZE - 1, CRLFCRLF);
             
             send_bytes = strlen(recv_buf);
 
@@ -529,27 +862,43 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
                         
                         if (length > MAXFILESIZE) {
                             ERROR("FILE TOO BIG %i / %i", length, MAXFILESIZE);
-                            free(getlinestart);
-                            return -10;
+                            return download_error(-10);
                         }
                         
                         if (!header) {
                             recv_bytes += ret;
-                            if (sector) { // Write to flash
+                            if (sector && collected == 0 && recv_buf[0] == PACKMAGIC[0]) {
+                                INFO("Packed file");
+                                packed = true;
+                                if (unpack_start(sector) < 0) {
+                                    return download_error(-9);
+                                }
+                            }
+                            
+                            if (packed) { // Unpack to flash
+                                const int unpack_ret = unpack_data((byte*) recv_buf, ret);
+                                if (unpack_ret < 0) {
+                                    ERROR("Unpack %i", unpack_ret);
+                                    unpack_finish();
+                                    return download_error(unpack_ret);
+                                }
+                            } else if (sector) { // Write to flash
                                 if (writespace < ret) {
-                                    printf("Sector 0x%05X ", sector + collected);
-                                    if (!spiflash_erase_sector(sector + collected)) return -6; // Erase error
+                                    // Next sector not erased yet. Ranges and resumes do not start at sector boundaries
+                                    printf("Sector 0x%05X ", sector + collected + writespace);
+                                    if (!spiflash_erase_sector(sector + collected + writespace)) return download_error(-6); // Erase error
                                     writespace += SPI_FLASH_SECTOR_SIZE;
                                 }
                                 if (collected) {
-                                    if (!spiflash_write(sector + collected, (byte *)recv_buf, ret)) return -7; // Write error
+                                    if (!spiflash_write(sector + collected, (byte *)recv_buf, ret)) return download_error(-7); // Write error
                                 } else { // At the very beginning, do not write the first byte yet but store it for later
                                     file_first_byte[0] = (byte)recv_buf[0];
-                                    if (!spiflash_write(sector + 1, (byte *)recv_buf + 1, ret - 1)) return -7; // Write error
+                                    if (!spiflash_write(sector + 1, (byte *)recv_buf + 1, ret - 1)) return download_error(-7); // Write error
                                 }
                                 writespace -= ret;
+                                wc_Sha384Update(&file_sha, (byte*) recv_buf, ret);
                             } else { // Buffer
-                                if (ret > bufsz) return -8; // Too big
+                                if (ret > bufsz) return download_error(-8); // Too big
                                 memcpy(buffer, recv_buf, ret);
                             }
                             collected += ret;
@@ -561,8 +910,9 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
                             ERROR("%d", ret);
                         }
                         
-                        if (!ret && collected < length)
-                            retc = ota_connect(last_host, port, &socket, &ssl, is_ssl);
+                        if (collected < length) {
+                            resume();
+                        }
                         
                         break;
                     }
@@ -580,9 +930,7 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
                     ERROR("wolfSSL_send %d", ret);
                 }
                 
-                if (ret == -308) {
-                    retc = ota_connect(last_host, port, &socket, &ssl, is_ssl); //dangerous for eternal connecting? memory leak?
-                } else {
+                if (!resume()) {
                     break;
                 }
             }
@@ -595,25 +943,46 @@ static int ota_get_file_ex(char* repo, char* file, int sector, byte* buffer, int
     
     INFO("");
     
-    switch (retc) {
-        case 0:
-        case -1:
-            if (is_ssl) {
-                wolfSSL_free(ssl);
-            }
-        case -2:
-            lwip_close(socket);
-        case -3:
-        default:
-        ;
+    ota_disconnect(retc, socket, ssl, is_ssl);
+    
+    if (packed) {
+        if (collected == length && unpack_finish() == 0) {
+            collected = unpack.size;
+            INFO("Unpacked %d Bytes", collected);
+        } else {
+            unpack_finish();
+            ERROR("Unpack incomplete");
+            return -11;
+        }
+    }
+    
+    if (sector && collected > 0 && (collected == length || packed)) {
+        wc_Sha384Final(&file_sha, file_hash);
+        file_hash_sector = sector;
+        file_hash_size = collected;
     }
 
     return collected;
 }
 
+// Delta image is tried first. If there is none, or installed image is not its base, or it fails, full image is downloaded
 int ota_get_file(char* repo, char* file, int sector, uint16_t port, const bool is_ssl) {
     INFO("Get file from %s", repo);
     
+    char* delta_file = malloc(strlen(file) + sizeof(PACKDELTASUFIX));
+    if (delta_file) {
+        strcpy(delta_file, file);
+        strcat(delta_file, PACKDELTASUFIX);
+        const int ret = ota_get_file_ex(repo, delta_file, sector, NULL, 0, port, is_ssl);
+        free(delta_file);
+        
+        if (ret > 0) {
+            return ret;
+        }
+        
+        INFO("Full image");
+    }
+    
     return ota_get_file_ex(repo, file, sector, NULL, 0, port, is_ssl);
 }
 
@@ -623,7 +992,7 @@ char* ota_get_version(char* repo, char* version_file, uint16_t port, const bool
     byte* version = malloc(VERSIONFILESIZE + 1);
     memset(version, 0, VERSIONFILESIZE + 1);
 
-    if (ota_get_file_ex(repo, version_file, 0, version, VERSIONFILESIZE, port, is_ssl)) {
+    if (ota_get_file_ex(repo, version_file, 0, version, VERSIONFILESIZE, port, is_ssl) > 0) {
         INFO("VERSION of %s: %s", version_file, (char*) version);
     } else {
         free(version);
@@ -650,33 +1019,40 @@ int ota_get_sign(char* repo, char* file, byte* signature, uint16_t port, bool is
 int ota_verify_sign(int start_sector, int filesize, byte* signature) {
     INFO("Verifying sign...");
     
-    int bytes;
     byte hash[HASHSIZE];
-    byte buffer[1024];
-    Sha384 sha;
     
-    wc_InitSha384(&sha);
+    if (file_hash_sector == start_sector && file_hash_size == filesize) {
+        // Hashed while downloading
+        memcpy(hash, file_hash, HASHSIZE);
+        
+    } else {
+        int bytes;
+        byte buffer[1024];
+        Sha384 sha;
+        
+        wc_InitSha384(&sha);
 
-    for (bytes = 0; bytes < filesize - 1024; bytes += 1024) {
-        if (!spiflash_read(start_sector + bytes, (byte*) buffer, 1024)) {
-            ERROR("Reading flash");
-            break;
+        for (bytes = 0; bytes < filesize - 1024; bytes += 1024) {
+            if (!spiflash_read(start_sector + bytes, (byte*) buffer, 1024)) {
+                ERROR("Reading flash");
+                break;
+            }
+            
+            if (bytes == 0) {
+                buffer[0] = file_first_byte[0];
+            }
+            
+            wc_Sha384Update(&sha, buffer, 1024);
         }
-        
-        if (bytes == 0) {
-            buffer[0] = file_first_byte[0];
+
+        if (!spiflash_read(start_sector + bytes, (byte*) buffer, filesize - bytes)) {
+            ERROR("Reading flash");
         }
         
-        wc_Sha384Update(&sha, buffer, 1024);
-    }
-
-    if (!spiflash_read(start_sector + bytes, (byte*) buffer, filesize - bytes)) {
-        ERROR("Reading flash");
+        wc_Sha384Update(&sha, buffer, filesize - bytes);
+        wc_Sha384Final(&sha, hash);
     }
     
-    wc_Sha384Update(&sha, buffer, filesize - bytes);
-    wc_Sha384Final(&sha, hash);
-    
     int verify = 0;
     wc_ecc_verify_hash(signature, SIGNSIZE, hash, HASHSIZE, &verify, &public_key);
     
@@ -37,9 +37,23 @@
 
 #define MAX_302_JUMPS           6
 
+#ifndef OTA_RANGE_SIZE
+#define OTA_RANGE_SIZE          16384       // Bytes asked in every Range request of the keep-alive connection
+#endif
+#define MAX_RESUMES             4           // Reconnections allowed while downloading a file
+
 #define HASHSIZE                48          //SHA-384
 #define SIGNSIZE                104         //ECDSA r+s in ASN1 format secP384r1
 
+// Packed images, made by devices/common/ota_pack.py
+#define PACKMAGIC               "HAZ2"
+#define PACKHEADERSIZE          (12 + HASHSIZE) // Magic + uint32 LE size of unpacked image + uint32 LE size of base image + SHA-384 of base image
+#define PACKDELTASUFIX          ".delta"    // Delta image, tried before full image
+#define PACKOP_LITERAL          0x00        // 0LLLLLLL: L + 1 literal bytes follow
+#define PACKOP_MATCH            0x80        // 10LLLLLL DD DD: L + 3 bytes from distance D of unpacked output
+#define PACKOP_COPY             0xC0        // 11LLLLLL LL OO OO OO: L + 1 bytes from offset O of base image, installed in target slot
+#define PACKBUFFERSIZE          64
+
 typedef unsigned char byte;
 
 void ota_init(char* repo, const bool is_ssl);
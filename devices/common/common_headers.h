@@ -22,6 +22,8 @@
 #define HAA_JSON_SYSPARAM                   "haa_conf"
 #define HAA_SETUP_MODE_SYSPARAM             "setup"
 #define LAST_CONFIG_NUMBER_SYSPARAM         "hkcf"
+#define HAA_CONFIG_IMAGE_SYSPARAM           "haa_bin"
+#define HAA_JSON_HASH_SYSPARAM              "haa_hash"
 
 #define BOOT0SECTOR                         (0x02000)
 #define BOOT1SECTOR                         (0x91000)   // Must match the sdk/ld/program1.ld value
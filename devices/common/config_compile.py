@@ -0,0 +1,346 @@
+#!/usr/bin/env python3
+#
+# Home Accessory Architect config compiler
+#
+# Validates HAA JSON configs and compiles them to the binary image that HAA firmware makes on
+# first boot after a config change, and loads on next boots instead of parsing the JSON.
+# Format is described in devices/HAA/config_image.h.
+#
+# Usage:
+#   config_compile.py validate config.json
+#   config_compile.py compile config.json config.bin [config_number]
+#   config_compile.py dump config.bin
+#
+# JSON hash in image header is made from the file as is, so it must contain the exact text
+# saved in device. Config number is the "hkcf" sysparam, increased every time config is saved.
+#
+
+import json
+import math
+import struct
+import sys
+
+MAGIC = b"HCF"
+VERSION = 1
+HEADER = "<3sBHHIII"
+HEADER_SIZE = struct.calcsize(HEADER)
+DEPTH_MAX = 12
+KEY_LEN_MAX = 255
+KEYS_MAX = 65535
+
+NULL, FALSE, TRUE, INT, FLOAT, DOUBLE, STRING, ARRAY, OBJECT = range(9)
+
+# devices/HAA/header.h
+GENERAL_CONFIG = "c"
+ACCESSORIES_ARRAY = "a"
+EXTRA_SERVICES_ARRAY = "es"
+PINGS_ARRAY = "l"
+PIN_GPIO = "g"
+MAX_ACTIONS = 51
+INPUT_ARRAYS = ["b", "b1"] + ["f%i" % i for i in range(9)]
+ACTION_ARRAYS = ["r", "m", "s", "h", "i", "u"]
+
+
+class ConfigError(Exception):
+    pass
+
+
+class Object(list):
+    """JSON object as its list of (key, value), so order and repeated keys are kept as in cJSON"""
+
+    def get(self, key):
+        for item_key, value in self:
+            if item_key == key:
+                return value
+        return None
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def load_json(text):
+    def no_constant(name):
+        raise ConfigError("invalid number %s" % name)
+
+    # All numbers are doubles, as in cJSON
+    try:
+        return json.loads(text, object_pairs_hook=Object, parse_int=float, parse_constant=no_constant)
+    except ValueError as e:
+        raise ConfigError("invalid JSON: %s" % e)
+
+
+def check_tree(value, path, depth):
+    if depth > DEPTH_MAX:
+        raise ConfigError("%s: nested more than %i levels" % (path, DEPTH_MAX))
+    if isinstance(value, float) and not math.isfinite(value):
+        raise ConfigError("%s: number out of range" % path)
+    if isinstance(value, str):
+        try:
+            encoded = value.encode("utf-8")
+        except UnicodeEncodeError:
+            raise ConfigError("%s: invalid string" % path)
+        if b"\0" in encoded:
+            raise ConfigError("%s: string with NUL" % path)
+    if isinstance(value, Object):
+        for key, item in value:
+            if len(key.encode("utf-8", "surrogatepass")) > KEY_LEN_MAX:
+                raise ConfigError("%s: key longer than %i Bytes" % (path, KEY_LEN_MAX))
+            check_tree(key, path, depth)
+            check_tree(item, "%s.%s" % (path, key), depth + 1)
+    elif isinstance(value, list):
+        for i, item in enumerate(value):
+            check_tree(item, "%s[%i]" % (path, i), depth + 1)
+
+
+def check_object_array(value, path):
+    if not isinstance(value, list) or isinstance(value, Object):
+        raise ConfigError("%s: must be an array" % path)
+    for i, item in enumerate(value):
+        if not isinstance(item, Object):
+            raise ConfigError("%s[%i]: must be an object" % (path, i))
+
+
+def check_inputs(context, path, input_arrays):
+    for key in input_arrays:
+        inputs = context.get(key)
+        if inputs is not None:
+            check_object_array(inputs, "%s.%s" % (path, key))
+            for i, item in enumerate(inputs):
+                gpio = item.get(PIN_GPIO)
+                if not isinstance(gpio, float):
+                    raise ConfigError("%s.%s[%i]: input without GPIO \"%s\"" % (path, key, i, PIN_GPIO))
+
+
+def check_service(service, path):
+    if not isinstance(service, Object):
+        raise ConfigError("%s: must be an object" % path)
+    check_inputs(service, path, INPUT_ARRAYS)
+
+    pings = service.get(PINGS_ARRAY)
+    if pings is not None:
+        check_object_array(pings, "%s.%s" % (path, PINGS_ARRAY))
+
+    for int_action in range(MAX_ACTIONS):
+        action = service.get(str(int_action))
+        if action is not None:
+            action_path = "%s.%i" % (path, int_action)
+            if not isinstance(action, Object):
+                raise ConfigError("%s: action must be an object" % action_path)
+            for key in ACTION_ARRAYS:
+                actions = action.get(key)
+                if actions is not None:
+                    check_object_array(actions, "%s.%s" % (action_path, key))
+
+
+def validate(config):
+    if not isinstance(config, Object):
+        raise ConfigError("config must be an object")
+    check_tree(config, "", 1)
+
+    general = config.get(GENERAL_CONFIG)
+    if general is not None:
+        if not isinstance(general, Object):
+            raise ConfigError(".%s: must be an object" % GENERAL_CONFIG)
+        check_inputs(general, "." + GENERAL_CONFIG, INPUT_ARRAYS[:1])
+
+    accessories = config.get(ACCESSORIES_ARRAY)
+    if not isinstance(accessories, list) or isinstance(accessories, Object) or not 0 < len(accessories) <= 255:
+        raise ConfigError(".%s: must be an array of 1 to 255 accessories" % ACCESSORIES_ARRAY)
+
+    for i, accessory in enumerate(accessories):
+        path = ".%s[%i]" % (ACCESSORIES_ARRAY, i)
+        check_service(accessory, path)
+
+        extra_services = accessory.get(EXTRA_SERVICES_ARRAY)
+        if extra_services is not None:
+            if not isinstance(extra_services, list) or isinstance(extra_services, Object):
+                raise ConfigError("%s.%s: must be an array" % (path, EXTRA_SERVICES_ARRAY))
+            for j, extra_service in enumerate(extra_services):
+                check_service(extra_service, "%s.%s[%i]" % (path, EXTRA_SERVICES_ARRAY, j))
+
+
+def varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def number(value):
+    # -0 is kept as float, so it is not changed to 0
+    if -2 ** 31 <= value < 2 ** 31 and value == math.floor(value) and not (value == 0 and math.copysign(1, value) < 0):
+        value = int(value)
+        return bytes([INT]) + varint(((value << 1) ^ (value >> 31)) & 0xFFFFFFFF)
+    try:
+        single = struct.pack("<f", value)
+        if struct.unpack("<f", single)[0] == value:
+            return bytes([FLOAT]) + single
+    except OverflowError:
+        pass
+    return bytes([DOUBLE]) + struct.pack("<d", value)
+
+
+def compile_config(config, config_number, json_hash):
+    validate(config)
+
+    keys = []
+    key_indexes = {}
+
+    def node(value):
+        if value is None:
+            return bytes([NULL])
+        if value is False:
+            return bytes([FALSE])
+        if value is True:
+            return bytes([TRUE])
+        if isinstance(value, float):
+            return number(value)
+        if isinstance(value, str):
+            encoded = value.encode("utf-8")
+            return bytes([STRING]) + varint(len(encoded)) + encoded + b"\0"
+
+        out = bytearray([OBJECT if isinstance(value, Object) else ARRAY])
+        out.extend(varint(len(value)))
+        for item in value:
+            if isinstance(value, Object):
+                key, item = item
+                if key not in key_indexes:
+                    if len(keys) == KEYS_MAX:
+                        raise ConfigError("more than %i different keys" % KEYS_MAX)
+                    key_indexes[key] = len(keys)
+                    keys.append(key)
+                out.extend(varint(key_indexes[key]))
+            out.extend(node(item))
+        return bytes(out)
+
+    tree = node(config)
+
+    body = bytearray()
+    for key in keys:
+        encoded = key.encode("utf-8")
+        body.append(len(encoded))
+        body.extend(encoded + b"\0")
+    body.extend(tree)
+
+    size = HEADER_SIZE + len(body)
+    return struct.pack(HEADER, MAGIC, VERSION, config_number, len(keys), size, json_hash, fnv1a(body)) + bytes(body)
+
+
+def load_image(image):
+    if len(image) < HEADER_SIZE:
+        raise ConfigError("image too short")
+    magic, version, config_number, keys_n, size, json_hash, body_hash = struct.unpack_from(HEADER, image)
+    if magic != MAGIC or version != VERSION:
+        raise ConfigError("not a config image version %i" % VERSION)
+    if size != len(image) or body_hash != fnv1a(image[HEADER_SIZE:]):
+        raise ConfigError("corrupt image")
+
+    pos = HEADER_SIZE
+
+    def get_varint():
+        nonlocal pos
+        value = 0
+        shift = 0
+        while True:
+            byte = image[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value
+
+    keys = []
+    for _ in range(keys_n):
+        length = image[pos]
+        keys.append(image[pos + 1:pos + 1 + length].decode("utf-8"))
+        pos += length + 2
+
+    def node():
+        nonlocal pos
+        node_type = image[pos]
+        pos += 1
+        if node_type == NULL:
+            return None
+        if node_type in (FALSE, TRUE):
+            return node_type == TRUE
+        if node_type == INT:
+            value = get_varint()
+            return float((value >> 1) ^ -(value & 1))
+        if node_type in (FLOAT, DOUBLE):
+            fmt = "<f" if node_type == FLOAT else "<d"
+            value = struct.unpack_from(fmt, image, pos)[0]
+            pos += struct.calcsize(fmt)
+            return value
+        if node_type == STRING:
+            length = get_varint()
+            value = image[pos:pos + length].decode("utf-8")
+            pos += length + 1
+            return value
+        count = get_varint()
+        if node_type == ARRAY:
+            return [node() for _ in range(count)]
+        items = Object()
+        for _ in range(count):
+            key = keys[get_varint()]
+            items.append((key, node()))
+        return items
+
+    config = node()
+    if pos != size:
+        raise ConfigError("corrupt image")
+    return config, config_number, json_hash
+
+
+def dump(value):
+    if isinstance(value, Object):
+        return "{" + ",".join("%s:%s" % (json.dumps(key, ensure_ascii=False), dump(item)) for key, item in value) + "}"
+    if isinstance(value, list):
+        return "[" + ",".join(dump(item) for item in value) + "]"
+    if isinstance(value, float) and value == math.floor(value) and abs(value) < 2 ** 53:
+        return "%i" % value
+    return json.dumps(value, ensure_ascii=False)
+
+
+def main(argv):
+    try:
+        if len(argv) == 3 and argv[1] == "validate":
+            with open(argv[2], "rb") as f:
+                validate(load_json(f.read()))
+            print("%s: OK" % argv[2])
+
+        elif len(argv) in (4, 5) and argv[1] == "compile":
+            with open(argv[2], "rb") as f:
+                text = f.read()
+            config_number = int(argv[4]) if len(argv) == 5 else 1
+            if not 0 < config_number <= 65535:
+                raise ConfigError("config number must be from 1 to 65535")
+            image = compile_config(load_json(text), config_number, fnv1a(text))
+            with open(argv[3], "wb") as f:
+                f.write(image)
+            print("%s: %i -> %i Bytes" % (argv[3], len(text), len(image)))
+
+        elif len(argv) == 3 and argv[1] == "dump":
+            with open(argv[2], "rb") as f:
+                config, config_number, json_hash = load_image(f.read())
+            print("Config number %i, JSON hash %08X" % (config_number, json_hash))
+            print(dump(config))
+
+        else:
+            print("Usage: %s validate <config.json> | compile <config.json> <config.bin> [config_number] | dump <config.bin>" % argv[0])
+            return 1
+
+    except ConfigError as e:
+        print("%s: %s" % (argv[2], e), file=sys.stderr)
+        return 2
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
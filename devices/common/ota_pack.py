@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+#
+# Home Accessory Architect OTA packer
+#
+# Makes packed firmware files that HAA OTA Installer unpacks to flash while downloading.
+# Signature files must be made from the original unpacked firmware.
+#
+# Usage:
+#   ota_pack.py compress firmware.bin release/firmware.bin
+#   ota_pack.py delta old_firmware.bin new_firmware.bin release/firmware.bin.delta
+#
+# Delta files are built against the firmware already installed in the slot that will be
+# overwritten, so they are only valid for devices running exactly that old firmware.
+# Size and SHA-384 of old firmware are in the header, so devices running other firmware skip
+# the delta file and download the full one, which has same name without ".delta".
+#
+
+import hashlib
+import struct
+import sys
+
+PACKMAGIC = b"HAZ2"
+HASH_SIZE = 48
+SECTOR_SIZE = 4096
+
+LITERAL_MAX = 0x80
+MATCH_MIN = 3
+MATCH_MAX = 0x3F + MATCH_MIN
+MATCH_DISTANCE_MAX = 0xFFFF
+COPY_MIN = 8
+COPY_MAX = 0x4000
+CHAIN_MAX = 32
+KEY_LEN = 4
+
+
+def sector_start(pos):
+    return pos & ~(SECTOR_SIZE - 1)
+
+
+def common_len(a, a_pos, b, b_pos, max_len):
+    n = 0
+    while n < max_len and a[a_pos + n] == b[b_pos + n]:
+        n += 1
+    return n
+
+
+def pack(new, old=None):
+    out = bytearray(PACKMAGIC + struct.pack("<II", len(new), len(old) if old else 0))
+    out.extend(hashlib.sha384(old).digest() if old else bytes(HASH_SIZE))
+    literals = bytearray()
+
+    def flush_literals():
+        while literals:
+            run = literals[:LITERAL_MAX]
+            out.append(len(run) - 1)
+            out.extend(run)
+            del literals[:LITERAL_MAX]
+
+    old_index = {}
+    if old:
+        for i in range(len(old) - COPY_MIN + 1):
+            old_index.setdefault(old[i:i + KEY_LEN], []).append(i)
+
+    new_index = {}
+    indexed = 0
+    pos = 0
+
+    while pos < len(new):
+        while indexed < pos and indexed + KEY_LEN <= len(new):
+            new_index.setdefault(new[indexed:indexed + KEY_LEN], []).append(indexed)
+            indexed += 1
+
+        key = new[pos:pos + KEY_LEN]
+        best_len = 0
+        best_op = None
+
+        # Old image is overwritten sector by sector, so sources can not be before current output sector
+        if old and len(key) == KEY_LEN:
+            for src in old_index.get(key, ()):
+                if src < pos:
+                    if src < sector_start(pos):
+                        continue
+                    limit = sector_start(pos) + SECTOR_SIZE - pos
+                else:
+                    limit = COPY_MAX
+                limit = min(limit, COPY_MAX, len(new) - pos, len(old) - src)
+                n = common_len(new, pos, old, src, limit)
+                if n > best_len:
+                    best_len = n
+                    best_op = ("copy", src)
+                    if n == limit:
+                        break
+            if best_len < COPY_MIN:
+                best_len = 0
+                best_op = None
+
+        if best_len < MATCH_MAX and len(key) == KEY_LEN:
+            candidates = new_index.get(key, ())
+            for src in reversed(candidates[-CHAIN_MAX:]):
+                if pos - src > MATCH_DISTANCE_MAX:
+                    break
+                n = common_len(new, pos, new, src, min(MATCH_MAX, len(new) - pos))
+                if n > best_len:
+                    best_len = n
+                    best_op = ("match", pos - src)
+                    if n == MATCH_MAX:
+                        break
+
+        if best_op is None:
+            literals.append(new[pos])
+            pos += 1
+            continue
+
+        flush_literals()
+        if best_op[0] == "copy":
+            length = best_len - 1
+            out.append(0xC0 | (length >> 8))
+            out.append(length & 0xFF)
+            out.extend(struct.pack("<I", best_op[1])[:3])
+        else:
+            out.append(0x80 | (best_len - MATCH_MIN))
+            out.extend(struct.pack("<H", best_op[1]))
+        pos += best_len
+
+    flush_literals()
+    return bytes(out)
+
+
+def main(argv):
+    if len(argv) == 4 and argv[1] == "compress":
+        old = None
+        new_name, out_name = argv[2], argv[3]
+    elif len(argv) == 5 and argv[1] == "delta":
+        with open(argv[2], "rb") as f:
+            old = f.read()
+        new_name, out_name = argv[3], argv[4]
+    else:
+        print("Usage: %s compress <in> <out> | delta <old> <new> <out>" % argv[0])
+        return 1
+
+    with open(new_name, "rb") as f:
+        new = f.read()
+
+    packed = pack(new, old)
+    with open(out_name, "wb") as f:
+        f.write(packed)
+
+    print("%s: %i -> %i Bytes" % (out_name, len(new), len(packed)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -49,6 +49,13 @@ void homekit_server_init(homekit_server_config_t *config);
 void homekit_set_max_clients(const uint8_t clients);
 #endif // HOMEKIT_CHANGE_MAX_CLIENTS
 
+#ifdef HOMEKIT_NOTIFY_LATENCY_STATS
+#define HOMEKIT_NOTIFY_LATENCY_BUCKETS          (8)
+// Copy histogram of latencies from homekit_characteristic_notify() to event socket write.
+// Bucket upper limits are 1, 2, 5, 10, 20, 50 and 100 ms; last bucket counts slower events
+void homekit_get_notify_latency_histogram(uint32_t histogram[HOMEKIT_NOTIFY_LATENCY_BUCKETS]);
+#endif // HOMEKIT_NOTIFY_LATENCY_STATS
+
 // Remove oldest client to free some DRAM
 void homekit_remove_oldest_client();
 
@@ -161,10 +161,11 @@ typedef struct {
     homekit_valid_values_range_t *ranges;
 } homekit_valid_values_ranges_t;
 
-typedef struct _homekit_characteristic_subscription {
-    void *context;
-    struct _homekit_characteristic_subscription *next;
-} homekit_characteristic_subscription_t;
+// Bitmap with one bit per characteristic, indexed by characteristic dense number
+typedef uint32_t homekit_characteristic_bitmap_t;
+#define HOMEKIT_CHARACTERISTIC_BITMAP_BITS              (32)
+#define HOMEKIT_CHARACTERISTIC_BITMAP_WORD(ch)          ((ch)->index / HOMEKIT_CHARACTERISTIC_BITMAP_BITS)
+#define HOMEKIT_CHARACTERISTIC_BITMAP_MASK(ch)          (1UL << ((ch)->index % HOMEKIT_CHARACTERISTIC_BITMAP_BITS))
 
 
 struct _homekit_characteristic {
@@ -173,6 +174,8 @@ struct _homekit_characteristic {
     const char *description;
     
     uint16_t id;
+    // Dense characteristic number, assigned by homekit_accessories_init()
+    uint16_t index;
     
     homekit_format_t format: 4;
     homekit_unit_t unit: 3;
@@ -192,8 +195,6 @@ struct _homekit_characteristic {
 
     homekit_valid_values_t valid_values;
     homekit_valid_values_ranges_t valid_values_ranges;
-    
-    homekit_characteristic_subscription_t* subscriptions;
 
     homekit_value_t (*getter_ex)(const homekit_characteristic_t *ch);
     void (*setter_ex)(homekit_characteristic_t *ch, const homekit_value_t value);
@@ -306,6 +307,7 @@ homekit_characteristic_t *homekit_characteristic_clone(homekit_characteristic_t
 
 // Init accessories by automatically assigning IDs to all
 // accessories/services/characteristics, normalizing internal data.
+// Also builds a sorted (aid, iid) index used by homekit_characteristic_by_aid_and_iid().
 void homekit_accessories_init(homekit_accessory_t **accessories);
 
 // Find accessory by ID. Returns NULL if not found
@@ -316,23 +318,26 @@ homekit_service_t *homekit_service_by_type(homekit_accessory_t *accessory, const
 homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service_t *service, const char *type);
 // Find characteristic by accessory ID and characteristic ID. Returns NULL if not found
 homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid);
+// Find characteristic by dense number. Returns NULL if not found
+homekit_characteristic_t *homekit_characteristic_by_index(homekit_accessory_t **accessories, uint16_t index);
+
+// Number of words of a bitmap covering all initialized characteristics
+size_t homekit_characteristic_bitmap_size();
+// Allocate a zeroed characteristics bitmap. Returns NULL if out of memory
+homekit_characteristic_bitmap_t *homekit_characteristic_bitmap_new();
 
 void homekit_characteristic_notify(homekit_characteristic_t *ch);
 void homekit_characteristic_add_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
+    homekit_characteristic_bitmap_t *subscriptions
 );
 void homekit_characteristic_remove_notify_subscription(
     homekit_characteristic_t *ch,
-    void *context
-);
-void homekit_accessories_clear_notify_subscriptions(
-    homekit_accessory_t **accessories,
-    void *context
+    homekit_characteristic_bitmap_t *subscriptions
 );
 bool homekit_characteristic_has_notify_subscription(
     const homekit_characteristic_t *ch,
-    void *context
+    const homekit_characteristic_bitmap_t *subscriptions
 );
 
 
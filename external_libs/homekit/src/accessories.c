@@ -268,7 +268,7 @@ homekit_characteristic_t* homekit_characteristic_clone(homekit_characteristic_t*
         p += align_size(sizeof(homekit_valid_values_range_t*) * c);
     }
     
-    clone->subscriptions = ch->subscriptions;
+    clone->index = ch->index;
     clone->getter_ex = ch->getter_ex;
     clone->setter_ex = ch->setter_ex;
     clone->context = ch->context;
@@ -364,6 +364,77 @@ homekit_accessory_t* homekit_accessory_clone(homekit_accessory_t* ac) {
     return clone;
 }
 
+// Sorted (aid, iid) index of all characteristics, built once by homekit_accessories_init()
+static homekit_accessory_t **characteristic_index_accessories = NULL;
+static homekit_characteristic_t **characteristic_index = NULL;
+static uint16_t characteristic_index_count = 0;
+
+static int characteristic_index_compare(const homekit_characteristic_t *ch, const int aid, const int iid) {
+    const int ch_aid = ch->service->accessory->id;
+    if (ch_aid != aid) {
+        return ch_aid < aid ? -1 : 1;
+    }
+    
+    if (ch->id != iid) {
+        return ch->id < iid ? -1 : 1;
+    }
+    
+    return 0;
+}
+
+static int characteristic_index_sort(const void *a, const void *b) {
+    const homekit_characteristic_t *ch_b = *(homekit_characteristic_t**) b;
+    return characteristic_index_compare(*(homekit_characteristic_t**) a, ch_b->service->accessory->id, ch_b->id);
+}
+
+static void homekit_characteristic_index_build(homekit_accessory_t **accessories) {
+    if (characteristic_index) {
+        free(characteristic_index);
+        characteristic_index = NULL;
+    }
+    characteristic_index_accessories = NULL;
+    characteristic_index_count = 0;
+    
+    size_t count = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                // Tree order dense number, replaced by sorted position when index is available
+                (*ch_it)->index = count++;
+            }
+        }
+    }
+    
+    if (count == 0 || count > UINT16_MAX) {
+        return;
+    }
+    
+    characteristic_index_count = count;
+    
+    characteristic_index = malloc(sizeof(homekit_characteristic_t*) * count);
+    if (!characteristic_index) {
+        // Lookups will fall back to walking accessories tree
+        return;
+    }
+    
+    size_t i = 0;
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        for (homekit_service_t **service_it = (*accessory_it)->services; *service_it; service_it++) {
+            for (homekit_characteristic_t **ch_it = (*service_it)->characteristics; *ch_it; ch_it++) {
+                characteristic_index[i++] = *ch_it;
+            }
+        }
+    }
+    
+    qsort(characteristic_index, count, sizeof(homekit_characteristic_t*), characteristic_index_sort);
+    
+    for (i = 0; i < count; i++) {
+        characteristic_index[i]->index = i;
+    }
+    
+    characteristic_index_accessories = accessories;
+}
+
 void homekit_accessories_init(homekit_accessory_t **accessories) {
     int aid = 1;
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
@@ -400,6 +471,8 @@ void homekit_accessories_init(homekit_accessory_t **accessories) {
             }
         }
     }
+    
+    homekit_characteristic_index_build(accessories);
 }
 
 homekit_accessory_t *homekit_accessory_by_id(homekit_accessory_t **accessories, int aid) {
@@ -436,6 +509,26 @@ homekit_characteristic_t *homekit_service_characteristic_by_type(homekit_service
 }
 
 homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessory_t **accessories, int aid, int iid) {
+    if (characteristic_index && accessories == characteristic_index_accessories) {
+        int low = 0;
+        int high = characteristic_index_count - 1;
+        while (low <= high) {
+            const int mid = (low + high) >> 1;
+            const int r = characteristic_index_compare(characteristic_index[mid], aid, iid);
+            if (r == 0) {
+                return characteristic_index[mid];
+            }
+            
+            if (r < 0) {
+                low = mid + 1;
+            } else {
+                high = mid - 1;
+            }
+        }
+        
+        return NULL;
+    }
+    
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
@@ -458,20 +551,25 @@ homekit_characteristic_t *homekit_characteristic_by_aid_and_iid(homekit_accessor
 }
 
 
-homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_t **accessories, int aid, const char *type) {
+homekit_characteristic_t *homekit_characteristic_by_index(homekit_accessory_t **accessories, uint16_t index) {
+    if (characteristic_index && accessories == characteristic_index_accessories) {
+        if (index < characteristic_index_count) {
+            return characteristic_index[index];
+        }
+        
+        return NULL;
+    }
+    
     for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
         homekit_accessory_t *accessory = *accessory_it;
 
-        if (accessory->id != aid)
-            continue;
-
         for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
             homekit_service_t *service = *service_it;
 
             for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
                 homekit_characteristic_t *ch = *ch_it;
 
-                if (!strcmp(ch->type, type))
+                if (ch->index == index)
                     return ch;
             }
         }
@@ -481,99 +579,65 @@ homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_
 }
 
 
-void homekit_characteristic_add_notify_subscription(
-    homekit_characteristic_t *ch,
-    void *context
-) {
-    homekit_characteristic_subscription_t *new_subscription = malloc(sizeof(homekit_characteristic_subscription_t));
-    new_subscription->context = context;
-    new_subscription->next = NULL;
-
-    if (!ch->subscriptions) {
-        ch->subscriptions = new_subscription;
-    } else {
-        homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-        if (subscription->context == context) {
-            free(new_subscription);
-            return;
-        }
+homekit_characteristic_t *homekit_characteristic_find_by_type(homekit_accessory_t **accessories, int aid, const char *type) {
+    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
+        homekit_accessory_t *accessory = *accessory_it;
 
-        while (subscription->next) {
-            if (subscription->next->context == context) {
-                free(new_subscription);
-                return;
-            }
-            subscription = subscription->next;
-        }
+        if (accessory->id != aid)
+            continue;
 
-        subscription->next = new_subscription;
-    }
-}
+        for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
+            homekit_service_t *service = *service_it;
 
+            for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
+                homekit_characteristic_t *ch = *ch_it;
 
-void homekit_characteristic_remove_notify_subscription(
-    homekit_characteristic_t *ch,
-    void *context
-) {
-    while (ch->subscriptions) {
-        if (ch->subscriptions->context != context) {
-            break;
+                if (!strcmp(ch->type, type))
+                    return ch;
+            }
         }
-
-        homekit_characteristic_subscription_t *c = ch->subscriptions;
-        ch->subscriptions = ch->subscriptions->next;
-        free(c);
     }
 
-    if (!ch->subscriptions)
-        return;
+    return NULL;
+}
 
-    homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-    while (subscription->next) {
-        if (subscription->next->context == context) {
-            homekit_characteristic_subscription_t *c = subscription->next;
-            subscription->next = subscription->next->next;
-            free(c);
-        } else {
-            subscription = subscription->next;
-        }
+
+size_t homekit_characteristic_bitmap_size() {
+    size_t size = (characteristic_index_count + HOMEKIT_CHARACTERISTIC_BITMAP_BITS - 1) / HOMEKIT_CHARACTERISTIC_BITMAP_BITS;
+    if (size == 0) {
+        size = 1;
     }
+    
+    return size;
+}
+
+homekit_characteristic_bitmap_t *homekit_characteristic_bitmap_new() {
+    return calloc(homekit_characteristic_bitmap_size(), sizeof(homekit_characteristic_bitmap_t));
 }
 
 
-// Removes particular subscription from all characteristics
-void homekit_accessories_clear_notify_subscriptions(
-    homekit_accessory_t **accessories,
-    void *context
+void homekit_characteristic_add_notify_subscription(
+    homekit_characteristic_t *ch,
+    homekit_characteristic_bitmap_t *subscriptions
 ) {
-    for (homekit_accessory_t **accessory_it = accessories; *accessory_it; accessory_it++) {
-        homekit_accessory_t *accessory = *accessory_it;
+    subscriptions[HOMEKIT_CHARACTERISTIC_BITMAP_WORD(ch)] |= HOMEKIT_CHARACTERISTIC_BITMAP_MASK(ch);
+}
 
-        for (homekit_service_t **service_it = accessory->services; *service_it; service_it++) {
-            homekit_service_t *service = *service_it;
 
-            for (homekit_characteristic_t **ch_it = service->characteristics; *ch_it; ch_it++) {
-                homekit_characteristic_t *ch = *ch_it;
-
-                homekit_characteristic_remove_notify_subscription(ch, context);
-            }
-        }
-    }
+void homekit_characteristic_remove_notify_subscription(
+    homekit_characteristic_t *ch,
+    homekit_characteristic_bitmap_t *subscriptions
+) {
+    subscriptions[HOMEKIT_CHARACTERISTIC_BITMAP_WORD(ch)] &= ~HOMEKIT_CHARACTERISTIC_BITMAP_MASK(ch);
 }
 
 
 bool homekit_characteristic_has_notify_subscription(
     const homekit_characteristic_t *ch,
-    void *context
+    const homekit_characteristic_bitmap_t *subscriptions
 ) {
-    homekit_characteristic_subscription_t *subscription = ch->subscriptions;
-    while (subscription) {
-        if (subscription->context == context)
-            return true;
-
-        subscription = subscription->next;
-    }
+    if (!subscriptions)
+        return false;
 
-    return false;
+    return subscriptions[HOMEKIT_CHARACTERISTIC_BITMAP_WORD(ch)] & HOMEKIT_CHARACTERISTIC_BITMAP_MASK(ch);
 }
-
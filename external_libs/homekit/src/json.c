@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include "json.h"
 #include "debug.h"
 
@@ -276,11 +277,35 @@ void json_string(json_stream *json, const char *x) {
     if (json->state == JSON_STATE_ERROR)
         return;
 
+    // Quotes, backslashes and control bytes are escaped, so string never has bytes below space,
+    // which /accessories cache uses as tokens
     void _do_write() {
-        // TODO: escape string
-        json_write(json, "\"%s\"", x);
+        json_raw(json, (const uint8_t*) "\"", 1);
+
+        const char *start = x;
+        for (const char *c = x; ; c++) {
+            if (*c && *c != '"' && *c != '\\' && (uint8_t) *c >= ' ')
+                continue;
+
+            json_raw(json, (const uint8_t*) start, c - start);
+            if (!*c)
+                break;
+
+            if (*c == '"' || *c == '\\') {
+                const uint8_t escaped[2] = { '\\', *c };
+                json_raw(json, escaped, sizeof(escaped));
+            } else {
+                json_write(json, "\\u%04x", (uint8_t) *c);
+            }
+            start = c + 1;
+        }
+
+        json_raw(json, (const uint8_t*) "\"", 1);
     }
 
+    if (!x)
+        x = "";
+
     switch (json->state) {
         case JSON_STATE_START:
             _do_write();
@@ -374,3 +399,32 @@ void json_null(json_stream *json) {
     }
 }
 
+
+void json_raw(json_stream *json, const uint8_t *data, size_t size) {
+    while (size > 0 && !json->error) {
+        size_t available = json->size - json->pos;
+        if (available == 0) {
+            json_flush(json);
+            continue;
+        }
+        
+        if (available > size) {
+            available = size;
+        }
+        
+        memcpy(json->buffer + json->pos, data, available);
+        json->pos += available;
+        data += available;
+        size -= available;
+    }
+}
+
+
+void json_object_continue(json_stream *json) {
+    if (json->error)
+        json->state = JSON_STATE_ERROR;
+    if (json->state == JSON_STATE_ERROR)
+        return;
+    
+    json->state = JSON_STATE_OBJECT_VALUE;
+}
@@ -48,3 +48,9 @@ void json_string(json_stream *json, const char *x);
 void json_boolean(json_stream *json, bool x);
 void json_null(json_stream *json);
 
+// Write already formatted data as is, without changing stream state
+void json_raw(json_stream *json, const uint8_t *data, size_t size);
+
+// Continue an object whose members were written by json_raw(), so next key is separated from them
+void json_object_continue(json_stream *json);
+
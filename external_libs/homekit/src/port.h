@@ -19,6 +19,13 @@ void homekit_random_fill(uint8_t *data, size_t size);
 #define sdk_system_restart()                esp_restart()
 #endif
 
+#ifdef ESP_IDF
+#include <esp_timer.h>
+#define homekit_port_time_us()              ((uint32_t) esp_timer_get_time())
+#else
+#define homekit_port_time_us()              sdk_system_get_time()
+#endif
+
 #ifdef ESP_IDF
 #define SERVER_TASK_STACK                   (12288)
 #else
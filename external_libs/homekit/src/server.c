@@ -60,6 +60,25 @@
 #define HOMEKIT_NETWORK_MIN_FREEHEAP            (14336)
 #endif
 
+// select() timeout when notifications wake up server loop through wakeup socket
+#ifndef HOMEKIT_SERVER_IDLE_TIMEOUT_MS
+#define HOMEKIT_SERVER_IDLE_TIMEOUT_MS          (1000)
+#endif
+
+// select() timeout when wakeup socket is not available
+#ifndef HOMEKIT_SERVER_POLL_TIMEOUT_MS
+#define HOMEKIT_SERVER_POLL_TIMEOUT_MS          (100)
+#endif
+
+// Maximum heap used by cached /accessories response. Set to 0 to disable cache
+#ifndef HOMEKIT_ACCESSORIES_CACHE_MAX_SIZE
+#define HOMEKIT_ACCESSORIES_CACHE_MAX_SIZE      (8192)
+#endif
+
+#ifndef HOMEKIT_GET_CHARACTERISTICS_STACK_IDS
+#define HOMEKIT_GET_CHARACTERISTICS_STACK_IDS   (16)
+#endif
+
 #ifdef HOMEKIT_DEBUG
 #define TLV_DEBUG(values)                       tlv_debug(values)
 #else
@@ -116,14 +135,20 @@ typedef struct {
     size_t accessory_public_key_size;
 } pair_verify_context_t;
 
-typedef struct _notification {
-    homekit_characteristic_t* ch;
-    struct _notification* next;
-} notification_t;
-
 #define BUFFER_DATA_SIZE        (1442)
 #define RECEIVED_DATA_SIZE      (1024 + 18)
 #define ENCRYPTED_DATA_SIZE     (768)
+
+// Encrypted frame: 2 bytes length (AAD), up to 1024 bytes payload and 16 bytes auth tag
+#define FRAME_HEADER_SIZE       (2)
+#define FRAME_PAYLOAD_SIZE      (1024)
+#define FRAME_TAG_SIZE          (16)
+
+// JSON is written inside a frame payload, after room for chunk size header ("3ff\r\n")
+// and leaving 2 bytes for chunk end ("\r\n"), so each chunk is encrypted in place
+#define CHUNK_HEADER_SIZE       (5)
+#define JSON_BUFFER_OFFSET      (FRAME_HEADER_SIZE + CHUNK_HEADER_SIZE)
+#define JSON_BUFFER_SIZE        (FRAME_PAYLOAD_SIZE - CHUNK_HEADER_SIZE - 2)
 typedef struct {
     char *accessory_id;
     ed25519_key* accessory_key;
@@ -134,9 +159,25 @@ typedef struct {
     
     client_context_t* clients;
     
-    notification_t* notifications;
+    // Characteristics changed since last notifications processing, and
+    // the ones being sent right now. Swapped by homekit_server_process_notifications()
+    homekit_characteristic_bitmap_t* notifications;
+    homekit_characteristic_bitmap_t* notifications_sending;
+    volatile bool has_notifications;
+    volatile bool wakeup_error;
+    uint32_t notifications_time;
+    
+#ifdef HOMEKIT_NOTIFY_LATENCY_STATS
+    uint32_t notify_latency[HOMEKIT_NOTIFY_LATENCY_BUCKETS];
+#endif
+    
+    // Compressed /accessories response skeleton, with holes for live values
+    byte* accessories_cache;
+    uint16_t accessories_cache_size;
+    bool accessories_cache_disabled: 1;
     
     int listen_fd;
+    int wakeup_fd;
     int max_fd;
     
     size_t data_available: 16;
@@ -178,6 +219,8 @@ struct _client_context_t {
     
     pair_verify_context_t *verify_context;
 
+    homekit_characteristic_bitmap_t *subscriptions;
+
     struct _client_context_t *next;
 };
 
@@ -198,11 +241,13 @@ homekit_server_t *server_new() {
     homekit_server_t* homekit_server = malloc(sizeof(homekit_server_t));
     memset(homekit_server, 0, sizeof(*homekit_server));
     
+    homekit_server->wakeup_fd = -1;
+    
     FD_ZERO(&homekit_server->fds);
     
     json_init(&homekit_server->json, NULL);
-    homekit_server->json.size = BUFFER_DATA_SIZE + (18 - 2);   // 2 bytes reserved for client_send_chunk() end
-    homekit_server->json.buffer = homekit_server->data;
+    homekit_server->json.size = JSON_BUFFER_SIZE;
+    homekit_server->json.buffer = homekit_server->data + JSON_BUFFER_OFFSET;
     homekit_server->json.on_flush = client_send_chunk;
     
     return homekit_server;
@@ -342,6 +387,9 @@ void client_context_free(client_context_t *c) {
     if (c->body)
         free(c->body);
 
+    if (c->subscriptions)
+        free(c->subscriptions);
+
     free(c);
 }
 
@@ -396,13 +444,29 @@ void homekit_remove_oldest_client() {
 }
 
 
+// --- CHARACTERISTIC JSON
 typedef enum {
     characteristic_format_type   = (1 << 1),
     characteristic_format_meta   = (1 << 2),
     characteristic_format_perms  = (1 << 3),
     characteristic_format_events = (1 << 4),
+    // Write cache holes instead of "ev" and "value" fields
+    characteristic_format_skeleton = (1 << 5),
 } characteristic_format_t;
 
+void write_characteristic_value_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch, const homekit_value_t *value);
+void write_accessories_cache_hole(json_stream *json, byte hole, const homekit_characteristic_t *ch);
+
+#define ACCESSORIES_CACHE_EVENTS        (0x01)
+#define ACCESSORIES_CACHE_VALUE         (0x02)
+#define ACCESSORIES_CACHE_TOKEN         (0x03)
+
+
+typedef struct {
+    homekit_characteristic_t *ch;
+    int aid;
+    int iid;
+} requested_characteristic_t;
 
 void write_characteristic_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch, characteristic_format_t format, const homekit_value_t *value) {
     json_string(json, "aid"); json_integer(json, ch->service->accessory->id);
@@ -430,9 +494,13 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
     }
 
     if ((format & characteristic_format_events) && (ch->permissions & HOMEKIT_PERMISSIONS_NOTIFY)) {
-        bool events = homekit_characteristic_has_notify_subscription(ch, client);
-        json_string(json, "ev");
-        json_boolean(json, events);
+        if (format & characteristic_format_skeleton) {
+            write_accessories_cache_hole(json, ACCESSORIES_CACHE_EVENTS, ch);
+        } else {
+            bool events = homekit_characteristic_has_notify_subscription(ch, client->subscriptions);
+            json_string(json, "ev");
+            json_boolean(json, events);
+        }
     }
 
     if (format & characteristic_format_meta) {
@@ -519,126 +587,181 @@ void write_characteristic_json(json_stream *json, client_context_t *client, cons
     }
     
     if (ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ) {
-        homekit_value_t v = value ? *value : ch->getter_ex ? ch->getter_ex(ch) : ch->value;
-        
-        if (v.is_null) {
-            // json_string(json, "value"); json_null(json);
-        } else if (v.format != ch->format) {
-            HOMEKIT_ERROR("Ch value format is different from ch format");
+        if (format & characteristic_format_skeleton) {
+            write_accessories_cache_hole(json, ACCESSORIES_CACHE_VALUE, ch);
         } else {
-            switch(v.format) {
-                case HOMETKIT_FORMAT_BOOL: {
-                    json_string(json, "value"); json_boolean(json, v.bool_value);
-                    break;
-                }
-                case HOMETKIT_FORMAT_UINT8:
-                case HOMETKIT_FORMAT_UINT16:
-                case HOMETKIT_FORMAT_UINT32:
-                case HOMETKIT_FORMAT_UINT64:
-                case HOMETKIT_FORMAT_INT: {
-                    if (ch->max_value) {
-                        int max_value = (int) *ch->max_value;
-                        if (v.int_value > max_value) {
-                            v.int_value = max_value;
-                        }
-                    }
-                    
-                    if (ch->min_value) {
-                        int min_value = (int) *ch->min_value;
-                        if (v.int_value < min_value) {
-                            v.int_value = min_value;
-                        }
+            write_characteristic_value_json(json, client, ch, value);
+        }
+    }
+}
+
+void write_characteristic_value_json(json_stream *json, client_context_t *client, const homekit_characteristic_t *ch, const homekit_value_t *value) {
+    homekit_value_t v = value ? *value : ch->getter_ex ? ch->getter_ex(ch) : ch->value;
+    
+    if (v.is_null) {
+        // json_string(json, "value"); json_null(json);
+    } else if (v.format != ch->format) {
+        HOMEKIT_ERROR("Ch value format is different from ch format");
+    } else {
+        switch(v.format) {
+            case HOMETKIT_FORMAT_BOOL: {
+                json_string(json, "value"); json_boolean(json, v.bool_value);
+                break;
+            }
+            case HOMETKIT_FORMAT_UINT8:
+            case HOMETKIT_FORMAT_UINT16:
+            case HOMETKIT_FORMAT_UINT32:
+            case HOMETKIT_FORMAT_UINT64:
+            case HOMETKIT_FORMAT_INT: {
+                if (ch->max_value) {
+                    int max_value = (int) *ch->max_value;
+                    if (v.int_value > max_value) {
+                        v.int_value = max_value;
                     }
-                    
-                    json_string(json, "value"); json_integer(json, v.int_value);
-                    break;
                 }
-                case HOMETKIT_FORMAT_FLOAT: {
-                    if (ch->max_value) {
-                        int max_value = (int) *ch->max_value;
-                        if (v.float_value > max_value) {
-                            v.float_value = max_value;
-                        }
-                    }
-                    
-                    if (ch->min_value) {
-                        int min_value = (int) *ch->min_value;
-                        if (v.float_value < min_value) {
-                            v.float_value = min_value;
-                        }
+                
+                if (ch->min_value) {
+                    int min_value = (int) *ch->min_value;
+                    if (v.int_value < min_value) {
+                        v.int_value = min_value;
                     }
-                    
-                    json_string(json, "value"); json_float(json, v.float_value);
-                    break;
                 }
-                case HOMETKIT_FORMAT_STRING: {
-                    json_string(json, "value"); json_string(json, v.string_value);
-                    break;
+                
+                json_string(json, "value"); json_integer(json, v.int_value);
+                break;
+            }
+            case HOMETKIT_FORMAT_FLOAT: {
+                if (ch->max_value) {
+                    int max_value = (int) *ch->max_value;
+                    if (v.float_value > max_value) {
+                        v.float_value = max_value;
+                    }
                 }
-                case HOMETKIT_FORMAT_TLV: {
-                    json_string(json, "value");
-                    if (!v.tlv_values) {
-                        json_string(json, "");
-                    } else {
-                        size_t tlv_size = 0;
-                        tlv_format(v.tlv_values, NULL, &tlv_size);
-                        if (tlv_size == 0) {
-                            json_string(json, "");
-                        } else {
-                            byte *tlv_data = malloc(tlv_size);
-                            tlv_format(v.tlv_values, tlv_data, &tlv_size);
-
-                            size_t encoded_tlv_size = base64_encoded_size(tlv_data, tlv_size);
-                            byte *encoded_tlv_data = malloc(encoded_tlv_size + 1);
-                            base64_encode(tlv_data, tlv_size, encoded_tlv_data);
-                            encoded_tlv_data[encoded_tlv_size] = 0;
-
-                            json_string(json, (char*) encoded_tlv_data);
-
-                            free(encoded_tlv_data);
-                            free(tlv_data);
-                        }
+                
+                if (ch->min_value) {
+                    int min_value = (int) *ch->min_value;
+                    if (v.float_value < min_value) {
+                        v.float_value = min_value;
                     }
-                    break;
                 }
-                case HOMETKIT_FORMAT_DATA:
-                    json_string(json, "value");
-                    if (!v.data_value || v.data_size == 0) {
+                
+                json_string(json, "value"); json_float(json, v.float_value);
+                break;
+            }
+            case HOMETKIT_FORMAT_STRING: {
+                json_string(json, "value"); json_string(json, v.string_value);
+                break;
+            }
+            case HOMETKIT_FORMAT_TLV: {
+                json_string(json, "value");
+                if (!v.tlv_values) {
+                    json_string(json, "");
+                } else {
+                    size_t tlv_size = 0;
+                    tlv_format(v.tlv_values, NULL, &tlv_size);
+                    if (tlv_size == 0) {
                         json_string(json, "");
                     } else {
-                        size_t encoded_data_size = base64_encoded_size(v.data_value, v.data_size);
-                        byte* encoded_data = malloc(encoded_data_size + 1);
-                        if (!encoded_data) {
-                            CLIENT_ERROR(client, "Allocate %d bytes for encoding data", encoded_data_size + 1);
-                            json_string(json, "");
-                            break;
-                        }
-                        base64_encode(v.data_value, v.data_size, encoded_data);
-                        encoded_data[encoded_data_size] = 0;
+                        byte *tlv_data = malloc(tlv_size);
+                        tlv_format(v.tlv_values, tlv_data, &tlv_size);
 
-                        json_string(json, (char*) encoded_data);
-                        
-                        free(encoded_data);
+                        size_t encoded_tlv_size = base64_encoded_size(tlv_data, tlv_size);
+                        byte *encoded_tlv_data = malloc(encoded_tlv_size + 1);
+                        base64_encode(tlv_data, tlv_size, encoded_tlv_data);
+                        encoded_tlv_data[encoded_tlv_size] = 0;
+
+                        json_string(json, (char*) encoded_tlv_data);
+
+                        free(encoded_tlv_data);
+                        free(tlv_data);
                     }
-                    break;
+                }
+                break;
             }
-        }
+            case HOMETKIT_FORMAT_DATA:
+                json_string(json, "value");
+                if (!v.data_value || v.data_size == 0) {
+                    json_string(json, "");
+                } else {
+                    size_t encoded_data_size = base64_encoded_size(v.data_value, v.data_size);
+                    byte* encoded_data = malloc(encoded_data_size + 1);
+                    if (!encoded_data) {
+                        CLIENT_ERROR(client, "Allocate %d bytes for encoding data", encoded_data_size + 1);
+                        json_string(json, "");
+                        break;
+                    }
+                    base64_encode(v.data_value, v.data_size, encoded_data);
+                    encoded_data[encoded_data_size] = 0;
 
-        if (!value && ch->getter_ex) {
-            // called getter to get value, need to free it
-            homekit_value_destruct(&v);
+                    json_string(json, (char*) encoded_data);
+                    
+                    free(encoded_data);
+                }
+                break;
         }
     }
+
+    if (!value && ch->getter_ex) {
+        // called getter to get value, need to free it
+        homekit_value_destruct(&v);
+    }
 }
 
 
+// --- ENCRYPTED SEND
+// Encrypts payload in place and sends it as a single frame.
+// Payload must be up to FRAME_PAYLOAD_SIZE bytes, with FRAME_HEADER_SIZE bytes free
+// before it and FRAME_TAG_SIZE bytes free after it.
+static int IRAM client_send_encrypted_frame(client_context_t *context, byte *payload, size_t size) {
+    byte nonce[12];
+    memset(nonce, 0, sizeof(nonce));
+    
+    byte *frame = payload - FRAME_HEADER_SIZE;
+    frame[0] = size % 256;
+    frame[1] = size / 256;
+    
+    byte i = 4;
+    int x = context->count_reads++;
+    while (x) {
+        nonce[i++] = x % 256;
+        x /= 256;
+    }
+    
+    size_t available = size + FRAME_TAG_SIZE;
+    int r = crypto_chacha20poly1305_encrypt(
+        context->read_key, nonce, frame, FRAME_HEADER_SIZE,
+        payload, size,
+        payload, &available
+    );
+    if (r) {
+        CLIENT_ERROR(context, "Encrypt payload (%d)", r);
+        return -1;
+    }
+    
+    const uint32_t free_heap = xPortGetFreeHeapSize();
+    
+    r = write(context->socket, frame, available + FRAME_HEADER_SIZE);
+    
+    if (r < 0) {
+        CLIENT_ERROR(context, "Send payload");
+        return r;
+    }
+    
+    if (free_heap < HOMEKIT_NETWORK_MIN_FREEHEAP) {
+        uint8_t count = 0;
+        while (free_heap > xPortGetFreeHeapSize() && count < 5) {
+            count++;
+            vTaskDelay(1);
+        }
+    }
+    
+    return 0;
+}
+
 int client_send_encrypted(client_context_t *context, byte *payload, size_t size) {
     if (!context || !context->encrypted)
         return -1;
 
-    byte nonce[12];
-    memset(nonce, 0, sizeof(nonce));
-    
     int payload_offset = 0;
 
     while (payload_offset < size) {
@@ -646,46 +769,14 @@ int client_send_encrypted(client_context_t *context, byte *payload, size_t size)
         if (chunk_size > ENCRYPTED_DATA_SIZE)
             chunk_size = ENCRYPTED_DATA_SIZE;
         
-        byte aead[2] = {chunk_size % 256, chunk_size / 256};
-
-        memcpy(homekit_server->encrypted, aead, 2);
-
-        byte i = 4;
-        int x = context->count_reads++;
-        while (x) {
-            nonce[i++] = x % 256;
-            x /= 256;
-        }
-        
-        size_t available = ENCRYPTED_DATA_SIZE + (18 - 2);
-        int r = crypto_chacha20poly1305_encrypt(
-            context->read_key, nonce, aead, 2,
-            payload + payload_offset, chunk_size,
-            homekit_server->encrypted + 2, &available
-        );
-        if (r) {
-            CLIENT_ERROR(context, "Encrypt payload (%d)", r);
-            return -1;
-        }
-        
-        payload_offset += chunk_size;
-        
-        const uint32_t free_heap = xPortGetFreeHeapSize();
-        
-        r = write(context->socket, homekit_server->encrypted, available + 2);
+        memcpy(homekit_server->encrypted + FRAME_HEADER_SIZE, payload + payload_offset, chunk_size);
         
+        int r = client_send_encrypted_frame(context, homekit_server->encrypted + FRAME_HEADER_SIZE, chunk_size);
         if (r < 0) {
-            CLIENT_ERROR(context, "Send payload");
             return r;
         }
         
-        if (free_heap < HOMEKIT_NETWORK_MIN_FREEHEAP) {
-            uint8_t count = 0;
-            while (free_heap > xPortGetFreeHeapSize() && count < 5) {
-                count++;
-                vTaskDelay(1);
-            }
-        }
+        payload_offset += chunk_size;
     }
 
     return 0;
@@ -786,45 +877,34 @@ int IRAM client_send(client_context_t *context, byte *data, size_t data_size) {
 }
 
 
+// Sends JSON buffer contents as one HTTP chunk. Data must point inside JSON buffer,
+// so chunk header and end are written around it and frame is encrypted in place.
 int IRAM client_send_chunk(byte *data, size_t size, void *arg) {
     client_context_t* context = arg;
     
-    byte header[9];
-    header[0] = 0;
-    int header_size = snprintf((char*) header, sizeof(header), "%x\r\n", size);
+    if (size == 0) {
+        byte end[] = "0\r\n\r\n";
+        return client_send(context, end, sizeof(end) - 1);
+    }
     
-    int r = 0;
+    char header[CHUNK_HEADER_SIZE + 1];
+    int header_size = snprintf(header, sizeof(header), "%x\r\n", size);
     
-    r = client_send(context, header, header_size);
+    byte *chunk = data - header_size;
+    memcpy(chunk, header, header_size);
+    data[size] = '\r';
+    data[size + 1] = '\n';
     
-    if (r == 0) {
-        if (size > 0) {
-            data[size] = '\r';
-            data[size + 1] = '\n';
-            r = client_send(context, data, size + 2);
-        } else {
-            byte end[2] = { '\r', '\n' };
-            r = client_send(context, end, sizeof(end));
-        }
-    }
+    const size_t chunk_size = header_size + size + 2;
     
-    return r;
+    if (context->encrypted) {
+        return client_send_encrypted_frame(context, chunk, chunk_size);
+    }
     
-    /*
-    size_t payload_size = size + 8;
-    byte *payload = malloc(payload_size);
-
-    int offset = snprintf((char *)payload, payload_size, "%x\r\n", size);
-    memcpy(payload + offset, data, size);
-    payload[offset + size] = '\r';
-    payload[offset + size + 1] = '\n';
-
-    client_send(context, payload, offset + size + 2);
-
-    free(payload);
-     */
+    return client_send(context, chunk, chunk_size);
 }
 
+// --- RESPONSES
 void IRAM send_200_response(client_context_t* context) {
     byte response[] =
         "HTTP/1.1 200 OK\r\n"
@@ -1982,15 +2062,8 @@ void homekit_server_on_pair_verify(client_context_t *context, const byte *data,
 }
 
 
-void homekit_server_on_get_accessories(client_context_t *context) {
-    CLIENT_INFO(context, "Get Acc");
-    DEBUG_HEAP();
-    
-    send_200_response(context);
-    
-    json_stream* json = &homekit_server->json;
-    json_init(json, context);
-    
+// --- ACCESSORIES JSON
+void write_accessories_json(json_stream *json, client_context_t *context, characteristic_format_t format) {
     json_object_start(json);
     json_string(json, "accessories"); json_array_start(json);
 
@@ -2029,14 +2102,7 @@ void homekit_server_on_get_accessories(client_context_t *context) {
                 homekit_characteristic_t *ch = *ch_it;
 
                 json_object_start(json);
-                write_characteristic_json(
-                    json, context, ch,
-                      characteristic_format_type
-                    | characteristic_format_meta
-                    | characteristic_format_perms
-                    | characteristic_format_events,
-                    NULL
-                );
+                write_characteristic_json(json, context, ch, format, NULL);
                 json_object_end(json);
                 
                 if (json->error) {
@@ -2062,6 +2128,215 @@ void homekit_server_on_get_accessories(client_context_t *context) {
     
     json_array_end(json);
     json_object_end(json); // response
+}
+
+// Frequent /accessories fragments, replaced by one byte token in cache
+static const char *accessories_cache_tokens[] = {
+    ",\"perms\":[\"pr\",\"pw\",\"ev\"]",
+    ",\"perms\":[\"pr\",\"ev\"]",
+    ",\"perms\":[\"pr\"]",
+    ",\"perms\":[\"pw\"]",
+    ",\"primary\":false,\"hidden\":false",
+    ",\"primary\":true,\"hidden\":false",
+    ",\"characteristics\":[",
+    ",\"services\":[",
+    ",\"format\":\"string\"",
+    ",\"format\":\"uint16\"",
+    ",\"format\":\"uint32\"",
+    ",\"format\":\"uint8\"",
+    ",\"format\":\"float\"",
+    ",\"format\":\"bool\"",
+    ",\"format\":\"tlv8\"",
+    ",\"format\":\"data\"",
+    ",\"format\":\"int\"",
+    ",\"valid-values\":[",
+    ",\"unit\":\"percentage\"",
+    ",\"unit\":\"celsius\"",
+    ",\"unit\":\"",
+    ",\"minValue\":",
+    ",\"maxValue\":",
+    ",\"minStep\":",
+    ",\"type\":\"",
+    ",\"iid\":",
+    "{\"aid\":",
+    "{\"iid\":",
+    NULL
+};
+
+typedef struct {
+    byte *buffer;       // NULL while measuring
+    size_t capacity;
+    size_t size;
+    uint8_t raw_bytes;  // Pending hole bytes to copy verbatim
+} accessories_cache_builder_t;
+
+void write_accessories_cache_hole(json_stream *json, byte hole, const homekit_characteristic_t *ch) {
+    const byte data[3] = { hole, ch->index % 256, ch->index / 256 };
+    json_raw(json, data, sizeof(data));
+}
+
+static int accessories_cache_builder_flush(uint8_t *data, size_t size, void *context) {
+    accessories_cache_builder_t *builder = context;
+    
+    void put(byte b) {
+        if (builder->buffer && builder->size < builder->capacity) {
+            builder->buffer[builder->size] = b;
+        }
+        builder->size++;
+    }
+    
+    size_t i = 0;
+    while (i < size) {
+        if (builder->raw_bytes) {
+            builder->raw_bytes--;
+            put(data[i++]);
+            continue;
+        }
+        
+        if (data[i] == ACCESSORIES_CACHE_EVENTS || data[i] == ACCESSORIES_CACHE_VALUE) {
+            builder->raw_bytes = 2;
+            put(data[i++]);
+            continue;
+        }
+        
+        bool found = false;
+        if (data[i] == ',' || data[i] == '{') {
+            for (uint8_t t = 0; accessories_cache_tokens[t]; t++) {
+                const size_t token_len = strlen(accessories_cache_tokens[t]);
+                if (token_len <= size - i && !memcmp(data + i, accessories_cache_tokens[t], token_len)) {
+                    put(ACCESSORIES_CACHE_TOKEN + t);
+                    i += token_len;
+                    found = true;
+                    break;
+                }
+            }
+        }
+        
+        if (!found) {
+            put(data[i++]);
+        }
+    }
+    
+    return 0;
+}
+
+static void accessories_cache_build(accessories_cache_builder_t *builder) {
+    json_stream json = homekit_server->json;
+    json.on_flush = accessories_cache_builder_flush;
+    json_init(&json, builder);
+    
+    write_accessories_json(&json, NULL, characteristic_format_type
+                                      | characteristic_format_meta
+                                      | characteristic_format_perms
+                                      | characteristic_format_events
+                                      | characteristic_format_skeleton);
+    json_flush(&json);
+}
+
+static void homekit_accessories_cache_init() {
+    if (HOMEKIT_ACCESSORIES_CACHE_MAX_SIZE == 0 || homekit_server->accessories_cache_disabled) {
+        return;
+    }
+    
+    accessories_cache_builder_t builder = { NULL, 0, 0, 0 };
+    
+    if (homekit_server->accessories_cache_size == 0) {
+        accessories_cache_build(&builder);
+        if (builder.size > HOMEKIT_ACCESSORIES_CACHE_MAX_SIZE) {
+            HOMEKIT_INFO("Acc cache too big (%i)", builder.size);
+            homekit_server->accessories_cache_disabled = true;
+            return;
+        }
+        
+        homekit_server->accessories_cache_size = builder.size;
+    }
+    
+    // Keep cache only when there is enough DRAM left for clients
+    if (xPortGetFreeHeapSize() < homekit_server->accessories_cache_size + HOMEKIT_NETWORK_MIN_FREEHEAP) {
+        return;
+    }
+    
+    builder.buffer = malloc(homekit_server->accessories_cache_size);
+    if (!builder.buffer) {
+        return;
+    }
+    
+    builder.capacity = homekit_server->accessories_cache_size;
+    builder.size = 0;
+    accessories_cache_build(&builder);
+    
+    if (builder.size != builder.capacity) {
+        // Accessories changed between measure and build
+        free(builder.buffer);
+        homekit_server->accessories_cache_size = 0;
+        return;
+    }
+    
+    homekit_server->accessories_cache = builder.buffer;
+    HOMEKIT_INFO("Acc cache %i bytes", builder.size);
+}
+
+static void write_accessories_cache_json(json_stream *json, client_context_t *context) {
+    const byte *cache = homekit_server->accessories_cache;
+    const size_t cache_size = homekit_server->accessories_cache_size;
+    
+    size_t i = 0;
+    while (i < cache_size && !json->error) {
+        const byte b = cache[i];
+        
+        if (b == ACCESSORIES_CACHE_EVENTS || b == ACCESSORIES_CACHE_VALUE) {
+            const homekit_characteristic_t *ch = homekit_characteristic_by_index(homekit_server->config->accessories, cache[i + 1] + (cache[i + 2] << 8));
+            i += 3;
+            
+            // Holes are inside characteristic objects, at least after aid and iid. Events hole
+            // is before meta fields, and value hole is last
+            json_object_continue(json);
+            if (b == ACCESSORIES_CACHE_EVENTS) {
+                json_string(json, "ev");
+                json_boolean(json, homekit_characteristic_has_notify_subscription(ch, context->subscriptions));
+            } else {
+                write_characteristic_value_json(json, context, ch, NULL);
+            }
+            
+        } else if (b >= ACCESSORIES_CACHE_TOKEN && b < ' ') {
+            const char *token = accessories_cache_tokens[b - ACCESSORIES_CACHE_TOKEN];
+            json_raw(json, (const uint8_t*) token, strlen(token));
+            i++;
+            
+        } else {
+            size_t literal_size = 1;
+            while (i + literal_size < cache_size && cache[i + literal_size] >= ' ') {
+                literal_size++;
+            }
+            
+            json_raw(json, cache + i, literal_size);
+            i += literal_size;
+        }
+    }
+}
+
+// --- GET ACCESSORIES
+void homekit_server_on_get_accessories(client_context_t *context) {
+    CLIENT_INFO(context, "Get Acc");
+    DEBUG_HEAP();
+    
+    if (!homekit_server->accessories_cache) {
+        homekit_accessories_cache_init();
+    }
+    
+    send_200_response(context);
+    
+    json_stream* json = &homekit_server->json;
+    json_init(json, context);
+    
+    if (homekit_server->accessories_cache) {
+        write_accessories_cache_json(json, context);
+    } else {
+        write_accessories_json(json, context, characteristic_format_type
+                                            | characteristic_format_meta
+                                            | characteristic_format_perms
+                                            | characteristic_format_events);
+    }
     
     json_flush(json);
     //json_buffer_free(json);
@@ -2086,7 +2361,7 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     }
 
     query_param_t *id_param = query_params_find(context->endpoint_params, "id");
-    if (!id_param) {
+    if (!id_param || !id_param->value) {
         CLIENT_ERROR(context, "Missing ID parameter");
         send_json_error_response(context, 400, HAPStatus_InvalidValue);
         return;
@@ -2110,39 +2385,59 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     if (bool_endpoint_param("ev"))
         format |= characteristic_format_events;
 
+    // Resolve all requested ids once, keeping them on stack unless request is too long
+    size_t requested_count = 1;
+    for (const char *c = id_param->value; *c; c++) {
+        if (*c == ',') {
+            requested_count++;
+        }
+    }
+
+    requested_characteristic_t requested_stack[HOMEKIT_GET_CHARACTERISTICS_STACK_IDS];
+    requested_characteristic_t *requested = requested_stack;
+    if (requested_count > HOMEKIT_GET_CHARACTERISTICS_STACK_IDS) {
+        requested = malloc(sizeof(requested_characteristic_t) * requested_count);
+        if (!requested) {
+            CLIENT_ERROR(context, "Allocate %d ids", requested_count);
+            send_json_error_response(context, 503, HAPStatus_OutOfResources);
+            return;
+        }
+    }
+
     bool success = true;
 
-    char *id = strdup(id_param->value);
-    char *ch_id;
-    char *_id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        if (!dot) {
+    const char *ch_id = id_param->value;
+    for (size_t i = 0; i < requested_count; i++) {
+        char *end;
+        const int aid = strtol(ch_id, &end, 10);
+        if (*end != '.') {
+            if (requested != requested_stack) {
+                free(requested);
+            }
             send_json_error_response(context, 400, HAPStatus_InvalidValue);
-            free(id);
             return;
         }
 
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
+        const int iid = strtol(end + 1, &end, 10);
+        ch_id = strchr(end, ',');
+        if (ch_id) {
+            ch_id++;
+        } else {
+            ch_id = end + strlen(end);
+        }
 
         CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", aid, iid);
         homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(homekit_server->config->accessories, aid, iid);
-        if (!ch) {
-            success = false;
-            continue;
-        }
 
-        if (!(ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ)) {
+        requested[i].ch = ch;
+        requested[i].aid = aid;
+        requested[i].iid = iid;
+
+        if (!ch || !(ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ)) {
             success = false;
-            continue;
         }
     }
 
-    free(id);
-    id = strdup(id_param->value);
-
     if (success) {
         send_200_response(context);
     } else {
@@ -2163,22 +2458,15 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
         json_object_end(json);
     }
 
-    _id = id;
-    while ((ch_id = strsep(&_id, ","))) {
-        char *dot = strstr(ch_id, ".");
-        *dot = 0;
-        int aid = atoi(ch_id);
-        int iid = atoi(dot+1);
-
-        CLIENT_DEBUG(context, "Requested characteristic info for %d.%d", aid, iid);
-        homekit_characteristic_t *ch = homekit_characteristic_by_aid_and_iid(homekit_server->config->accessories, aid, iid);
+    for (size_t i = 0; i < requested_count; i++) {
+        homekit_characteristic_t *ch = requested[i].ch;
         if (!ch) {
-            write_characteristic_error(json, aid, iid, HAPStatus_NoResource);
+            write_characteristic_error(json, requested[i].aid, requested[i].iid, HAPStatus_NoResource);
             continue;
         }
 
         if (!(ch->permissions & HOMEKIT_PERMISSIONS_PAIRED_READ)) {
-            write_characteristic_error(json, aid, iid, HAPStatus_WriteOnly);
+            write_characteristic_error(json, requested[i].aid, requested[i].iid, HAPStatus_WriteOnly);
             continue;
         }
 
@@ -2194,6 +2482,10 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
         }
     }
 
+    if (requested != requested_stack) {
+        free(requested);
+    }
+
     json_array_end(json);
     json_object_end(json); // response
 
@@ -2207,8 +2499,6 @@ void homekit_server_on_get_characteristics(client_context_t *context) {
     } else {
         client_send_chunk(NULL, 0, context);
     }
-    
-    free(id);
 }
 
 void homekit_server_on_update_characteristics(client_context_t *context, const byte *data, size_t size) {
@@ -2624,9 +2914,17 @@ void homekit_server_on_update_characteristics(client_context_t *context, const b
             }
 
             if (j_events->type == cJSON_True) {
-                homekit_characteristic_add_notify_subscription(ch, context);
-            } else {
-                homekit_characteristic_remove_notify_subscription(ch, context);
+                if (!context->subscriptions) {
+                    context->subscriptions = homekit_characteristic_bitmap_new();
+                    if (!context->subscriptions) {
+                        CLIENT_ERROR(context, "Notification for %d.%d: no memory", aid, iid);
+                        return HAPStatus_OutOfResources;
+                    }
+                }
+                
+                homekit_characteristic_add_notify_subscription(ch, context->subscriptions);
+            } else if (context->subscriptions) {
+                homekit_characteristic_remove_notify_subscription(ch, context->subscriptions);
             }
         }
 
@@ -3214,8 +3512,6 @@ void IRAM homekit_server_close_client(client_context_t *context) {
         pairing_context_free(homekit_server->pairing_context);
     }
 
-    homekit_accessories_clear_notify_subscriptions(homekit_server->config->accessories, context);
-    
     HOMEKIT_NOTIFY_EVENT(homekit_server, HOMEKIT_EVENT_CLIENT_DISCONNECTED);
 
     client_context_free(context);
@@ -3290,42 +3586,107 @@ void homekit_server_accept_client() {
     }
 }
 
-void homekit_characteristic_notify(homekit_characteristic_t *ch) {
+static void homekit_server_wakeup_init() {
+    homekit_server->wakeup_fd = -1;
+    
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) {
+        HOMEKIT_ERROR("Wakeup socket");
+        return;
+    }
+    
+    // Bind to a free loopback port and connect to itself, so any task can wake up select()
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    
+    if (bind(s, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        getsockname(s, (struct sockaddr*) &addr, &addr_len) < 0 ||
+        connect(s, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        HOMEKIT_ERROR("Wakeup socket setup");
+        close(s);
+        return;
+    }
+    
+    homekit_server->wakeup_fd = s;
+    FD_SET(s, &homekit_server->fds);
+}
+
+static void homekit_server_wakeup_drain() {
+    byte buffer[8];
+    while (recv(homekit_server->wakeup_fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+#ifdef HOMEKIT_NOTIFY_LATENCY_STATS
+static void homekit_notify_latency_add(const uint32_t latency_us) {
+    static const uint32_t limits_ms[HOMEKIT_NOTIFY_LATENCY_BUCKETS - 1] = { 1, 2, 5, 10, 20, 50, 100 };
+    
+    const uint32_t latency_ms = latency_us / 1000;
+    uint8_t bucket = 0;
+    while (bucket < HOMEKIT_NOTIFY_LATENCY_BUCKETS - 1 && latency_ms >= limits_ms[bucket]) {
+        bucket++;
+    }
+    
+    homekit_server->notify_latency[bucket]++;
+}
+
+void homekit_get_notify_latency_histogram(uint32_t histogram[HOMEKIT_NOTIFY_LATENCY_BUCKETS]) {
     if (homekit_server) {
-        notification_t* notification = homekit_server->notifications;
-        while (notification) {
-            if (ch == notification->ch) {
-                return;
-            }
-            
-            notification = notification->next;
-        }
-        
-        notification = malloc(sizeof(notification_t));
-        memset(notification, 0, sizeof(*notification));
+        memcpy(histogram, homekit_server->notify_latency, sizeof(homekit_server->notify_latency));
+    } else {
+        memset(histogram, 0, sizeof(uint32_t) * HOMEKIT_NOTIFY_LATENCY_BUCKETS);
+    }
+}
+#endif // HOMEKIT_NOTIFY_LATENCY_STATS
+
+void homekit_characteristic_notify(homekit_characteristic_t *ch) {
+    if (homekit_server && homekit_server->notifications) {
+        taskENTER_CRITICAL();
+        homekit_server->notifications[HOMEKIT_CHARACTERISTIC_BITMAP_WORD(ch)] |= HOMEKIT_CHARACTERISTIC_BITMAP_MASK(ch);
+        const bool wakeup = !homekit_server->has_notifications;
+        if (wakeup) {
+            homekit_server->notifications_time = homekit_port_time_us();
+        }
+        homekit_server->has_notifications = true;
+        taskEXIT_CRITICAL();
         
-        notification->ch = ch;
-        notification->next = homekit_server->notifications;
-        homekit_server->notifications = notification;
+        // Only first notification of a batch needs to wake up server loop.
+        // A failed send, like a transient lack of buffers, only uses polling until next batch is sent
+        if (wakeup && homekit_server->wakeup_fd >= 0) {
+            const byte signal = 0;
+            homekit_server->wakeup_error = send(homekit_server->wakeup_fd, &signal, 1, MSG_DONTWAIT) < 0;
+        }
     }
 }
 
 inline static void homekit_server_process_notifications() {
-    notification_t *notifications = homekit_server->notifications;
-    homekit_server->notifications = NULL;
+    const size_t bitmap_size = homekit_characteristic_bitmap_size();
+    
+    taskENTER_CRITICAL();
+    homekit_characteristic_bitmap_t *notifications = homekit_server->notifications;
+    homekit_server->notifications = homekit_server->notifications_sending;
+    homekit_server->notifications_sending = notifications;
+    homekit_server->has_notifications = false;
+#ifdef HOMEKIT_NOTIFY_LATENCY_STATS
+    const uint32_t notifications_time = homekit_server->notifications_time;
+#endif
+    taskEXIT_CRITICAL();
     
     client_context_t *context = homekit_server->clients;
     while (context) {
-        bool has_notifications = false;
+        const homekit_characteristic_bitmap_t *subscriptions = context->subscriptions;
         
-        notification_t *notification = notifications;
-        while (notification) {
-            if (homekit_characteristic_has_notify_subscription(notification->ch, context)) {
-                has_notifications = true;
-                break;
+        bool has_notifications = false;
+        if (subscriptions) {
+            for (size_t i = 0; i < bitmap_size; i++) {
+                if (notifications[i] & subscriptions[i]) {
+                    has_notifications = true;
+                    break;
+                }
             }
-
-            notification = notification->next;
         }
         
         if (has_notifications) {
@@ -3344,17 +3705,22 @@ inline static void homekit_server_process_notifications() {
             json_object_start(json);
             json_string(json, "characteristics"); json_array_start(json);
             
-            notification = notifications;
-            while (notification) {
-                json_object_start(json);
-                write_characteristic_json(json, context, notification->ch, 0, &notification->ch->value);
-                json_object_end(json);
-                
-                if (json->error) {
-                    break;
+            for (size_t i = 0; i < bitmap_size && !json->error; i++) {
+                homekit_characteristic_bitmap_t pending = notifications[i] & subscriptions[i];
+                while (pending) {
+                    const uint16_t index = i * HOMEKIT_CHARACTERISTIC_BITMAP_BITS + __builtin_ctz(pending);
+                    pending &= pending - 1;
+                    
+                    homekit_characteristic_t *ch = homekit_characteristic_by_index(homekit_server->config->accessories, index);
+                    
+                    json_object_start(json);
+                    write_characteristic_json(json, context, ch, 0, &ch->value);
+                    json_object_end(json);
+                    
+                    if (json->error) {
+                        break;
+                    }
                 }
-                
-                notification = notification->next;
             }
             
             json_array_end(json);
@@ -3367,18 +3733,17 @@ inline static void homekit_server_process_notifications() {
                 homekit_disconnect_client(context);
             } else {
                 client_send_chunk(NULL, 0, context);
+#ifdef HOMEKIT_NOTIFY_LATENCY_STATS
+                homekit_notify_latency_add(homekit_port_time_us() - notifications_time);
+#endif
             }
         }
         
         context = context->next;
     }
     
-    // Remove pending notifications
-    while (notifications) {
-        notification_t* notification_old = notifications;
-        notifications = notifications->next;
-        free(notification_old);
-    }
+    // Remove sent notifications
+    memset(notifications, 0, bitmap_size * sizeof(homekit_characteristic_bitmap_t));
 }
 
 inline static void IRAM homekit_server_close_clients() {
@@ -3386,6 +3751,8 @@ inline static void IRAM homekit_server_close_clients() {
         homekit_server->pending_close = false;
         
         int max_fd = homekit_server->listen_fd;
+        if (homekit_server->wakeup_fd > max_fd)
+            max_fd = homekit_server->wakeup_fd;
 
         client_context_t head;
         head.next = homekit_server->clients;
@@ -3425,15 +3792,34 @@ static void IRAM homekit_run_server() {
     FD_SET(homekit_server->listen_fd, &homekit_server->fds);
     homekit_server->max_fd = homekit_server->listen_fd;
     
-    struct timeval timeout = { 0, 100000 }; /* 0.1 seconds timeout (orig: 1s) */
+    homekit_server_wakeup_init();
+    if (homekit_server->wakeup_fd > homekit_server->max_fd) {
+        homekit_server->max_fd = homekit_server->wakeup_fd;
+    }
+    
+    const struct timeval idle_timeout = { HOMEKIT_SERVER_IDLE_TIMEOUT_MS / 1000, (HOMEKIT_SERVER_IDLE_TIMEOUT_MS % 1000) * 1000 };
+    const struct timeval poll_timeout = { HOMEKIT_SERVER_POLL_TIMEOUT_MS / 1000, (HOMEKIT_SERVER_POLL_TIMEOUT_MS % 1000) * 1000 };
+    struct timeval timeout;
     int triggered_nfds;
     fd_set read_fds;
     
     for (;;) {
         memcpy(&read_fds, &homekit_server->fds, sizeof(read_fds));
         
+        // Without a working wakeup socket, notifications are only checked on timeout
+        if (homekit_server->wakeup_fd < 0 || homekit_server->wakeup_error) {
+            timeout = poll_timeout;
+        } else {
+            timeout = idle_timeout;
+        }
+        
         triggered_nfds = select(homekit_server->max_fd + 1, &read_fds, NULL, NULL, &timeout);
         if (triggered_nfds > 0) {
+            if (homekit_server->wakeup_fd >= 0 && FD_ISSET(homekit_server->wakeup_fd, &read_fds)) {
+                homekit_server_wakeup_drain();
+                triggered_nfds--;
+            }
+            
             if (FD_ISSET(homekit_server->listen_fd, &read_fds)) {
                 homekit_server_accept_client();
                 triggered_nfds--;
@@ -3456,7 +3842,7 @@ static void IRAM homekit_run_server() {
             homekit_server_close_clients();
         }
         
-        if (homekit_server->notifications) {
+        if (homekit_server->has_notifications) {
             homekit_server_process_notifications();
         }
     }
@@ -3628,6 +4014,13 @@ void homekit_server_init(homekit_server_config_t *config) {
     homekit_server = server_new();
     homekit_server->config = config;
     
+    homekit_server->notifications = homekit_characteristic_bitmap_new();
+    homekit_server->notifications_sending = homekit_characteristic_bitmap_new();
+    if (!homekit_server->notifications_sending && homekit_server->notifications) {
+        free(homekit_server->notifications);
+        homekit_server->notifications = NULL;
+    }
+    
     if (homekit_server->config->max_clients == 0) {
         homekit_server->config->max_clients = HOMEKIT_MAX_CLIENTS_DEFAULT;
     }
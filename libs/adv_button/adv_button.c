@@ -19,6 +19,7 @@
 #include "adv_button.h"
 
 #define ADV_BUTTON_DEFAULT_EVAL     (4)
+#define ADV_BUTTON_GPIOS            (17)
 
 #define DOUBLEPRESS_TIME            (450)
 #define LONGPRESS_TIME              (DOUBLEPRESS_TIME + 10)
@@ -33,6 +34,10 @@
 #define MCP_CHANNEL_A               (0)
 #define MCP_CHANNEL_B               (1)
 #define MCP_CHANNEL_BOTH            (2)
+#define MCP_PINS                    (16)
+
+#define MCP_REG_INTFA               (0x0E)  // INTFA, INTFB, INTCAPA and INTCAPB are read together
+#define MCP_REG_GPIOA               (0x12)
 
 #define DISABLE_TIME                (ADV_BUTTON_DEFAULT_EVAL * 10)
 #define MIN(x, y)                   (((x) < (y)) ? (x) : (y))
@@ -58,6 +63,7 @@ typedef struct _adv_button {
     bool inverted: 1;
     bool state: 1;
     bool old_state: 1;
+    bool is_polled: 1;      // Evaluated every cycle. Otherwise, only when an interrupt wakes up evaluation
 
     TimerHandle_t press_timer;
     TimerHandle_t hold_timer;
@@ -82,6 +88,13 @@ typedef struct _adv_button_mcp {
     
     uint8_t bus: 1;
     uint8_t channels: 2;
+    bool has_inputs: 1;
+    bool has_interrupt: 1;
+    
+    uint8_t interrupt_gpio;
+    volatile bool interrupt_pending;    // Written by ISR, so it does not share a byte with bitfields written by task
+    
+    adv_button_t* buttons[MCP_PINS];    // Indexed by MCP23017 pin
 
     struct _adv_button_mcp* next;
 } adv_button_mcp_t;
@@ -94,39 +107,41 @@ typedef struct _adv_button_main_config {
     
     uint8_t button_evaluate_delay;
     bool button_evaluate_is_working: 1;
-    bool continuos_mode: 1;
+    bool has_polled_buttons: 1;
+    volatile bool is_awake;     // Written by ISR, so it does not share a byte with bitfields written by task
     
     TimerHandle_t button_evaluate_timer;
 
     adv_button_t* buttons;
     adv_button_mcp_t* mcps;
+    
+    // Lookup tables, so interrupts and callbacks find inputs without walking lists
+    adv_button_t* buttons_by_gpio[ADV_BUTTON_GPIOS];
+    adv_button_mcp_t** mcps_by_index;
+    uint8_t mcps_by_index_size;
 } adv_button_main_config_t;
 
 static adv_button_main_config_t* adv_button_main_config = NULL;
 
-static adv_button_t* IRAM button_find_by_gpio(const uint16_t gpio) {
-    if (adv_button_main_config) {
-        adv_button_t* button = adv_button_main_config->buttons;
-        
-        while (button && button->gpio != gpio) {
-            button = button->next;
-        }
-
-        return button;
+static adv_button_mcp_t* IRAM mcp_find_by_index(const uint8_t index) {
+    if (adv_button_main_config && index < adv_button_main_config->mcps_by_index_size) {
+        return adv_button_main_config->mcps_by_index[index];
     }
     
     return NULL;
 }
 
-static adv_button_mcp_t* IRAM mcp_find_by_index(const uint8_t index) {
+// MCP23017 inputs are numbered as index * 100 + pin
+static adv_button_t* IRAM button_find_by_gpio(const uint16_t gpio) {
     if (adv_button_main_config) {
-        adv_button_mcp_t* mcp = adv_button_main_config->mcps;
+        if (gpio < ADV_BUTTON_GPIOS) {
+            return adv_button_main_config->buttons_by_gpio[gpio];
+        }
         
-        while (mcp && mcp->index != index) {
-            mcp = mcp->next;
+        adv_button_mcp_t* mcp = mcp_find_by_index(gpio / 100);
+        if (mcp && (gpio % 100) < MCP_PINS) {
+            return mcp->buttons[gpio % 100];
         }
-
-        return mcp;
     }
     
     return NULL;
@@ -144,11 +159,46 @@ static bool IRAM adv_button_read_mcp_gpio(const uint16_t gpio) {
         if (mcp_gpio > 7) {
             return (bool) ((1 << (mcp_gpio - 8)) & adv_button_mcp->value_b);
         }
+        
+        return (bool) ((1 << mcp_gpio) & adv_button_mcp->value_a);
     }
     
     return false;
 }
 
+// Ports with inputs are read in a single transaction
+static void adv_button_mcp_read(adv_button_mcp_t* mcp) {
+    uint8_t reg = MCP_REG_GPIOA;
+    
+    if (mcp->channels == MCP_CHANNEL_BOTH) {
+        uint8_t values[2];
+        if (i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, values, 2) == 0) {
+            mcp->value_a = values[0];
+            mcp->value_b = values[1];
+        }
+    } else if (mcp->channels == MCP_CHANNEL_A) {
+        i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_a, 1);
+    } else {
+        reg++;
+        i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_b, 1);
+    }
+}
+
+// Values captured when interrupt happened are taken only from ports that raised it. Reading them clears interrupt
+static void adv_button_mcp_read_interrupt(adv_button_mcp_t* mcp) {
+    const uint8_t reg = MCP_REG_INTFA;
+    uint8_t values[4];
+    if (i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, values, 4) == 0) {
+        if (values[0] && mcp->channels != MCP_CHANNEL_B) {
+            mcp->value_a = values[2];
+        }
+        
+        if (values[1] && mcp->channels != MCP_CHANNEL_A) {
+            mcp->value_b = values[3];
+        }
+    }
+}
+
 static void IRAM adv_button_run_callback_fn(adv_button_callback_fn_t* callbacks, const uint16_t gpio) {
     adv_button_callback_fn_t* adv_button_callback_fn = callbacks;
     
@@ -158,11 +208,10 @@ static void IRAM adv_button_run_callback_fn(adv_button_callback_fn_t* callbacks,
     }
 }
 
-static void IRAM push_down(const uint8_t used_gpio) {
+static void IRAM push_down(adv_button_t* button) {
     const uint32_t now = xTaskGetTickCountFromISR();
     
     if (now - adv_button_main_config->disable_time > DISABLE_TIME / portTICK_PERIOD_MS) {
-        adv_button_t *button = button_find_by_gpio(used_gpio);
         if (button->singlepress0_callback_fn) {
             adv_button_run_callback_fn(button->singlepress0_callback_fn, button->gpio);
         }
@@ -173,12 +222,10 @@ static void IRAM push_down(const uint8_t used_gpio) {
     }
 }
 
-static void inline IRAM push_up(const uint8_t used_gpio) {
+static void inline IRAM push_up(adv_button_t* button) {
     const uint32_t now = xTaskGetTickCountFromISR();
     
     if (now - adv_button_main_config->disable_time > DISABLE_TIME / portTICK_PERIOD_MS) {
-        adv_button_t *button = button_find_by_gpio(used_gpio);
-        
         if (button->press_count == DISABLE_PRESS_COUNT) {
             button->press_count = 0;
             return;
@@ -243,49 +290,134 @@ static void IRAM adv_button_interrupt_pulse(const uint8_t gpio) {
     gpio_set_interrupt(gpio, GPIO_INTTYPE_EDGE_NEG, adv_button_interrupt_pulse);
 }
 
-static void IRAM adv_button_interrupt_normal(const uint8_t gpio) {
-    gpio_set_interrupt(gpio, GPIO_INTTYPE_NONE, NULL);
-    
+static void IRAM adv_button_interrupt_normal(const uint8_t gpio);
+
+static void IRAM adv_button_interrupts_set(const bool enable) {
     adv_button_t* button = adv_button_main_config->buttons;
     while (button) {
-        if (button->mode == ADV_BUTTON_NORMAL_MODE) {
-            gpio_set_interrupt(button->gpio, GPIO_INTTYPE_NONE, NULL);
+        if (button->mode == ADV_BUTTON_NORMAL_MODE && !button->is_polled) {
+            gpio_set_interrupt(button->gpio, enable ? GPIO_INTTYPE_EDGE_ANY : GPIO_INTTYPE_NONE, enable ? adv_button_interrupt_normal : NULL);
         }
         button = button->next;
     }
+    
+    adv_button_mcp_t* mcp = adv_button_main_config->mcps;
+    while (mcp) {
+        if (mcp->has_interrupt) {
+            gpio_set_interrupt(mcp->interrupt_gpio, enable ? GPIO_INTTYPE_EDGE_NEG : GPIO_INTTYPE_NONE, enable ? adv_button_interrupt_normal : NULL);
+        }
+        mcp = mcp->next;
+    }
+}
+
+// Any interrupt wakes up evaluation of all inputs not polled, until they are stable
+static void IRAM adv_button_interrupt_normal(const uint8_t gpio) {
+    adv_button_interrupts_set(false);
+    
+    adv_button_mcp_t* mcp = adv_button_main_config->mcps;
+    while (mcp) {
+        if (mcp->has_interrupt && mcp->interrupt_gpio == gpio) {
+            mcp->interrupt_pending = true;
+        }
+        mcp = mcp->next;
+    }
+    
+    adv_button_main_config->button_evaluate_sleep_countdown = 0;
+    adv_button_main_config->is_awake = true;
 
     esp_timer_start_from_ISR(adv_button_main_config->button_evaluate_timer);
 }
 
+// Enables interrupts again. Returns false if inputs changed while doing it, so evaluation must go on
+static bool adv_button_sleep() {
+    adv_button_mcp_t* mcp = adv_button_main_config->mcps;
+    while (mcp) {
+        if (mcp->has_interrupt && mcp->has_inputs) {
+            const uint8_t value_a = mcp->value_a;
+            const uint8_t value_b = mcp->value_b;
+            
+            adv_button_mcp_read(mcp);
+            
+            if (value_a != mcp->value_a || value_b != mcp->value_b) {
+                return false;
+            }
+        }
+        mcp = mcp->next;
+    }
+    
+    adv_button_main_config->is_awake = false;
+    adv_button_interrupts_set(true);
+    
+    bool is_changed = false;
+    
+    adv_button_t* button = adv_button_main_config->buttons;
+    while (button && !is_changed) {
+        if (button->mode == ADV_BUTTON_NORMAL_MODE && !button->is_polled && gpio_read(button->gpio) != button->state) {
+            is_changed = true;
+        }
+        button = button->next;
+    }
+    
+    mcp = adv_button_main_config->mcps;
+    while (mcp && !is_changed) {
+        if (mcp->has_interrupt && !gpio_read(mcp->interrupt_gpio)) {
+            is_changed = true;
+        }
+        mcp = mcp->next;
+    }
+    
+    if (is_changed) {
+        adv_button_interrupts_set(false);
+        adv_button_main_config->is_awake = true;
+        return false;
+    }
+    
+    return true;
+}
+
+static void adv_button_polled_update() {
+    adv_button_main_config->has_polled_buttons = false;
+    
+    adv_button_t* button = adv_button_main_config->buttons;
+    while (button) {
+        if (button->mode > ADV_BUTTON_PULSE_MODE) {     // MCP23017
+            adv_button_mcp_t* mcp = mcp_find_by_index(button->gpio / 100);
+            button->is_polled = !mcp || !mcp->has_interrupt;
+        }
+        
+        if (button->is_polled) {
+            adv_button_main_config->has_polled_buttons = true;
+        }
+        
+        button = button->next;
+    }
+    
+    if (adv_button_main_config->has_polled_buttons) {
+        esp_timer_start(adv_button_main_config->button_evaluate_timer);
+    } else {
+        taskENTER_CRITICAL();
+        if (adv_button_main_config->is_awake) {
+            esp_timer_start_from_ISR(adv_button_main_config->button_evaluate_timer);
+        } else {
+            esp_timer_stop_from_ISR(adv_button_main_config->button_evaluate_timer);
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
 static void IRAM button_evaluate_fn() {
     if (!adv_button_main_config->button_evaluate_is_working) {
         adv_button_main_config->button_evaluate_is_working = true;
         
-        if (!adv_button_main_config->continuos_mode) {
-            if (adv_button_main_config->button_evaluate_sleep_countdown < adv_button_main_config->button_evaluate_sleep_time) {
-                adv_button_main_config->button_evaluate_sleep_countdown++;
-            } else {
-                esp_timer_stop(adv_button_main_config->button_evaluate_timer);
-                adv_button_main_config->button_evaluate_sleep_countdown = 0;
-                
-                adv_button_t* button = adv_button_main_config->buttons;
-                while (button) {
-                    gpio_set_interrupt(button->gpio, GPIO_INTTYPE_EDGE_ANY, adv_button_interrupt_normal);
-                    button = button->next;
-                }
-            }
-        }
+        const bool is_awake = adv_button_main_config->is_awake;
         
         adv_button_mcp_t* mcp = adv_button_main_config->mcps;
         while (mcp) {
-            if (mcp->channels == MCP_CHANNEL_A || mcp->channels == MCP_CHANNEL_BOTH) {
-                const uint8_t reg = 0x12;
-                i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_a, 1);
-            }
-            
-            if (mcp->channels > MCP_CHANNEL_A) {
-                const uint8_t reg = 0x13;
-                i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_b, 1);
+            if (mcp->interrupt_pending) {
+                mcp->interrupt_pending = false;
+                adv_button_mcp_read_interrupt(mcp);
+            } else if (mcp->has_inputs && (!mcp->has_interrupt || is_awake)) {
+                adv_button_mcp_read(mcp);
             }
             
             mcp = mcp->next;
@@ -293,6 +425,11 @@ static void IRAM button_evaluate_fn() {
 
         adv_button_t* button = adv_button_main_config->buttons;
         while (button) {
+            if (!button->is_polled && !is_awake) {
+                button = button->next;
+                continue;
+            }
+            
             if (button->mode == ADV_BUTTON_NORMAL_MODE) {
                 if (gpio_read(button->gpio)) {
                     button->value = MIN(button->value++, button->max_eval);
@@ -331,18 +468,39 @@ static void IRAM button_evaluate_fn() {
             
             if (button->state != button->old_state) {
                 button->old_state = button->state;
-                adv_button_main_config->button_evaluate_sleep_countdown = 0;
+                
+                if (!button->is_polled) {
+                    adv_button_main_config->button_evaluate_sleep_countdown = 0;
+                }
                 
                 if (button->state ^ button->inverted) {     // 1 HIGH
-                    push_up(button->gpio);
+                    push_up(button);
                 } else {                                    // 0 LOW
-                    push_down(button->gpio);
+                    push_down(button);
                 }
             }
             
             button = button->next;
         }
         
+        if (is_awake) {
+            if (adv_button_main_config->button_evaluate_sleep_countdown < adv_button_main_config->button_evaluate_sleep_time) {
+                adv_button_main_config->button_evaluate_sleep_countdown++;
+            } else {
+                adv_button_main_config->button_evaluate_sleep_countdown = 0;
+                
+                if (adv_button_sleep() && !adv_button_main_config->has_polled_buttons) {
+                    // An interrupt after enabling them has already queued a timer start, so timer must keep running.
+                    // Otherwise, stop is queued before any later start from ISR
+                    taskENTER_CRITICAL();
+                    if (!adv_button_main_config->is_awake) {
+                        esp_timer_stop_from_ISR(adv_button_main_config->button_evaluate_timer);
+                    }
+                    taskEXIT_CRITICAL();
+                }
+            }
+        }
+        
         adv_button_main_config->button_evaluate_is_working = false;
     }
 }
@@ -393,7 +551,58 @@ void adv_button_set_disable_time() {
     }
 }
 
+static adv_button_mcp_t* adv_button_mcp_new(const uint8_t index, const uint8_t bus, const uint8_t addr) {
+    adv_button_mcp_t* mcp = mcp_find_by_index(index);
+    if (!mcp) {
+        mcp = malloc(sizeof(adv_button_mcp_t));
+        memset(mcp, 0, sizeof(*mcp));
+        mcp->next = adv_button_main_config->mcps;
+        adv_button_main_config->mcps = mcp;
+        
+        mcp->index = index;
+        mcp->addr = addr;
+        mcp->bus = bus;
+        
+        if (index >= adv_button_main_config->mcps_by_index_size) {
+            adv_button_main_config->mcps_by_index = realloc(adv_button_main_config->mcps_by_index, (index + 1) * sizeof(adv_button_mcp_t*));
+            memset(adv_button_main_config->mcps_by_index + adv_button_main_config->mcps_by_index_size, 0, (index + 1 - adv_button_main_config->mcps_by_index_size) * sizeof(adv_button_mcp_t*));
+            adv_button_main_config->mcps_by_index_size = index + 1;
+        }
+        
+        adv_button_main_config->mcps_by_index[index] = mcp;
+    }
+    
+    return mcp;
+}
+
+// MCP23017 must be configured to raise interrupt on change of its inputs, with INTA and INTB mirrored
+void adv_button_set_mcp_interrupt(const uint8_t index, const uint8_t bus, const uint8_t addr, const uint8_t interrupt_gpio) {
+    adv_button_init();
+    
+    adv_button_mcp_t* mcp = adv_button_mcp_new(index, bus, addr);
+    mcp->has_interrupt = true;
+    mcp->interrupt_gpio = interrupt_gpio;
+    
+    gpio_enable(interrupt_gpio, GPIO_INPUT);
+    gpio_set_pullup(interrupt_gpio, true, true);
+    
+    // Clears any interrupt raised before
+    const uint8_t reg = MCP_REG_GPIOA;
+    uint8_t values[2];
+    i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, values, 2);
+    
+    if (!adv_button_main_config->is_awake) {
+        gpio_set_interrupt(interrupt_gpio, GPIO_INTTYPE_EDGE_NEG, adv_button_interrupt_normal);
+    }
+    
+    adv_button_polled_update();
+}
+
 int adv_button_create(const uint16_t gpio, const uint8_t pullup_resistor, const bool inverted, const uint8_t mode) {
+    if ((mode > ADV_BUTTON_PULSE_MODE && (gpio % 100) >= MCP_PINS) || (mode <= ADV_BUTTON_PULSE_MODE && gpio >= ADV_BUTTON_GPIOS)) {
+        return -2;
+    }
+    
     adv_button_init();
     
     adv_button_t* button = button_find_by_gpio(gpio);
@@ -415,6 +624,10 @@ int adv_button_create(const uint16_t gpio, const uint8_t pullup_resistor, const
         
         gpio_set_pullup(gpio, pullup_resistor, pullup_resistor);
         
+        if (mode <= ADV_BUTTON_PULSE_MODE) {
+            adv_button_main_config->buttons_by_gpio[gpio] = button;
+        }
+        
         if (mode == ADV_BUTTON_NORMAL_MODE) {
             vTaskDelay(pdMS_TO_TICKS(30));
             
@@ -426,54 +639,31 @@ int adv_button_create(const uint16_t gpio, const uint8_t pullup_resistor, const
                 button->value = button->max_eval;
             }
 
-            if (gpio != 16 && adv_button_main_config->continuos_mode == false) {
+            if (gpio == 16) {
+                button->is_polled = true;
+            } else if (!adv_button_main_config->is_awake) {
                 gpio_set_interrupt(gpio, GPIO_INTTYPE_EDGE_ANY, adv_button_interrupt_normal);
-            } else {
-                adv_button_main_config->continuos_mode = true;
             }
             
         } else if (mode == ADV_BUTTON_PULSE_MODE) {
-            adv_button_main_config->continuos_mode = true;
+            button->is_polled = true;
 
             gpio_set_interrupt(gpio, GPIO_INTTYPE_EDGE_NEG, adv_button_interrupt_pulse);
             
         } else {    // MCP23017
-            adv_button_main_config->continuos_mode = true;
-            
-            const uint8_t index = gpio / 100;
             const uint8_t mcp_gpio = gpio % 100;
-            adv_button_mcp_t* mcp = mcp_find_by_index(index);
-            if (!mcp) {
-                mcp = malloc(sizeof(adv_button_mcp_t));
-                memset(mcp, 0, sizeof(*mcp));
-                mcp->next = adv_button_main_config->mcps;
-                adv_button_main_config->mcps = mcp;
-                
-                mcp->index = index;
-                mcp->addr = mode;
-                mcp->bus = pullup_resistor;
-                
-                if (mcp_gpio < 8) {
-                    mcp->channels = MCP_CHANNEL_A;
-                    const uint8_t reg = 0x12;
-                    i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_a, 1);
-                } else {
-                    mcp->channels = MCP_CHANNEL_B;
-                    const uint8_t reg = 0x13;
-                    i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_b, 1);
-                }
-            } else if (mcp->channels != MCP_CHANNEL_BOTH) {
-                if (mcp->channels == MCP_CHANNEL_A && mcp_gpio > 7) {
-                    mcp->channels = MCP_CHANNEL_BOTH;
-                    const uint8_t reg = 0x13;
-                    i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_b, 1);
-                } else if (mcp->channels == MCP_CHANNEL_B && mcp_gpio < 8) {
-                    mcp->channels = MCP_CHANNEL_BOTH;
-                    const uint8_t reg = 0x12;
-                    i2c_slave_read(mcp->bus, mcp->addr, &reg, 1, &mcp->value_a, 1);
-                }
+            adv_button_mcp_t* mcp = adv_button_mcp_new(gpio / 100, pullup_resistor, mode);
+            mcp->buttons[mcp_gpio] = button;
+            
+            if (!mcp->has_inputs) {
+                mcp->has_inputs = true;
+                mcp->channels = (mcp_gpio < 8) ? MCP_CHANNEL_A : MCP_CHANNEL_B;
+            } else if ((mcp->channels == MCP_CHANNEL_A && mcp_gpio > 7) || (mcp->channels == MCP_CHANNEL_B && mcp_gpio < 8)) {
+                mcp->channels = MCP_CHANNEL_BOTH;
             }
             
+            adv_button_mcp_read(mcp);
+            
             button->state = adv_button_read_mcp_gpio(gpio);
             button->old_state = button->state;
             
@@ -482,17 +672,7 @@ int adv_button_create(const uint16_t gpio, const uint8_t pullup_resistor, const
             }
         }
         
-        if (adv_button_main_config->continuos_mode) {
-            esp_timer_start(adv_button_main_config->button_evaluate_timer);
-            
-            adv_button_t *button = adv_button_main_config->buttons;
-            while (button) {
-                if (button->mode == ADV_BUTTON_NORMAL_MODE) {
-                    gpio_set_interrupt(button->gpio, GPIO_INTTYPE_NONE, NULL);
-                }
-                button = button->next;
-            }
-        }
+        adv_button_polled_update();
         
         return 0;
     }
@@ -561,58 +741,80 @@ int adv_button_destroy(const uint16_t gpio) {
         return -2;
     }
     
+    adv_button_t* button = NULL;
     if (adv_button_main_config->buttons) {
-        adv_button_t *button = NULL;
         if (adv_button_main_config->buttons->gpio == gpio) {
-            
-            gpio_set_interrupt(gpio, GPIO_INTTYPE_NONE, NULL);
-            
-            if (button->gpio != 0) {
-                gpio_disable(gpio);
-            }
-            
-            esp_timer_delete(button->hold_timer);
-            esp_timer_delete(button->press_timer);
-            
             button = adv_button_main_config->buttons;
-            adv_button_main_config->buttons = adv_button_main_config->buttons->next;
+            adv_button_main_config->buttons = button->next;
         } else {
-            adv_button_t *b = adv_button_main_config->buttons;
-            while (b->next) {
-                if (b->next->gpio == gpio) {
-                    
-                    if (b->next->gpio != 0) {
-                        gpio_disable(b->next->gpio);
-                    }
-                    
-                    button = b->next;
-                    b->next = b->next->next;
-                    break;
-                }
+            adv_button_t* b = adv_button_main_config->buttons;
+            while (b->next && b->next->gpio != gpio) {
+                b = b->next;
             }
-        }
-
-        if (!adv_button_main_config->buttons) {
-            esp_timer_delete(adv_button_main_config->button_evaluate_timer);
-            
-            free(adv_button_main_config);
-            adv_button_main_config = NULL;
             
-        } else if (gpio == 16) {
-            adv_button_t *button = adv_button_main_config->buttons;
-            while (button) {
-                if (button->mode == ADV_BUTTON_NORMAL_MODE) {
-                    gpio_set_interrupt(button->gpio, GPIO_INTTYPE_EDGE_ANY, adv_button_interrupt_normal);
-                }
-                button = button->next;
+            if (b->next) {
+                button = b->next;
+                b->next = button->next;
             }
-            
-            esp_timer_stop(adv_button_main_config->button_evaluate_timer);
-            adv_button_main_config->continuos_mode = false;
         }
+    }
+    
+    if (!button) {
+        return -1;
+    }
+    
+    if (button->mode <= ADV_BUTTON_PULSE_MODE) {
+        adv_button_main_config->buttons_by_gpio[gpio] = NULL;
         
-        return 0;
+        gpio_set_interrupt(gpio, GPIO_INTTYPE_NONE, NULL);
+        
+        if (gpio != 0) {
+            gpio_disable(gpio);
+        }
+    } else {    // MCP23017
+        mcp_find_by_index(gpio / 100)->buttons[gpio % 100] = NULL;
     }
     
-    return -1;
+    esp_timer_delete(button->hold_timer);
+    esp_timer_delete(button->press_timer);
+    
+    adv_button_callback_fn_t* callbacks[] = {
+        button->singlepress0_callback_fn,
+        button->singlepress_callback_fn,
+        button->doublepress_callback_fn,
+        button->longpress_callback_fn,
+        button->verylongpress_callback_fn,
+        button->holdpress_callback_fn
+    };
+    
+    for (uint8_t i = 0; i < sizeof(callbacks) / sizeof(callbacks[0]); i++) {
+        while (callbacks[i]) {
+            adv_button_callback_fn_t* next = callbacks[i]->next;
+            free(callbacks[i]);
+            callbacks[i] = next;
+        }
+    }
+    
+    free(button);
+    
+    if (!adv_button_main_config->buttons) {
+        adv_button_interrupts_set(false);
+        esp_timer_delete(adv_button_main_config->button_evaluate_timer);
+        
+        adv_button_mcp_t* mcp = adv_button_main_config->mcps;
+        while (mcp) {
+            adv_button_mcp_t* next = mcp->next;
+            free(mcp);
+            mcp = next;
+        }
+        
+        free(adv_button_main_config->mcps_by_index);
+        free(adv_button_main_config);
+        adv_button_main_config = NULL;
+        
+    } else {
+        adv_button_polled_update();
+    }
+    
+    return 0;
 }
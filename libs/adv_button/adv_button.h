@@ -32,6 +32,13 @@ int adv_button_destroy(const uint16_t gpio);
 void adv_button_set_disable_time();
 bool adv_button_read_gpio(const uint16_t gpio);
 
+/*
+ * MCP23017 with its INT pin wired to a GPIO.
+ * Its inputs are read only when INT goes LOW, instead of being polled.
+ * MCP23017 must be configured with interrupt on change of inputs, and INTA and INTB mirrored.
+ */
+void adv_button_set_mcp_interrupt(const uint8_t index, const uint8_t bus, const uint8_t addr, const uint8_t interrupt_gpio);
+
 /*
  * Button callback types:
  * 0 Single press (inverted to 1)
@@ -17,6 +17,7 @@
 #define MODE_CURRENT            (0)
 #define MODE_VOLTAGE            (1)
 #define PERIOD_TIMEOUT          (1500000)
+#define ADV_HLW_GPIOS           (17)
 
 typedef struct _adv_hlw_unit {
     int8_t gpio_cf;
@@ -32,21 +33,17 @@ typedef struct _adv_hlw_unit {
     uint32_t last_cf1;
     uint32_t period_cf1_v;
     uint32_t period_cf1_c;
-
-    struct _adv_hlw_unit* next;
 } adv_hlw_unit_t;
 
-static adv_hlw_unit_t* adv_hlw_units = NULL;
+// Units indexed by their CF and CF1 GPIOs, so interrupts find them directly
+static adv_hlw_unit_t* adv_hlw_units_by_gpio[ADV_HLW_GPIOS];
 
 static adv_hlw_unit_t* IRAM adv_hlw_find_by_gpio(const uint8_t gpio) {
-    adv_hlw_unit_t* adv_hlw_unit = adv_hlw_units;
-    while (adv_hlw_unit &&
-           adv_hlw_unit->gpio_cf != gpio &&
-           adv_hlw_unit->gpio_cf1 != gpio) {
-        adv_hlw_unit = adv_hlw_unit->next;
+    if (gpio < ADV_HLW_GPIOS) {
+        return adv_hlw_units_by_gpio[gpio];
     }
     
-    return adv_hlw_unit;
+    return NULL;
 }
 
 static void normalize_cf1(adv_hlw_unit_t* adv_hlw_unit) {
@@ -167,6 +164,10 @@ static void IRAM adv_hlw_cf_callback(const uint8_t gpio) {
 }
 
 int adv_hlw_unit_create(const int8_t gpio_cf, const int8_t gpio_cf1, const int8_t gpio_sel, const uint8_t current_mode) {
+    if (gpio_cf >= ADV_HLW_GPIOS || gpio_cf1 >= ADV_HLW_GPIOS || gpio_sel >= ADV_HLW_GPIOS) {
+        return -4;
+    }
+    
     adv_hlw_unit_t* adv_hlw_unit = adv_hlw_find_by_gpio(gpio_cf);
     
     if (!adv_hlw_unit) {
@@ -186,16 +187,17 @@ int adv_hlw_unit_create(const int8_t gpio_cf, const int8_t gpio_cf1, const int8_
                 adv_hlw_unit->current_mode = current_mode;
                 adv_hlw_unit->mode = current_mode;
                 
-                adv_hlw_unit->next = adv_hlw_units;
-                adv_hlw_units = adv_hlw_unit;
-                
                 if (adv_hlw_unit->gpio_cf >= 0) {
+                    adv_hlw_units_by_gpio[adv_hlw_unit->gpio_cf] = adv_hlw_unit;
+                    
                     gpio_enable(adv_hlw_unit->gpio_cf, GPIO_INPUT);
                     gpio_set_pullup(adv_hlw_unit->gpio_cf, true, true);
                     gpio_set_interrupt(adv_hlw_unit->gpio_cf, GPIO_INTTYPE_EDGE_NEG, adv_hlw_cf_callback);
                 }
                 
                 if (adv_hlw_unit->gpio_cf1 >= 0) {
+                    adv_hlw_units_by_gpio[adv_hlw_unit->gpio_cf1] = adv_hlw_unit;
+                    
                     gpio_enable(adv_hlw_unit->gpio_cf1, GPIO_INPUT);
                     gpio_set_pullup(adv_hlw_unit->gpio_cf1, true, true);
                     gpio_set_interrupt(adv_hlw_unit->gpio_cf1, GPIO_INTTYPE_EDGE_NEG, adv_hlw_cf1_callback);
@@ -0,0 +1,126 @@
+/*
+ * Advanced IR TX Driver
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#include <string.h>
+#include <espressif/esp_common.h>
+#include <esp8266.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <adv_pwm.h>
+
+#include "adv_ir_tx.h"
+
+#define ADV_IR_TX_TIMEOUT_MARGIN_MS         (100)
+
+typedef struct _adv_ir_tx_config {
+    uint16_t* half_periods;     // Code as number of carrier half periods
+    uint16_t half_periods_size;
+    uint16_t len;
+    uint16_t index;
+    uint16_t left;
+    
+    uint8_t gpio: 5;
+    bool inverted: 1;
+    bool is_mark: 1;
+    bool level: 1;
+    
+    SemaphoreHandle_t done;
+} adv_ir_tx_config_t;
+
+static adv_ir_tx_config_t* adv_ir_tx_config = NULL;
+
+// Runs every carrier half period with FRC1 in reload mode, so ISR latency does not add drift
+static void IRAM adv_ir_tx_worker() {
+    while (adv_ir_tx_config->left == 0) {
+        if (adv_ir_tx_config->index == adv_ir_tx_config->len) {
+            timer_set_interrupts(FRC1, false);
+            timer_set_run(FRC1, false);
+            
+            gpio_write(adv_ir_tx_config->gpio, adv_ir_tx_config->inverted);
+            
+            xSemaphoreGiveFromISR(adv_ir_tx_config->done, NULL);
+            return;
+        }
+        
+        adv_ir_tx_config->is_mark = !(adv_ir_tx_config->index & 1);
+        adv_ir_tx_config->left = adv_ir_tx_config->half_periods[adv_ir_tx_config->index];
+        adv_ir_tx_config->index++;
+        adv_ir_tx_config->level = false;
+    }
+    
+    adv_ir_tx_config->left--;
+    adv_ir_tx_config->level = adv_ir_tx_config->is_mark && !adv_ir_tx_config->level;
+    
+    gpio_write(adv_ir_tx_config->gpio, adv_ir_tx_config->level ^ adv_ir_tx_config->inverted);
+}
+
+bool adv_ir_tx_send(const uint8_t gpio, const bool inverted, const uint8_t half_period_us, const uint16_t* code, const uint16_t len) {
+    if (adv_pwm_is_running() || half_period_us == 0) {
+        return false;
+    }
+    
+    if (!adv_ir_tx_config) {
+        adv_ir_tx_config = malloc(sizeof(adv_ir_tx_config_t));
+        if (!adv_ir_tx_config) {
+            return false;
+        }
+        
+        memset(adv_ir_tx_config, 0, sizeof(*adv_ir_tx_config));
+        
+        adv_ir_tx_config->done = xSemaphoreCreateBinary();
+    }
+    
+    if (len > adv_ir_tx_config->half_periods_size) {
+        uint16_t* half_periods = realloc(adv_ir_tx_config->half_periods, len * sizeof(uint16_t));
+        if (!half_periods) {
+            return false;
+        }
+        
+        adv_ir_tx_config->half_periods = half_periods;
+        adv_ir_tx_config->half_periods_size = len;
+    }
+    
+    // Pulse queue is converted before starting, so ISR does not need divisions.
+    // Edges are rounded from start of code, so rounding errors do not add up along long codes
+    uint32_t total_us = 0;
+    uint32_t total_half_periods = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        total_us += code[i];
+        
+        const uint32_t edge = (total_us + (half_period_us >> 1)) / half_period_us;
+        adv_ir_tx_config->half_periods[i] = edge - total_half_periods;
+        total_half_periods = edge;
+    }
+    
+    adv_ir_tx_config->len = len;
+    adv_ir_tx_config->index = 0;
+    adv_ir_tx_config->left = 0;
+    adv_ir_tx_config->gpio = gpio;
+    adv_ir_tx_config->inverted = inverted;
+    
+    xSemaphoreTake(adv_ir_tx_config->done, 0);
+    
+    _xt_isr_attach(INUM_TIMER_FRC1, adv_ir_tx_worker, NULL);
+    
+    timer_set_frequency(FRC1, 1000000 / half_period_us);
+    timer_set_reload(FRC1, true);
+    
+    taskENTER_CRITICAL();
+    timer_set_interrupts(FRC1, true);
+    timer_set_run(FRC1, true);
+    adv_ir_tx_worker();
+    taskEXIT_CRITICAL();
+    
+    // Code was started, so it is not reported as failed to avoid sending it again by other way
+    if (xSemaphoreTake(adv_ir_tx_config->done, (total_us / 1000 + ADV_IR_TX_TIMEOUT_MARGIN_MS) / portTICK_PERIOD_MS) != pdTRUE) {
+        timer_set_interrupts(FRC1, false);
+        timer_set_run(FRC1, false);
+        gpio_write(gpio, inverted);
+    }
+    
+    return true;
+}
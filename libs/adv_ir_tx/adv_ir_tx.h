@@ -0,0 +1,24 @@
+/*
+* Advanced IR TX Driver
+*
+* Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+*
+*/
+
+#ifndef __ADV_IR_TX_H__
+#define __ADV_IR_TX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sends IR code using FRC1 timer interrupts. Carrier is made toggling GPIO every half_period_us.
+// Code is an array of marks and spaces in microseconds, starting with a mark.
+// Blocks calling task until code is sent. Returns false if code was not started because FRC1 is in use by adv_pwm or no memory.
+bool adv_ir_tx_send(const uint8_t gpio, const bool inverted, const uint8_t half_period_us, const uint16_t* code, const uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __ADV_IR_TX_H__
@@ -0,0 +1,8 @@
+# Component makefile for adv_ir_tx
+
+INC_DIRS += $(adv_ir_tx_ROOT)
+
+adv_ir_tx_INC_DIR =  $(adv_ir_tx_ROOT)
+adv_ir_tx_SRC_DIR =  $(adv_ir_tx_ROOT)
+
+$(eval $(call component_compile_rules,adv_ir_tx))
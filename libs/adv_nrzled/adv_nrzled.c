@@ -6,12 +6,25 @@
 */
 
 #include <esplibs/libmain.h>
+#include <espressif/esp_common.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <xtensa_ops.h>
 
 #include "adv_nrzled.h"
 
+#define NRZLED_BLOCK_SIZE                   (48)    // Bytes sent with interrupts disabled
+#define NRZLED_GAP_MAX_US                   (6)     // Longer gaps between blocks can latch LEDs
+#define NRZLED_RESET_US                     (300)
+#define NRZLED_ATTEMPTS                     (4)     // Attempts sent by blocks
+#define NRZLED_BACKOFF_MAX_US               (2400)  // Wait before next attempt doubles from NRZLED_RESET_US up to this
+#define NRZLED_FAILED_FRAMES_MAX            (3)     // Calls with same frame not completed before it is sent with interrupts disabled, or dropped
+
+static nrzled_stats_t nrzled_stats;
+
 static inline IRAM uint32_t get_cycle_count() {
     uint32_t cycles;
-    asm volatile("rsr %0,ccount" : "=a" (cycles));
+    RSR(cycles, ccount);
     return cycles;
 }
 
@@ -37,3 +50,78 @@ void IRAM nrzled_set(const uint8_t gpio, const uint16_t time_0, const uint16_t t
         }
     }
 }
+
+// Returns false if interrupts took too long between blocks, and LEDs may have latched a partial frame
+static bool nrzled_send(const uint8_t gpio, const uint16_t time_0, const uint16_t time_1, const uint16_t period, uint8_t *colors, const uint16_t size, const uint16_t block_size, const uint32_t gap_max) {
+    bool is_latched = false;
+    
+    taskENTER_CRITICAL();
+    
+    for (uint16_t i = 0; i < size; i += block_size) {
+        if (i > 0) {
+            const uint32_t gap_start = get_cycle_count();
+            taskEXIT_CRITICAL();
+            taskENTER_CRITICAL();
+            
+            if ((get_cycle_count() - gap_start) > gap_max) {
+                is_latched = true;
+                break;
+            }
+        }
+        
+        nrzled_set(gpio, time_0, time_1, period, colors + i, (size - i) < block_size ? (size - i) : block_size);
+    }
+    
+    taskEXIT_CRITICAL();
+    
+    return !is_latched;
+}
+
+// Interrupts are enabled between blocks. If they took too long, frame is sent again from start after a reset.
+// Each wait is longer than previous one, so busy interrupts (mostly WiFi) have time to finish.
+// failed_frames counts calls of caller strip that could not complete its frame. When it reaches NRZLED_FAILED_FRAMES_MAX,
+// frame is sent with interrupts disabled if critical_fallback is set, or dropped. Returns false if caller must send frame again
+bool nrzled_set_blocks(const uint8_t gpio, const uint16_t time_0, const uint16_t time_1, const uint16_t period, uint8_t *colors, const uint16_t size, const bool critical_fallback, uint8_t* failed_frames) {
+    const uint32_t gap_max = NRZLED_GAP_MAX_US * sdk_system_get_cpu_freq();
+    uint32_t backoff_us = NRZLED_RESET_US;
+    
+    nrzled_stats.frames++;
+    
+    for (uint8_t attempt = 0; attempt < NRZLED_ATTEMPTS; attempt++) {
+        if (nrzled_send(gpio, time_0, time_1, period, colors, size, NRZLED_BLOCK_SIZE, gap_max)) {
+            *failed_frames = 0;
+            return true;
+        }
+        
+        nrzled_stats.retries++;
+        
+        sdk_os_delay_us(backoff_us);
+        
+        backoff_us <<= 1;
+        if (backoff_us > NRZLED_BACKOFF_MAX_US) {
+            backoff_us = NRZLED_BACKOFF_MAX_US;
+        }
+    }
+    
+    nrzled_stats.failures++;
+    
+    (*failed_frames)++;
+    if (*failed_frames < NRZLED_FAILED_FRAMES_MAX) {
+        return false;
+    }
+    
+    *failed_frames = 0;
+    
+    if (critical_fallback) {
+        nrzled_stats.fallbacks++;
+        nrzled_send(gpio, time_0, time_1, period, colors, size, size, gap_max);
+    } else {
+        nrzled_stats.drops++;
+    }
+    
+    return true;
+}
+
+const nrzled_stats_t* nrzled_get_stats() {
+    return &nrzled_stats;
+}
@@ -8,6 +8,16 @@
 #ifndef __ADVANCED_NRZ_LED__
 #define __ADVANCED_NRZ_LED__
 
+typedef struct _nrzled_stats {
+    uint32_t frames;
+    uint32_t retries;       // Attempts interrupted between blocks
+    uint32_t fallbacks;     // Frames sent with interrupts disabled
+    uint32_t failures;      // Frames not completed
+    uint32_t drops;         // Frames given up after NRZLED_FAILED_FRAMES_MAX failures, without critical fallback
+} nrzled_stats_t;
+
 void IRAM nrzled_set(const uint8_t gpio, const uint16_t time_0, const uint16_t time_1, const uint16_t period, uint8_t *colors, const uint16_t size);
+bool nrzled_set_blocks(const uint8_t gpio, const uint16_t time_0, const uint16_t time_1, const uint16_t period, uint8_t *colors, const uint16_t size, const bool critical_fallback, uint8_t* failed_frames);
+const nrzled_stats_t* nrzled_get_stats();
 
 #endif // __ADVANCED_NRZ_LED__
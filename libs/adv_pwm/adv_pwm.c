@@ -10,10 +10,15 @@
 #include <espressif/sdk_private.h>
 #include <esp8266.h>
 #include <FreeRTOS.h>
+#include <task.h>
 
 #include "adv_pwm.h"
 
 #define ADV_PWM_FREQUENCY_DEFAULT           (305)
+#define ADV_PWM_CYCLES                      (8)     // Dithering cycles
+#define ADV_PWM_MIN_EDGE_US                 (4)     // Closer edges are joined, so ISR keeps up at high frequencies
+#define ADV_PWM_GPIO16_MASK                 BIT(16)
+#define ADV_PWM_GPIOS                       (17)
 
 typedef struct _adv_pwm_channel {
     uint16_t duty[8];
@@ -23,97 +28,216 @@ typedef struct _adv_pwm_channel {
     struct _adv_pwm_channel* next;
 } adv_pwm_channel_t;
 
+// Edges of one PWM period. First edge is period start
+typedef struct _adv_pwm_edge {
+    uint32_t set_mask;
+    uint32_t clear_mask;
+    uint32_t load;          // FRC1 ticks until next edge
+} adv_pwm_edge_t;
+
+typedef struct _adv_pwm_schedule {
+    uint8_t edges_n[ADV_PWM_CYCLES];
+    adv_pwm_edge_t* edges[ADV_PWM_CYCLES];
+} adv_pwm_schedule_t;
+
 typedef struct _adv_pwm_config {
-    uint16_t current_duty;
     uint8_t cycle: 3;
     bool is_running: 1;
+    bool schedule_pending: 1;
+    uint8_t schedule_active: 1;
+    bool schedule_dirty: 1;     // Duties changed since last build
+    uint8_t channels_n;
+    uint8_t edge;
 
     uint32_t max_load;
+    uint32_t min_load;
     
     adv_pwm_channel_t* adv_pwm_channels;
+    adv_pwm_channel_t* channels_by_gpio[ADV_PWM_GPIOS];
+    
+    // Double buffered: ISR only switches to the pending schedule at period start
+    adv_pwm_schedule_t schedule[2];
+    adv_pwm_edge_t* edges_buffer[2];
+    
+#ifdef ADV_PWM_BENCHMARK
+    uint32_t isr_cycles_max;
+    uint32_t isr_cycles_last;
+#endif
 } adv_pwm_config_t;
 
 static adv_pwm_config_t* adv_pwm_config = NULL;
 
 static adv_pwm_channel_t* adv_pwm_channel_find_by_gpio(const uint8_t gpio) {
-    if (adv_pwm_config) {
-        adv_pwm_channel_t* adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
-        
-        while (adv_pwm_channel && adv_pwm_channel->gpio != gpio) {
-            adv_pwm_channel = adv_pwm_channel->next;
-        }
-
-        return adv_pwm_channel;
+    if (adv_pwm_config && gpio < ADV_PWM_GPIOS) {
+        return adv_pwm_config->channels_by_gpio[gpio];
     }
     
     return NULL;
 }
 
 uint16_t adv_pwm_get_duty(const uint8_t gpio) {
-    if (adv_pwm_config) {
-        adv_pwm_channel_t* adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
-        
-        while (adv_pwm_channel && adv_pwm_channel->gpio != gpio) {
-            adv_pwm_channel = adv_pwm_channel->next;
-        }
-
-        if (adv_pwm_channel) {
-            return (adv_pwm_channel->duty[0] + adv_pwm_channel->duty[1] + adv_pwm_channel->duty[2] + adv_pwm_channel->duty[3]) >> 2;
-        }
+    adv_pwm_channel_t* adv_pwm_channel = adv_pwm_channel_find_by_gpio(gpio);
+    if (adv_pwm_channel) {
+        return (adv_pwm_channel->duty[0] + adv_pwm_channel->duty[1] + adv_pwm_channel->duty[2] + adv_pwm_channel->duty[3]) >> 2;
     }
     
     return 0;
 }
 
+static inline IRAM void adv_pwm_write_masks(const uint32_t set_mask, const uint32_t clear_mask) {
+    GPIO.OUT_SET = set_mask & 0xFFFF;
+    GPIO.OUT_CLEAR = clear_mask & 0xFFFF;
+    
+    if ((set_mask | clear_mask) & ADV_PWM_GPIO16_MASK) {
+        gpio_write(16, (set_mask & ADV_PWM_GPIO16_MASK) != 0);
+    }
+}
+
+#ifdef ADV_PWM_BENCHMARK
+static inline IRAM uint32_t get_cycle_count() {
+    uint32_t cycles;
+    asm volatile("rsr %0,ccount" : "=a" (cycles));
+    return cycles;
+}
+#endif
+
 static void IRAM adv_pwm_worker() {
-    uint32_t next_load = adv_pwm_config->max_load;
-    uint16_t next_duty = UINT16_MAX;
+#ifdef ADV_PWM_BENCHMARK
+    const uint32_t isr_start = get_cycle_count();
+#endif
     
-    adv_pwm_channel_t* adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
-    if (adv_pwm_config->current_duty == 0) {
+    if (adv_pwm_config->edge == 0) {
+        if (adv_pwm_config->schedule_pending) {
+            adv_pwm_config->schedule_active ^= 1;
+            adv_pwm_config->schedule_pending = false;
+        }
+        
         adv_pwm_config->cycle++;
+    }
+    
+    const adv_pwm_schedule_t* schedule = &adv_pwm_config->schedule[adv_pwm_config->schedule_active];
+    const adv_pwm_edge_t* edge = &schedule->edges[adv_pwm_config->cycle][adv_pwm_config->edge];
+    
+    adv_pwm_write_masks(edge->set_mask, edge->clear_mask);
+    timer_set_load(FRC1, edge->load);
+    
+    adv_pwm_config->edge++;
+    if (adv_pwm_config->edge == schedule->edges_n[adv_pwm_config->cycle]) {
+        adv_pwm_config->edge = 0;
+    }
+    
+#ifdef ADV_PWM_BENCHMARK
+    adv_pwm_config->isr_cycles_last = get_cycle_count() - isr_start;
+    if (adv_pwm_config->isr_cycles_last > adv_pwm_config->isr_cycles_max) {
+        adv_pwm_config->isr_cycles_max = adv_pwm_config->isr_cycles_last;
+    }
+#endif
+}
+
+// Builds sorted edges of every dithering cycle into the schedule not used by ISR
+static void adv_pwm_schedule_build() {
+    adv_pwm_config->schedule_dirty = false;
+    
+    taskENTER_CRITICAL();
+    adv_pwm_config->schedule_pending = false;
+    const uint8_t schedule_index = adv_pwm_config->schedule_active ^ 1;
+    taskEXIT_CRITICAL();
+    
+    adv_pwm_schedule_t* schedule = &adv_pwm_config->schedule[schedule_index];
+    adv_pwm_edge_t* edges = adv_pwm_config->edges_buffer[schedule_index];
+    
+    for (uint8_t cycle = 0; cycle < ADV_PWM_CYCLES; cycle++) {
+        schedule->edges[cycle] = edges;
         
+        // Period start
+        edges[0].set_mask = 0;
+        edges[0].clear_mask = 0;
+        edges[0].load = 0;
+        uint8_t edges_n = 1;
+        
+        adv_pwm_channel_t* adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
         while (adv_pwm_channel) {
-            if (adv_pwm_channel->duty[adv_pwm_config->cycle] == 0) {
-                gpio_write(adv_pwm_channel->gpio, adv_pwm_channel->inverted);
+            const uint16_t duty = adv_pwm_channel->duty[cycle];
+            const uint32_t mask = BIT(adv_pwm_channel->gpio);
+            
+            if ((duty > 0) ^ adv_pwm_channel->inverted) {
+                edges[0].set_mask |= mask;
             } else {
-                gpio_write(adv_pwm_channel->gpio, 1 ^ adv_pwm_channel->inverted);
+                edges[0].clear_mask |= mask;
+            }
+            
+            if (duty > 0 && duty < UINT16_MAX) {
+                // Insertion in order, joining equal duties. Load keeps duty until edges are complete
+                uint8_t i = 1;
+                while (i < edges_n && edges[i].load < duty) {
+                    i++;
+                }
+                
+                if (i == edges_n || edges[i].load != duty) {
+                    memmove(&edges[i + 1], &edges[i], (edges_n - i) * sizeof(adv_pwm_edge_t));
+                    edges[i].set_mask = 0;
+                    edges[i].clear_mask = 0;
+                    edges[i].load = duty;
+                    edges_n++;
+                }
+                
+                if (adv_pwm_channel->inverted) {
+                    edges[i].set_mask |= mask;
+                } else {
+                    edges[i].clear_mask |= mask;
+                }
             }
             
             adv_pwm_channel = adv_pwm_channel->next;
         }
         
-        adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
-    }
-    
-    while (adv_pwm_channel) {
-        if (adv_pwm_channel->duty[adv_pwm_config->cycle] <= adv_pwm_config->current_duty) {
-            gpio_write(adv_pwm_channel->gpio, adv_pwm_channel->inverted);
-        } else if (adv_pwm_channel->duty[adv_pwm_config->cycle] > adv_pwm_config->current_duty && adv_pwm_channel->duty[adv_pwm_config->cycle] < next_duty) {
-            next_duty = adv_pwm_channel->duty[adv_pwm_config->cycle];
+        // Duties to FRC1 loads, joining edges too close to be served by ISR
+        // Loads are taken from absolute positions, so rounding errors do not change period
+        uint32_t last_position = 0;
+        uint8_t last_edge = 0;
+        for (uint8_t i = 1; i < edges_n; i++) {
+            const uint32_t position = ((uint64_t) edges[i].load) * adv_pwm_config->max_load / UINT16_MAX;
+            
+            if (position - last_position < adv_pwm_config->min_load) {
+                edges[last_edge].set_mask = (edges[last_edge].set_mask & ~edges[i].clear_mask) | edges[i].set_mask;
+                edges[last_edge].clear_mask = (edges[last_edge].clear_mask & ~edges[i].set_mask) | edges[i].clear_mask;
+                continue;
+            }
+            
+            edges[last_edge].load = position - last_position;
+            last_position = position;
+            last_edge++;
+            edges[last_edge] = edges[i];
         }
         
-        adv_pwm_channel = adv_pwm_channel->next;
-    }
-
-    next_load = (next_duty - adv_pwm_config->current_duty) * adv_pwm_config->max_load / UINT16_MAX;
-    if (!next_load) {
-        next_load = 1;
-    }
-    
-    if (next_duty == UINT16_MAX) {
-        adv_pwm_config->current_duty = 0;
-    } else {
-        adv_pwm_config->current_duty = next_duty;
+        // Last edge too close to period end is done by next period start, which writes all channels
+        if (last_edge > 0 && adv_pwm_config->max_load - last_position < adv_pwm_config->min_load) {
+            last_position -= edges[last_edge - 1].load;
+            last_edge--;
+        }
+        
+        edges[last_edge].load = adv_pwm_config->max_load - last_position;
+        last_edge++;
+        
+        schedule->edges_n[cycle] = last_edge;
+        edges += adv_pwm_config->channels_n + 1;
     }
     
-    timer_set_load(FRC1, next_load);
+    taskENTER_CRITICAL();
+    adv_pwm_config->schedule_pending = true;
+    taskEXIT_CRITICAL();
 }
 
 void adv_pwm_start() {
     if (!adv_pwm_config->is_running) {
         adv_pwm_config->is_running = true;
         
+        adv_pwm_schedule_build();
+        adv_pwm_config->edge = 0;
+        
+        // FRC1 can be used by other drivers while PWM is stopped
+        _xt_isr_attach(INUM_TIMER_FRC1, adv_pwm_worker, NULL);
+        
         timer_set_load(FRC1, adv_pwm_config->max_load);
         timer_set_reload(FRC1, false);
         timer_set_interrupts(FRC1, true);
@@ -128,7 +252,7 @@ void adv_pwm_stop() {
         timer_set_interrupts(FRC1, false);
         timer_set_run(FRC1, false);
         
-        adv_pwm_config->current_duty = 0;
+        adv_pwm_config->edge = 0;
         adv_pwm_config->cycle = 0;
         
         adv_pwm_channel_t* adv_pwm_channel = adv_pwm_config->adv_pwm_channels;
@@ -141,10 +265,35 @@ void adv_pwm_stop() {
     }
 }
 
+bool adv_pwm_is_running() {
+    return adv_pwm_config && adv_pwm_config->is_running;
+}
+
+static bool adv_pwm_buffers_alloc() {
+    for (uint8_t i = 0; i < 2; i++) {
+        adv_pwm_edge_t* edges = realloc(adv_pwm_config->edges_buffer[i], ADV_PWM_CYCLES * (adv_pwm_config->channels_n + 1) * sizeof(adv_pwm_edge_t));
+        if (!edges) {
+            return false;
+        }
+        
+        adv_pwm_config->edges_buffer[i] = edges;
+    }
+    
+    return true;
+}
+
+#ifdef ADV_PWM_BENCHMARK
+uint32_t adv_pwm_get_isr_cycles_max() {
+    return adv_pwm_config ? adv_pwm_config->isr_cycles_max : 0;
+}
+#endif
+
 static void adv_pwm_init(const uint8_t mode) {
     if (!adv_pwm_config) {
         adv_pwm_config = malloc(sizeof(adv_pwm_config_t));
         memset(adv_pwm_config, 0, sizeof(*adv_pwm_config));
+        
+        adv_pwm_buffers_alloc();
 
         _xt_isr_attach(INUM_TIMER_FRC1, adv_pwm_worker, NULL);
         
@@ -157,14 +306,16 @@ static void adv_pwm_init(const uint8_t mode) {
 void adv_pwm_set_freq(const uint16_t freq) {
     adv_pwm_init(1);
     
-    if (adv_pwm_config->is_running) {
+    const bool is_running = adv_pwm_config->is_running;
+    if (is_running) {
         adv_pwm_stop();
     }
     
     timer_set_frequency(FRC1, freq);
     adv_pwm_config->max_load = timer_get_load(FRC1);
+    adv_pwm_config->min_load = ((uint64_t) adv_pwm_config->max_load) * freq * ADV_PWM_MIN_EDGE_US / 1000000;
     
-    if (adv_pwm_config->is_running) {
+    if (is_running) {
         adv_pwm_start();
     }
 }
@@ -195,13 +346,22 @@ void adv_pwm_set_duty(const uint8_t gpio, const uint16_t duty, uint16_t ditherin
                 adv_pwm_channel->duty[i] = adv_pwm_channel->duty[8 - i];
             }
         }
+        
+        adv_pwm_config->schedule_dirty = true;
+    }
+}
+
+// Duties set since last call are built in one schedule, taken by ISR at next period start
+void adv_pwm_commit() {
+    if (adv_pwm_config && adv_pwm_config->is_running && adv_pwm_config->schedule_dirty) {
+        adv_pwm_schedule_build();
     }
 }
 
 void adv_pwm_new_channel(const uint8_t gpio, const bool inverted) {
     adv_pwm_init(0);
     
-    if (!adv_pwm_channel_find_by_gpio(gpio)) {
+    if (gpio < ADV_PWM_GPIOS && !adv_pwm_channel_find_by_gpio(gpio)) {
         bool is_running = adv_pwm_config->is_running;
         if (is_running) {
             adv_pwm_stop();
@@ -218,6 +378,15 @@ void adv_pwm_new_channel(const uint8_t gpio, const bool inverted) {
         adv_pwm_channel->next = adv_pwm_config->adv_pwm_channels;
         adv_pwm_config->adv_pwm_channels = adv_pwm_channel;
         
+        adv_pwm_config->channels_n++;
+        if (adv_pwm_buffers_alloc()) {
+            adv_pwm_config->channels_by_gpio[gpio] = adv_pwm_channel;
+        } else {
+            adv_pwm_config->adv_pwm_channels = adv_pwm_channel->next;
+            adv_pwm_config->channels_n--;
+            free(adv_pwm_channel);
+        }
+        
         if (is_running) {
             adv_pwm_start();
         }
@@ -14,12 +14,18 @@ extern "C" {
 
 void adv_pwm_start();
 void adv_pwm_stop();
+bool adv_pwm_is_running();
 void adv_pwm_set_freq(const uint16_t freq);
 void adv_pwm_set_duty(const uint8_t gpio, const uint16_t duty, uint16_t dithering);
+void adv_pwm_commit();
 uint16_t adv_pwm_get_duty(const uint8_t gpio);
 void adv_pwm_new_channel(const uint8_t gpio, const bool inverted);
 //void adv_pwm_set_zc_gpio(const uint8_t gpio);
 
+#ifdef ADV_PWM_BENCHMARK
+uint32_t adv_pwm_get_isr_cycles_max();
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,348 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Input events replay: simulated ms clock, GPIOs, timers and one MCP23017 with INT pin
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "../libs/adv_button/adv_button.c"
+
+#define TIMERS_MAX                          (64)
+#define GPIOS_MAX                           (20)
+#define MCP_INT_GPIO                        (5)
+
+typedef struct _host_timer {
+    uint32_t period;
+    uint32_t expiry;
+    bool reload;
+    bool is_running;
+    bool is_used;
+    void* id;
+    TimerCallbackFunction_t callback;
+} host_timer_t;
+
+static uint32_t now_ms = 0;
+static uint16_t evaluations = 0;
+static host_timer_t timers[TIMERS_MAX];
+
+static bool level[GPIOS_MAX];
+static gpio_inttype_t inttype[GPIOS_MAX];
+static gpio_interrupt_handler_t handler[GPIOS_MAX];
+static int8_t glitch_gpio = -1;
+
+static uint8_t mcp_pins[2], mcp_intf[2], mcp_intcap[2];
+static uint32_t i2c_reads = 0;
+
+void host_enter_critical() { }
+void host_exit_critical() { }
+
+TickType_t xTaskGetTickCount() {
+    return now_ms / portTICK_PERIOD_MS;
+}
+
+TickType_t xTaskGetTickCountFromISR() {
+    return now_ms / portTICK_PERIOD_MS;
+}
+
+void vTaskDelay(const TickType_t ticks) { }
+
+void* pvTimerGetTimerID(TimerHandle_t timer) {
+    return ((host_timer_t*) timer)->id;
+}
+
+TimerHandle_t esp_timer_create(const uint32_t period_ms, const bool auto_reload, void* pvTimerID, TimerCallbackFunction_t pxCallbackFunction) {
+    for (uint8_t i = 0; i < TIMERS_MAX; i++) {
+        if (!timers[i].is_used) {
+            timers[i] = (host_timer_t) {
+                .period = period_ms,
+                .reload = auto_reload,
+                .is_used = true,
+                .id = pvTimerID,
+                .callback = pxCallbackFunction,
+            };
+            return &timers[i];
+        }
+    }
+    
+    return NULL;
+}
+
+int esp_timer_start(TimerHandle_t xTimer) {
+    host_timer_t* timer = xTimer;
+    if (!timer) {
+        return TIMER_HELPER_ERR_NO_TIMER;
+    }
+    
+    timer->is_running = true;
+    timer->expiry = now_ms + timer->period;
+    return TIMER_HELPER_OK;
+}
+
+void esp_timer_start_from_ISR(TimerHandle_t xTimer) {
+    esp_timer_start(xTimer);
+}
+
+int esp_timer_stop(TimerHandle_t xTimer) {
+    if (!xTimer) {
+        return TIMER_HELPER_ERR_NO_TIMER;
+    }
+    
+    ((host_timer_t*) xTimer)->is_running = false;
+    return TIMER_HELPER_OK;
+}
+
+void esp_timer_stop_from_ISR(TimerHandle_t xTimer) {
+    esp_timer_stop(xTimer);
+}
+
+int esp_timer_change_period(TimerHandle_t xTimer, const uint32_t new_period_ms) {
+    ((host_timer_t*) xTimer)->period = new_period_ms;
+    return TIMER_HELPER_OK;
+}
+
+int esp_timer_delete(TimerHandle_t xTimer) {
+    if (!xTimer) {
+        return TIMER_HELPER_ERR_NO_TIMER;
+    }
+    
+    ((host_timer_t*) xTimer)->is_used = false;
+    ((host_timer_t*) xTimer)->is_running = false;
+    return TIMER_HELPER_OK;
+}
+
+void gpio_enable(const uint8_t gpio, const gpio_direction_t direction) { }
+void gpio_disable(const uint8_t gpio) { }
+void gpio_set_pullup(const uint8_t gpio, const bool enabled, const bool enabled_during_sleep) { }
+
+bool gpio_read(const uint8_t gpio) {
+    return level[gpio];
+}
+
+// A glitch is an edge too short to change input level, raised as soon as its interrupt is enabled
+void gpio_set_interrupt(const uint8_t gpio, const gpio_inttype_t int_type, gpio_interrupt_handler_t int_handler) {
+    assert(gpio < GPIOS_MAX);
+    inttype[gpio] = int_type;
+    handler[gpio] = int_handler;
+    
+    if (gpio == glitch_gpio && int_handler && int_type != GPIO_INTTYPE_NONE) {
+        glitch_gpio = -1;
+        int_handler(gpio);
+    }
+}
+
+// MCP23017: INT goes LOW on change of inputs, until GPIO or INTCAP registers are read
+static void mcp_update_int() {
+    level[MCP_INT_GPIO] = !(mcp_intf[0] | mcp_intf[1]);
+}
+
+int i2c_slave_read(uint8_t bus, uint8_t slave_addr, const uint8_t *data, const uint16_t data_len, uint8_t *buf, uint32_t len) {
+    i2c_reads++;
+    
+    for (uint32_t i = 0; i < len; i++) {
+        const uint8_t reg = *data + i;
+        if (reg == 0x0E || reg == 0x0F) {
+            buf[i] = mcp_intf[reg - 0x0E];
+        } else if (reg == 0x10 || reg == 0x11) {
+            buf[i] = mcp_intcap[reg - 0x10];
+            mcp_intf[0] = 0;
+            mcp_intf[1] = 0;
+        } else if (reg == 0x12 || reg == 0x13) {
+            buf[i] = mcp_pins[reg - 0x12];
+            mcp_intf[0] = 0;
+            mcp_intf[1] = 0;
+        }
+    }
+    
+    mcp_update_int();
+    
+    return 0;
+}
+
+static void set_gpio(const uint16_t gpio, const bool value) {
+    const bool old = level[gpio];
+    level[gpio] = value;
+    
+    if (old != value && handler[gpio]) {
+        const gpio_inttype_t type = inttype[gpio];
+        if (type == GPIO_INTTYPE_EDGE_ANY ||
+            (type == GPIO_INTTYPE_EDGE_NEG && !value) ||
+            (type == GPIO_INTTYPE_EDGE_POS && value)) {
+            handler[gpio](gpio);
+        }
+    }
+}
+
+static void set_mcp_pin(const uint16_t pin, const bool value) {
+    const uint8_t port = pin > 7;
+    const uint8_t bit = 1 << (pin & 7);
+    const uint8_t old = mcp_pins[port];
+    
+    mcp_pins[port] = value ? (old | bit) : (old & ~bit);
+    
+    if (old != mcp_pins[port] && !(mcp_intf[0] | mcp_intf[1])) {
+        mcp_intf[port] = bit;
+        mcp_intcap[0] = mcp_pins[0];
+        mcp_intcap[1] = mcp_pins[1];
+        set_gpio(MCP_INT_GPIO, false);
+    }
+}
+
+static void run_ms(const uint32_t ms) {
+    for (uint32_t i = 0; i < ms; i++) {
+        now_ms++;
+        
+        for (uint8_t t = 0; t < TIMERS_MAX; t++) {
+            host_timer_t* timer = &timers[t];
+            if (timer->is_used && timer->is_running && timer->expiry == now_ms) {
+                if (timer->reload) {
+                    timer->expiry = now_ms + timer->period;
+                } else {
+                    timer->is_running = false;
+                }
+                
+                // Only evaluation timer has no ID
+                if (!timer->id) {
+                    evaluations++;
+                }
+                
+                timer->callback(timer);
+            }
+        }
+    }
+}
+
+static uint8_t singles[300], doubles[300], longs[300];
+
+static void single_press(uint16_t gpio, void* args, uint8_t param) {
+    singles[gpio]++;
+}
+
+static void double_press(uint16_t gpio, void* args, uint8_t param) {
+    doubles[gpio]++;
+}
+
+static void long_press(uint16_t gpio, void* args, uint8_t param) {
+    longs[gpio]++;
+}
+
+static void press(void (*set)(const uint16_t, const bool), const uint16_t input, const uint32_t ms) {
+    set(input, false);
+    run_ms(ms);
+    set(input, true);
+    run_ms(150);
+}
+
+// Idle inputs must not use I2C bus, and without polled inputs, evaluation timer must not run
+static void check_idle(const bool has_polled) {
+    run_ms(20000);
+    
+    const uint32_t reads = i2c_reads;
+    const uint16_t evals = evaluations;
+    run_ms(10000);
+    
+    printf("Idle %s polled inputs: %u I2C reads, %u evaluations in 10 s\n", has_polled ? "with" : "without", i2c_reads - reads, evaluations - evals);
+    assert(i2c_reads == reads);
+    assert(has_polled || evaluations == evals);
+}
+
+int main() {
+    for (uint8_t i = 0; i < GPIOS_MAX; i++) {
+        level[i] = true;
+    }
+    
+    mcp_pins[0] = 0xFF;
+    mcp_pins[1] = 0xFF;
+    mcp_update_int();
+    
+    adv_button_set_mcp_interrupt(1, 0, 0x20, MCP_INT_GPIO);
+    
+    // Interrupt GPIO, polled GPIO16, and MCP23017 A0 and B3 with INT pin
+    const uint16_t buttons[] = { 4, 16, 100, 111 };
+    for (uint8_t i = 0; i < 4; i++) {
+        assert(adv_button_create(buttons[i], buttons[i] > 99 ? 0 : 1, false, buttons[i] > 99 ? 0x20 : ADV_BUTTON_NORMAL_MODE) == 0);
+        adv_button_register_callback_fn(buttons[i], single_press, SINGLEPRESS_TYPE, NULL, 0);
+        adv_button_register_callback_fn(buttons[i], double_press, DOUBLEPRESS_TYPE, NULL, 0);
+        adv_button_register_callback_fn(buttons[i], long_press, LONGPRESS_TYPE, NULL, 0);
+    }
+    
+    // Lookups by GPIO and by MCP23017 index * 100 + pin
+    assert(button_find_by_gpio(4) && button_find_by_gpio(4)->gpio == 4);
+    assert(button_find_by_gpio(16) && button_find_by_gpio(16)->gpio == 16);
+    assert(button_find_by_gpio(100) && button_find_by_gpio(100)->gpio == 100);
+    assert(button_find_by_gpio(111) && button_find_by_gpio(111)->gpio == 111);
+    assert(!button_find_by_gpio(5) && !button_find_by_gpio(17) && !button_find_by_gpio(99));
+    assert(!button_find_by_gpio(101) && !button_find_by_gpio(116) && !button_find_by_gpio(200) && !button_find_by_gpio(2511));
+    assert(mcp_find_by_index(1) && !mcp_find_by_index(0) && !mcp_find_by_index(2) && !mcp_find_by_index(255));
+    
+    check_idle(true);
+    
+    press(set_gpio, 4, 100);
+    run_ms(1000);
+    assert(singles[4] == 1);
+    
+    press(set_gpio, 16, 100);
+    run_ms(1000);
+    assert(singles[16] == 1);
+    
+    press(set_mcp_pin, 0, 100);
+    run_ms(1000);
+    assert(singles[100] == 1);
+    
+    press(set_mcp_pin, 11, 100);
+    press(set_mcp_pin, 11, 100);
+    run_ms(1000);
+    assert(doubles[111] == 1 && singles[111] == 0);
+    
+    press(set_mcp_pin, 0, 700);
+    run_ms(1000);
+    assert(longs[100] == 1);
+    
+    // All kinds of inputs pressed together
+    set_gpio(4, false);
+    set_gpio(16, false);
+    set_mcp_pin(0, false);
+    set_mcp_pin(11, false);
+    run_ms(100);
+    set_gpio(4, true);
+    set_gpio(16, true);
+    set_mcp_pin(0, true);
+    set_mcp_pin(11, true);
+    run_ms(1000);
+    assert(singles[4] == 2 && singles[16] == 2 && singles[100] == 2 && singles[111] == 1);
+    
+    check_idle(true);
+    
+    adv_button_destroy(16);
+    assert(!button_find_by_gpio(16));
+    check_idle(false);
+    
+    press(set_mcp_pin, 11, 100);
+    run_ms(1000);
+    assert(singles[111] == 2);
+    
+    press(set_gpio, 4, 100);
+    run_ms(1000);
+    assert(singles[4] == 3);
+    
+    // Interrupt raised while evaluation is going to sleep must not leave inputs without interrupts nor timer
+    glitch_gpio = 4;
+    run_ms(20000);
+    assert(glitch_gpio == -1);
+    
+    press(set_gpio, 4, 100);
+    run_ms(1000);
+    assert(singles[4] == 4);
+    
+    press(set_mcp_pin, 0, 100);
+    run_ms(1000);
+    assert(singles[100] == 3);
+    
+    printf("adv_button: OK\n");
+    
+    return 0;
+}
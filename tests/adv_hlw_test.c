@@ -0,0 +1,106 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// HLW8012 units are found by GPIO from interrupts. Pulses are simulated on CF and CF1 with a us clock
+
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+
+#include "../libs/adv_hlw/adv_hlw.c"
+
+#define GPIOS_MAX                           (20)
+
+static uint32_t now_us = 0;
+static bool level[GPIOS_MAX];
+static gpio_interrupt_handler_t handler[GPIOS_MAX];
+
+void host_enter_critical() { }
+void host_exit_critical() { }
+
+uint32_t sdk_system_get_time() {
+    return now_us;
+}
+
+void gpio_enable(const uint8_t gpio, const gpio_direction_t direction) { }
+void gpio_set_pullup(const uint8_t gpio, const bool enabled, const bool enabled_during_sleep) { }
+
+void gpio_write(const uint8_t gpio, const bool set) {
+    assert(gpio < GPIOS_MAX);
+    level[gpio] = set;
+}
+
+void gpio_set_interrupt(const uint8_t gpio, const gpio_inttype_t int_type, gpio_interrupt_handler_t int_handler) {
+    assert(gpio < GPIOS_MAX);
+    handler[gpio] = (int_type == GPIO_INTTYPE_NONE) ? NULL : int_handler;
+}
+
+// Pulses on CF and CF1 GPIOs, with given periods in us, for a time
+static void pulses(const uint8_t gpio_cf, const uint32_t period_cf, const uint8_t gpio_cf1, const uint32_t period_cf1, const uint32_t time_us) {
+    const uint32_t end = now_us + time_us;
+    uint32_t next_cf = now_us + period_cf;
+    uint32_t next_cf1 = now_us + period_cf1;
+    
+    while (now_us < end) {
+        now_us = next_cf < next_cf1 ? next_cf : next_cf1;
+        
+        if (now_us == next_cf) {
+            assert(handler[gpio_cf]);
+            handler[gpio_cf](gpio_cf);
+            next_cf += period_cf;
+        }
+        
+        if (now_us == next_cf1) {
+            assert(handler[gpio_cf1]);
+            handler[gpio_cf1](gpio_cf1);
+            next_cf1 += period_cf1;
+        }
+    }
+}
+
+int main() {
+    // CF 4, CF1 5 and SEL 12
+    assert(adv_hlw_unit_create(4, 5, 12, 0) == 0);
+    
+    // GPIOs already used by a unit, and GPIOs out of range
+    assert(adv_hlw_unit_create(4, 13, 14, 0) == -1);
+    assert(adv_hlw_unit_create(13, 5, 14, 0) == -2);
+    assert(adv_hlw_unit_create(13, 14, 4, 0) == -3);
+    assert(adv_hlw_unit_create(17, 13, 14, 0) == -4);
+    assert(adv_hlw_unit_create(13, 40, 14, 0) == -4);
+    assert(adv_hlw_unit_create(13, 14, 17, 0) == -4);
+    
+    // Second unit without SEL
+    assert(adv_hlw_unit_create(13, 14, -1, 0) == 0);
+    
+    assert(adv_hlw_find_by_gpio(4) == adv_hlw_find_by_gpio(5));
+    assert(adv_hlw_find_by_gpio(13) == adv_hlw_find_by_gpio(14));
+    assert(adv_hlw_find_by_gpio(4) != adv_hlw_find_by_gpio(13));
+    assert(!adv_hlw_find_by_gpio(0) && !adv_hlw_find_by_gpio(16) && !adv_hlw_find_by_gpio(200));
+    assert(adv_hlw_get_power_freq(200) == 0);
+    
+    // First unit: current is read first, then SEL switches to voltage after PERIOD_TIMEOUT
+    pulses(4, 1000, 5, 2000, 1600000);
+    assert(fabs(adv_hlw_get_power_freq(4) - 1000) < 1);
+    assert(fabs(adv_hlw_get_current_freq(5) - 500) < 1);
+    assert(level[12] == 1);
+    
+    pulses(4, 1000, 5, 400, 1600000);
+    assert(fabs(adv_hlw_get_voltage_freq(5) - 2500) < 1);
+    assert(fabs(adv_hlw_get_current_freq(4) - 500) < 1);
+    assert(level[12] == 0);
+    
+    // Second unit has its own periods, and first one has no pulses for more than PERIOD_TIMEOUT
+    pulses(13, 250, 14, 125, 1600000);
+    assert(fabs(adv_hlw_get_power_freq(13) - 4000) < 1);
+    assert(adv_hlw_find_by_gpio(4)->period_cf == 1000);
+    assert(adv_hlw_get_power_freq(4) == 0);
+    
+    printf("adv_hlw: OK\n");
+    
+    return 0;
+}
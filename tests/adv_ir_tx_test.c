@@ -0,0 +1,186 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// IR TX simulator: FRC1 is fired every carrier half period until driver stops it,
+// and emitted marks are checked against code timings
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "../libs/adv_ir_tx/adv_ir_tx.c"
+
+#define EDGES_MAX                           (65536)
+#define MARKS_MAX                           (1024)
+#define CARRIER_HALF_PERIOD_US              (13)    // 38 kHz
+
+static void (*isr)() = NULL;
+static bool is_running = false;
+static bool is_given = false;
+static bool pwm_running = false;
+static uint32_t freq = 0;
+static uint32_t now_us = 0;
+static uint8_t critical = 0;
+
+static bool level = false;
+static uint32_t edges_n = 0;
+static uint32_t edges[EDGES_MAX];
+
+void host_enter_critical() {
+    critical++;
+}
+
+void host_exit_critical() {
+    assert(critical > 0);
+    critical--;
+}
+
+void gpio_write(const uint8_t gpio, const bool set) {
+    if (set != level) {
+        assert(edges_n < EDGES_MAX);
+        edges[edges_n++] = now_us;
+        level = set;
+    }
+}
+
+void _xt_isr_attach(const uint8_t inum, void (*fn)(), void* args) {
+    assert(inum == INUM_TIMER_FRC1);
+    isr = fn;
+}
+
+void timer_set_interrupts(const uint8_t frc, const bool enable) { }
+
+void timer_set_run(const uint8_t frc, const bool run) {
+    is_running = run;
+}
+
+void timer_set_reload(const uint8_t frc, const bool reload) {
+    assert(reload);
+}
+
+bool timer_set_frequency(const uint8_t frc, const uint32_t frequency) {
+    freq = frequency;
+    return true;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return (SemaphoreHandle_t) &is_given;
+}
+
+// Waiting for code end runs timer, and no task is blocked in critical section
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, const TickType_t ticks) {
+    assert(critical == 0);
+    
+    const uint32_t timeout_us = now_us + ticks * portTICK_PERIOD_MS * 1000;
+    while (ticks > 0 && is_running && now_us < timeout_us) {
+        now_us += 1000000 / freq;
+        isr();
+    }
+    
+    const bool was_given = is_given;
+    is_given = false;
+    return was_given;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* woken) {
+    is_given = true;
+    return pdTRUE;
+}
+
+bool adv_pwm_is_running() {
+    return pwm_running;
+}
+
+// Marks are bursts of carrier. Each one must start within one half period of code, and its last falling
+// edge within one carrier period of mark end
+static void check_marks(const uint16_t* code, const uint16_t len, const bool inverted) {
+    static uint32_t mark_start[MARKS_MAX], mark_end[MARKS_MAX];
+    uint16_t marks_n = 0;
+    uint32_t t = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        if (!(i & 1) && code[i] > 0) {
+            assert(marks_n < MARKS_MAX);
+            mark_start[marks_n] = t;
+            mark_end[marks_n] = t + code[i];
+            marks_n++;
+        }
+        t += code[i];
+    }
+    
+    uint16_t burst = 0;
+    uint32_t burst_start = edges[0];
+    for (uint32_t i = 1; i <= edges_n; i++) {
+        if (i == edges_n || edges[i] - edges[i - 1] > 2 * CARRIER_HALF_PERIOD_US) {
+            const uint32_t burst_end = edges[i - 1];
+            assert(burst < marks_n);
+            
+            if (abs((int32_t) (burst_start - mark_start[burst])) > CARRIER_HALF_PERIOD_US ||
+                abs((int32_t) (burst_end - mark_end[burst])) > 2 * CARRIER_HALF_PERIOD_US) {
+                fprintf(stderr, "Mark %i: %u..%u us, expected %u..%u us\n", burst, burst_start, burst_end, mark_start[burst], mark_end[burst]);
+                assert(false);
+            }
+            
+            burst++;
+            if (i < edges_n) {
+                burst_start = edges[i];
+            }
+        }
+    }
+    
+    assert(burst == marks_n);
+    assert(level == inverted);
+}
+
+static void send(const uint16_t* code, const uint16_t len, const bool inverted) {
+    now_us = 0;
+    edges_n = 0;
+    level = inverted;
+    
+    assert(adv_ir_tx_send(2, inverted, CARRIER_HALF_PERIOD_US, code, len));
+    assert(!is_running);
+    assert(critical == 0);
+}
+
+int main() {
+    // NEC: header, 32 bits and footer
+    uint16_t nec[2 + 32 * 2 + 1];
+    uint16_t len = 0;
+    nec[len++] = 9000;
+    nec[len++] = 4500;
+    for (uint8_t i = 0; i < 32; i++) {
+        nec[len++] = 560;
+        nec[len++] = ((0x20DF10EF >> i) & 1) ? 1690 : 560;
+    }
+    nec[len++] = 560;
+    
+    send(nec, len, false);
+    check_marks(nec, len, false);
+    printf("NEC: %u edges, last at %u us\n", edges_n, edges[edges_n - 1]);
+    
+    send(nec, len, true);
+    check_marks(nec, len, true);
+    
+    // Long code with empty marks and long spaces does not drift
+    uint16_t long_code[601];
+    for (uint16_t i = 0; i < 601; i++) {
+        long_code[i] = (i % 14 == 4) ? 0 : (i & 1) ? 40000 - i * 37 : 300 + i;
+    }
+    
+    send(long_code, 601, false);
+    check_marks(long_code, 601, false);
+    printf("Long code: %u edges, last at %u us\n", edges_n, edges[edges_n - 1]);
+    
+    // FRC1 is used by PWM
+    pwm_running = true;
+    assert(!adv_ir_tx_send(2, false, CARRIER_HALF_PERIOD_US, nec, len));
+    pwm_running = false;
+    
+    assert(!adv_ir_tx_send(2, false, 0, nec, len));
+    
+    printf("adv_ir_tx: OK\n");
+    
+    return 0;
+}
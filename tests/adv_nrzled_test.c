@@ -0,0 +1,194 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// NRZ LED strip simulator: CPU cycle counter, interrupts served when critical sections end,
+// and a strip latching received bits after a long low level
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../libs/adv_nrzled/adv_nrzled.c"
+
+#define CPU_FREQ                            (80)
+#define LEDS                                (60)
+#define FRAME_SIZE                          (LEDS * 3)
+#define TIME_0                              (32)    // 0.4 us
+#define TIME_1                              (64)    // 0.8 us
+#define PERIOD                              (100)   // 1.25 us
+#define LATCH_CYCLES                        (NRZLED_GAP_MAX_US * CPU_FREQ)
+#define IRQ_CYCLES                          (25 * CPU_FREQ)
+#define DELAYS_MAX                          (16)
+#define NRZ_GPIO                            (2)
+
+static uint32_t ccount = 0;
+static uint32_t busy_until = 0;
+static bool is_always_busy = false;
+
+static uint16_t delays[DELAYS_MAX];
+static uint8_t delays_n = 0;
+
+// Strip
+static bool level = false;
+static uint32_t last_edge = 0;
+static uint8_t received[FRAME_SIZE * 2];
+static uint16_t received_bits = 0;
+static uint8_t latched[FRAME_SIZE * 2];
+static uint16_t latched_size = 0;
+static uint16_t latches = 0;
+
+static uint8_t failed_frames = 0;
+
+uint32_t host_rsr_ccount() {
+    return ccount++;
+}
+
+uint8_t sdk_system_get_cpu_freq() {
+    return CPU_FREQ;
+}
+
+void sdk_os_delay_us(const uint16_t us) {
+    assert(delays_n < DELAYS_MAX);
+    delays[delays_n++] = us;
+    ccount += us * CPU_FREQ;
+}
+
+void host_enter_critical() { }
+
+// Pending interrupts are served as soon as they are enabled
+void host_exit_critical() {
+    if (is_always_busy || (int32_t) (ccount - busy_until) < 0) {
+        ccount += IRQ_CYCLES;
+    }
+}
+
+static void strip_latch() {
+    if (received_bits > 0) {
+        memcpy(latched, received, received_bits >> 3);
+        latched_size = received_bits >> 3;
+        latches++;
+        received_bits = 0;
+    }
+}
+
+void gpio_write(const uint8_t gpio, const bool set) {
+    assert(gpio == NRZ_GPIO);
+    
+    if (set && !level) {
+        if (ccount - last_edge > LATCH_CYCLES) {
+            strip_latch();
+        }
+    } else if (!set && level) {
+        const uint16_t byte = received_bits >> 3;
+        assert(byte < sizeof(received));
+        
+        if (received_bits % 8 == 0) {
+            received[byte] = 0;
+        }
+        
+        if (ccount - last_edge > (TIME_0 + TIME_1) / 2) {
+            received[byte] |= 1 << (7 - (received_bits % 8));
+        }
+        
+        received_bits++;
+    }
+    
+    level = set;
+    last_edge = ccount;
+}
+
+static bool send(uint8_t* colors, const bool critical_fallback) {
+    delays_n = 0;
+    latches = 0;
+    
+    const bool result = nrzled_set_blocks(NRZ_GPIO, TIME_0, TIME_1, PERIOD, colors, FRAME_SIZE, critical_fallback, &failed_frames);
+    
+    ccount += LATCH_CYCLES + 1;
+    gpio_write(NRZ_GPIO, true);
+    gpio_write(NRZ_GPIO, false);
+    received_bits = 0;
+    
+    return result;
+}
+
+static bool is_frame_latched(uint8_t* colors) {
+    return latched_size == FRAME_SIZE && memcmp(latched, colors, FRAME_SIZE) == 0;
+}
+
+int main() {
+    uint8_t colors[FRAME_SIZE];
+    for (uint16_t i = 0; i < FRAME_SIZE; i++) {
+        colors[i] = i * 37 + 5;
+    }
+    
+    const nrzled_stats_t* stats = nrzled_get_stats();
+    
+    // Idle interrupts: frame is sent by blocks at first attempt
+    assert(send(colors, false));
+    assert(is_frame_latched(colors) && latches == 1 && delays_n == 0);
+    assert(stats->frames == 1 && stats->retries == 0);
+    
+    // Interrupts busy for a while: each wait is longer, until a complete frame is sent by blocks
+    colors[0] ^= 0xFF;
+    busy_until = ccount + 2000 * CPU_FREQ;
+    assert(send(colors, false));
+    assert(is_frame_latched(colors));
+    assert(stats->frames == 2 && stats->retries == 2 && stats->fallbacks == 0);
+    assert(delays_n == 2 && delays[0] == NRZLED_RESET_US && delays[1] == NRZLED_RESET_US * 2);
+    
+    // Interrupts always busy, without fallback: frame is not completed, and caller must send it again,
+    // until it is dropped after some calls
+    colors[1] ^= 0xFF;
+    is_always_busy = true;
+    for (uint8_t i = 1; i < NRZLED_FAILED_FRAMES_MAX; i++) {
+        assert(!send(colors, false));
+        assert(!is_frame_latched(colors) && latched_size < FRAME_SIZE && failed_frames == i);
+    }
+    
+    uint32_t delay_total = 0;
+    assert(delays_n == NRZLED_ATTEMPTS);
+    for (uint8_t i = 0; i < delays_n; i++) {
+        assert(delays[i] <= NRZLED_BACKOFF_MAX_US);
+        assert(i == 0 || delays[i] >= delays[i - 1]);
+        delay_total += delays[i];
+    }
+    
+    printf("Busy interrupts: %u attempts, %u us of back-off\n", NRZLED_ATTEMPTS, delay_total);
+    
+    assert(send(colors, false));
+    assert(!is_frame_latched(colors) && failed_frames == 0);
+    assert(stats->frames == 2 + NRZLED_FAILED_FRAMES_MAX && stats->failures == NRZLED_FAILED_FRAMES_MAX);
+    assert(stats->drops == 1 && stats->fallbacks == 0);
+    
+    // Interrupts always busy, with fallback: frame is sent with interrupts disabled after some calls
+    for (uint8_t i = 1; i < NRZLED_FAILED_FRAMES_MAX; i++) {
+        assert(!send(colors, true));
+        assert(!is_frame_latched(colors) && failed_frames == i);
+    }
+    
+    assert(send(colors, true));
+    assert(is_frame_latched(colors) && failed_frames == 0);
+    assert(delays_n == NRZLED_ATTEMPTS);
+    assert(stats->failures == NRZLED_FAILED_FRAMES_MAX * 2 && stats->drops == 1 && stats->fallbacks == 1);
+    
+    // A completed frame starts count again
+    colors[2] ^= 0xFF;
+    assert(!send(colors, true) && failed_frames == 1);
+    
+    is_always_busy = false;
+    busy_until = ccount;
+    
+    assert(send(colors, false));
+    assert(is_frame_latched(colors) && latches == 1 && failed_frames == 0);
+    
+    printf("Stats: frames %u, retries %u, fallbacks %u, failures %u, drops %u\n", stats->frames, stats->retries, stats->fallbacks, stats->failures, stats->drops);
+    assert(stats->frames == 4 + NRZLED_FAILED_FRAMES_MAX * 2 && stats->retries == 2 + (NRZLED_FAILED_FRAMES_MAX * 2 + 1) * NRZLED_ATTEMPTS);
+    
+    printf("adv_nrzled: OK\n");
+    
+    return 0;
+}
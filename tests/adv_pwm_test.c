@@ -0,0 +1,232 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// PWM schedule simulator: FRC1 is fired after every load given by ISR, and time each output is on
+// is compared with its duties. It also reports ISR budget: interrupts per period and closest edges
+
+#include <stdio.h>
+#include <assert.h>
+
+#include "../libs/adv_pwm/adv_pwm.c"
+
+#define FRC1_TICKS_PER_SECOND               (5000000)   // 80 MHz with divider 16
+#define PERIODS                             (ADV_PWM_CYCLES)
+#define TRIALS                              (3000)
+
+static const uint8_t gpios[] = { 4, 5, 12, 13, 16 };
+#define CHANNELS                            (sizeof(gpios))
+#define INVERTED_CHANNEL                    (2)
+
+host_gpio_t GPIO;
+static uint32_t gpio16 = 0;
+static uint32_t load = 0;
+static uint32_t freq_load = 0;
+
+void host_enter_critical() { }
+void host_exit_critical() { }
+
+void gpio_enable(const uint8_t gpio, const gpio_direction_t direction) { }
+
+void gpio_write(const uint8_t gpio, const bool set) {
+    if (gpio == 16) {
+        gpio16 = set;
+    } else if (set) {
+        GPIO.OUT |= BIT(gpio);
+    } else {
+        GPIO.OUT &= ~BIT(gpio);
+    }
+}
+
+void _xt_isr_attach(const uint8_t inum, void (*isr)(), void* args) { }
+void timer_set_interrupts(const uint8_t frc, const bool enable) { }
+void timer_set_run(const uint8_t frc, const bool run) { }
+void timer_set_reload(const uint8_t frc, const bool reload) { }
+
+void timer_set_load(const uint8_t frc, const uint32_t new_load) {
+    load = new_load;
+}
+
+uint32_t timer_get_load(const uint8_t frc) {
+    return freq_load;
+}
+
+bool timer_set_frequency(const uint8_t frc, const uint32_t freq) {
+    freq_load = FRC1_TICKS_PER_SECOND / freq;
+    return true;
+}
+
+static bool output(const uint8_t gpio) {
+    if (gpio == 16) {
+        return gpio16;
+    }
+    
+    return (GPIO.OUT >> gpio) & 1;
+}
+
+// One interrupt. GPIO set and clear registers are applied as hardware does
+static void isr() {
+    GPIO.OUT_SET = 0;
+    GPIO.OUT_CLEAR = 0;
+    
+    adv_pwm_worker();
+    
+    GPIO.OUT = (GPIO.OUT | GPIO.OUT_SET) & ~GPIO.OUT_CLEAR;
+}
+
+static uint16_t random_duty() {
+    switch (rand() % 6) {
+        case 0:
+            return 0;
+            
+        case 1:
+            return UINT16_MAX;
+            
+        case 2:
+            return rand() % 50;
+            
+        case 3:
+            return UINT16_MAX - rand() % 50;
+            
+        default:
+            return rand() % (UINT16_MAX + 1);
+    }
+}
+
+static void test_freq(const uint16_t freq) {
+    adv_pwm_set_freq(freq);
+    
+    uint32_t isr_max = 0;
+    uint32_t load_min = UINT32_MAX;
+    
+    for (uint16_t trial = 0; trial < TRIALS; trial++) {
+        // Odd trials have close duties, so edges must be joined
+        const uint16_t base = random_duty();
+        for (uint8_t i = 0; i < CHANNELS; i++) {
+            const uint16_t duty = (trial & 1) ? base : random_duty();
+            adv_pwm_set_duty(gpios[i], duty, (trial % 3 == 0) ? 6000 : 0);
+        }
+        
+        adv_pwm_start();
+        
+        // First period finishes previous schedule
+        do {
+            isr();
+        } while (adv_pwm_config->edge != 0);
+        
+        uint64_t on[CHANNELS] = { 0 };
+        uint64_t total = 0;
+        uint32_t isr_n = 0;
+        for (uint8_t period = 0; period < PERIODS; period++) {
+            do {
+                isr();
+                
+                for (uint8_t i = 0; i < CHANNELS; i++) {
+                    if (output(gpios[i]) ^ (i == INVERTED_CHANNEL)) {
+                        on[i] += load;
+                    }
+                }
+                
+                total += load;
+                isr_n++;
+                if (load < load_min && load < adv_pwm_config->max_load) {
+                    load_min = load;
+                }
+            } while (adv_pwm_config->edge != 0);
+        }
+        
+        // Period never changes, and each output is within joined edges of its duty
+        assert(total == (uint64_t) PERIODS * adv_pwm_config->max_load);
+        
+        for (uint8_t i = 0; i < CHANNELS; i++) {
+            const adv_pwm_channel_t* adv_pwm_channel = adv_pwm_channel_find_by_gpio(gpios[i]);
+            uint64_t expected = 0;
+            for (uint8_t cycle = 0; cycle < PERIODS; cycle++) {
+                expected += ((uint64_t) adv_pwm_channel->duty[cycle]) * adv_pwm_config->max_load / UINT16_MAX;
+            }
+            
+            const int64_t error = llabs((int64_t) on[i] - (int64_t) expected);
+            if (error > PERIODS * (adv_pwm_config->min_load * CHANNELS + 2)) {
+                fprintf(stderr, "%i Hz, GPIO %i: on %llu, expected %llu\n", freq, gpios[i], (unsigned long long) on[i], (unsigned long long) expected);
+                assert(false);
+            }
+        }
+        
+        if (isr_n > isr_max) {
+            isr_max = isr_n;
+        }
+        
+        adv_pwm_stop();
+    }
+    
+    // Edges closer than min_load are joined, so ISR always has ADV_PWM_MIN_EDGE_US to run
+    assert(load_min == UINT32_MAX || load_min >= adv_pwm_config->min_load);
+    assert(isr_max <= PERIODS * (CHANNELS + 1));
+    
+    printf("%5i Hz: max load %u, interrupts per period <= %u, closest edges %u ticks (%u us)\n",
+           freq, adv_pwm_config->max_load, isr_max / PERIODS, load_min, load_min * 1000000 / FRC1_TICKS_PER_SECOND);
+}
+
+int main() {
+    srand(1);
+    
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+        adv_pwm_new_channel(gpios[i], i == INVERTED_CHANNEL);
+    }
+    
+    // Lookups by GPIO, and no channel beyond GPIO16
+    for (uint8_t i = 0; i < CHANNELS; i++) {
+        assert(adv_pwm_channel_find_by_gpio(gpios[i])->gpio == gpios[i]);
+    }
+    
+    adv_pwm_new_channel(17, false);
+    assert(adv_pwm_config->channels_n == CHANNELS);
+    assert(!adv_pwm_channel_find_by_gpio(0) && !adv_pwm_channel_find_by_gpio(17) && !adv_pwm_channel_find_by_gpio(255));
+    
+    // Duty changes while running are taken at period start, without mixing schedules
+    adv_pwm_set_freq(305);
+    adv_pwm_set_duty(gpios[0], UINT16_MAX / 2, 0);
+    adv_pwm_start();
+    for (uint8_t i = 0; i < 3; i++) {
+        isr();
+    }
+    
+    // Duties of several channels are built together by adv_pwm_commit()
+    const uint8_t schedule_active = adv_pwm_config->schedule_active;
+    adv_pwm_set_duty(gpios[0], UINT16_MAX / 4, 0);
+    adv_pwm_set_duty(gpios[1], UINT16_MAX / 3, 0);
+    assert(adv_pwm_config->schedule_dirty && !adv_pwm_config->schedule_pending);
+    
+    adv_pwm_commit();
+    assert(!adv_pwm_config->schedule_dirty);
+    assert(adv_pwm_config->schedule_pending && adv_pwm_config->schedule_active == schedule_active);
+    
+    while (adv_pwm_config->edge != 0) {
+        isr();
+    }
+    
+    isr();
+    assert(!adv_pwm_config->schedule_pending && adv_pwm_config->schedule_active != schedule_active);
+    
+    // Both channels are in new schedule
+    const adv_pwm_schedule_t* schedule = &adv_pwm_config->schedule[adv_pwm_config->schedule_active];
+    assert(schedule->edges_n[0] == 3);
+    assert(schedule->edges[0][0].load == ((uint64_t) (UINT16_MAX / 4)) * adv_pwm_config->max_load / UINT16_MAX);
+    assert(schedule->edges[0][0].load + schedule->edges[0][1].load == ((uint64_t) (UINT16_MAX / 3)) * adv_pwm_config->max_load / UINT16_MAX);
+    
+    // Nothing is built again without duty changes
+    adv_pwm_commit();
+    assert(!adv_pwm_config->schedule_pending);
+    adv_pwm_stop();
+    
+    test_freq(305);
+    test_freq(2000);
+    test_freq(20000);
+    
+    printf("adv_pwm: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Compiled config images: firmware and devices/common/config_compile.py must make byte-identical images,
+// loaded images must rebuild same cJSON tree as parser, and damaged or stale images must be refused
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../external_libs/cJSON/cJSON/cJSON.c"
+#include "../devices/HAA/config_image.c"
+
+#define CONFIG_NUMBER                       (7)
+
+static uint32_t allocs = 0;
+static uint32_t alloc_fail = 0;     // Number of allocation that fails, 0 for none
+
+static void* host_malloc(size_t size) {
+    allocs++;
+    if (allocs == alloc_fail) {
+        return NULL;
+    }
+    
+    return malloc(size);
+}
+
+static uint8_t* load_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    assert(file);
+    
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    uint8_t* data = malloc(*size + 1);
+    assert(data && fread(data, 1, *size, file) == *size);
+    data[*size] = 0;
+    fclose(file);
+    
+    return data;
+}
+
+// Same types, keys, values and links, including -0 and repeated keys
+static bool is_same_tree(cJSON* a, cJSON* b) {
+    if ((a->type & 0xFF) != (b->type & 0xFF) ||
+        (a->string == NULL) != (b->string == NULL) ||
+        (a->string && strcmp(a->string, b->string) != 0) ||
+        (cJSON_IsNumber(a) && (memcmp(&a->valuedouble, &b->valuedouble, sizeof(double)) != 0 || a->valueint != b->valueint)) ||
+        (cJSON_IsString(a) && strcmp(a->valuestring, b->valuestring) != 0)) {
+        return false;
+    }
+    
+    cJSON* a_item = a->child;
+    cJSON* b_item = b->child;
+    cJSON* b_prev = NULL;
+    while (a_item && b_item) {
+        if (b_item->prev != b_prev || !is_same_tree(a_item, b_item)) {
+            return false;
+        }
+        
+        b_prev = b_item;
+        a_item = a_item->next;
+        b_item = b_item->next;
+    }
+    
+    return !a_item && !b_item;
+}
+
+static int load(uint8_t* image, const size_t size, const uint32_t json_hash) {
+    cJSON* json_haa = (cJSON*) 1;
+    const int ret = config_image_load(image, size, CONFIG_NUMBER, json_hash, &json_haa);
+    
+    assert((ret == CONFIG_IMAGE_OK) == (json_haa != NULL));
+    cJSON_Delete(json_haa);
+    
+    return ret;
+}
+
+// Header hash is made again, so damaged body reaches loader checks
+static int load_damaged(const uint8_t* image, const size_t size, const uint32_t json_hash, const size_t pos, const uint8_t mask) {
+    uint8_t* damaged = malloc(size);
+    memcpy(damaged, image, size);
+    damaged[pos] ^= mask;
+    
+    const uint32_t body_hash = config_image_hash(damaged + CONFIG_IMAGE_HEADER_SIZE, size - CONFIG_IMAGE_HEADER_SIZE);
+    for (uint8_t i = 0; i < 4; i++) {
+        damaged[16 + i] = body_hash >> (i * 8);
+    }
+    
+    const int ret = load(damaged, size, json_hash);
+    free(damaged);
+    
+    return ret;
+}
+
+static void test_invalid(const char* path) {
+    size_t text_size;
+    char* text = (char*) load_file(path, &text_size);
+    cJSON* json_haa = cJSON_Parse(text);
+    
+    uint8_t* image = (uint8_t*) 1;
+    assert(config_image_validate(json_haa) == CONFIG_IMAGE_ERR_INVALID);
+    assert(config_image_compile(json_haa, CONFIG_NUMBER, 0, &image) == CONFIG_IMAGE_ERR_INVALID && image == NULL);
+    
+    printf("%s: invalid\n", path);
+    
+    cJSON_Delete(json_haa);
+    free(text);
+}
+
+static void test_config(const char* path, const char* images_dir) {
+    size_t text_size;
+    char* text = (char*) load_file(path, &text_size);
+    const uint32_t json_hash = config_image_hash((uint8_t*) text, text_size);
+    
+    allocs = 0;
+    cJSON* json_parsed = cJSON_Parse(text);
+    const uint32_t parse_allocs = allocs;
+    assert(json_parsed && config_image_validate(json_parsed) == CONFIG_IMAGE_OK);
+    
+    // Firmware and host compiler
+    uint8_t* image = NULL;
+    const int size = config_image_compile(json_parsed, CONFIG_NUMBER, json_hash, &image);
+    assert(size > CONFIG_IMAGE_HEADER_SIZE && image);
+    
+    char image_path[256];
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    snprintf(image_path, sizeof(image_path), "%s/%.*s.bin", images_dir, (int) (strlen(name) - 5), name);
+    
+    size_t host_size;
+    uint8_t* host_image = load_file(image_path, &host_size);
+    assert(host_size == size && memcmp(host_image, image, size) == 0);
+    
+    // Round trip
+    allocs = 0;
+    cJSON* json_loaded = NULL;
+    assert(config_image_load(image, size, CONFIG_NUMBER, json_hash, &json_loaded) == CONFIG_IMAGE_OK);
+    const uint32_t load_allocs = allocs;
+    
+    assert(is_same_tree(json_parsed, json_loaded));
+    
+    char* parsed_text = cJSON_PrintUnformatted(json_parsed);
+    char* loaded_text = cJSON_PrintUnformatted(json_loaded);
+    assert(strcmp(parsed_text, loaded_text) == 0);
+    free(parsed_text);
+    free(loaded_text);
+    
+    printf("%s: JSON %i Bytes, %u allocations. Image %i Bytes, %u allocations\n", path, (int) text_size, parse_allocs, size, load_allocs);
+    assert(size < text_size && load_allocs < parse_allocs);
+    
+    // Loaded tree is used as firmware does: actions are referenced by new objects, and accessories are deleted one by one
+    cJSON* json_accessories = cJSON_GetObjectItemCaseSensitive(json_loaded, ACCESSORIES_ARRAY);
+    cJSON* json_action = cJSON_GetObjectItemCaseSensitive(json_accessories->child, "0");
+    if (json_action) {
+        cJSON* json_new_input_action = cJSON_CreateObject();
+        cJSON_AddItemReferenceToObject(json_new_input_action, "1", json_action);
+        assert(is_same_tree(cJSON_GetObjectItemCaseSensitive(json_new_input_action, "1")->child, json_action->child));
+        cJSON_Delete(json_new_input_action);
+    }
+    
+    while (json_accessories->child) {
+        cJSON_Delete(cJSON_DetachItemViaPointer(json_accessories, json_accessories->child));
+    }
+    
+    cJSON_Delete(json_loaded);
+    
+    // Images made from another config or by another version
+    uint8_t* other_image = malloc(size);
+    memcpy(other_image, image, size);
+    other_image[3] = CONFIG_IMAGE_VERSION + 1;
+    
+    json_loaded = NULL;
+    assert(config_image_load(image, size, CONFIG_NUMBER + 1, json_hash, &json_loaded) == CONFIG_IMAGE_ERR_STALE && !json_loaded);
+    assert(load(image, size, json_hash + 1) == CONFIG_IMAGE_ERR_STALE);
+    assert(load(other_image, size, json_hash) == CONFIG_IMAGE_ERR_STALE);
+    
+    // Damaged images
+    memcpy(other_image, image, size);
+    other_image[size / 2] ^= 0x10;
+    assert(load(other_image, size, json_hash) == CONFIG_IMAGE_ERR_CORRUPT);
+    assert(load(image, size - 1, json_hash) == CONFIG_IMAGE_ERR_CORRUPT);
+    assert(load(image, CONFIG_IMAGE_HEADER_SIZE - 1, json_hash) == CONFIG_IMAGE_ERR_CORRUPT);
+    assert(load(NULL, 0, json_hash) == CONFIG_IMAGE_ERR_CORRUPT);
+    
+    free(other_image);
+    
+    // Every Byte of body damaged, with a valid hash, must be loaded or refused without reading out of image
+    uint32_t refused = 0, loaded = 0;
+    const uint8_t masks[] = { 0x01, 0x08, 0x80, 0xFF };
+    for (size_t pos = CONFIG_IMAGE_HEADER_SIZE; pos < size; pos++) {
+        for (uint8_t i = 0; i < sizeof(masks); i++) {
+            if (load_damaged(image, size, json_hash, pos, masks[i]) == CONFIG_IMAGE_OK) {
+                loaded++;
+            } else {
+                refused++;
+            }
+        }
+    }
+    
+    printf("%s: damaged images, %u refused, %u loaded\n", path, refused, loaded);
+    
+    // Every allocation failure is reported without leaks
+    for (alloc_fail = 1; alloc_fail <= load_allocs; alloc_fail++) {
+        allocs = 0;
+        assert(load(image, size, json_hash) == CONFIG_IMAGE_ERR_NO_MEM);
+    }
+    
+    alloc_fail = 0;
+    
+    cJSON_Delete(json_parsed);
+    free(host_image);
+    free(image);
+    free(text);
+}
+
+// Arguments: images made by config_compile.py directory, and JSON configs. Invalid ones are named "invalid_*"
+int main(int argc, char** argv) {
+    assert(argc > 2);
+    
+    cJSON_Hooks hooks = {
+        .malloc_fn = host_malloc,
+        .free_fn = free,
+    };
+    cJSON_InitHooks(&hooks);
+    
+    for (int i = 2; i < argc; i++) {
+        if (strstr(argv[i], "/invalid_")) {
+            test_invalid(argv[i]);
+        } else {
+            test_config(argv[i], argv[1]);
+        }
+    }
+    
+    printf("config image: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Sections of devices/HAA/main.c are built with its real headers.
+// Tests define main_config and functions called by those sections
+
+#ifndef __HOST_HAA_MAIN_H__
+#define __HOST_HAA_MAIN_H__
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <netinet/in.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include <timers.h>
+#include <homekit/homekit.h>
+#include <ds18b20/ds18b20.h>
+#include <onewire/onewire.h>
+
+#include "../devices/HAA/header.h"
+#include "../devices/HAA/types.h"
+
+extern main_config_t main_config;
+
+#endif  // __HOST_HAA_MAIN_H__
@@ -0,0 +1,294 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// /accessories cache of external_libs/homekit/src/server.c: replay of cached skeleton, with its tokens and holes,
+// is compared with a fresh write_accessories_json() of same tree. Both must be byte identical, also after values and
+// event subscriptions change, and with names and string values that have quotes, backslashes and control bytes
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "../external_libs/homekit/src/json.c"
+#include "../external_libs/homekit/src/tlv.c"
+#include "../external_libs/homekit/src/base64.c"
+#include "../external_libs/homekit/src/accessories.c"
+
+#define HOMEKIT_ACCESSORIES_CACHE_MAX_SIZE  (65535)
+#define HOMEKIT_NETWORK_MIN_FREEHEAP        (14336)
+#define HOMEKIT_INFO(message, ...)          INFO(message, ##__VA_ARGS__)
+#define HOMEKIT_ERROR(message, ...)         ERROR(message, ##__VA_ARGS__)
+#define CLIENT_ERROR(client, message, ...)  ERROR("[%d] " message, client->socket, ##__VA_ARGS__)
+
+#define ACCESSORIES                         (30)
+#define SERVICES                            (3)     // Per accessory
+#define CHARACTERISTICS                     (5)     // Per service
+#define JSON_BUFFER_SIZE                    (512)   // Small, so tokens and holes are split between flushes
+#define CAPTURE_SIZE                        (256 * 1024)
+
+struct _client_context_t {
+    int socket;
+    homekit_characteristic_bitmap_t* subscriptions;
+};
+typedef struct _client_context_t client_context_t;
+
+typedef struct {
+    homekit_accessory_t** accessories;
+} server_config_t;
+
+typedef struct {
+    server_config_t* config;
+    
+    byte* accessories_cache;
+    uint16_t accessories_cache_size;
+    bool accessories_cache_disabled: 1;
+    
+    json_stream json;
+    
+    byte data[JSON_BUFFER_SIZE];
+} homekit_server_t;
+
+static homekit_server_t* homekit_server = NULL;
+
+uint32_t xPortGetFreeHeapSize() {
+    return 80000;
+}
+
+#include "server_characteristic_json.inc"
+#include "server_accessories_json.inc"
+
+static homekit_accessory_t* accessories[ACCESSORIES + 1];
+
+static byte* capture = NULL;
+static size_t capture_size = 0;
+
+static int capture_flush(uint8_t* data, size_t size, void* context) {
+    assert(capture_size + size <= CAPTURE_SIZE);
+    memcpy(capture + capture_size, data, size);
+    capture_size += size;
+    return 0;
+}
+
+// Names with every byte below space, and with quotes and backslashes
+static char* name_new(const uint16_t n) {
+    char* name = malloc(16);
+    snprintf(name, 16, "N%c\"%c\\%u", 1 + (n % 31), 1 + ((n * 7) % 31), n);
+    return name;
+}
+
+static float* float_new(const float value) {
+    float* f = malloc(sizeof(float));
+    *f = value;
+    return f;
+}
+
+static homekit_characteristic_t* characteristic_new(const uint16_t n) {
+    homekit_characteristic_t* ch = calloc(1, sizeof(homekit_characteristic_t));
+    ch->type = (n % 2) ? "25" : "00000023-0000-1000-8000-0026BB765291";
+    ch->permissions = HOMEKIT_PERMISSIONS_PAIRED_READ;
+    if (n % 3) {
+        ch->permissions |= HOMEKIT_PERMISSIONS_NOTIFY;
+    }
+    
+    switch (n % 6) {
+        case 0:
+            ch->format = HOMETKIT_FORMAT_BOOL;
+            ch->permissions |= HOMEKIT_PERMISSIONS_PAIRED_WRITE;
+            ch->value.bool_value = n % 4;
+            break;
+        
+        case 1:
+            ch->format = HOMETKIT_FORMAT_UINT8;
+            ch->valid_values.count = 2;
+            ch->valid_values.values = malloc(2);
+            ch->valid_values.values[0] = 0;
+            ch->valid_values.values[1] = 3;
+            ch->value.int_value = 3;
+            break;
+        
+        case 2:
+            ch->format = HOMETKIT_FORMAT_FLOAT;
+            ch->unit = HOMETKIT_UNIT_CELSIUS;
+            ch->min_value = float_new(-40);
+            ch->max_value = float_new(100);
+            ch->min_step = float_new(0.1);
+            ch->value.float_value = n / 10.f;
+            break;
+        
+        case 3:
+            ch->format = HOMETKIT_FORMAT_STRING;
+            ch->description = name_new(n);
+            ch->value.string_value = name_new(n + 1);
+            break;
+        
+        case 4:
+            ch->format = HOMETKIT_FORMAT_UINT16;
+            ch->unit = HOMETKIT_UNIT_PERCENTAGE;
+            ch->permissions |= HOMEKIT_PERMISSIONS_PAIRED_WRITE;
+            ch->max_value = float_new(100);
+            ch->value.int_value = n % 100;
+            break;
+        
+        default:
+            ch->format = HOMETKIT_FORMAT_DATA;
+            ch->value.data_value = (uint8_t*) name_new(n);
+            ch->value.data_size = n % 8;
+            break;
+    }
+    
+    return ch;
+}
+
+static void tree_new() {
+    uint16_t n = 0;
+    for (uint16_t a = 0; a < ACCESSORIES; a++) {
+        homekit_accessory_t* accessory = calloc(1, sizeof(homekit_accessory_t));
+        accessory->services = calloc(SERVICES + 1, sizeof(homekit_service_t*));
+        
+        for (uint8_t s = 0; s < SERVICES; s++) {
+            homekit_service_t* service = calloc(1, sizeof(homekit_service_t));
+            service->type = (s % 2) ? "43" : "0000003E-0000-1000-8000-0026BB765291";
+            service->primary = (s == 1);
+            service->hidden = (a % 5 == 0);
+            service->characteristics = calloc(CHARACTERISTICS + 1, sizeof(homekit_characteristic_t*));
+            
+            for (uint8_t c = 0; c < CHARACTERISTICS; c++) {
+                service->characteristics[c] = characteristic_new(n++);
+            }
+            
+            accessory->services[s] = service;
+        }
+        
+        // Last service is linked to first one
+        accessory->services[0]->linked = calloc(2, sizeof(homekit_service_t*));
+        accessory->services[0]->linked[0] = accessory->services[SERVICES - 1];
+        
+        accessories[a] = accessory;
+    }
+    
+    homekit_accessories_init(accessories);
+}
+
+// Fresh and cached responses of client must be same bytes
+static void compare(client_context_t* client) {
+    json_stream json = { .buffer = homekit_server->data, .size = JSON_BUFFER_SIZE, .on_flush = capture_flush };
+    
+    capture_size = 0;
+    json_init(&json, client);
+    write_accessories_json(&json, client, characteristic_format_type
+                                        | characteristic_format_meta
+                                        | characteristic_format_perms
+                                        | characteristic_format_events);
+    json_flush(&json);
+    assert(!json.error);
+    
+    byte* fresh = malloc(capture_size);
+    const size_t fresh_size = capture_size;
+    memcpy(fresh, capture, capture_size);
+    
+    // Output is JSON text, without raw control bytes
+    for (size_t i = 0; i < fresh_size; i++) {
+        assert(fresh[i] >= ' ');
+    }
+    
+    capture_size = 0;
+    json_init(&json, client);
+    write_accessories_cache_json(&json, client);
+    json_flush(&json);
+    assert(!json.error);
+    
+    assert(capture_size == fresh_size && memcmp(capture, fresh, fresh_size) == 0);
+    
+    free(fresh);
+}
+
+int main() {
+    capture = malloc(CAPTURE_SIZE);
+    
+    tree_new();
+    
+    server_config_t config = { .accessories = accessories };
+    homekit_server = calloc(1, sizeof(homekit_server_t));
+    homekit_server->config = &config;
+    homekit_server->json.buffer = homekit_server->data;
+    homekit_server->json.size = JSON_BUFFER_SIZE;
+    
+    // Escaped strings
+    json_stream json = { .buffer = homekit_server->data, .size = JSON_BUFFER_SIZE, .on_flush = capture_flush };
+    capture_size = 0;
+    json_init(&json, NULL);
+    json_string(&json, "a\"b\\c\x01\x1F");
+    json_flush(&json);
+    const char* escaped = "\"a\\\"b\\\\c\\u0001\\u001f\"";
+    assert(capture_size == strlen(escaped) && memcmp(capture, escaped, capture_size) == 0);
+    
+    homekit_accessories_cache_init();
+    assert(homekit_server->accessories_cache && !homekit_server->accessories_cache_disabled);
+    
+    client_context_t client = { .socket = 1, .subscriptions = homekit_characteristic_bitmap_new() };
+    compare(&client);
+    
+    json_init(&json, &client);
+    capture_size = 0;
+    write_accessories_json(&json, &client, characteristic_format_type
+                                         | characteristic_format_meta
+                                         | characteristic_format_perms
+                                         | characteristic_format_events);
+    json_flush(&json);
+    printf("Accessories: %zu bytes, cache %u bytes\n", capture_size, homekit_server->accessories_cache_size);
+    
+    // Values and subscriptions change after cache is built
+    uint16_t n = 0;
+    for (uint16_t a = 0; a < ACCESSORIES; a++) {
+        for (uint8_t s = 0; s < SERVICES; s++) {
+            for (uint8_t c = 0; c < CHARACTERISTICS; c++) {
+                homekit_characteristic_t* ch = accessories[a]->services[s]->characteristics[c];
+                switch (ch->format) {
+                    case HOMETKIT_FORMAT_BOOL:
+                        ch->value.bool_value = !ch->value.bool_value;
+                        break;
+                    
+                    case HOMETKIT_FORMAT_FLOAT:
+                        ch->value.float_value = 1000;   // Over max value
+                        break;
+                    
+                    case HOMETKIT_FORMAT_STRING:
+                        free(ch->value.string_value);
+                        ch->value.string_value = name_new(n * 3);
+                        break;
+                    
+                    case HOMETKIT_FORMAT_DATA:
+                        ch->value.data_size = 0;
+                        break;
+                    
+                    default:
+                        ch->value.int_value = n;
+                        break;
+                }
+                
+                if (ch->permissions & HOMEKIT_PERMISSIONS_NOTIFY && n % 2) {
+                    homekit_characteristic_add_notify_subscription(ch, client.subscriptions);
+                }
+                
+                n++;
+            }
+        }
+    }
+    
+    compare(&client);
+    
+    // Client without subscriptions
+    client_context_t other_client = { .socket = 2, .subscriptions = NULL };
+    compare(&other_client);
+    
+    free(client.subscriptions);
+    
+    printf("homekit accessories cache: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,372 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Encrypted send path of external_libs/homekit/src/server.c: a large /accessories response is sent through
+// in place framing and through previous chunk sender, which sent chunk header and data by encrypt-and-copy.
+// Frames are decrypted back and compared, and bytes per second of both are reported
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "../external_libs/homekit/src/json.c"
+
+#define HOMEKIT_NETWORK_MIN_FREEHEAP        (14336)
+#define CLIENT_ERROR(client, message, ...)  ERROR("[%d] " message, client->socket, ##__VA_ARGS__)
+
+#define ACCESSORIES                         (40)
+#define SERVICES                            (4)     // Per accessory
+#define CHARACTERISTICS                     (6)     // Per service
+#define CAPTURE_SIZE                        (256 * 1024)
+#define FRAMES_MAX                          (2048)
+#define ROUNDS                              (100)
+
+#include "server_sizes.inc"
+
+struct _client_context_t {
+    int socket;
+    bool encrypted;
+    byte read_key[32];
+    byte write_key[32];
+    int count_reads;
+    int count_writes;
+};
+typedef struct _client_context_t client_context_t;
+
+typedef struct {
+    json_stream json;
+    byte data[BUFFER_DATA_SIZE + 18];
+    byte encrypted[ENCRYPTED_DATA_SIZE + 18];
+} homekit_server_t;
+
+static homekit_server_t* homekit_server = NULL;
+
+// Socket writes are captured, or only counted for benchmark
+static byte* capture = NULL;
+static size_t capture_size = 0;
+static size_t written = 0;
+
+static int host_write(int socket, const void* data, size_t size) {
+    if (capture) {
+        assert(capture_size + size <= CAPTURE_SIZE);
+        memcpy(capture + capture_size, data, size);
+        capture_size += size;
+    }
+    written += size;
+    return size;
+}
+
+void vTaskDelay(const TickType_t ticks) { }
+
+uint32_t xPortGetFreeHeapSize() {
+    return 40000;
+}
+
+static int chacha20poly1305(const bool encrypt, const byte* key, const byte* nonce, const byte* aad, size_t aad_size,
+                            const byte* message, size_t message_size, byte* output, byte* tag) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int len;
+    int r = EVP_CipherInit_ex(ctx, EVP_chacha20_poly1305(), NULL, key, nonce, encrypt);
+    if (!encrypt) {
+        r = r && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, tag);
+    }
+    r = r && EVP_CipherUpdate(ctx, NULL, &len, aad, aad_size);
+    r = r && EVP_CipherUpdate(ctx, output, &len, message, message_size);
+    r = r && EVP_CipherFinal_ex(ctx, output + len, &len);
+    if (encrypt) {
+        r = r && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, tag);
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return r ? 0 : -1;
+}
+
+int crypto_chacha20poly1305_encrypt(const byte* key, const byte* nonce, const byte* aad, size_t aad_size,
+                                    const byte* message, size_t message_size, byte* encrypted, size_t* encrypted_size) {
+    if (*encrypted_size < message_size + 16) {
+        return -1;
+    }
+    *encrypted_size = message_size + 16;
+    return chacha20poly1305(true, key, nonce, aad, aad_size, message, message_size, encrypted, encrypted + message_size);
+}
+
+int crypto_chacha20poly1305_decrypt(const byte* key, const byte* nonce, const byte* aad, size_t aad_size,
+                                    const byte* message, size_t message_size, byte* decrypted, size_t* decrypted_size) {
+    if (message_size < 16 || *decrypted_size < message_size - 16) {
+        return -1;
+    }
+    *decrypted_size = message_size - 16;
+    return chacha20poly1305(false, key, nonce, aad, aad_size, message, message_size - 16, decrypted, (byte*) message + message_size - 16);
+}
+
+#define write host_write
+#include "server_frames.inc"
+#undef write
+
+// Previous client_send_chunk(): chunk header and data were sent by client_send(), each one copied
+// into encrypted buffer and split in frames of ENCRYPTED_DATA_SIZE
+static int previous_send_chunk(byte* data, size_t size, void* arg) {
+    client_context_t* context = arg;
+    
+    byte header[9];
+    header[0] = 0;
+    int header_size = snprintf((char*) header, sizeof(header), "%x\r\n", (unsigned int) size);
+    
+    int r = client_send(context, header, header_size);
+    
+    if (r == 0) {
+        if (size > 0) {
+            data[size] = '\r';
+            data[size + 1] = '\n';
+            r = client_send(context, data, size + 2);
+        } else {
+            byte end[2] = { '\r', '\n' };
+            r = client_send(context, end, sizeof(end));
+        }
+    }
+    
+    return r;
+}
+
+typedef struct _frames {
+    uint16_t count;
+    uint16_t size[FRAMES_MAX];
+    byte* plain[FRAMES_MAX];
+} frames_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Response like /accessories, with same buffer than server_new() or than previous one
+static void send_accessories(client_context_t* context, const bool in_place, const bool previous_buffer) {
+    json_stream* json = &homekit_server->json;
+    json_init(json, context);
+    if (previous_buffer) {
+        json->size = BUFFER_DATA_SIZE + (18 - 2);
+        json->buffer = homekit_server->data;
+    } else {
+        json->size = JSON_BUFFER_SIZE;
+        json->buffer = homekit_server->data + JSON_BUFFER_OFFSET;
+    }
+    json->on_flush = in_place ? client_send_chunk : previous_send_chunk;
+    
+    json_object_start(json);
+    json_string(json, "accessories");
+    json_array_start(json);
+    
+    for (uint16_t a = 0; a < ACCESSORIES; a++) {
+        json_object_start(json);
+        json_string(json, "aid"); json_integer(json, a + 1);
+        json_string(json, "services"); json_array_start(json);
+        
+        uint16_t iid = 1;
+        for (uint8_t s = 0; s < SERVICES; s++) {
+            json_object_start(json);
+            json_string(json, "iid"); json_integer(json, iid++);
+            json_string(json, "type"); json_string(json, "43");
+            json_string(json, "characteristics"); json_array_start(json);
+            
+            for (uint8_t c = 0; c < CHARACTERISTICS; c++) {
+                json_object_start(json);
+                json_string(json, "iid"); json_integer(json, iid++);
+                json_string(json, "type"); json_string(json, "CE");
+                json_string(json, "perms"); json_array_start(json);
+                json_string(json, "pr"); json_string(json, "pw"); json_string(json, "ev");
+                json_array_end(json);
+                json_string(json, "format"); json_string(json, "int");
+                json_string(json, "value"); json_integer(json, a * c);
+                json_string(json, "minValue"); json_integer(json, 0);
+                json_string(json, "maxValue"); json_integer(json, 100);
+                json_object_end(json);
+            }
+            
+            json_array_end(json);
+            json_object_end(json);
+        }
+        
+        json_array_end(json);
+        json_object_end(json);
+    }
+    
+    json_array_end(json);
+    json_object_end(json);
+    
+    json_flush(json);
+    
+    if (in_place) {
+        client_send_chunk(NULL, 0, context);
+    } else {
+        previous_send_chunk(NULL, 0, context);
+    }
+}
+
+// Each captured frame is decrypted by a controller context, with same key and nonce sequence
+static void frames_decrypt(const byte* key, frames_t* frames) {
+    client_context_t controller = { .encrypted = true };
+    memcpy(controller.write_key, key, sizeof(controller.write_key));
+    
+    frames->count = 0;
+    size_t offset = 0;
+    while (offset < capture_size) {
+        const size_t size = capture[offset] + capture[offset + 1] * 256;
+        assert(offset + size + 18 <= capture_size && frames->count < FRAMES_MAX);
+        
+        size_t plain_size = size;
+        byte* plain = malloc(size + 1);
+        assert(client_decrypt(&controller, capture + offset, size + 18, plain, &plain_size) == size + 18);
+        assert(plain_size == size);
+        
+        frames->size[frames->count] = size;
+        frames->plain[frames->count] = plain;
+        frames->count++;
+        offset += size + 18;
+    }
+}
+
+static void frames_free(frames_t* frames) {
+    for (uint16_t i = 0; i < frames->count; i++) {
+        free(frames->plain[i]);
+    }
+}
+
+static void capture_frames(client_context_t* context, const bool in_place, const bool previous_buffer, frames_t* frames) {
+    capture_size = 0;
+    context->count_reads = 0;
+    send_accessories(context, in_place, previous_buffer);
+    frames_decrypt(context->read_key, frames);
+}
+
+// HTTP chunked body, without chunk headers
+static size_t body_dechunk(const frames_t* frames, byte* body) {
+    byte* stream = malloc(CAPTURE_SIZE);
+    size_t stream_size = 0;
+    for (uint16_t i = 0; i < frames->count; i++) {
+        memcpy(stream + stream_size, frames->plain[i], frames->size[i]);
+        stream_size += frames->size[i];
+    }
+    
+    size_t offset = 0;
+    size_t body_size = 0;
+    for (;;) {
+        char* end;
+        const size_t size = strtoul((char*) stream + offset, &end, 16);
+        assert(end[0] == '\r' && end[1] == '\n');
+        offset = (byte*) end + 2 - stream;
+        assert(stream[offset + size] == '\r' && stream[offset + size + 1] == '\n');
+        memcpy(body + body_size, stream + offset, size);
+        body_size += size;
+        offset += size + 2;
+        
+        if (size == 0) {
+            break;
+        }
+    }
+    
+    assert(offset == stream_size);
+    free(stream);
+    
+    return body_size;
+}
+
+static double benchmark(client_context_t* context, const bool in_place, const bool previous_buffer, size_t* body_size) {
+    written = 0;
+    const uint64_t start = now_ns();
+    for (uint16_t r = 0; r < ROUNDS; r++) {
+        send_accessories(context, in_place, previous_buffer);
+    }
+    const uint64_t time_ns = now_ns() - start;
+    
+    printf("%-14s %7zu Bytes sent per response, %6.2f MB/s of JSON\n",
+           in_place ? "In place:" : "Encrypt-copy:", written / ROUNDS, (double) *body_size * ROUNDS * 1000 / time_ns);
+    
+    return (double) time_ns;
+}
+
+int main() {
+    homekit_server = calloc(1, sizeof(homekit_server_t));
+    capture = malloc(CAPTURE_SIZE);
+    
+    client_context_t context = { .socket = 5, .encrypted = true };
+    for (uint8_t i = 0; i < sizeof(context.read_key); i++) {
+        context.read_key[i] = i * 7 + 1;
+    }
+    
+    // JSON buffer leaves room for chunk around it, inside one frame payload
+    assert(JSON_BUFFER_OFFSET - FRAME_HEADER_SIZE + JSON_BUFFER_SIZE + 2 == FRAME_PAYLOAD_SIZE);
+    assert(JSON_BUFFER_OFFSET + JSON_BUFFER_SIZE + 2 + FRAME_TAG_SIZE <= sizeof(homekit_server->data));
+    
+    frames_t in_place, previous;
+    capture_frames(&context, true, false, &in_place);
+    capture_frames(&context, false, false, &previous);
+    
+    // Each in place frame is one whole HTTP chunk, up to FRAME_PAYLOAD_SIZE, and it is the same as
+    // previous chunk header frame followed by its data frames
+    uint16_t p = 0;
+    uint16_t size_min = FRAME_PAYLOAD_SIZE;
+    for (uint16_t i = 0; i < in_place.count; i++) {
+        assert(in_place.size[i] <= FRAME_PAYLOAD_SIZE);
+        if (i < in_place.count - 2 && in_place.size[i] < size_min) {
+            size_min = in_place.size[i];
+        }
+        
+        size_t size = 0;
+        while (size < in_place.size[i]) {
+            assert(p < previous.count && previous.size[p] <= ENCRYPTED_DATA_SIZE);
+            assert(size + previous.size[p] <= in_place.size[i]);
+            assert(memcmp(in_place.plain[i] + size, previous.plain[p], previous.size[p]) == 0);
+            size += previous.size[p];
+            p++;
+        }
+    }
+    assert(p == previous.count);
+    
+    // JSON is flushed when next value does not fit, so chunks are almost full
+    assert(size_min >= FRAME_PAYLOAD_SIZE - 32);
+    
+    // Last frame is terminating chunk
+    assert(in_place.size[in_place.count - 1] == 5 && memcmp(in_place.plain[in_place.count - 1], "0\r\n\r\n", 5) == 0);
+    
+    // Same body than previous sender with previous JSON buffer
+    frames_t previous_buffer;
+    capture_frames(&context, false, true, &previous_buffer);
+    
+    byte* body = malloc(CAPTURE_SIZE);
+    byte* body_previous = malloc(CAPTURE_SIZE);
+    size_t body_size = body_dechunk(&in_place, body);
+    assert(body_size == body_dechunk(&previous_buffer, body_previous));
+    assert(memcmp(body, body_previous, body_size) == 0);
+    
+    printf("/accessories: %zu Bytes JSON, %u frames in place, %u frames by encrypt-and-copy\n",
+           body_size, in_place.count, previous_buffer.count);
+    
+    frames_free(&in_place);
+    frames_free(&previous);
+    frames_free(&previous_buffer);
+    free(body);
+    free(body_previous);
+    free(capture);
+    capture = NULL;
+    
+    const double time_previous = benchmark(&context, false, true, &body_size);
+    const double time_in_place = benchmark(&context, true, false, &body_size);
+    printf("Speedup x%.2f\n", time_previous / time_in_place);
+    
+    free(homekit_server);
+    
+    printf("homekit frames: OK\n");
+    
+    return 0;
+}
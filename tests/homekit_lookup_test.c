@@ -0,0 +1,115 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Characteristics by aid and iid: sorted index lookup is compared with accessories tree walk on a synthetic
+// tree of 100 accessories, with unsorted and not contiguous aids. Both must return same characteristic
+
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+
+#include "../external_libs/homekit/src/tlv.c"
+#include "../external_libs/homekit/src/accessories.c"
+
+#define ACCESSORIES                         (100)
+#define SERVICES                            (3)     // Per accessory
+#define CHARACTERISTICS                     (6)     // Per service
+#define ROUNDS                              (200)
+
+static homekit_accessory_t* accessories[ACCESSORIES + 1];
+static homekit_accessory_t* accessories_copy[ACCESSORIES + 1];
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void tree_new() {
+    for (uint16_t a = 0; a < ACCESSORIES; a++) {
+        homekit_accessory_t* accessory = calloc(1, sizeof(homekit_accessory_t));
+        // Unsorted aids, with gaps
+        accessory->id = 1 + ((a * 37) % ACCESSORIES) * 3;
+        accessory->services = calloc(SERVICES + 1, sizeof(homekit_service_t*));
+        
+        for (uint8_t s = 0; s < SERVICES; s++) {
+            homekit_service_t* service = calloc(1, sizeof(homekit_service_t));
+            service->characteristics = calloc(CHARACTERISTICS + 1, sizeof(homekit_characteristic_t*));
+            
+            // Last service of some accessories has less characteristics
+            const uint8_t characteristics_n = (s == SERVICES - 1 && (a % 4) == 0) ? 1 : CHARACTERISTICS;
+            for (uint8_t c = 0; c < characteristics_n; c++) {
+                service->characteristics[c] = calloc(1, sizeof(homekit_characteristic_t));
+            }
+            
+            accessory->services[s] = service;
+        }
+        
+        accessories[a] = accessory;
+    }
+    
+    homekit_accessories_init(accessories);
+    
+    // Other array with same accessories is not indexed, so its lookups walk tree
+    memcpy(accessories_copy, accessories, sizeof(accessories));
+}
+
+int main() {
+    tree_new();
+    
+    assert(characteristic_index && characteristic_index_accessories == accessories);
+    
+    const int aid_max = 1 + (ACCESSORIES - 1) * 3 + 1;
+    const int iid_max = SERVICES * (CHARACTERISTICS + 1) + 2;
+    
+    // Every aid and iid, including misses between aids and past last iid
+    uint32_t found = 0;
+    for (int aid = 0; aid <= aid_max; aid++) {
+        for (int iid = 0; iid <= iid_max; iid++) {
+            homekit_characteristic_t* ch = homekit_characteristic_by_aid_and_iid(accessories, aid, iid);
+            assert(ch == homekit_characteristic_by_aid_and_iid(accessories_copy, aid, iid));
+            
+            if (ch) {
+                assert(ch->service->accessory->id == aid && ch->id == iid);
+                assert(characteristic_index[ch->index] == ch);
+                found++;
+            }
+        }
+    }
+    
+    assert(found == characteristic_index_count);
+    assert(!homekit_characteristic_by_aid_and_iid(accessories, -1, 1));
+    assert(!homekit_characteristic_by_aid_and_iid(accessories, 1, -1));
+    
+    // Lookups of all characteristics, and same number of misses
+    uint64_t time_ns[2];
+    for (uint8_t indexed = 0; indexed < 2; indexed++) {
+        homekit_accessory_t** tree = indexed ? accessories : accessories_copy;
+        volatile uintptr_t result = 0;
+        
+        const uint64_t start = now_ns();
+        for (uint16_t r = 0; r < ROUNDS; r++) {
+            for (uint16_t i = 0; i < characteristic_index_count; i++) {
+                const homekit_characteristic_t* ch = characteristic_index[i];
+                result += (uintptr_t) homekit_characteristic_by_aid_and_iid(tree, ch->service->accessory->id, ch->id);
+                result += (uintptr_t) homekit_characteristic_by_aid_and_iid(tree, ch->service->accessory->id + 1, ch->id);
+            }
+        }
+        time_ns[indexed] = now_ns() - start;
+    }
+    
+    const uint32_t lookups = ROUNDS * characteristic_index_count * 2;
+    printf("%u accessories, %u characteristics: tree walk %.1f ns, index %.1f ns per lookup (x%.1f)\n",
+           ACCESSORIES, characteristic_index_count,
+           (double) time_ns[0] / lookups, (double) time_ns[1] / lookups, (double) time_ns[0] / time_ns[1]);
+    
+    assert(time_ns[1] < time_ns[0]);
+    
+    printf("homekit lookup: OK\n");
+    
+    return 0;
+}
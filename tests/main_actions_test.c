@@ -0,0 +1,436 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Compiled actions: same action sequences are replayed over action lists and over compiled tables,
+// and handlers called must be the same and in same order. One task keeps running actions while
+// compile_all_actions() runs in other one, so it reads lists before, while waiting and after compiling
+
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+
+#include "haa_main.h"
+
+// Handlers log is checked instead of INFO output
+#undef INFO
+#define INFO(message, ...)
+
+#define LOG_SIZE                            (64 * 1024)
+#define TARGET_ACCESSORY                    (5)
+#define MISSING_ACCESSORY                   (9)
+#define ACTIONS_MAX                         (16)        // Action numbers used by replays, beside 254 and 255
+#define REPLAY_ACTIONS                      (400)
+#define READER_COMPILE_ACTION               (150)       // Replay step inside which actions are compiled
+
+main_config_t main_config;
+
+static char* log_buffer = NULL;
+static size_t log_size = 0;
+static int16_t mcp_batch_depth = 0;
+
+static pthread_mutex_t critical = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t compile_thread;
+static __thread bool is_compile_task = false;
+static pthread_t reader_thread;
+static sem_t reader_inside;
+static sem_t compile_waiting;
+static sem_t reader_waiting;
+static sem_t compile_started;
+static uint16_t compile_waits = 0;
+static uint16_t reader_waits = 0;
+static bool is_reader_step = false;
+
+static ch_group_t* target = NULL;
+static ch_group_t* list_ch_group = NULL;
+static ch_group_t* compiled_ch_group = NULL;
+static ch_group_t* running_ch_group = NULL;
+
+static void log_add(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_size += vsnprintf(log_buffer + log_size, LOG_SIZE - log_size, format, args);
+    va_end(args);
+    assert(log_size < LOG_SIZE - 1);
+}
+
+void host_enter_critical() {
+    pthread_mutex_lock(&critical);
+}
+
+void host_exit_critical() {
+    pthread_mutex_unlock(&critical);
+}
+
+// compile_all_actions() waits here for readers to end, and readers wait here while it compiles
+void vTaskDelay(const TickType_t ticks) {
+    if (is_compile_task) {
+        if (compile_waits++ == 0) {
+            sem_post(&compile_waiting);
+        }
+    } else {
+        if (reader_waits++ == 0) {
+            sem_post(&reader_waiting);
+        }
+    }
+    
+    usleep(100);
+}
+
+// Earlier in main.c
+void do_actions(ch_group_t* ch_group, uint8_t action);
+action_entry_t* action_entry_find(ch_group_t* ch_group, const uint8_t action);
+
+void autoswitch_timer(TimerHandle_t xTimer) { }
+
+ch_group_t* ch_group_find_by_acc(uint16_t accessory) {
+    ch_group_t* ch_group = main_config.ch_groups;
+    while (ch_group && ch_group->accessory != accessory) {
+        ch_group = ch_group->next;
+    }
+    
+    return ch_group;
+}
+
+// Reader stops inside its list walk, until compile_all_actions() is waiting for it
+void extended_gpio_write(const uint16_t extended_gpio, bool value) {
+    log_add("gpio %u %u\n", extended_gpio, value);
+    
+    if (is_reader_step) {
+        is_reader_step = false;
+        sem_post(&reader_inside);
+        sem_wait(&compile_waiting);
+    }
+}
+
+TimerHandle_t esp_timer_create(const uint32_t period_ms, const bool auto_reload, void* pvTimerID, TimerCallbackFunction_t pxCallbackFunction) {
+    log_add("timer %u %u\n", period_ms, (uint32_t) (uintptr_t) pvTimerID);
+    return (TimerHandle_t) 1;
+}
+
+int esp_timer_start(TimerHandle_t xTimer) {
+    return pdPASS;
+}
+
+int esp_timer_change_period(TimerHandle_t xTimer, const uint32_t new_period_ms) {
+    return pdPASS;
+}
+
+void mcp_batch_begin() {
+    mcp_batch_depth++;
+}
+
+void mcp_batch_end() {
+    mcp_batch_depth--;
+}
+
+void button_event(const uint8_t gpio, void* args, const uint8_t event_type) {
+    log_add("button %u %u\n", ((ch_group_t*) args)->accessory, event_type);
+}
+
+// Nodes run by action workers, which walk lists like uart_action_task(). Over action lists,
+// a job is queued even when no node has its action
+void action_task_enqueue(ch_group_t* ch_group, const uint8_t action, const uint8_t type) {
+    action_entry_t* action_entry = action_entry_find(ch_group, action);
+    
+    if (type == ACTION_TASK_TYPE_UART) {
+        for (action_uart_t* action_uart = ACTION_LIST(ch_group, action_entry, action_uart); action_uart; action_uart = action_uart->next) {
+            if (action_uart->action == action) {
+                log_add("uart %u\n", action_uart->len);
+            }
+        }
+    } else if (type == ACTION_TASK_TYPE_NETWORK) {
+        for (action_network_t* action_network = ACTION_LIST(ch_group, action_entry, action_network); action_network; action_network = action_network->next) {
+            if (action_network->action == action) {
+                log_add("network %u\n", action_network->port_n);
+            }
+        }
+    } else {
+        for (action_ir_tx_t* action_ir_tx = ACTION_LIST(ch_group, action_entry, action_ir_tx); action_ir_tx; action_ir_tx = action_ir_tx->next) {
+            if (action_ir_tx->action == action) {
+                log_add("ir %u\n", action_ir_tx->freq);
+            }
+        }
+    }
+}
+
+void setup_mode_call(const uint16_t gpio, void* args, const uint8_t param) {
+    log_add("setup\n");
+}
+
+void rboot_set_temp_rom(const uint8_t rom) {
+    log_add("rom %u\n", rom);
+}
+
+void reboot_haa() {
+    log_add("reboot\n");
+}
+
+void sdk_wifi_station_disconnect() {
+    log_add("wifi disconnect\n");
+}
+
+void wifi_config_reset() {
+    log_add("wifi reset\n");
+}
+
+// Compiled action nodes are new ones, so cached IR codes are evicted first.
+// Reader tries to start walking while compiling, and it must wait
+void ir_code_cache_evict() {
+    assert(main_config.action_lists_compiling && main_config.action_lists_readers == 0);
+    main_config.ir_code_cache = NULL;
+    sem_post(&compile_started);
+    sem_wait(&reader_waiting);
+}
+
+// Handlers only reached by other accessory types
+static void setter_log(const char* name, homekit_characteristic_t* ch, const homekit_value_t value) {
+    log_add("%s %i\n", name, value.int_value);
+}
+
+void binary_sensor(const uint16_t gpio, void* args, uint8_t type) { }
+void garage_door_obstruction(const uint16_t gpio, void* args, const uint8_t type) { }
+void garage_door_stop(const uint16_t gpio, void* args, const uint8_t type) { }
+void window_cover_obstruction(const uint16_t gpio, void* args, const uint8_t type) { }
+void pm_custom_consumption_reset(ch_group_t* ch_group) { }
+void save_historical_data(homekit_characteristic_t* ch_hist) { }
+void homekit_characteristic_notify_safe(homekit_characteristic_t* ch) { }
+void hkc_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("setter", ch, value); }
+void hkc_on_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("on", ch, value); }
+void hkc_on_status_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("on status", ch, value); }
+void hkc_lock_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("lock", ch, value); }
+void hkc_lock_status_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("lock status", ch, value); }
+void hkc_valve_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("valve", ch, value); }
+void update_th(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("th", ch, value); }
+void update_humidif(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("humidif", ch, value); }
+void hkc_garage_door_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("garage", ch, value); }
+void hkc_rgbw_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("rgbw", ch, value); }
+void autodimmer_call(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("autodimmer", ch, value); }
+void hkc_window_cover_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("cover", ch, value); }
+void hkc_fan_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("fan", ch, value); }
+void hkc_fan_speed_setter(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("fan speed", ch, value); }
+void hkc_sec_system(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("sec", ch, value); }
+void hkc_sec_system_status(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("sec status", ch, value); }
+void hkc_tv_active(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv active", ch, value); }
+void hkc_tv_status_active(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv status", ch, value); }
+void hkc_tv_active_identifier(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv input", ch, value); }
+void hkc_tv_key(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv key", ch, value); }
+void hkc_tv_mute(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv mute", ch, value); }
+void hkc_tv_volume(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv volume", ch, value); }
+void hkc_tv_power_mode(homekit_characteristic_t* ch, const homekit_value_t value) { setter_log("tv power", ch, value); }
+
+lightbulb_group_t* lightbulb_group_find(homekit_characteristic_t* ch) {
+    return NULL;
+}
+
+time_t raven_ntp_get_time_t() {
+    return 0;
+}
+
+#include "main_actions.inc"
+
+// Nodes are prepended, as configuration parser does
+#define ACTION_ADD(ch_group, list, type, ...) \
+    do { \
+        type* node = calloc(1, sizeof(type)); \
+        *node = (type) { __VA_ARGS__, .next = (ch_group)->list }; \
+        (ch_group)->list = node; \
+    } while (0)
+
+static ch_group_t* ch_group_new(const uint16_t accessory) {
+    ch_group_t* ch_group = calloc(1, sizeof(ch_group_t));
+    ch_group->accessory = accessory;
+    ch_group->main_enabled = true;
+    ch_group->child_enabled = true;
+    
+    // Several nodes per action and list, interleaved with other actions
+    for (uint8_t action = 0; action < ACTIONS_MAX; action++) {
+        for (uint8_t i = 0; i < action % 4; i++) {
+            ACTION_ADD(ch_group, action_binary_output, action_binary_output_t,
+                       .action = action, .gpio = action * 4 + i, .value = i & 1, .inching = (action % 5 == 0) ? action + i : 0);
+        }
+        
+        if (action % 3 == 1) {
+            ACTION_ADD(ch_group, action_acc_manager, action_acc_manager_t, .action = action, .accessory = TARGET_ACCESSORY, .value = action);
+        }
+    }
+    
+    for (uint8_t action = 0; action < ACTIONS_MAX; action++) {
+        if (action % 3 == 1) {
+            ACTION_ADD(ch_group, action_acc_manager, action_acc_manager_t, .action = action, .accessory = TARGET_ACCESSORY, .value = -10002);
+        }
+        
+        if (action % 6 == 2) {
+            ACTION_ADD(ch_group, action_binary_output, action_binary_output_t, .action = action, .gpio = 100 + action, .value = true);
+        }
+    }
+    
+    ACTION_ADD(ch_group, action_acc_manager, action_acc_manager_t, .action = 254, .accessory = MISSING_ACCESSORY, .value = 1);
+    ACTION_ADD(ch_group, action_acc_manager, action_acc_manager_t, .action = 3, .accessory = TARGET_ACCESSORY, .value = -20002);
+    
+    ACTION_ADD(ch_group, action_system, action_system_t, .action = 6, .value = SYSTEM_ACTION_WIFI_RECONNECTION);
+    ACTION_ADD(ch_group, action_system, action_system_t, .action = 6, .value = SYSTEM_ACTION_OTA_UPDATE);
+    ACTION_ADD(ch_group, action_system, action_system_t, .action = 13, .value = SYSTEM_ACTION_SETUP_MODE);
+    ACTION_ADD(ch_group, action_system, action_system_t, .action = 255, .value = SYSTEM_ACTION_REBOOT);
+    
+    ACTION_ADD(ch_group, action_uart, action_uart_t, .action = 2, .len = 1);
+    ACTION_ADD(ch_group, action_uart, action_uart_t, .action = 2, .len = 2);
+    ACTION_ADD(ch_group, action_network, action_network_t, .action = 4, .port_n = 80);
+    ACTION_ADD(ch_group, action_network, action_network_t, .action = 9, .port_n = 81);
+    ACTION_ADD(ch_group, action_network, action_network_t, .action = 4, .port_n = 82);
+    ACTION_ADD(ch_group, action_ir_tx, action_ir_tx_t, .action = 9, .freq = 38);
+    ACTION_ADD(ch_group, action_ir_tx, action_ir_tx_t, .action = 11, .freq = 40);
+    
+    // Copies to actions with and without other nodes, to a copied action, and only first copy is taken
+    ACTION_ADD(ch_group, action_copy, action_copy_t, .action = 14, .new_action = 5);
+    ACTION_ADD(ch_group, action_copy, action_copy_t, .action = 15, .new_action = 200);
+    ACTION_ADD(ch_group, action_copy, action_copy_t, .action = 12, .new_action = 14);
+    ACTION_ADD(ch_group, action_copy, action_copy_t, .action = 10, .new_action = 9);
+    ACTION_ADD(ch_group, action_copy, action_copy_t, .action = 10, .new_action = 1);
+    
+    return ch_group;
+}
+
+static void target_reset() {
+    target->main_enabled = true;
+    target->child_enabled = true;
+    mcp_batch_depth = 0;
+}
+
+static void target_log() {
+    log_add("target %u %u\n", target->main_enabled, target->child_enabled);
+}
+
+static uint8_t replay_action(const uint16_t step) {
+    static const uint8_t actions[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 200, 254, 255, 1, 1, 10, 3 };
+    
+    if (step < sizeof(actions)) {
+        return actions[step];
+    }
+    
+    // Fixed pseudo-random sequence, with some actions out of used range
+    const uint8_t r = (step * 37 + 11) % (ACTIONS_MAX + 3);
+    return r < ACTIONS_MAX ? r : 255 - r;
+}
+
+// Handlers log of a replay over action lists, and of same replay once compiled
+static char* replay(ch_group_t* ch_group) {
+    log_size = 0;
+    log_buffer[0] = 0;
+    target_reset();
+    
+    for (uint16_t step = 0; step < REPLAY_ACTIONS; step++) {
+        log_add("- %u\n", replay_action(step));
+        do_actions(ch_group, replay_action(step));
+        target_log();
+        assert(mcp_batch_depth == 0);
+    }
+    
+    return strdup(log_buffer);
+}
+
+static void* reader_task(void* args) {
+    ch_group_t* ch_group = args;
+    
+    for (uint16_t step = 0; step < REPLAY_ACTIONS; step++) {
+        // A binary output of this step waits for compile_all_actions()
+        is_reader_step = (step == READER_COMPILE_ACTION);
+        log_add("- %u\n", replay_action(step));
+        do_actions(ch_group, replay_action(step));
+        target_log();
+        
+        // Next step starts while compiling
+        if (step == READER_COMPILE_ACTION) {
+            sem_wait(&compile_started);
+        }
+    }
+    
+    return NULL;
+}
+
+static void* compile_task(void* args) {
+    is_compile_task = true;
+    sem_wait(&reader_inside);
+    compile_all_actions();
+    return NULL;
+}
+
+int main() {
+    log_buffer = malloc(LOG_SIZE);
+    main_config.wifi_status = WIFI_STATUS_CONNECTED;
+    
+    // Target of accessory manager actions, without actions
+    target = calloc(1, sizeof(ch_group_t));
+    target->accessory = TARGET_ACCESSORY;
+    target->acc_type = ACC_TYPE_BUTTON;
+    
+    list_ch_group = ch_group_new(1);
+    compiled_ch_group = ch_group_new(1);
+    
+    // Only compiled ch_group and target are in ch_groups list, so compile_all_actions() compiles them
+    compiled_ch_group->next = target;
+    main_config.ch_groups = compiled_ch_group;
+    
+    compile_all_actions();
+    assert(compiled_ch_group->action_compiled && !list_ch_group->action_compiled);
+    assert(!compiled_ch_group->action_binary_output && !compiled_ch_group->action_copy && !compiled_ch_group->action_uart);
+    assert(main_config.action_lists_readers == 0 && !main_config.action_lists_compiling);
+    
+    // Entries are sorted, and they only exist for actions with nodes
+    for (uint16_t i = 1; i < compiled_ch_group->action_entries; i++) {
+        assert(compiled_ch_group->action_entry[i - 1].action < compiled_ch_group->action_entry[i].action);
+    }
+    assert(action_entry_find(compiled_ch_group, 255) && !action_entry_find(compiled_ch_group, 16) && !action_entry_find(compiled_ch_group, 200));
+    assert(target->action_compiled && target->action_entries == 0);
+    
+    char* list_log = replay(list_ch_group);
+    char* compiled_log = replay(compiled_ch_group);
+    assert(strcmp(list_log, compiled_log) == 0);
+    
+    uint32_t handlers = 0;
+    for (const char* line = list_log; *line; line = strchr(line, '\n') + 1) {
+        if (strncmp(line, "- ", 2) && strncmp(line, "target ", 7)) {
+            handlers++;
+        }
+    }
+    
+    printf("%u actions replayed, %u handler calls, same with compiled actions\n", REPLAY_ACTIONS, handlers);
+    
+    // Actions keep running while they are compiled
+    running_ch_group = ch_group_new(1);
+    running_ch_group->next = target;
+    main_config.ch_groups = running_ch_group;
+    main_config.ir_code_cache = running_ch_group->action_ir_tx;
+    
+    sem_init(&reader_inside, 0, 0);
+    sem_init(&compile_waiting, 0, 0);
+    sem_init(&reader_waiting, 0, 0);
+    sem_init(&compile_started, 0, 0);
+    
+    log_size = 0;
+    target_reset();
+    assert(pthread_create(&reader_thread, NULL, reader_task, running_ch_group) == 0);
+    assert(pthread_create(&compile_thread, NULL, compile_task, NULL) == 0);
+    assert(pthread_join(compile_thread, NULL) == 0);
+    assert(pthread_join(reader_thread, NULL) == 0);
+    
+    assert(running_ch_group->action_compiled && !main_config.ir_code_cache);
+    assert(main_config.action_lists_readers == 0 && !main_config.action_lists_compiling);
+    assert(compile_waits > 0 && reader_waits > 0);
+    assert(strcmp(list_log, log_buffer) == 0);
+    
+    printf("Compiled while running: compile waited %u times, reader waited %u times\n", compile_waits, reader_waits);
+    
+    free(list_log);
+    free(compiled_log);
+    free(log_buffer);
+    
+    printf("main actions: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// DS18B20 shared buses: simulated 1-Wire bus with 8 sensors, served to 8 accessories
+
+#include "haa_main.h"
+
+static bool realloc_fails = false;
+
+static void* host_realloc(void* ptr, size_t size) {
+    if (realloc_fails) {
+        return NULL;
+    }
+    
+    return realloc(ptr, size);
+}
+
+#define realloc host_realloc
+#include "main_ds18b20.inc"
+#undef realloc
+
+#define SENSORS                             (8)
+#define GPIO                                (4)
+
+main_config_t main_config;
+
+static TickType_t ticks = 0;
+
+static ds18b20_addr_t rom[SENSORS];
+static int16_t real_temp[SENSORS], scratchpad_temp[SENSORS];
+static uint8_t scratchpad_config[SENSORS];
+static bool is_present[SENSORS];
+static uint8_t pending_cmd = 0;
+static TickType_t conversion_start = 0;
+static uint16_t scans = 0, conversions = 0, reads = 0;
+
+TickType_t xTaskGetTickCount() {
+    return ticks;
+}
+
+void vTaskDelay(const TickType_t delay) {
+    ticks += delay;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return (SemaphoreHandle_t) 1;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, const TickType_t wait) {
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    return pdTRUE;
+}
+
+int ds18b20_scan_devices(int pin, ds18b20_addr_t* addr_list, int addr_count) {
+    scans++;
+    
+    int found = 0;
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        if (is_present[i]) {
+            if (found < addr_count) {
+                addr_list[found] = rom[i];
+            }
+            found++;
+        }
+    }
+    
+    return found;
+}
+
+bool onewire_reset(int pin) {
+    return true;
+}
+
+bool onewire_skip_rom(int pin) {
+    return true;
+}
+
+bool onewire_write(int pin, uint8_t v) {
+    pending_cmd = v;
+    return true;
+}
+
+// Write Scratchpad after Skip ROM configures all sensors
+bool onewire_write_bytes(int pin, const uint8_t* buf, size_t count) {
+    assert(pending_cmd == DS18B20_CMD_WRITE_SCRATCHPAD && count == 3);
+    
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        if (is_present[i]) {
+            scratchpad_config[i] = buf[2];
+        }
+    }
+    
+    return true;
+}
+
+bool ds18b20_measure(int pin, ds18b20_addr_t addr, bool wait) {
+    assert(addr == DS18B20_ANY && !wait);
+    conversions++;
+    conversion_start = ticks;
+    return true;
+}
+
+// Conversion ends when strong pull-up is removed, and it must have waited for configured resolution
+void onewire_depower(int pin) {
+    const uint8_t resolution = ((scratchpad_config[0] >> 5) & 3) + DS18B20_RESOLUTION_MIN;
+    assert((ticks - conversion_start) * portTICK_PERIOD_MS >= (750 >> (DS18B20_RESOLUTION_DEFAULT - resolution)));
+    
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        if (is_present[i]) {
+            scratchpad_temp[i] = real_temp[i];
+        }
+    }
+}
+
+// Undefined bits of lower resolutions are set, so they must be cleared by reader
+bool ds18b20_read_scratchpad(int pin, ds18b20_addr_t addr, uint8_t* buffer) {
+    reads++;
+    
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        if (is_present[i] && rom[i] == addr) {
+            const uint8_t resolution = ((scratchpad_config[i] >> 5) & 3) + DS18B20_RESOLUTION_MIN;
+            const int16_t temp = scratchpad_temp[i] | ((1 << (DS18B20_RESOLUTION_DEFAULT - resolution)) - 1);
+            buffer[0] = temp & 0xFF;
+            buffer[1] = temp >> 8;
+            buffer[4] = scratchpad_config[i];
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+int main() {
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        rom[i] = 0x28 + ((uint64_t) i << 8);
+        is_present[i] = true;
+        real_temp[i] = (20 + i) * 16 + 9;
+        scratchpad_config[i] = 0x7F;
+        scratchpad_temp[i] = 85 * 16;
+    }
+    
+    // Highest resolution and shortest poll period of all accessories are used
+    for (uint8_t i = 0; i < SENSORS; i++) {
+        ds18b20_bus_new(GPIO, i == 3 ? 10 : 9, i == 5 ? 30 : 60);
+    }
+    
+    ds18b20_bus_t* ds18b20_bus = ds18b20_bus_find(GPIO);
+    assert(ds18b20_bus && !ds18b20_bus->next);
+    assert(ds18b20_bus->resolution == 10 && ds18b20_bus->max_age == MS_TO_TICKS(15000));
+    
+    float temperature;
+    for (uint8_t poll = 0; poll < 5; poll++) {
+        for (uint8_t i = 0; i < SENSORS; i++) {
+            assert(ds18b20_bus_get_temperature(GPIO, i + 1, &temperature));
+            assert(temperature == 20 + i + 0.5f);   // 10 bits have 0.25 C steps, so 9/16 is 0.5
+        }
+        
+        ticks += MS_TO_TICKS(30000);
+    }
+    
+    printf("%i accessories, 5 polls: %i scans, %i conversions, %i scratchpad reads\n", SENSORS, scans, conversions, reads);
+    assert(scans == 1 && conversions == 5 && reads == 5 * SENSORS);
+    
+    // A sensor lost power, so its resolution is back to 12 bits. Bus is scanned and configured again
+    scratchpad_config[2] = 0x7F;
+    assert(!ds18b20_bus_get_temperature(GPIO, 3, &temperature));
+    assert(ds18b20_bus_get_temperature(GPIO, 3, &temperature) && temperature == 22.5f);
+    assert(scans == 2);
+    
+    // Missing sensor
+    is_present[SENSORS - 1] = false;
+    ticks += MS_TO_TICKS(30000);
+    assert(!ds18b20_bus_get_temperature(GPIO, SENSORS, &temperature));
+    assert(ds18b20_bus_get_temperature(GPIO, 1, &temperature) && temperature == 20.5f);
+    assert(ds18b20_bus->devices_n == SENSORS - 1);
+    
+    // No memory for a different number of sensors: bus has no sensors, and it is scanned again on next read
+    is_present[SENSORS - 1] = true;
+    realloc_fails = true;
+    ticks += MS_TO_TICKS(30000);
+    assert(!ds18b20_bus_get_temperature(GPIO, SENSORS, &temperature));
+    assert(ds18b20_bus->devices_n == 0 && ds18b20_bus->is_scan_needed);
+    
+    realloc_fails = false;
+    assert(ds18b20_bus_get_temperature(GPIO, SENSORS, &temperature) && temperature == 27.5f);
+    assert(ds18b20_bus->devices_n == SENSORS && !ds18b20_bus->is_scan_needed);
+    
+    printf("DS18B20 bus: OK\n");
+    
+    return 0;
+}
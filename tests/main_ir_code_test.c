@@ -0,0 +1,335 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// IR codes: ir_code_decode() is compared with decoder that ir_tx_task() had before, for 2, 4 and 6 bits protocols
+// and raw codes. Malformed codes are compared with baseline decoding of same code without chars it can not decode.
+// Decoded codes cache must keep most recently used first, stay inside IR_CODE_CACHE_SIZE and skip bigger codes
+
+#include <ctype.h>
+
+#include "haa_main.h"
+#include "../devices/common/ir_code.h"
+
+#define SEED                                (1021)
+#define RANDOM_CODES                        (300)
+#define CODE_LEN_MAX                        (60)
+
+main_config_t main_config;
+
+static ch_group_t root_ch_group;
+
+// Earlier in main.c
+ch_group_t* ch_group_find_by_acc(uint16_t accessory) {
+    assert(accessory == ACC_TYPE_ROOT_DEVICE);
+    return &root_ch_group;
+}
+
+// Decoded codes are printed by section
+#define printf(...)                         ((void) 0)
+#include "main_ir_code.inc"
+#undef printf
+
+// Decoding of ir_tx_task() before ir_code_decode(), with strchr() over dictionaries. Code must be valid
+static uint16_t baseline_raw_packet(const char* code) {
+    return (((strchr(baseRaw_dic, code[0]) - baseRaw_dic) * IR_CODE_LEN) + (strchr(baseRaw_dic, code[1]) - baseRaw_dic)) * IR_CODE_SCALE;
+}
+
+static uint16_t* baseline_decode(const char* prot, const char* prot_code, const char* raw_code, uint16_t* ir_code_len) {
+    uint16_t* ir_code = NULL;
+    
+    if (prot_code) {
+        const uint8_t ir_action_protocol_len = strlen(prot);
+        const uint16_t json_ir_code_len = strlen(prot_code);
+        
+        // Runs of each char, and its bit for upper case char
+        uint8_t split = 26;
+        if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_4BITS) {
+            split = 13;
+        } else if (ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_6BITS) {
+            split = 9;
+        }
+        
+        *ir_code_len = 3;
+        for (uint16_t i = 0; i < json_ir_code_len; i++) {
+            char* found = strchr(baseUC_dic, prot_code[i]);
+            if (!found) {
+                found = strchr(baseLC_dic, prot_code[i]);
+            }
+            const uint8_t index = found - (isupper((int) prot_code[i]) ? baseUC_dic : baseLC_dic);
+            *ir_code_len += (1 + (index % split)) << 1;
+        }
+        
+        ir_code = calloc(*ir_code_len, sizeof(uint16_t));
+        
+        uint16_t bit_mark[6] = { 0 }, bit_space[6] = { 0 };
+        
+        for (uint8_t i = 0; i < (ir_action_protocol_len >> 1); i++) {
+            const uint16_t packet = baseline_raw_packet(prot + (i << 1));
+            
+            if (i == IR_CODE_HEADER_MARK_POS) {
+                ir_code[0] = packet;
+            } else if (i == IR_CODE_HEADER_SPACE_POS) {
+                ir_code[1] = packet;
+            } else if ((i == IR_CODE_BIT2_MARK_POS && ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_2BITS) ||
+                       (i == IR_CODE_BIT4_MARK_POS && ir_action_protocol_len == IR_ACTION_PROTOCOL_LEN_4BITS) ||
+                       i == IR_CODE_FOOTER_MARK_POS_6BITS) {
+                ir_code[*ir_code_len - 1] = packet;
+            } else if (i <= IR_CODE_BIT5_SPACE_POS) {
+                if (i & 1) {
+                    bit_space[(i - IR_CODE_BIT0_MARK_POS) >> 1] = packet;
+                } else {
+                    bit_mark[(i - IR_CODE_BIT0_MARK_POS) >> 1] = packet;
+                }
+            }
+        }
+        
+        uint16_t ir_code_index = 2;
+        for (uint16_t i = 0; i < json_ir_code_len; i++) {
+            const bool is_uc = isupper((int) prot_code[i]);
+            const uint8_t index = strchr(is_uc ? baseUC_dic : baseLC_dic, prot_code[i]) - (is_uc ? baseUC_dic : baseLC_dic);
+            const uint8_t bit = ((index / split) << 1) + is_uc;
+            for (uint8_t j = 0; j < 1 + (index % split); j++) {
+                ir_code[ir_code_index++] = bit_mark[bit];
+                ir_code[ir_code_index++] = bit_space[bit];
+            }
+        }
+    
+    } else {
+        *ir_code_len = strlen(raw_code) >> 1;
+        ir_code = calloc(*ir_code_len, sizeof(uint16_t));
+        
+        for (uint16_t i = 0; i < *ir_code_len; i++) {
+            ir_code[i] = baseline_raw_packet(raw_code + (i << 1));
+        }
+    }
+    
+    return ir_code;
+}
+
+static void random_chars(char* buffer, const uint16_t len, const char* dic) {
+    const size_t dic_len = strlen(dic);
+    for (uint16_t i = 0; i < len; i++) {
+        buffer[i] = dic[rand() % dic_len];
+    }
+    buffer[len] = 0;
+}
+
+// Baseline decodes expected_code, and ir_code_decode() decodes code of action_ir_tx
+static void compare(action_ir_tx_t* action_ir_tx, ch_group_t* ch_group, const char* expected_prot, const char* expected_code) {
+    uint16_t len = 0;
+    uint16_t* ir_code = ir_code_decode(action_ir_tx, ch_group, &len);
+    
+    uint16_t expected_len = 0;
+    uint16_t* expected = NULL;
+    if (action_ir_tx->prot_code) {
+        expected = baseline_decode(expected_prot, expected_code, NULL, &expected_len);
+    } else {
+        expected = baseline_decode(NULL, NULL, expected_code, &expected_len);
+    }
+    
+    if (len != expected_len || (len > 0 && memcmp(ir_code, expected, len * sizeof(uint16_t)) != 0)) {
+        printf("Code \"%s\", expected \"%s\": len %i, expected %i\n", action_ir_tx->prot_code ? action_ir_tx->prot_code : action_ir_tx->raw_code, expected_code, len, expected_len);
+        for (uint16_t i = 0; i < len && i < expected_len; i++) {
+            if (ir_code[i] != expected[i]) {
+                printf("[%i] %i, expected %i\n", i, ir_code[i], expected[i]);
+            }
+        }
+        assert(false);
+    }
+    
+    free(ir_code);
+    free(expected);
+}
+
+static void compare_prot(const char* prot, const char* code, const char* expected_code) {
+    ch_group_t ch_group = { .accessory = 1 };
+    action_ir_tx_t action_ir_tx = { .prot = (char*) prot, .prot_code = (char*) code };
+    compare(&action_ir_tx, &ch_group, prot, expected_code);
+}
+
+static void compare_raw(const char* code, const char* expected_code) {
+    ch_group_t ch_group = { .accessory = 1 };
+    action_ir_tx_t action_ir_tx = { .raw_code = (char*) code };
+    compare(&action_ir_tx, &ch_group, NULL, expected_code);
+}
+
+static char* raw_new(const uint16_t ir_code_len) {
+    char* code = malloc((ir_code_len << 1) + 1);
+    random_chars(code, ir_code_len << 1, baseRaw_dic);
+    return code;
+}
+
+static void check_cache(action_ir_tx_t** expected) {
+    uint16_t size = 0;
+    action_ir_tx_t* cached = main_config.ir_code_cache;
+    for (; *expected; expected++) {
+        assert(cached == *expected && cached->ir_code);
+        size += cached->ir_code_len * sizeof(uint16_t);
+        cached = cached->cache_next;
+    }
+    
+    assert(!cached);
+    assert(size == main_config.ir_code_cache_size && size <= IR_CODE_CACHE_SIZE);
+}
+
+int main() {
+    srand(SEED);
+    
+    char prot[IR_ACTION_PROTOCOL_LEN_6BITS + 1];
+    char code[CODE_LEN_MAX + 1];
+    char expected_code[CODE_LEN_MAX + 1];
+    
+    // Valid codes
+    const uint8_t prot_lens[] = { IR_ACTION_PROTOCOL_LEN_2BITS, IR_ACTION_PROTOCOL_LEN_4BITS, IR_ACTION_PROTOCOL_LEN_6BITS };
+    for (uint16_t n = 0; n < RANDOM_CODES; n++) {
+        random_chars(prot, prot_lens[n % 3], baseRaw_dic);
+        random_chars(code, rand() % CODE_LEN_MAX, (n & 1) ? "ABCDEFGHIJKLMNOPQRSTUVWXYZ" : "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
+        compare_prot(prot, code, code);
+        
+        random_chars(code, rand() % CODE_LEN_MAX, baseRaw_dic);
+        compare_raw(code, code);
+    }
+    
+    // Every run length of every bit
+    random_chars(prot, IR_ACTION_PROTOCOL_LEN_6BITS, baseRaw_dic);
+    compare_prot(prot, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    compare_prot(prot, "abcdefghijklmnopqrstuvwxyz", "abcdefghijklmnopqrstuvwxyz");
+    prot[IR_ACTION_PROTOCOL_LEN_4BITS] = 0;
+    compare_prot(prot, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    compare_prot(prot, "abcdefghijklmnopqrstuvwxyz", "abcdefghijklmnopqrstuvwxyz");
+    prot[IR_ACTION_PROTOCOL_LEN_2BITS] = 0;
+    compare_prot(prot, "ABCDEFGHIJKLMNOPQRSTUVWXYZ", "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    compare_prot(prot, "abcdefghijklmnopqrstuvwxyz", "abcdefghijklmnopqrstuvwxyz");
+    
+    // Empty codes
+    compare_prot(prot, "", "");
+    compare_raw("", "");
+    
+    // Protocol of accessory, and of root device
+    ch_group_t ch_group = { .accessory = 1, .ir_protocol = prot };
+    action_ir_tx_t action_ir_tx = { .prot_code = "aBcD" };
+    compare(&action_ir_tx, &ch_group, prot, "aBcD");
+    
+    ch_group.ir_protocol = NULL;
+    random_chars(code, IR_ACTION_PROTOCOL_LEN_4BITS, baseRaw_dic);
+    root_ch_group.ir_protocol = code;
+    compare(&action_ir_tx, &ch_group, code, "aBcD");
+    
+    // Malformed protocol codes: chars out of dictionaries are skipped
+    random_chars(prot, IR_ACTION_PROTOCOL_LEN_4BITS, baseRaw_dic);
+    compare_prot(prot, "a1B-c d\tZ", "aBcdZ");
+    compare_prot(prot, "0123456789", "");
+    compare_prot(prot, "\x7F\x80\xFFz", "z");
+    
+    // Malformed protocols: chars out of dictionary are first dictionary char
+    strcpy(code, prot);
+    code[0] = ' ';
+    code[5] = '\x80';
+    prot[0] = '0';
+    prot[5] = '0';
+    {
+        action_ir_tx_t action_ir_tx = { .prot = code, .prot_code = "aBzZ" };
+        compare(&action_ir_tx, &ch_group, prot, "aBzZ");
+    }
+    
+    // Malformed protocols: shorter than header and bits, and odd lengths of known ones
+    random_chars(prot, 9, baseRaw_dic);
+    compare_prot(prot, "aBcD", "aBcD");
+    random_chars(prot, IR_ACTION_PROTOCOL_LEN_4BITS, baseRaw_dic);
+    prot[IR_ACTION_PROTOCOL_LEN_4BITS] = 0;
+    strcpy(code, prot);
+    strcat(code, "Z");
+    {
+        action_ir_tx_t action_ir_tx = { .prot = code, .prot_code = "aBcD" };
+        uint16_t len = 0;
+        uint16_t* ir_code = ir_code_decode(&action_ir_tx, &ch_group, &len);
+        
+        // Protocol with an extra char is decoded as 2 bits one, and footer is always set
+        uint16_t expected_len = 0;
+        prot[IR_ACTION_PROTOCOL_LEN_2BITS] = 0;
+        uint16_t* expected = baseline_decode(prot, "aBcD", NULL, &expected_len);
+        assert(len == expected_len && memcmp(ir_code, expected, len * sizeof(uint16_t)) == 0);
+        
+        free(ir_code);
+        free(expected);
+    }
+    
+    // Malformed raw codes: odd lengths drop last char, and chars out of dictionary are first dictionary char
+    compare_raw("AbC", "Ab");
+    compare_raw("A b\x01zz\x80" "9", "A0b0zz09");
+    strcpy(code, "~~\"[]'");
+    for (uint8_t i = 0; code[i]; i++) {
+        expected_code[i] = '0';
+    }
+    expected_code[strlen(code)] = 0;
+    compare_raw(code, expected_code);
+    
+    // Cache
+    ch_group_t cache_ch_group = { .accessory = 2 };
+    action_ir_tx_t a = { .raw_code = raw_new(500) };
+    action_ir_tx_t b = { .raw_code = raw_new(500) };
+    action_ir_tx_t c = { .raw_code = raw_new(500) };
+    action_ir_tx_t d = { .raw_code = raw_new(100) };
+    action_ir_tx_t e = { .raw_code = raw_new((IR_CODE_CACHE_SIZE / sizeof(uint16_t)) + 1) };
+    
+    uint16_t* a_code = ir_code_get(&a, &cache_ch_group);
+    assert(a_code && a.ir_code == a_code && a.ir_code_len == 500);
+    ir_code_get(&b, &cache_ch_group);
+    ir_code_get(&c, &cache_ch_group);
+    check_cache((action_ir_tx_t*[]) { &c, &b, &a, NULL });
+    
+    // Cached code is not decoded again, and it is moved first
+    assert(ir_code_get(&a, &cache_ch_group) == a_code);
+    check_cache((action_ir_tx_t*[]) { &a, &c, &b, NULL });
+    
+    // Least recently used code is evicted
+    ir_code_get(&d, &cache_ch_group);
+    assert(!b.ir_code);
+    check_cache((action_ir_tx_t*[]) { &d, &a, &c, NULL });
+    
+    // Released codes stay cached
+    ir_code_release(&a);
+    assert(a.ir_code == a_code);
+    
+    // Code bigger than cache is not cached, and cached codes are kept
+    uint16_t* e_code = ir_code_get(&e, &cache_ch_group);
+    assert(e_code && e.ir_code == e_code && e.ir_code_len == (IR_CODE_CACHE_SIZE / sizeof(uint16_t)) + 1);
+    assert(!e.cache_next);
+    check_cache((action_ir_tx_t*[]) { &d, &a, &c, NULL });
+    
+    {
+        uint16_t len = 0;
+        uint16_t* expected = baseline_decode(NULL, NULL, e.raw_code, &len);
+        assert(len == e.ir_code_len && memcmp(e_code, expected, len * sizeof(uint16_t)) == 0);
+        free(expected);
+    }
+    
+    ir_code_release(&e);
+    assert(!e.ir_code);
+    check_cache((action_ir_tx_t*[]) { &d, &a, &c, NULL });
+    
+    // Decoded again when it is sent again
+    e_code = ir_code_get(&e, &cache_ch_group);
+    assert(e_code);
+    ir_code_release(&e);
+    check_cache((action_ir_tx_t*[]) { &d, &a, &c, NULL });
+    
+    while (main_config.ir_code_cache) {
+        ir_code_cache_evict();
+    }
+    assert(main_config.ir_code_cache_size == 0);
+    
+    free(a.raw_code);
+    free(b.raw_code);
+    free(c.raw_code);
+    free(d.raw_code);
+    free(e.raw_code);
+    
+    printf("main ir code: OK\n");
+    
+    return 0;
+}
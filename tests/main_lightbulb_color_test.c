@@ -0,0 +1,331 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Lightbulb color tables: error of table colors against hsi2rgbw_float() over all hues and saturations,
+// time of both, tables shared by lightbulbs with same settings, colors without table, and brightness curve
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "haa_main.h"
+
+main_config_t main_config;
+
+static uint16_t mallocs = 0;
+static bool is_malloc_failing = false;
+
+static void* host_malloc(const size_t size) {
+    mallocs++;
+    if (is_malloc_failing) {
+        return NULL;
+    }
+    
+    return malloc(size);
+}
+
+// Earlier in main.c
+double fast_precise_pow(double a, double b) {
+    return pow(a, b);
+}
+
+lightbulb_group_t* lightbulb_group_find(homekit_characteristic_t* ch) {
+    lightbulb_group_t* lightbulb_group = main_config.lightbulb_groups;
+    while (lightbulb_group && lightbulb_group->ch0 != ch) {
+        lightbulb_group = lightbulb_group->next;
+    }
+    
+    return lightbulb_group;
+}
+
+#define malloc host_malloc
+#include "main_lightbulb_color.inc"
+#undef malloc
+
+// Same defaults as normal_mode_init()
+static ch_group_t* new_lightbulb(const uint8_t channels) {
+    ch_group_t* ch_group = calloc(1, sizeof(ch_group_t));
+    ch_group->chs = 1;
+    ch_group->ch = calloc(1, sizeof(homekit_characteristic_t*));
+    ch_group->ch[0] = calloc(1, sizeof(homekit_characteristic_t));
+    ch_group->num = calloc(2, sizeof(float));
+    
+    lightbulb_group_t* lightbulb_group = calloc(1, sizeof(lightbulb_group_t));
+    lightbulb_group->ch0 = ch_group->ch[0];
+    lightbulb_group->channels = channels;
+    for (uint8_t i = 0; i <= 4; i++) {
+        lightbulb_group->flux[i] = 1;
+    }
+    
+    LIGHTBULB_MAX_POWER = 1;
+    LIGHTBULB_CURVE_FACTOR = 0;
+    lightbulb_group->r[0] = 0.6914;
+    lightbulb_group->r[1] = 0.3077;
+    lightbulb_group->g[0] = 0.1451;
+    lightbulb_group->g[1] = 0.7097;
+    lightbulb_group->b[0] = 0.1350;
+    lightbulb_group->b[1] = 0.0622;
+    lightbulb_group->cw[0] = 0.3115;
+    lightbulb_group->cw[1] = 0.3338;
+    lightbulb_group->ww[0] = 0.4784;
+    lightbulb_group->ww[1] = 0.4065;
+    lightbulb_group->wp[0] = 0.34567;
+    lightbulb_group->wp[1] = 0.35850;
+    lightbulb_group->rgb[0][0] = lightbulb_group->r[0];
+    lightbulb_group->rgb[0][1] = lightbulb_group->r[1];
+    lightbulb_group->rgb[1][0] = lightbulb_group->g[0];
+    lightbulb_group->rgb[1][1] = lightbulb_group->g[1];
+    lightbulb_group->rgb[2][0] = lightbulb_group->b[0];
+    lightbulb_group->rgb[2][1] = lightbulb_group->b[1];
+    lightbulb_group->cmy[0][0] = 0.241393;
+    lightbulb_group->cmy[0][1] = 0.341227;
+    lightbulb_group->cmy[1][0] = 0.455425;
+    lightbulb_group->cmy[1][1] = 0.227088;
+    lightbulb_group->cmy[2][0] = 0.503095;
+    lightbulb_group->cmy[2][1] = 0.449426;
+    
+    lightbulb_group->next = main_config.lightbulb_groups;
+    main_config.lightbulb_groups = lightbulb_group;
+    
+    ch_group->next = main_config.ch_groups;
+    main_config.ch_groups = ch_group;
+    
+    return ch_group;
+}
+
+static uint8_t color_tables_n() {
+    uint8_t count = 0;
+    color_table_t* color_table = main_config.color_tables;
+    while (color_table) {
+        count++;
+        color_table = color_table->next;
+    }
+    
+    return count;
+}
+
+#define COLOR_POINTS                        (360 * 401)
+
+// Biggest difference of hsi2rgbw_float() to its neighbours, in 1 hue and 0.25 saturation
+static uint16_t float_jump(ch_group_t* ch_group, const uint16_t h, const uint16_t s4, const uint16_t* color) {
+    uint16_t jump = 0;
+    const int8_t steps[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        const int16_t s4_near = s4 + steps[i][1];
+        if (s4_near < 0 || s4_near > 400) {
+            continue;
+        }
+        
+        uint16_t color_near[5] = { 0, 0, 0, 0, 0 };
+        hsi2rgbw_float((h + 360 + steps[i][0]) % 360, s4_near / 4.f, ch_group, lightbulb_gamma_table, LIGHTBULB_COLOR_REGION_ANY, color_near);
+        
+        for (uint8_t n = 0; n < 5; n++) {
+            jump = MAX(jump, abs(color_near[n] - color[n]));
+        }
+    }
+    
+    return jump;
+}
+
+// Every hue, and saturation in 0.25 steps. Returns points with error over LIGHTBULB_COLOR_TABLE_MAX_ERROR,
+// and in unexplained, points with error over twice it where hsi2rgbw_float() has no jump
+static uint32_t color_error(ch_group_t* ch_group, uint16_t* max_error, uint32_t* unexplained) {
+    lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
+    uint32_t over_limit = 0;
+    *max_error = 0;
+    *unexplained = 0;
+    
+    for (uint16_t h = 0; h < 360; h++) {
+        for (uint16_t s4 = 0; s4 <= 400; s4++) {
+            const float s = s4 / 4.f;
+            uint16_t color_float[5] = { 0, 0, 0, 0, 0 };
+            hsi2rgbw_float(h, s, ch_group, lightbulb_gamma_table, LIGHTBULB_COLOR_REGION_ANY, color_float);
+            hsi2rgbw(h, s, 100, ch_group);
+            
+            uint16_t point_error = 0;
+            for (uint8_t n = 0; n < 5; n++) {
+                point_error = MAX(point_error, abs(color_float[n] - lightbulb_group->target[n]));
+            }
+            
+            if (point_error > LIGHTBULB_COLOR_TABLE_MAX_ERROR) {
+                over_limit++;
+                
+                if (point_error > LIGHTBULB_COLOR_TABLE_MAX_ERROR * 2 && float_jump(ch_group, h, s4, color_float) <= LIGHTBULB_COLOR_TABLE_MAX_ERROR * 2) {
+                    (*unexplained)++;
+                }
+            }
+            
+            *max_error = MAX(*max_error, point_error);
+        }
+    }
+    
+    return over_limit;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Colors of every hue and integer saturation that take hsi2rgbw_float() with table too
+static uint32_t float_colors_n(ch_group_t* ch_group) {
+    const color_table_t* color_table = lightbulb_group_find(ch_group->ch[0])->color_table;
+    uint32_t count = 0;
+    
+    for (uint16_t h = 0; h < 360; h++) {
+        for (uint8_t s = 0; s <= 100; s++) {
+            const uint16_t h_cell = h / LIGHTBULB_COLOR_TABLE_HUE_STEP;
+            const uint8_t s_cell = MIN(s / LIGHTBULB_COLOR_TABLE_SAT_STEP, LIGHTBULB_COLOR_TABLE_SATS - 2);
+            const uint8_t region = lightbulb_color_region(color_table->forms, h, s << 8);
+            if (!lightbulb_color_table_has_cell(color_table, region, h_cell, s_cell)) {
+                count++;
+            }
+        }
+    }
+    
+    return count;
+}
+
+static size_t table_size(ch_group_t* ch_group) {
+    lightbulb_group_t* lightbulb_group = lightbulb_group_find(ch_group->ch[0]);
+    const color_table_t* color_table = lightbulb_group->color_table;
+    size_t size = sizeof(color_table_t);
+    
+    for (uint8_t region = 0; region < LIGHTBULB_COLOR_REGIONS; region++) {
+        for (uint16_t h = 0; h < LIGHTBULB_COLOR_TABLE_HUES; h++) {
+            if (color_table->rows_end[region][h] > color_table->rows_start[region][h]) {
+                size += (color_table->rows_end[region][h] - color_table->rows_start[region][h]) * lightbulb_group->channels * sizeof(uint16_t);
+            }
+        }
+    }
+    
+    return size;
+}
+
+#define TIME_POINTS                         (360 * 101)
+#define TIME_ROUNDS                         (5)
+
+// Time per color of hsi2rgbw() with table, and of hsi2rgbw_float(), every hue and saturation.
+// Best of some rounds, so other processes of host do not change result
+static void color_time(ch_group_t* ch_group, double* table_ns, double* float_ns) {
+    uint16_t color_float[5];
+    *table_ns = INFINITY;
+    *float_ns = INFINITY;
+    
+    for (uint8_t round = 0; round < TIME_ROUNDS; round++) {
+        uint64_t start = now_ns();
+        for (uint16_t h = 0; h < 360; h++) {
+            for (uint8_t s = 0; s <= 100; s++) {
+                hsi2rgbw(h, s, 100, ch_group);
+            }
+        }
+        *table_ns = MIN(*table_ns, (double) (now_ns() - start) / TIME_POINTS);
+        
+        start = now_ns();
+        for (uint16_t h = 0; h < 360; h++) {
+            for (uint8_t s = 0; s <= 100; s++) {
+                hsi2rgbw_float(h, s, ch_group, lightbulb_gamma_table, LIGHTBULB_COLOR_REGION_ANY, color_float);
+            }
+        }
+        *float_ns = MIN(*float_ns, (double) (now_ns() - start) / TIME_POINTS);
+    }
+}
+
+int main() {
+    // Profiles: RGB, RGBW, RGBWW, and RGBWW with flux, max power and curve factor
+    ch_group_t* profiles[4] = { new_lightbulb(3), new_lightbulb(4), new_lightbulb(5), new_lightbulb(5) };
+    
+    lightbulb_group_t* lightbulb_group = lightbulb_group_find(profiles[3]->ch[0]);
+    lightbulb_group->flux[0] = 1.2;
+    lightbulb_group->flux[3] = 2.5;
+    lightbulb_group->flux[4] = 2.2;
+    profiles[3]->num[0] = 2;
+    profiles[3]->num[1] = -1.5;
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        assert(lightbulb_color_table_build(profiles[i]));
+    }
+    
+    assert(color_tables_n() == 4 && mallocs == 4);
+    
+    // Error is only checked on a grid of every cell, so a gamut boundary or a clipped channel crossing a cell
+    // between those points can give a bigger error, but only at a few colors, and big errors only where
+    // hsi2rgbw_float() itself jumps
+    for (uint8_t i = 0; i < 4; i++) {
+        uint16_t max_error;
+        uint32_t unexplained;
+        const uint32_t over_limit = color_error(profiles[i], &max_error, &unexplained);
+        printf("Profile %i: max error %0.2f %%, %0.3f %% of colors over %0.2f %%\n", i, max_error * 100.f / PWM_SCALE, over_limit * 100.f / COLOR_POINTS, LIGHTBULB_COLOR_TABLE_MAX_ERROR * 100.f / PWM_SCALE);
+        assert(unexplained == 0);
+        assert(over_limit * 1000 < COLOR_POINTS);
+    }
+    
+    // Host has FPU, so table gains less than in ESP8266, where float operations are emulated.
+    // Times depend on host load, so they are only printed
+    for (uint8_t i = 0; i < 4; i++) {
+        double table_ns, float_ns;
+        color_time(profiles[i], &table_ns, &float_ns);
+        const uint32_t float_colors = float_colors_n(profiles[i]);
+        printf("Profile %i: table %0.1f ns, float %0.1f ns per color (x%0.1f), %0.1f %% of colors with float, table %zu bytes\n", i, table_ns, float_ns, float_ns / table_ns,
+               float_colors * 100.f / TIME_POINTS, table_size(profiles[i]));
+        assert(float_colors * 3 < TIME_POINTS);
+    }
+    
+    // Lightbulbs with same settings share table, and any different setting builds a new one
+    ch_group_t* same = new_lightbulb(5);
+    assert(lightbulb_color_table_build(same));
+    assert(lightbulb_group_find(same->ch[0])->color_table == lightbulb_group_find(profiles[2]->ch[0])->color_table);
+    assert(color_tables_n() == 4 && mallocs == 4);
+    
+    ch_group_t* other_wp = new_lightbulb(5);
+    lightbulb_group_find(other_wp->ch[0])->wp[0] = 0.3127;
+    assert(lightbulb_color_table_build(other_wp));
+    assert(color_tables_n() == 5 && mallocs == 5);
+    
+    ch_group_t* other_power = new_lightbulb(5);
+    other_power->num[0] = 3;
+    assert(lightbulb_color_table_build(other_power));
+    assert(color_tables_n() == 6 && mallocs == 6);
+    
+    // Without memory, lightbulb has no table, and color changes use hsi2rgbw_float() without building it again
+    is_malloc_failing = true;
+    ch_group_t* no_table = new_lightbulb(4);
+    lightbulb_group_find(no_table->ch[0])->flux[3] = 3;
+    assert(!lightbulb_color_table_build(no_table));
+    assert(!lightbulb_group_find(no_table->ch[0])->color_table && mallocs == 7);
+    
+    uint16_t max_error;
+    uint32_t unexplained;
+    assert(color_error(no_table, &max_error, &unexplained) == 0 && max_error == 0);
+    assert(mallocs == 7);
+    
+    // Brightness is linear, and with brightness curve it is CIE 1976 lightness: 50 % is 18.4 % of output
+    lightbulb_group = lightbulb_group_find(profiles[1]->ch[0]);
+    assert(lightbulb_brightness(lightbulb_group, 0) == 0 && lightbulb_brightness(lightbulb_group, 50) == PWM_SCALE / 2);
+    assert(lightbulb_brightness(lightbulb_group, 100) == PWM_SCALE && lightbulb_brightness(lightbulb_group, 150) == PWM_SCALE);
+    
+    lightbulb_group->brightness_curve = true;
+    assert(lightbulb_brightness(lightbulb_group, 0) == 0 && lightbulb_brightness(lightbulb_group, 1) > 0);
+    assert(lightbulb_brightness(lightbulb_group, 100) == PWM_SCALE && lightbulb_brightness(lightbulb_group, 150) == PWM_SCALE);
+    assert(abs(lightbulb_brightness(lightbulb_group, 50) - (int) (PWM_SCALE * 0.1842f)) < PWM_SCALE / 1000);
+    for (uint8_t v = 1; v <= LIGHTBULB_BRIGHTNESS_TABLE_SIZE; v++) {
+        assert(lightbulb_brightness(lightbulb_group, v) > lightbulb_brightness(lightbulb_group, v - 1));
+    }
+    
+    uint16_t color_full[5];
+    hsi2rgbw(200, 60, 100, profiles[1]);
+    memcpy(color_full, lightbulb_group->target, sizeof(color_full));
+    hsi2rgbw(200, 60, 50, profiles[1]);
+    for (uint8_t n = 0; n < 5; n++) {
+        assert(lightbulb_group->target[n] == ((uint32_t) color_full[n]) * lightbulb_brightness(lightbulb_group, 50) / PWM_SCALE);
+    }
+    
+    printf("main lightbulb colors: OK\n");
+    
+    return 0;
+}
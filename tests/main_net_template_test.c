@@ -0,0 +1,102 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Network action templates: compiled texts and wildcards must render same payloads that wildcards replaced
+// in place gave, in buffers of exactly net_template_size() + 1 bytes
+
+#include "haa_main.h"
+
+main_config_t main_config;
+
+static ch_group_t* other_ch_group = NULL;
+
+// Earlier in main.c
+ch_group_t* ch_group_find_by_acc(uint16_t accessory) {
+    if (other_ch_group && accessory == other_ch_group->accessory) {
+        return other_ch_group;
+    }
+    
+    return NULL;
+}
+
+#include "main_net_template.inc"
+
+static void check_render(const char* string, ch_group_t* ch_group, const char* expected) {
+    net_template_t template;
+    assert(net_template_compile(&template, string));
+    
+    char* buffer = malloc(net_template_size(&template) + 1);
+    const uint16_t len = net_template_render(&template, ch_group, buffer);
+    
+    if (strcmp(buffer, expected) != 0) {
+        printf("\"%s\": \"%s\", expected \"%s\"\n", string, buffer, expected);
+        assert(false);
+    }
+    
+    assert(len == strlen(expected));
+    
+    free(buffer);
+    net_template_free(&template);
+}
+
+int main() {
+    homekit_characteristic_t on = { .value = { .format = HOMETKIT_FORMAT_BOOL, .bool_value = true } };
+    homekit_characteristic_t temp = { .value = { .format = HOMETKIT_FORMAT_FLOAT, .float_value = 21.5 } };
+    homekit_characteristic_t name = { .value = { .format = HOMETKIT_FORMAT_STRING } };
+    homekit_characteristic_t* chs[] = { &on, &temp, &name };
+    ch_group_t ch_group = { .accessory = 1, .chs = 3, .ch = chs };
+    
+    homekit_characteristic_t level = { .value = { .format = HOMETKIT_FORMAT_UINT8, .int_value = 42 } };
+    homekit_characteristic_t hum = { .value = { .format = HOMETKIT_FORMAT_FLOAT, .float_value = -1e-9 } };
+    homekit_characteristic_t* other_chs[] = { &level, &hum };
+    ch_group_t other = { .accessory = 2, .chs = 2, .ch = other_chs };
+    other_ch_group = &other;
+    
+    // Empty
+    net_template_t template;
+    assert(net_template_compile(&template, "") && template.len == 0 && template.wildcards_n == 0 && !template.wildcards);
+    assert(net_template_size(&template) == 0);
+    net_template_free(&template);
+    
+    check_render("", &ch_group, "");
+    
+    // Plain, and wildcards without their 4 digits
+    check_render("/api/set?on=1", &ch_group, "/api/set?on=1");
+    check_render("value=#HAA@01", &ch_group, "value=#HAA@01");
+    
+    // Own accessory, another one, characteristic out of range, string characteristic and wildcards side by side
+    check_render("on=#HAA@0000&temp=#HAA@0001", &ch_group, "on=true&temp=21.5");
+    check_render("#HAA@0200#HAA@0201", &ch_group, "42-1e-09");
+    check_render("first=#HAA@0009;name=#HAA@0002.", &ch_group, "first=true;name=.");
+    check_render("#HAA@0000", &ch_group, "true");
+    
+    // Missing accessory is left empty
+    check_render("a=#HAA@0700&b=#HAA@0200", &ch_group, "a=&b=42");
+    
+    // Wildcards count is limited by uint8_t
+    char* string = malloc(UINT8_MAX * 10 + 10);
+    string[0] = 0;
+    for (uint16_t i = 0; i < UINT8_MAX; i++) {
+        strcat(string, "#HAA@0200,");
+    }
+    
+    assert(net_template_compile(&template, string) && template.wildcards_n == UINT8_MAX);
+    char* buffer = malloc(net_template_size(&template) + 1);
+    assert(net_template_render(&template, &ch_group, buffer) == UINT8_MAX * 3);
+    free(buffer);
+    net_template_free(&template);
+    
+    strcat(string, "#HAA@0200");
+    assert(!net_template_compile(&template, string) && !template.text && !template.wildcards);
+    net_template_free(&template);
+    
+    free(string);
+    
+    printf("main net templates: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Notification policies: interval, deadband, staleness, forced values and counters over a simulated tick clock.
+// Policies are found by characteristic number, and values are compared by their format
+
+#include "haa_main.h"
+
+main_config_t main_config;
+
+static TickType_t ticks = 0;
+static uint16_t notifications = 0;
+static homekit_characteristic_t* last_notified = NULL;
+
+TickType_t xTaskGetTickCount() {
+    return ticks;
+}
+
+// Earlier in main.c
+void homekit_characteristic_notify_safe(homekit_characteristic_t* ch) {
+    notifications++;
+    last_notified = ch;
+}
+
+#include "main_notify_policy.inc"
+
+static void set_value(ch_group_t* ch_group, const uint8_t ch_n, const float value, const bool force) {
+    homekit_characteristic_t* ch = ch_group->ch[ch_n];
+    if (ch->value.format == HOMETKIT_FORMAT_FLOAT) {
+        ch->value.float_value = value;
+    } else {
+        ch->value.int_value = value;
+    }
+    
+    homekit_characteristic_notify_policy(ch_group, ch_n, force);
+}
+
+int main() {
+    homekit_characteristic_t temp = { .value = { .format = HOMETKIT_FORMAT_FLOAT, .float_value = 20 } };
+    homekit_characteristic_t hum = { .value = { .format = HOMETKIT_FORMAT_FLOAT, .float_value = 50 } };
+    homekit_characteristic_t on = { .value = { .format = HOMETKIT_FORMAT_BOOL } };
+    homekit_characteristic_t level = { .value = { .format = HOMETKIT_FORMAT_UINT8 } };
+    homekit_characteristic_t* chs[] = { &temp, &hum, &on, &level };
+    ch_group_t sensor = { .chs = 4, .ch = chs };
+    
+    homekit_characteristic_t other = { .value = { .format = HOMETKIT_FORMAT_FLOAT, .float_value = 1 } };
+    homekit_characteristic_t* other_chs[] = { &other };
+    ch_group_t other_sensor = { .chs = 1, .ch = other_chs };
+    
+    // Policies are found by characteristic number, and only numeric characteristics have one
+    notify_policy_t* notify_policies = notify_policies_create(&sensor, 6);
+    assert(notify_policies && sensor.notify_policies == notify_policies && sensor.notify_policies_n == 4);
+    
+    notify_policy_t* temp_policy = notify_policy_find(&sensor, 0);
+    notify_policy_t* hum_policy = notify_policy_find(&sensor, 1);
+    notify_policy_t* level_policy = notify_policy_find(&sensor, 3);
+    assert(temp_policy == &notify_policies[0] && temp_policy->ch == &temp && temp_policy->ch_group == &sensor);
+    assert(hum_policy == &notify_policies[1] && level_policy == &notify_policies[3]);
+    assert(!notify_policy_find(&sensor, 2) && !notify_policy_find(&sensor, 4) && !notify_policy_find(&other_sensor, 0));
+    assert(main_config.notify_policies == level_policy && level_policy->next == hum_policy && hum_policy->next == temp_policy && !temp_policy->next);
+    
+    temp_policy->deadband = 0.5;
+    temp_policy->min_interval = 100;
+    temp_policy->max_stale = 1000;
+    
+    // Without staleness, small changes wait until deadband is reached
+    hum_policy->deadband = 2;
+    
+    level_policy->deadband = 5;
+    
+    // First value is always sent
+    ticks = 500;
+    set_value(&sensor, 0, 20, false);
+    assert(notifications == 1 && last_notified == &temp);
+    
+    // Same value is never sent again
+    ticks = 520;
+    set_value(&sensor, 0, 20, false);
+    assert(notifications == 1 && temp_policy->suppressed == 1);
+    
+    // Big change inside interval waits, and it is sent by flush once interval is reached
+    ticks = 550;
+    set_value(&sensor, 0, 25, false);
+    assert(notifications == 1 && temp_policy->suppressed == 2);
+    
+    ticks = 599;
+    notify_policies_flush();
+    assert(notifications == 1);
+    
+    ticks = 600;
+    notify_policies_flush();
+    assert(notifications == 2 && last_notified == &temp && temp_policy->last_value == 25);
+    
+    // Change under deadband waits until it is stale
+    ticks = 800;
+    set_value(&sensor, 0, 25.2, false);
+    assert(notifications == 2 && temp_policy->suppressed == 3);
+    
+    ticks = 1599;
+    notify_policies_flush();
+    assert(notifications == 2);
+    
+    ticks = 1600;
+    notify_policies_flush();
+    assert(notifications == 3 && temp_policy->last_value == 25.2f);
+    
+    // Forced values skip interval and deadband
+    ticks = 1610;
+    set_value(&sensor, 0, 25.3, true);
+    assert(notifications == 4 && temp_policy->last_time == 1610);
+    
+    // Forced value equal to last notified one is sent too
+    set_value(&sensor, 0, 25.3, true);
+    assert(notifications == 5 && temp_policy->suppressed == 3 && temp_policy->sent == 5);
+    
+    // Not forced equal value is still suppressed after a forced one
+    set_value(&sensor, 0, 25.3, false);
+    assert(notifications == 5 && temp_policy->suppressed == 4);
+    
+    // Without staleness, a small change is never sent by flush
+    set_value(&sensor, 1, 50, false);
+    assert(notifications == 6 && last_notified == &hum);
+    
+    ticks = 5000;
+    set_value(&sensor, 1, 51.5, false);
+    ticks = 1000000;
+    notify_policies_flush();
+    assert(notifications == 6 && hum_policy->suppressed == 1);
+    
+    set_value(&sensor, 1, 52, false);
+    assert(notifications == 7 && hum_policy->last_value == 52);
+    
+    // Policy not notified yet is not sent by flush
+    hum_policy->has_notified = false;
+    hum.value.float_value = 60;
+    notify_policies_flush();
+    assert(notifications == 7);
+    
+    // Characteristics without policy are always sent
+    set_value(&other_sensor, 0, 1, false);
+    set_value(&other_sensor, 0, 1, false);
+    assert(notifications == 9 && last_notified == &other);
+    
+    // Tick counter overflow
+    ticks = UINT32_MAX - 10;
+    set_value(&sensor, 0, 30, false);
+    assert(notifications == 10);
+    
+    ticks = UINT32_MAX - 5;
+    set_value(&sensor, 0, 35, false);
+    assert(notifications == 10);
+    
+    ticks = 88;
+    notify_policies_flush();
+    assert(notifications == 10);
+    
+    ticks = 89;
+    notify_policies_flush();
+    assert(notifications == 11 && temp_policy->last_value == 35);
+    
+    printf("Temperature: %u sent, %u suppressed. Humidity: %u sent, %u suppressed\n", temp_policy->sent, temp_policy->suppressed, hum_policy->sent, hum_policy->suppressed);
+    assert(temp_policy->sent == 7 && hum_policy->sent == 2);
+    
+    // Bool characteristic has no policy, so it is always sent
+    on.value.bool_value = true;
+    homekit_characteristic_notify_policy(&sensor, 2, false);
+    homekit_characteristic_notify_policy(&sensor, 2, false);
+    assert(notifications == 13 && last_notified == &on);
+    
+    // Integer characteristics are compared by their integer value
+    set_value(&sensor, 3, 10, false);
+    assert(notifications == 14 && last_notified == &level && level_policy->last_value == 10);
+    
+    set_value(&sensor, 3, 14, false);
+    assert(notifications == 14 && level_policy->suppressed == 1);
+    
+    set_value(&sensor, 3, 15, false);
+    assert(notifications == 15 && level_policy->last_value == 15);
+    
+    printf("main notify policies: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Sensor filters, and scheduler task run over a simulated tick clock until given time
+
+#include <setjmp.h>
+
+#include "haa_main.h"
+
+// Earlier in main.c
+void notify_policies_flush();
+
+#include "main_sensor_scheduler.inc"
+
+#define JOBS                                (4)
+#define PERIOD_MS                           (5000)
+#define READ_MS                             (30)
+#define SLOW_READ_MS                        (12000)
+
+main_config_t main_config;
+
+static TickType_t ticks = 0;
+static TickType_t end_ticks = 0;
+static jmp_buf scheduler_end;
+static uint8_t tasks_created = 0;
+static uint16_t flushes = 0;
+static bool is_pairing = false;
+
+static uint16_t reads[JOBS];
+static TickType_t last_group_start = 0;
+static int8_t last_bus_gpio = -2;
+static uint16_t close_reads = 0;
+static uint8_t slow_job = 0xFF;
+
+TickType_t xTaskGetTickCount() {
+    return ticks;
+}
+
+BaseType_t xTaskCreate(void (*task)(void*), const char* name, const uint16_t stack, void* args, const UBaseType_t priority, TaskHandle_t* handle) {
+    tasks_created++;
+    *handle = (TaskHandle_t) 1;
+    return pdPASS;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+    assert(task);
+}
+
+// Scheduler waits here, so time passes, and simulation ends
+uint32_t ulTaskNotifyTake(const BaseType_t clear_on_exit, const TickType_t wait) {
+    assert(wait != portMAX_DELAY);
+    
+    ticks += wait;
+    if ((int32_t) (ticks - end_ticks) >= 0) {
+        longjmp(scheduler_end, 1);
+    }
+    
+    return 0;
+}
+
+bool homekit_is_pairing() {
+    return is_pairing;
+}
+
+void notify_policies_flush() {
+    flushes++;
+}
+
+static bool read_sensor(sensor_job_t* sensor_job) {
+    const uint8_t n = sensor_job->ch_group->accessory;
+    
+    // Only jobs sharing a bus are read one right after another. Other reads are staggered
+    if (sensor_job->bus_gpio < 0 || sensor_job->bus_gpio != last_bus_gpio) {
+        if (last_bus_gpio > -2 && ticks - last_group_start < MS_TO_TICKS(SENSOR_SCHEDULER_STAGGER_MS)) {
+            close_reads++;
+        }
+        
+        last_group_start = ticks;
+    }
+    
+    last_bus_gpio = sensor_job->bus_gpio;
+    reads[n]++;
+    
+    ticks += MS_TO_TICKS(n == slow_job ? SLOW_READ_MS : READ_MS);
+    
+    return n != 2;
+}
+
+static void run_until(const uint32_t ms) {
+    end_ticks = MS_TO_TICKS(ms);
+    if (!setjmp(scheduler_end)) {
+        sensor_scheduler_task(NULL);
+    }
+}
+
+static void test_filter() {
+    ch_group_t ch_group = { .accessory = 1 };
+    sensor_filter_t filters[2];
+    memset(filters, 0, sizeof(filters));
+    
+    sensor_job_t sensor_job = {
+        .ch_group = &ch_group,
+        .filters = filters,
+        .filters_n = 2,
+        .filter_window = 3,
+    };
+    
+    // Median of last 3 samples. With 2 samples, higher one
+    assert(sensor_filter(&sensor_job, 0, 10) == 10);
+    assert(sensor_filter(&sensor_job, 0, 100) == 100);
+    assert(sensor_filter(&sensor_job, 0, 11) == 11);
+    assert(sensor_filter(&sensor_job, 0, 12) == 12);
+    assert(sensor_filter(&sensor_job, 0, 13) == 12);
+    
+    // Values without filter
+    assert(sensor_filter(&sensor_job, 5, 7) == 7);
+    assert(sensor_filter(NULL, 0, 7) == 7);
+    
+    // EMA after median
+    sensor_job.filter_ema = 0.5;
+    assert(sensor_filter(&sensor_job, 1, 10) == 10);
+    assert(sensor_filter(&sensor_job, 1, 20) == 15);
+    assert(sensor_filter(&sensor_job, 1, 30) == 17.5f);
+    assert(sensor_filter(&sensor_job, 1, 40) == 23.75f);
+    
+    // EMA only
+    memset(filters, 0, sizeof(filters));
+    sensor_job.filter_window = 0;
+    assert(sensor_filter(&sensor_job, 1, 10) == 10);
+    assert(sensor_filter(&sensor_job, 1, 20) == 15);
+    assert(sensor_filter(&sensor_job, 0, 8) == 8);
+}
+
+int main() {
+    test_filter();
+    
+    // Jobs 1 and 3 share a bus, job 2 always fails
+    static ch_group_t ch_groups[JOBS];
+    static sensor_job_t sensor_jobs[JOBS];
+    for (uint8_t i = 1; i < JOBS; i++) {
+        ch_groups[i].accessory = i;
+        sensor_jobs[i].ch_group = &ch_groups[i];
+        sensor_jobs[i].read = read_sensor;
+        sensor_jobs[i].bus_gpio = (i == 2) ? -1 : 4;
+        sensor_jobs[i].period = MS_TO_TICKS(PERIOD_MS);
+        sensor_jobs[i].next = main_config.sensor_jobs;
+        main_config.sensor_jobs = &sensor_jobs[i];
+    }
+    
+    sensor_job_start(&sensor_jobs[1], 1000);
+    sensor_job_start(&sensor_jobs[2], 1000);
+    sensor_job_start(&sensor_jobs[3], 3000);
+    assert(tasks_created == 1);
+    assert(sensor_jobs[2].next_time == sensor_jobs[1].next_time + MS_TO_TICKS(SENSOR_SCHEDULER_STAGGER_MS));
+    assert(sensor_jobs[3].next_time == sensor_jobs[1].next_time);
+    
+    run_until(61000);
+    printf("60 s: reads %i %i %i, errors %i %i %i, flushes %i, latency max %i ms\n",
+           reads[1], reads[2], reads[3], sensor_jobs[1].errors, sensor_jobs[2].errors, sensor_jobs[3].errors, flushes, sensor_jobs[3].latency_max);
+    for (uint8_t i = 1; i < JOBS; i++) {
+        assert(reads[i] == 12 && sensor_jobs[i].samples == 12);
+        assert(sensor_jobs[i].latency_max <= 2 * READ_MS);
+    }
+    
+    assert(sensor_jobs[1].errors == 0 && sensor_jobs[2].errors == 12 && sensor_jobs[3].errors == 0);
+    assert(flushes == 36);
+    assert(close_reads == 0);
+    
+    // A read longer than two periods is not followed by a burst of late reads
+    slow_job = 2;
+    const uint16_t reads_1 = reads[1], reads_2 = reads[2];
+    run_until(62000);
+    slow_job = 0xFF;
+    run_until(90000);
+    printf("Slow read: %i and %i reads of jobs 1 and 2 in 28 s\n", reads[1] - reads_1, reads[2] - reads_2);
+    assert(reads[1] - reads_1 <= 28000 / PERIOD_MS);
+    assert(reads[2] - reads_2 <= 28000 / PERIOD_MS);
+    assert(sensor_jobs[2].latency_max >= SLOW_READ_MS - PERIOD_MS);
+    
+    // No reads while pairing
+    is_pairing = true;
+    const uint16_t all_reads = reads[1] + reads[2] + reads[3];
+    run_until(96000);
+    assert(reads[1] + reads[2] + reads[3] == all_reads);
+    
+    printf("Sensor scheduler: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,500 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// OTA files are downloaded from a loopback HTTP server that redirects, serves OTA_RANGE_SIZE ranges and drops
+// connections in the middle of ranges. Resumed downloads must write same images to a simulated flash slot,
+// and SHA-384 hashed while downloading must be the one of image, as ota_verify_sign() trusts it
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <wolfssl/ssl.h>
+#include <wolfssl/wolfcrypt/sha512.h>
+#include <wolfssl/wolfcrypt/ecc.h>
+#include <rboot-api.h>
+#include <task.h>
+#include <espressif/esp_common.h>
+
+#include "../devices/HAA_OTA/ota.h"
+
+#define SPI_FLASH_SECTOR_SIZE               (4096)
+#define FLASH_SIZE                          (0x40000)
+#define SLOT                                (0x2000)
+#define MAXFILESIZE                         (FLASH_SIZE - SLOT - 16)
+#define HAABOOT
+
+#define REPO_PATH                           "/releases/latest/download"
+#define FILES_PATH                          "/files/"
+#define FILES_MAX                           (4)
+#define REQUEST_LEN_MAX                     (1024)
+#define DROPS_ALL                           (0xFFFF)
+
+typedef struct _image {
+    uint8_t* data;
+    int size;
+} image_t;
+
+typedef struct _file {
+    const char* name;
+    const image_t* image;
+} file_t;
+
+static uint8_t flash[FLASH_SIZE];
+
+static struct {
+    int listener;
+    uint16_t port;
+    
+    file_t files[FILES_MAX];
+    
+    uint16_t drop_every;    // Every Nth range is dropped after half of its body
+    uint16_t drops_max;
+    
+    uint16_t connections;
+    uint16_t ranges;
+    uint16_t drops;
+    int bytes;              // Body bytes sent
+    int sent;               // Body bytes of file being downloaded, sent before connection was dropped
+} server;
+
+// Earlier in ota.c
+static ecc_key public_key;
+static byte file_first_byte[] = { 0xff };
+static WOLFSSL_CTX* ctx;
+static char last_host[HOST_LEN];
+static char last_location[RECV_BUF_LEN];
+static Sha384 file_sha;
+static byte file_hash[HASHSIZE];
+static int file_hash_sector = 0;
+static int file_hash_size = 0;
+
+// Signature of image is its SHA-384
+int wc_ecc_verify_hash(const unsigned char* sig, const word32 siglen, const unsigned char* hash, const word32 hashlen, int* stat, ecc_key* key) {
+    *stat = (siglen == SIGNSIZE && hashlen == HASHSIZE && memcmp(sig, hash, HASHSIZE) == 0);
+    return 0;
+}
+
+rboot_config rboot_get_config() {
+    const rboot_config conf = { .count = 2, .roms = { BOOT0SECTOR, BOOT1SECTOR } };
+    return conf;
+}
+
+bool rboot_set_config(rboot_config* conf) {
+    return true;
+}
+
+void vTaskDelay(const TickType_t ticks) {
+}
+
+void sdk_system_restart() {
+    abort();
+}
+
+bool spiflash_erase_sector(const uint32_t addr) {
+    assert((addr & (SPI_FLASH_SECTOR_SIZE - 1)) == 0 && addr >= SLOT && addr + SPI_FLASH_SECTOR_SIZE <= FLASH_SIZE);
+    memset(flash + addr, 0xFF, SPI_FLASH_SECTOR_SIZE);
+    return true;
+}
+
+// NOR flash: written bits can only go from 1 to 0
+bool spiflash_write(const uint32_t addr, const uint8_t* buf, const uint32_t size) {
+    assert(addr >= SLOT && addr + size <= FLASH_SIZE);
+    for (uint32_t i = 0; i < size; i++) {
+        flash[addr + i] &= buf[i];
+    }
+    return true;
+}
+
+bool spiflash_read(const uint32_t addr, uint8_t* buf, const uint32_t size) {
+    assert(addr >= SLOT && addr + size <= FLASH_SIZE);
+    memcpy(buf, flash + addr, size);
+    return true;
+}
+
+// lwIP sockets are host sockets
+static int host_socket(const int domain, const int type, const int protocol) {
+    return socket(domain, type, protocol);
+}
+
+#define socket(domain, type, protocol)      host_socket(domain, type, protocol)
+#define lwip_read                           read
+#define lwip_write                          write
+#define lwip_close                          close
+
+static char* itoa(const int value, char* str, const int base) {
+    sprintf(str, "%i", value);
+    return str;
+}
+
+// Download logs are not shown
+#define printf(...)                         ((void) 0)
+
+#include "ota_http.inc"
+#include "ota_unpack.inc"
+#include "ota_download.inc"
+
+#undef printf
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool send_all(const int fd, const void* data, const int len) {
+    for (int sent = 0; sent < len; ) {
+        const int ret = send(fd, (const uint8_t*) data + sent, len - sent, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            return false;
+        }
+        sent += ret;
+    }
+    
+    return true;
+}
+
+static const image_t* server_file(const char* name) {
+    for (uint8_t i = 0; i < FILES_MAX; i++) {
+        if (server.files[i].name && strcmp(server.files[i].name, name) == 0) {
+            return server.files[i].image;
+        }
+    }
+    
+    return NULL;
+}
+
+// Return false when connection must be closed
+static bool server_response(const int fd, char* request) {
+    char path[256];
+    int start = 0, end = 0;
+    char header[512];
+    
+    assert(sscanf(request, "GET %255s HTTP/1.1", path) == 1);
+    
+    char* range = strstr(request, "\r\nRange: bytes=");
+    assert(range && sscanf(range, "\r\nRange: bytes=%i-%i", &start, &end) == 2 && start <= end);
+    
+    // Latest release redirects to its files
+    if (strncmp(path, REPO_PATH "/", strlen(REPO_PATH "/")) == 0) {
+        snprintf(header, sizeof(header), "HTTP/1.1 302 Found\r\nLocation: http://127.0.0.1" FILES_PATH "%s\r\nContent-Length: 0\r\n\r\n",
+                 path + strlen(REPO_PATH "/"));
+        send_all(fd, header, strlen(header));
+        return false;
+    }
+    
+    const image_t* image = NULL;
+    if (strncmp(path, FILES_PATH, strlen(FILES_PATH)) == 0) {
+        image = server_file(path + strlen(FILES_PATH));
+    }
+    
+    if (!image) {
+        snprintf(header, sizeof(header), "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+        send_all(fd, header, strlen(header));
+        return false;
+    }
+    
+    assert(start < image->size);
+    if (end >= image->size) {
+        end = image->size - 1;
+    }
+    
+    const int len = end - start + 1;
+    
+    // Probe of final location is made in its own connection
+    const bool is_probe = (start == 0 && end == 1);
+    
+    if (!is_probe) {
+        // Every byte is asked once, and first byte not received is asked after a drop
+        if (start == 0) {
+            server.sent = 0;
+        }
+        assert(start == server.sent);
+        
+        server.ranges++;
+        server.sent += len;
+    }
+    
+    const int header_len = snprintf(header, sizeof(header),
+                                    "HTTP/1.1 206 Partial Content\r\n"
+                                    "Content-Type: application/octet-stream\r\n"
+                                    "Content-Range: bytes %i-%i/%i\r\n"
+                                    "Content-Length: %i\r\n\r\n",
+                                    start, end, image->size, len);
+    
+    // Body of small files, as signatures and versions, is sent with header, and they are not dropped
+    int body_len = len;
+    if (!is_probe && len > RECV_BUF_LEN && server.drop_every > 0 && server.drops < server.drops_max &&
+        (server.ranges % server.drop_every) == 0) {
+        server.drops++;
+        body_len = len / 2;
+        server.sent -= len - body_len;
+    }
+    
+    if (!is_probe) {
+        server.bytes += body_len;
+    }
+    
+    // Body is sent in pieces of changing sizes, so reads end anywhere
+    static uint32_t seed = 1;
+    uint8_t* buffer = malloc(header_len + len);
+    memcpy(buffer, header, header_len);
+    memcpy(buffer + header_len, image->data + start, body_len);
+    
+    int pos = 0;
+    const int total = header_len + body_len;
+    while (pos < total) {
+        seed = seed * 1103515245 + 12345;
+        int n = (pos == 0 ? header_len : 0) + 1 + (seed >> 16) % (2 * RECV_BUF_LEN);
+        if (n > total - pos || len <= RECV_BUF_LEN) {
+            n = total - pos;
+        }
+        
+        if (!send_all(fd, buffer + pos, n)) {
+            break;
+        }
+        pos += n;
+    }
+    
+    free(buffer);
+    
+    return !is_probe && body_len == len;
+}
+
+// Requests of one connection are answered in order, until server or client closes it
+static void* server_task(void* args) {
+    for (;;) {
+        const int fd = accept(server.listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        
+        server.connections++;
+        
+        // Ranges are not delayed by Nagle algorithm of loopback
+        const int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        
+        char request[REQUEST_LEN_MAX];
+        int request_len = 0;
+        bool is_open = true;
+        
+        while (is_open) {
+            const int ret = recv(fd, request + request_len, REQUEST_LEN_MAX - 1 - request_len, 0);
+            if (ret <= 0) {
+                break;
+            }
+            
+            request_len += ret;
+            request[request_len] = 0;
+            
+            char* request_end = strstr(request, CRLFCRLF);
+            if (request_end) {
+                request_end += 4;
+                is_open = server_response(fd, request);
+                
+                request_len -= request_end - request;
+                memmove(request, request_end, request_len + 1);
+            }
+        }
+        
+        shutdown(fd, SHUT_WR);
+        close(fd);
+    }
+    
+    return NULL;
+}
+
+static void server_start() {
+    server.listener = socket(AF_INET, SOCK_STREAM, 0);
+    assert(server.listener >= 0);
+    
+    const int reuse = 1;
+    setsockopt(server.listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    
+    assert(bind(server.listener, (struct sockaddr*) &addr, addr_len) == 0);
+    assert(listen(server.listener, 4) == 0);
+    assert(getsockname(server.listener, (struct sockaddr*) &addr, &addr_len) == 0);
+    
+    server.port = ntohs(addr.sin_port);
+    
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, server_task, NULL) == 0);
+    pthread_detach(thread);
+}
+
+static void server_set(const file_t* files, const uint16_t drop_every, const uint16_t drops_max) {
+    memset(server.files, 0, sizeof(server.files));
+    for (uint8_t i = 0; files[i].name; i++) {
+        server.files[i] = files[i];
+    }
+    
+    server.drop_every = drop_every;
+    server.drops_max = drops_max;
+    server.connections = 0;
+    server.ranges = 0;
+    server.drops = 0;
+    server.bytes = 0;
+}
+
+static image_t load(const char* dir, const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    
+    FILE* file = fopen(path, "rb");
+    assert(file);
+    
+    fseek(file, 0, SEEK_END);
+    image_t image = { .size = ftell(file) };
+    fseek(file, 0, SEEK_SET);
+    
+    image.data = malloc(image.size);
+    assert(image.data && fread(image.data, 1, image.size, file) == image.size);
+    fclose(file);
+    
+    return image;
+}
+
+static void install(const image_t* image) {
+    memset(flash, 0xFF, sizeof(flash));
+    memcpy(flash + SLOT, image->data, image->size);
+}
+
+static bool is_installed(const image_t* image) {
+    return memcmp(flash + SLOT, image->data, image->size) == 0;
+}
+
+static char repo[] = "127.0.0.1" REPO_PATH;
+static char file[] = HAAMAINFILE;
+
+// As HAA OTA main task: signature, image, its check and its first byte. Return image size, or error
+static int update(const char* name) {
+    byte signature[SIGNSIZE];
+    assert(ota_get_sign(repo, file, signature, server.port, false) == SIGNSIZE);
+    
+    server.connections = 0;
+    server.ranges = 0;
+    server.drops = 0;
+    server.bytes = 0;
+    
+    const uint64_t start = now_ns();
+    const int size = ota_get_file(repo, file, SLOT, server.port, false);
+    const double time_ms = (now_ns() - start) * 1e-6;
+    
+    printf("%s: %i Bytes in %i ranges, %i connections, %i dropped, %.1f ms (%.0f KB/s)\n",
+           name, server.bytes, server.ranges, server.connections, server.drops,
+           time_ms, server.bytes / time_ms * 1000 / 1024);
+    
+    if (size <= 0 || ota_verify_sign(SLOT, size, signature) != 0) {
+        return -1;
+    }
+    
+    // Hash read back from flash must be same one
+    const int hash_size = file_hash_size;
+    file_hash_size = 0;
+    assert(ota_verify_sign(SLOT, size, signature) == 0);
+    file_hash_size = hash_size;
+    
+    ota_finalize_file(SLOT);
+    
+    return size;
+}
+
+int main(int argc, char** argv) {
+    assert(argc == 2);
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    const image_t base = load(argv[1], "base.bin");
+    const image_t new = load(argv[1], "new.bin");
+    const image_t other = load(argv[1], "other.bin");
+    const image_t full = load(argv[1], "new.bin.full");
+    const image_t delta = load(argv[1], "new.bin.delta");
+    
+    image_t signature = { .data = calloc(1, SIGNSIZE), .size = SIGNSIZE };
+    Sha384 sha;
+    wc_InitSha384(&sha);
+    wc_Sha384Update(&sha, new.data, new.size);
+    wc_Sha384Final(&sha, signature.data);
+    
+    image_t version = { .data = (uint8_t*) "9.9.9", .size = 5 };
+    
+    const int ranges = (new.size + OTA_RANGE_SIZE - 1) / OTA_RANGE_SIZE;
+    
+    server_start();
+    ota_init(repo, false);
+    
+    // Version file
+    const file_t version_files[] = { { HAAVERSIONFILE, &version }, { NULL } };
+    server_set(version_files, 0, 0);
+    char* version_read = ota_get_version(repo, HAAVERSIONFILE, server.port, false);
+    assert(version_read && strcmp(version_read, "9.9.9") == 0);
+    free(version_read);
+    
+    // Plain image, without delta
+    const file_t plain_files[] = { { HAAMAINFILE, &new }, { HAAMAINFILE SIGNFILESUFIX, &signature }, { NULL } };
+    server_set(plain_files, 0, 0);
+    install(&base);
+    assert(update("Plain") == new.size && is_installed(&new));
+    assert(server.ranges == ranges && file_hash_sector == SLOT && file_hash_size == new.size);
+    
+    // Dropped ranges are resumed from first byte not received, and only MAX_RESUMES times
+    server_set(plain_files, 2, MAX_RESUMES);
+    install(&base);
+    assert(update("Plain, dropped") == new.size && is_installed(&new));
+    assert(server.drops == MAX_RESUMES && server.ranges > ranges);
+    
+    server_set(plain_files, 1, DROPS_ALL);
+    install(&base);
+    assert(update("Plain, always dropped") < 0);
+    assert(server.drops == MAX_RESUMES + 1 && file_hash_sector == 0);
+    
+    // Packed images
+    const file_t packed_files[] = { { HAAMAINFILE, &full }, { HAAMAINFILE PACKDELTASUFIX, &delta }, { HAAMAINFILE SIGNFILESUFIX, &signature }, { NULL } };
+    server_set(packed_files, 0, 0);
+    install(&base);
+    assert(update("Delta") == new.size && is_installed(&new));
+    
+    server_set(packed_files, 1, MAX_RESUMES);
+    install(&base);
+    assert(update("Delta, dropped") == new.size && is_installed(&new));
+    assert(server.drops > 0);
+    
+    // Delta image over another image is refused, and full image is downloaded
+    server_set(packed_files, 2, MAX_RESUMES);
+    install(&other);
+    assert(update("Full after delta, dropped") == new.size && is_installed(&new));
+    assert(server.drops > 0);
+    
+    free(signature.data);
+    free(base.data);
+    free(new.data);
+    free(other.data);
+    free(full.data);
+    free(delta.data);
+    
+    printf("ota download: OK\n");
+    
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+#
+# Home Accessory Architect - Host tests
+#
+# Makes firmware-like test images for ota_unpack_test and ota_download_test:
+#   base.bin    Image installed in target slot
+#   new.bin     Update: changed addresses, inserted and removed blocks, and a longer tail
+#   other.bin   base.bin with one changed byte, so deltas from base.bin are not valid for it
+#
+
+import os
+import random
+import sys
+
+
+def firmware(rnd, size):
+    # Code-like blocks that repeat with small changes, and random data
+    words = [rnd.getrandbits(32).to_bytes(4, "little") for _ in range(512)]
+    out = bytearray(b"\xE9")
+    while len(out) < size:
+        if rnd.random() < 0.7:
+            out.extend(b"".join(rnd.choice(words) for _ in range(rnd.randint(4, 64))))
+        else:
+            out.extend(rnd.getrandbits(8) for _ in range(rnd.randint(16, 256)))
+    return out[:size]
+
+
+def main(argv):
+    out_dir = argv[1]
+    rnd = random.Random(2021)
+
+    base = firmware(rnd, 150000)
+
+    new = bytearray(base)
+    for _ in range(300):
+        pos = rnd.randrange(16, len(new) - 4)
+        new[pos:pos + 4] = rnd.getrandbits(32).to_bytes(4, "little")
+    new[60000:60000] = firmware(rnd, 3000)
+    del new[100000:102500]
+    new.extend(firmware(rnd, 6000))
+
+    other = bytearray(base)
+    other[len(other) // 2] ^= 0x01
+
+    os.makedirs(out_dir, exist_ok=True)
+    for name, data in (("base.bin", base), ("new.bin", new), ("other.bin", other)):
+        with open(os.path.join(out_dir, name), "wb") as f:
+            f.write(data)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,200 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Packed OTA images made by devices/common/ota_pack.py, unpacked over a simulated flash slot,
+// must rebuild byte-identical images. Delta images must be refused when installed image is not their base
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include <wolfssl/wolfcrypt/sha512.h>
+
+#include "../devices/HAA_OTA/ota.h"
+
+#define SPI_FLASH_SECTOR_SIZE               (4096)
+#define FLASH_SIZE                          (0x40000)
+#define SLOT                                (0x2000)
+#define MAXFILESIZE                         (FLASH_SIZE - SLOT - 16)
+#define CHUNK_MAX                           (RECV_BUF_LEN)
+
+typedef struct _image {
+    uint8_t* data;
+    int size;
+} image_t;
+
+static uint8_t flash[FLASH_SIZE];
+static uint16_t erases = 0;
+
+// Earlier in ota.c
+static byte file_first_byte[] = { 0xff };
+static Sha384 file_sha;
+
+bool spiflash_erase_sector(const uint32_t addr) {
+    assert((addr & (SPI_FLASH_SECTOR_SIZE - 1)) == 0 && addr >= SLOT && addr + SPI_FLASH_SECTOR_SIZE <= FLASH_SIZE);
+    memset(flash + addr, 0xFF, SPI_FLASH_SECTOR_SIZE);
+    erases++;
+    return true;
+}
+
+// NOR flash: written bits can only go from 1 to 0
+bool spiflash_write(const uint32_t addr, const uint8_t* buf, const uint32_t size) {
+    assert(addr >= SLOT && addr + size <= FLASH_SIZE);
+    for (uint32_t i = 0; i < size; i++) {
+        flash[addr + i] &= buf[i];
+    }
+    return true;
+}
+
+bool spiflash_read(const uint32_t addr, uint8_t* buf, const uint32_t size) {
+    assert(addr >= SLOT && addr + size <= FLASH_SIZE);
+    memcpy(buf, flash + addr, size);
+    return true;
+}
+
+#include "ota_unpack.inc"
+
+static image_t load(const char* dir, const char* name) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    
+    FILE* file = fopen(path, "rb");
+    assert(file);
+    
+    fseek(file, 0, SEEK_END);
+    image_t image = { .size = ftell(file) };
+    fseek(file, 0, SEEK_SET);
+    
+    image.data = malloc(image.size);
+    assert(image.data && fread(image.data, 1, image.size, file) == image.size);
+    fclose(file);
+    
+    return image;
+}
+
+static void install(const image_t* image) {
+    memset(flash, 0xFF, sizeof(flash));
+    memcpy(flash + SLOT, image->data, image->size);
+}
+
+static bool is_installed(const image_t* image) {
+    return memcmp(flash + SLOT, image->data, image->size) == 0;
+}
+
+// Packed image is received in chunks of changing sizes, as TLS records are, so headers and ops are split anywhere
+static int unpack_image(const image_t* packed, const int packed_size) {
+    erases = 0;
+    wc_InitSha384(&file_sha);
+    
+    int ret = unpack_start(SLOT);
+    
+    uint32_t seed = 1;
+    for (int pos = 0; ret == 0 && pos < packed_size; ) {
+        seed = seed * 1103515245 + 12345;
+        int n = 1 + (seed >> 16) % CHUNK_MAX;
+        if (n > packed_size - pos) {
+            n = packed_size - pos;
+        }
+        
+        ret = unpack_data(packed->data + pos, n);
+        pos += n;
+    }
+    
+    if (ret < 0) {
+        free(unpack.sector_buffer);
+        unpack.sector_buffer = NULL;
+        return ret;
+    }
+    
+    ret = unpack_finish();
+    if (ret == 0) {
+        // ota_finalize_file()
+        spiflash_write(SLOT, file_first_byte, 1);
+        ret = unpack.size;
+    }
+    
+    return ret;
+}
+
+static bool is_hash_valid(const image_t* image) {
+    byte hash[HASHSIZE], expected[HASHSIZE];
+    Sha384 sha;
+    
+    wc_Sha384Final(&file_sha, hash);
+    
+    wc_InitSha384(&sha);
+    wc_Sha384Update(&sha, image->data, image->size);
+    wc_Sha384Final(&sha, expected);
+    
+    return memcmp(hash, expected, HASHSIZE) == 0;
+}
+
+int main(int argc, char** argv) {
+    assert(argc == 2);
+    
+    const image_t base = load(argv[1], "base.bin");
+    const image_t new = load(argv[1], "new.bin");
+    const image_t other = load(argv[1], "other.bin");
+    const image_t full = load(argv[1], "new.bin.full");
+    const image_t delta = load(argv[1], "new.bin.delta");
+    
+    assert(memcmp(full.data, PACKMAGIC, 4) == 0 && memcmp(delta.data, PACKMAGIC, 4) == 0);
+    
+    printf("Image %i Bytes: full %i Bytes, delta %i Bytes\n", new.size, full.size, delta.size);
+    assert(delta.size < full.size && full.size < new.size);
+    
+    // Full image does not depend on installed image
+    install(&other);
+    assert(unpack_image(&full, full.size) == new.size);
+    assert(is_installed(&new) && is_hash_valid(&new));
+    
+    // Delta image over its base
+    install(&base);
+    assert(unpack_image(&delta, delta.size) == new.size);
+    assert(is_installed(&new) && is_hash_valid(&new));
+    
+    // Delta image over another image is refused before any sector is erased, and full image is installed after it
+    install(&other);
+    assert(unpack_image(&delta, delta.size) == -13);
+    assert(erases == 0 && is_installed(&other));
+    
+    assert(unpack_image(&full, full.size) == new.size);
+    assert(is_installed(&new) && is_hash_valid(&new));
+    
+    // Delta image over an updated image is refused too, so a repeated update is safe
+    assert(unpack_image(&delta, delta.size) == -13);
+    assert(erases == 0 && is_installed(&new));
+    
+    // Truncated images
+    install(&base);
+    assert(unpack_image(&delta, delta.size - 100) == -11);
+    
+    install(&base);
+    assert(unpack_image(&full, PACKHEADERSIZE - 1) == -11);
+    
+    // Base image bigger than slot
+    image_t wrong_base = { .data = malloc(delta.size), .size = delta.size };
+    memcpy(wrong_base.data, delta.data, delta.size);
+    wrong_base.data[11] = 0x7F;
+    
+    install(&base);
+    assert(unpack_image(&wrong_base, wrong_base.size) == -13);
+    assert(erases == 0 && is_installed(&base));
+    
+    free(wrong_base.data);
+    free(base.data);
+    free(new.data);
+    free(other.data);
+    free(full.data);
+    free(delta.data);
+    
+    printf("ota unpack: OK\n");
+    
+    return 0;
+}
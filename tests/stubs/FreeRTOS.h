@@ -0,0 +1,44 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+// Stubs of esp-open-rtos. Functions are defined by each test, simulating what it needs
+
+#ifndef __HOST_FREERTOS_H__
+#define __HOST_FREERTOS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#define IRAM
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef void* TaskHandle_t;
+typedef void* QueueHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef void* TimerHandle_t;
+
+#define pdFALSE                             (0)
+#define pdTRUE                              (1)
+#define pdFAIL                              (0)
+#define pdPASS                              (1)
+
+#define portMAX_DELAY                       (0xFFFFFFFF)
+#define portTICK_PERIOD_MS                  (10)
+#define pdMS_TO_TICKS(ms)                   ((ms) / portTICK_PERIOD_MS)
+
+void host_enter_critical();
+void host_exit_critical();
+
+#define taskENTER_CRITICAL()                host_enter_critical()
+#define taskEXIT_CRITICAL()                 host_exit_critical()
+
+#endif  // __HOST_FREERTOS_H__
@@ -0,0 +1,22 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_DS18B20_H__
+#define __HOST_DS18B20_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint64_t ds18b20_addr_t;
+
+#define DS18B20_ANY                         ((ds18b20_addr_t) 0xFFFFFFFFFFFFFFFFLL)
+
+int ds18b20_scan_devices(int pin, ds18b20_addr_t* addr_list, int addr_count);
+bool ds18b20_measure(int pin, ds18b20_addr_t addr, bool wait);
+bool ds18b20_read_scratchpad(int pin, ds18b20_addr_t addr, uint8_t* buffer);
+
+#endif  // __HOST_DS18B20_H__
@@ -0,0 +1,61 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_ESP8266_H__
+#define __HOST_ESP8266_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BIT(x)                              (1UL << (x))
+
+typedef enum {
+    GPIO_INPUT,
+    GPIO_OUTPUT,
+    GPIO_OUT_OPEN_DRAIN,
+} gpio_direction_t;
+
+typedef enum {
+    GPIO_INTTYPE_NONE,
+    GPIO_INTTYPE_EDGE_POS,
+    GPIO_INTTYPE_EDGE_NEG,
+    GPIO_INTTYPE_EDGE_ANY,
+    GPIO_INTTYPE_LEVEL_LOW,
+    GPIO_INTTYPE_LEVEL_HIGH,
+} gpio_inttype_t;
+
+typedef void (*gpio_interrupt_handler_t)(uint8_t gpio);
+
+#define FRC1                                (0)
+#define INUM_TIMER_FRC1                     (9)
+
+// GPIO.OUT_SET and GPIO.OUT_CLEAR are plain fields. Tests apply them after each write
+typedef struct {
+    uint32_t OUT;
+    uint32_t OUT_SET;
+    uint32_t OUT_CLEAR;
+} host_gpio_t;
+
+extern host_gpio_t GPIO;
+
+void gpio_enable(const uint8_t gpio, const gpio_direction_t direction);
+void gpio_disable(const uint8_t gpio);
+void gpio_set_pullup(const uint8_t gpio, const bool enabled, const bool enabled_during_sleep);
+void gpio_write(const uint8_t gpio, const bool set);
+bool gpio_read(const uint8_t gpio);
+void gpio_set_interrupt(const uint8_t gpio, const gpio_inttype_t int_type, gpio_interrupt_handler_t handler);
+
+void _xt_isr_attach(const uint8_t inum, void (*isr)(), void* args);
+
+void timer_set_interrupts(const uint8_t frc, const bool enable);
+void timer_set_run(const uint8_t frc, const bool run);
+void timer_set_reload(const uint8_t frc, const bool reload);
+void timer_set_load(const uint8_t frc, const uint32_t load);
+uint32_t timer_get_load(const uint8_t frc);
+bool timer_set_frequency(const uint8_t frc, const uint32_t freq);
+
+#endif  // __HOST_ESP8266_H__
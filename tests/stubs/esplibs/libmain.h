@@ -0,0 +1,14 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_LIBMAIN_H__
+#define __HOST_LIBMAIN_H__
+
+#include <esp8266.h>
+#include <espressif/esp_common.h>
+
+#endif  // __HOST_LIBMAIN_H__
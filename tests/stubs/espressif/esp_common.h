@@ -0,0 +1,19 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_ESP_COMMON_H__
+#define __HOST_ESP_COMMON_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+uint32_t sdk_system_get_time();
+uint8_t sdk_system_get_cpu_freq();
+void sdk_os_delay_us(const uint16_t us);
+void sdk_system_restart();
+
+#endif  // __HOST_ESP_COMMON_H__
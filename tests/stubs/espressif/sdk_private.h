@@ -0,0 +1 @@
+// Nothing is used from espressif/sdk_private.h in host tests
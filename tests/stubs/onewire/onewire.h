@@ -0,0 +1,21 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_ONEWIRE_H__
+#define __HOST_ONEWIRE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+bool onewire_reset(int pin);
+bool onewire_skip_rom(int pin);
+bool onewire_write(int pin, uint8_t v);
+bool onewire_write_bytes(int pin, const uint8_t* buf, size_t count);
+void onewire_depower(int pin);
+
+#endif  // __HOST_ONEWIRE_H__
@@ -0,0 +1,25 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_RBOOT_API_H__
+#define __HOST_RBOOT_API_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_ROMS                            (4)
+
+typedef struct {
+    uint8_t count;
+    uint8_t current_rom;
+    uint32_t roms[MAX_ROMS];
+} rboot_config;
+
+rboot_config rboot_get_config();
+bool rboot_set_config(rboot_config* conf);
+
+#endif  // __HOST_RBOOT_API_H__
@@ -0,0 +1,23 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_TASK_H__
+#define __HOST_TASK_H__
+
+#include "FreeRTOS.h"
+
+#define tskIDLE_PRIORITY                    (0)
+
+void vTaskDelay(const TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TickType_t xTaskGetTickCountFromISR();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(const BaseType_t clear_on_exit, const TickType_t ticks);
+BaseType_t xTaskCreate(void (*task)(void*), const char* name, const uint16_t stack, void* args, const UBaseType_t priority, TaskHandle_t* handle);
+
+#endif  // __HOST_TASK_H__
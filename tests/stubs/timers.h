@@ -0,0 +1,17 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_TIMERS_H__
+#define __HOST_TIMERS_H__
+
+#include "FreeRTOS.h"
+
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+void* pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif  // __HOST_TIMERS_H__
@@ -0,0 +1,62 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_WOLFSSL_SSL_H__
+#define __HOST_WOLFSSL_SSL_H__
+
+// TLS is not available in host tests, so every call fails. Downloads are made with plain HTTP
+
+typedef struct _host_wolfssl WOLFSSL;
+typedef struct _host_wolfssl_ctx WOLFSSL_CTX;
+typedef struct _host_wolfssl_method WOLFSSL_METHOD;
+
+#define SSL_SUCCESS                         (1)
+#define SSL_VERIFY_NONE                     (0)
+
+static inline int wolfSSL_Init() {
+    return -1;
+}
+
+static inline WOLFSSL_METHOD* wolfTLSv1_2_client_method() {
+    return NULL;
+}
+
+static inline WOLFSSL_CTX* wolfSSL_CTX_new(WOLFSSL_METHOD* method) {
+    return NULL;
+}
+
+static inline void wolfSSL_CTX_set_verify(WOLFSSL_CTX* ctx, const int mode, void* verify_callback) {
+}
+
+static inline WOLFSSL* wolfSSL_new(WOLFSSL_CTX* ctx) {
+    return NULL;
+}
+
+static inline int wolfSSL_set_fd(WOLFSSL* ssl, const int fd) {
+    return -1;
+}
+
+static inline int wolfSSL_connect(WOLFSSL* ssl) {
+    return -1;
+}
+
+static inline int wolfSSL_read(WOLFSSL* ssl, void* data, const int size) {
+    return -1;
+}
+
+static inline int wolfSSL_write(WOLFSSL* ssl, const void* data, const int size) {
+    return -1;
+}
+
+static inline int wolfSSL_get_error(WOLFSSL* ssl, const int ret) {
+    return ret;
+}
+
+static inline void wolfSSL_free(WOLFSSL* ssl) {
+}
+
+#endif  // __HOST_WOLFSSL_SSL_H__
@@ -0,0 +1,29 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_WOLFSSL_SHA512_H__
+#define __HOST_WOLFSSL_SHA512_H__
+
+// SHA-384 from host OpenSSL (libcrypto)
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/sha.h>
+
+typedef SHA512_CTX Sha384;
+
+static inline int wc_InitSha384(Sha384* sha) {
+    return SHA384_Init(sha) == 1 ? 0 : -1;
+}
+
+static inline int wc_Sha384Update(Sha384* sha, const unsigned char* data, const unsigned int len) {
+    return SHA384_Update(sha, data, len) == 1 ? 0 : -1;
+}
+
+static inline int wc_Sha384Final(Sha384* sha, unsigned char* hash) {
+    return SHA384_Final(hash, sha) == 1 ? 0 : -1;
+}
+
+#endif  // __HOST_WOLFSSL_SHA512_H__
@@ -0,0 +1,18 @@
+/*
+ * Home Accessory Architect - Host tests
+ *
+ * Copyright 2021 José Antonio Jiménez Campos (@RavenSystem)
+ *
+ */
+
+#ifndef __HOST_XTENSA_OPS_H__
+#define __HOST_XTENSA_OPS_H__
+
+#include <stdint.h>
+
+// Special registers are read from host_rsr_<reg>(), defined by each test
+#define RSR(var, reg)                       var = host_rsr_##reg();
+
+uint32_t host_rsr_ccount();
+
+#endif  // __HOST_XTENSA_OPS_H__